@@ -0,0 +1,165 @@
+/* converts magiclantern.sym (text: "address name" per line)
+ * into a binary symbol table with a precomputed hash index,
+ * so the module loader can resolve core symbols without parsing text.
+ *
+ * the layout must match the one in src/module.c (struct symtab_header)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYMTAB_MAGIC    0x59534C4D  /* MLSY */
+#define SYMTAB_VERSION  1
+
+struct symbol
+{
+    uint32_t hash;
+    uint32_t address;
+    uint32_t name;
+};
+
+/* FNV-1a, same as module_hash in src/module.c */
+static uint32_t symhash(const char * name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name)
+    {
+        hash = (hash ^ (uint8_t) *name++) * 16777619;
+    }
+    return hash;
+}
+
+static void put32(FILE * f, uint32_t x)
+{
+    uint8_t b[4] = { x, x >> 8, x >> 16, x >> 24 };
+    fwrite(b, 4, 1, f);
+}
+
+int main (int argc, char *argv[])
+{
+    if(argc != 3)
+    {
+        printf("Usage: %s magiclantern.sym output\n", argv[0]);
+        return -1;
+    }
+
+    FILE *f = fopen(argv[1], "r");
+    if(!f)
+    {
+        printf("Failed to open %s\n", argv[1]);
+        return -1;
+    }
+
+    struct symbol * symbols = 0;
+    char * strings = 0;
+    uint32_t num_symbols = 0;
+    uint32_t max_symbols = 0;
+    uint32_t strings_size = 0;
+    uint32_t max_strings = 0;
+
+    char line[512];
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned int address;
+        char name[256];
+        if (sscanf(line, "%x %255s", &address, name) != 2)
+        {
+            continue;
+        }
+
+        int len = strlen(name) + 1;
+
+        if (num_symbols == max_symbols)
+        {
+            max_symbols = max_symbols ? max_symbols * 2 : 1024;
+            symbols = realloc(symbols, max_symbols * sizeof(symbols[0]));
+        }
+        while (strings_size + len > max_strings)
+        {
+            max_strings = max_strings ? max_strings * 2 : 16384;
+            strings = realloc(strings, max_strings);
+        }
+        if (!symbols || !strings)
+        {
+            printf("Out of memory\n");
+            return -1;
+        }
+
+        symbols[num_symbols].hash = symhash(name);
+        symbols[num_symbols].address = address;
+        symbols[num_symbols].name = strings_size;
+        memcpy(strings + strings_size, name, len);
+        strings_size += len;
+        num_symbols++;
+    }
+    fclose(f);
+
+    /* open addressing with linear probing, at most half full */
+    uint32_t num_buckets = 16;
+    while (num_buckets < num_symbols * 2)
+    {
+        num_buckets *= 2;
+    }
+
+    /* bucket = symbol index + 1, 0 = empty */
+    uint32_t * buckets = calloc(num_buckets, sizeof(buckets[0]));
+    if (!buckets)
+    {
+        printf("Out of memory\n");
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < num_symbols; i++)
+    {
+        uint32_t b = symbols[i].hash & (num_buckets - 1);
+        while (buckets[b])
+        {
+            if (!strcmp(strings + symbols[buckets[b] - 1].name, strings + symbols[i].name))
+            {
+                printf("Duplicate symbol: %s\n", strings + symbols[i].name);
+                return -1;
+            }
+            b = (b + 1) & (num_buckets - 1);
+        }
+        buckets[b] = i + 1;
+    }
+
+    FILE *out = fopen(argv[2], "wb");
+    if(!out)
+    {
+        printf("Failed to create %s\n", argv[2]);
+        return -1;
+    }
+
+    /* header */
+    put32(out, SYMTAB_MAGIC);
+    put32(out, SYMTAB_VERSION);
+    put32(out, num_symbols);
+    put32(out, num_buckets);
+    put32(out, strings_size);
+
+    for (uint32_t i = 0; i < num_buckets; i++)
+    {
+        put32(out, buckets[i]);
+    }
+
+    for (uint32_t i = 0; i < num_symbols; i++)
+    {
+        put32(out, symbols[i].hash);
+        put32(out, symbols[i].address);
+        put32(out, symbols[i].name);
+    }
+
+    fwrite(strings, 1, strings_size, out);
+
+    /* keep the file size a multiple of 4 */
+    for (uint32_t i = strings_size; i % 4; i++)
+    {
+        fputc(0, out);
+    }
+
+    fclose(out);
+    return 0;
+}
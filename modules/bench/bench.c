@@ -20,6 +20,7 @@ extern void menu_benchmark();
 #include "card_bench.c"
 #include "mem_bench.c"
 #include "mem_perf.c"
+#include "font_bench.c"
 
 static struct menu_entry bench_menu[] =
 {
@@ -77,6 +78,13 @@ static struct menu_entry bench_menu[] =
                         .help = "Check memory read/write speed using different methods.",
                         .help2 = "(cacheable, uncacheable, EDMAC, different data types...)"
                     },
+                    {
+                        .name = "EDMAC copy engine benchmark",
+                        .select = run_in_separate_task,
+                        .priv = mem_benchmark_edmac_copy_task,
+                        .help = "Throughput of queued EDMAC copies (one or many requests, odd sizes)",
+                        .help2 = "and the latency of small requests.",
+                    },
                     {
                         .name = "Cache benchmark (RAM)",
                         .select = run_in_separate_task,
@@ -104,7 +112,7 @@ static struct menu_entry bench_menu[] =
             {
                 .name        = "Misc Benchmarks",
                 .select        = menu_open_submenu,
-                .help = "Benchmarks for focus peaking and menu backend (for now)",
+                .help = "Benchmarks for focus peaking, menu backend and font rendering",
                 .children =  (struct menu_entry[]) {
                     {
                         .name = "Focus peaking benchmark (30s)",
@@ -119,6 +127,13 @@ static struct menu_entry bench_menu[] =
                         .priv = menu_benchmark,
                         .help = "Check speed of menu backend."
                     },
+                    {
+                        .name = "Font benchmark (15s)",
+                        .select = run_in_separate_task,
+                        .priv = font_benchmark_task,
+                        .help = "Text rendering speed (characters per second),",
+                        .help2 = "without and with the glyph cache, and with pre-rendered strings."
+                    },
                     MENU_EOL,
                 },
             },
@@ -0,0 +1,96 @@
+/* this is included directly in bench.c */
+
+static const char * font_bench_str = "Shutter 1/50, ISO 800, f/2.8";
+
+/* draw a string repeatedly for about one second; returns characters per second */
+static int font_benchmark_string(uint32_t fontspec, int y)
+{
+    int len = strlen(font_bench_str);
+    int times = 0;
+    int t0m = get_ms_clock();
+    int64_t t0 = get_us_clock();
+
+    for (int i = 0; i < INT_MAX; i++)
+    {
+        bmp_printf(fontspec, 0, y, "%s", font_bench_str);
+
+        if (get_ms_clock() - t0m > 1000)
+        {
+            times = i + 1;
+            break;
+        }
+    }
+
+    int64_t dt = get_us_clock() - t0;
+    return (int64_t) len * times * 1000000ull / dt;
+}
+
+/* same, but blitting a pre-rendered string */
+static int font_benchmark_prerendered(uint32_t fontspec, int y)
+{
+    struct bmp_text * text = bmp_text_render(fontspec, font_bench_str);
+    if (!text)
+    {
+        return 0;
+    }
+
+    int len = strlen(font_bench_str);
+    int times = 0;
+    int t0m = get_ms_clock();
+    int64_t t0 = get_us_clock();
+
+    for (int i = 0; i < INT_MAX; i++)
+    {
+        bmp_text_draw(text, 0, y);
+
+        if (get_ms_clock() - t0m > 1000)
+        {
+            times = i + 1;
+            break;
+        }
+    }
+
+    int64_t dt = get_us_clock() - t0;
+    bmp_text_free(text);
+    return (int64_t) len * times * 1000000ull / dt;
+}
+
+static void font_benchmark_run(char * name, uint32_t fontspec, int * y)
+{
+    int y0 = 300;
+
+    glyph_cache_enable(0);
+    int uncached = font_benchmark_string(fontspec, y0);
+
+    glyph_cache_enable(1);
+    font_benchmark_string(fontspec, y0);    /* warm-up */
+    int cached = font_benchmark_string(fontspec, y0);
+    int prerendered = font_benchmark_prerendered(fontspec, y0);
+
+    bmp_fill(COLOR_BLACK, 0, y0, 720, 480 - y0);
+    bmp_printf(FONT_MONO_20, 0, *y += 20, "%s %7d %7d %7d", name, uncached, cached, prerendered);
+}
+
+static void font_benchmark_task()
+{
+    msleep(1000);
+    canon_gui_disable_front_buffer();
+    clrscr();
+    print_benchmark_header();
+
+    int y = 100;
+    bmp_printf(FONT_MONO_20, 0, y, "Font (chars/s)  uncached  cached  pre-rendered");
+
+    font_benchmark_run("FONT_SMALL    ", FONT_SMALL, &y);
+    font_benchmark_run("FONT_MED      ", FONT_MED, &y);
+    font_benchmark_run("FONT_LARGE    ", FONT_LARGE, &y);
+    font_benchmark_run("shadow MED    ", SHADOW_FONT(FONT(FONT_MED, COLOR_WHITE, COLOR_BLACK)), &y);
+    font_benchmark_run("FONT_CANON    ", FONT_CANON, &y);
+
+    bmp_fill(COLOR_BLACK, 0, 0, 720, font_large.height);
+    bmp_printf(FONT_LARGE, 0, 0, "Benchmark complete.");
+
+    take_screenshot("bench%d.ppm", SCREENSHOT_BMP);
+    msleep(3000);
+    canon_gui_enable_front_buffer(0);
+}
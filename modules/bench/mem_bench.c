@@ -4,9 +4,12 @@
 extern WEAK_FUNC(ret_0) void* dma_memcpy(void* dest, void* srce, size_t n);
 extern WEAK_FUNC(ret_0) void* edmac_memcpy(void* dest, void* srce, size_t n);
 extern WEAK_FUNC(ret_0) void* edmac_copy_rectangle_adv(void* dst, void* src, int src_width, int src_x, int src_y, int dst_width, int dst_x, int dst_y, int w, int h);
+extern WEAK_FUNC(ret_0) uint32_t edmac_copy_queue(void* dst, void* src, size_t length, edmac_copy_cbr_t cbr, void* ctx);
+extern WEAK_FUNC(ret_0) int edmac_copy_wait(uint32_t id, int timeout);
 
 #define HAS_DMA_MEMCPY ((void*)&dma_memcpy != (void*)&ret_0)
 #define HAS_EDMAC_MEMCPY ((void*)&edmac_memcpy != (void*)&ret_0)
+#define HAS_EDMAC_COPY ((void*)&edmac_copy_queue != (void*)&ret_0)
 
 static void mem_benchmark_fill(uint32_t * src, uint32_t * dst, int size)
 {
@@ -148,6 +151,45 @@ static void mem_test_edmac_copy_rectangle(int arg0, int arg1, int arg2, int arg3
     edmac_copy_rectangle_adv(UNCACHEABLE(idle), UNCACHEABLE(real), 960, 0, 0, 960, 0, 0, 720, 480);
 }
 
+/* memcpy-like: split the copy into requests for the EDMAC copy engine, then wait for all of them */
+static void mem_test_edmac_copy_queue(int dst, int src, int size, int chunks)
+{
+    uint32_t ids[EDMAC_COPY_QUEUE];
+    int chunk = size / chunks;
+
+    for (int i = 0; i < chunks; i++)
+    {
+        /* the last request also takes the remainder */
+        int len = (i == chunks - 1) ? size - i * chunk : chunk;
+        ids[i] = edmac_copy_queue((void*)dst + i * chunk, (void*)src + i * chunk, len, 0, 0);
+
+        if (!ids[i])
+        {
+            /* no channel available, copy it ourselves */
+            memcpy((void*)dst + i * chunk, (void*)src + i * chunk, len);
+        }
+    }
+
+    for (int i = 0; i < chunks; i++)
+    {
+        edmac_copy_wait(ids[i], 1000);
+    }
+}
+
+/* average time from queuing a request to getting it back, in microseconds */
+static int mem_test_edmac_copy_latency(void* dst, void* src, int size)
+{
+    int n = 100;
+    int64_t t0 = get_us_clock();
+
+    for (int i = 0; i < n; i++)
+    {
+        edmac_copy_wait(edmac_copy_queue(dst, src, size, 0, 0), 1000);
+    }
+
+    return (get_us_clock() - t0) / n;
+}
+
 static uint64_t FAST DUMP_ASM mem_test_read64(uint64_t* buf, uint32_t n)
 {
     /** GCC output with -Os attribute(O3):
@@ -233,7 +275,7 @@ static void mem_benchmark_task()
         mem_benchmark_run("edmac_memcpy        ", &y, bufsize, (mem_bench_fun)edmac_memcpy, (intptr_t)UNCACHEABLE(buf1),   (intptr_t)UNCACHEABLE(buf2),   bufsize, 0, 1);
         mem_benchmark_run("edmac_copy_rectangle", &y, 720*480, (mem_bench_fun)mem_test_edmac_copy_rectangle, 0, 0, 0, 0, 0);
     }
-    
+
     mem_benchmark_run("memset cacheable    ", &y, bufsize, (mem_bench_fun)memset,     (intptr_t)CACHEABLE(buf1),   0,                           bufsize, 0, 0);
     mem_benchmark_run("memset uncacheable  ", &y, bufsize, (mem_bench_fun)memset,     (intptr_t)UNCACHEABLE(buf1), 0,                           bufsize, 0, 0);
     mem_benchmark_run("memset64 cacheable  ", &y, bufsize, (mem_bench_fun)memset64,   (intptr_t)CACHEABLE(buf1),   0,                           bufsize, 0, 0);
@@ -255,3 +297,59 @@ cleanup:
     if (buf1) free(buf1);
     if (buf2) free(buf2);
 }
+
+/* EDMAC copy engine: throughput with one or many requests, odd sizes, and latency */
+static void mem_benchmark_edmac_copy_task()
+{
+    if (!HAS_EDMAC_COPY)
+    {
+        NotifyBox(2000, "EDMAC copy engine not available");
+        return;
+    }
+
+    msleep(1000);
+
+    if (!lv)
+    {
+        enter_play_mode();
+    }
+
+    canon_gui_disable_front_buffer();
+    clrscr();
+    print_benchmark_header();
+
+    int bufsize = 16*1024*1024;
+
+    void* buf1 = fio_malloc(bufsize);
+    void* buf2 = fio_malloc(bufsize);
+    if (!buf1 || !buf2)
+    {
+        bmp_printf(FONT_LARGE, 0, 0, "malloc error :(");
+        goto cleanup;
+    }
+
+    int y = 100;
+
+    mem_benchmark_run("edmac_memcpy        ", &y, bufsize,      (mem_bench_fun)edmac_memcpy,              (intptr_t)UNCACHEABLE(buf1), (intptr_t)UNCACHEABLE(buf2), bufsize,      0,  1);
+    mem_benchmark_run("edmac_copy 1 request", &y, bufsize,      (mem_bench_fun)mem_test_edmac_copy_queue, (intptr_t)UNCACHEABLE(buf1), (intptr_t)UNCACHEABLE(buf2), bufsize,      1,  1);
+    mem_benchmark_run("edmac_copy 16 reqs  ", &y, bufsize,      (mem_bench_fun)mem_test_edmac_copy_queue, (intptr_t)UNCACHEABLE(buf1), (intptr_t)UNCACHEABLE(buf2), bufsize,      16, 1);
+    mem_benchmark_run("edmac_copy odd size ", &y, bufsize - 13, (mem_bench_fun)mem_test_edmac_copy_queue, (intptr_t)UNCACHEABLE(buf1), (intptr_t)UNCACHEABLE(buf2), bufsize - 13, 16, 1);
+
+    bmp_fill(COLOR_BLACK, 0, 0, 720, font_large.height);
+    bmp_printf(FONT_LARGE, 0, 0, "edmac_copy latency");
+
+    int lat_4k  = mem_test_edmac_copy_latency(UNCACHEABLE(buf1), UNCACHEABLE(buf2), 4096);
+    int lat_64k = mem_test_edmac_copy_latency(UNCACHEABLE(buf1), UNCACHEABLE(buf2), 65536);
+    bmp_printf(FONT_MONO_20, 0, y += 20, "edmac_copy latency     4K: %5d us   64K: %5d us    ", lat_4k, lat_64k);
+
+    bmp_fill(COLOR_BLACK, 0, 0, 720, font_large.height);
+    bmp_printf(FONT_LARGE, 0, 0, "Benchmark complete.");
+
+    take_screenshot("bench%d.ppm", SCREENSHOT_BMP);
+    msleep(3000);
+    canon_gui_enable_front_buffer(0);
+
+cleanup:
+    if (buf1) free(buf1);
+    if (buf2) free(buf2);
+}
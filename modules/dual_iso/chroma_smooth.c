@@ -1,69 +1,234 @@
+/* chroma smoothing kernels (included several times, see the CHROMA_SMOOTH_* switches below)
+ *
+ * inp and out may be the same buffer (the filter only reads pixels from rows
+ * that were not written yet). With CHROMA_SMOOTH_RAW_INFO defined, inp and out
+ * may also be NULL: raw_info is then processed in place, through
+ * raw_get_pixel / raw_set_pixel, without any full-frame buffer.
+ *
+ * Each 2x2 Bayer cell is converted to EV (r - g, b - g, g) only once, into a
+ * ring of a few cell rows, instead of once for every filter window it belongs to.
+ */
+
+#ifndef CHROMA_SMOOTH_COMMON
+#define CHROMA_SMOOTH_COMMON
+
+#if defined(__SSE2__)
+#include "optmed_sse2.h"
+#endif
+
+/* scratch memory, shared by all filter sizes and reused from one frame to the next */
+static int* chroma_smooth_scratch(int size)
+{
+    static int* buf = 0;
+    static int buf_size = 0;
+
+    if (size > buf_size)
+    {
+        free(buf);
+        buf = malloc(size * sizeof(buf[0]));
+        buf_size = buf ? size : 0;
+    }
+    return buf;
+}
+
+/* one row of 2x2 cells (R G1 / G2 B), starting at image row y */
+static void chroma_smooth_cells(uint32_t * inp, int w, int y, int cells, int* raw2ev, int* dr, int* db, int* ge)
+{
+    int cx;
+#ifdef CHROMA_SMOOTH_RAW_INFO
+    if (!inp)
+    {
+        for (cx = 0; cx < cells; cx++)
+        {
+            int x = 2*cx;
+            int e = (raw2ev[raw_get_pixel(x+1, y)] + raw2ev[raw_get_pixel(x, y+1)]) / 2;
+            ge[cx] = e;
+            dr[cx] = raw2ev[raw_get_pixel(x, y)] - e;
+            db[cx] = raw2ev[raw_get_pixel(x+1, y+1)] - e;
+        }
+        return;
+    }
+#endif
+
+    {
+        uint32_t * row0 = inp + y * w;
+        uint32_t * row1 = row0 + w;
+        for (cx = 0; cx < cells; cx++)
+        {
+            int e = (raw2ev[row0[2*cx+1]] + raw2ev[row1[2*cx]]) / 2;
+            ge[cx] = e;
+            dr[cx] = raw2ev[row0[2*cx]] - e;
+            db[cx] = raw2ev[row1[2*cx+1]] - e;
+        }
+    }
+}
+
+/* store the result for one cell (same rules as the per-pixel version) */
+static inline void chroma_smooth_put(uint32_t * out, int w, int x, int y, int ge, int dr, int db, int* ev2raw)
+{
+    if (ge + dr <= EV_RESOLUTION) return;
+    if (ge + db <= EV_RESOLUTION) return;
+
+    int r = ev2raw[COERCE(ge + dr, 0, 14*EV_RESOLUTION-1)];
+    int b = ev2raw[COERCE(ge + db, 0, 14*EV_RESOLUTION-1)];
+
+#ifdef CHROMA_SMOOTH_RAW_INFO
+    if (!out)
+    {
+        raw_set_pixel(x, y, r);
+        raw_set_pixel(x+1, y+1, b);
+        return;
+    }
+#endif
+
+    out[x   +     y * w] = r;
+    out[x+1 + (y+1) * w] = b;
+}
+
+#endif
+
 #ifdef CHROMA_SMOOTH_2X2
 #define CHROMA_SMOOTH_FUNC chroma_smooth_2x2
 #define CHROMA_SMOOTH_MAX_IJ 2
 #define CHROMA_SMOOTH_FILTER_SIZE 5
 #define CHROMA_SMOOTH_MEDIAN opt_med5
+#define CHROMA_SMOOTH_MEDIAN_SSE2 opt_med5_sse2
 #elif defined(CHROMA_SMOOTH_3X3)
 #define CHROMA_SMOOTH_FUNC chroma_smooth_3x3
 #define CHROMA_SMOOTH_MAX_IJ 2
 #define CHROMA_SMOOTH_FILTER_SIZE 9
 #define CHROMA_SMOOTH_MEDIAN opt_med9
+#define CHROMA_SMOOTH_MEDIAN_SSE2 opt_med9_sse2
 #else
 #define CHROMA_SMOOTH_FUNC chroma_smooth_5x5
 #define CHROMA_SMOOTH_MAX_IJ 4
 #define CHROMA_SMOOTH_FILTER_SIZE 25
 #define CHROMA_SMOOTH_MEDIAN opt_med25
+#define CHROMA_SMOOTH_MEDIAN_SSE2 opt_med25_sse2
 #endif
 
+/* radius and height of the filter window, in cells */
+#define CHROMA_SMOOTH_R (CHROMA_SMOOTH_MAX_IJ / 2)
+#define CHROMA_SMOOTH_ROWS (2 * CHROMA_SMOOTH_R + 1)
+
 static void CHROMA_SMOOTH_FUNC(uint32_t * inp, uint32_t * out, int* raw2ev, int* ev2raw)
 {
     int w = raw_info.width;
     int h = raw_info.height;
-    int x,y;
+    int cells = w / 2;
+    int i, j, k;
 
-    for (y = 4; y < h-5; y += 2)
+    int* scratch = chroma_smooth_scratch(3 * CHROMA_SMOOTH_ROWS * cells);
+    if (!scratch) return;
+
+    /* ring of cell rows: cell row cy is kept in slot cy % CHROMA_SMOOTH_ROWS */
+    int* ring_dr[CHROMA_SMOOTH_ROWS];
+    int* ring_db[CHROMA_SMOOTH_ROWS];
+    int* ring_ge[CHROMA_SMOOTH_ROWS];
+    for (k = 0; k < CHROMA_SMOOTH_ROWS; k++)
+    {
+        ring_dr[k] = scratch + (3*k + 0) * cells;
+        ring_db[k] = scratch + (3*k + 1) * cells;
+        ring_ge[k] = scratch + (3*k + 2) * cells;
+    }
+
+    /* same loop bounds as the per-pixel version: y = 4 .. h-6, x = 4 .. w-5 (even) */
+    int cy_start = 2;
+    int cy_end = (h - 4) / 2;
+    int cx_start = 2;
+    int cx_end = (w - 3) / 2;
+    int next_row = cy_start - CHROMA_SMOOTH_R;
+
+    for (int cy = cy_start; cy < cy_end; cy++)
     {
-        for (x = 4; x < w-4; x += 2)
+        /* convert the cell rows entering the window */
+        for ( ; next_row <= cy + CHROMA_SMOOTH_R; next_row++)
+        {
+            int s = next_row % CHROMA_SMOOTH_ROWS;
+            chroma_smooth_cells(inp, w, 2 * next_row, cells, raw2ev, ring_dr[s], ring_db[s], ring_ge[s]);
+        }
+
+        /* window rows, top to bottom */
+        int* dr_rows[CHROMA_SMOOTH_ROWS];
+        int* db_rows[CHROMA_SMOOTH_ROWS];
+        for (j = 0; j < CHROMA_SMOOTH_ROWS; j++)
+        {
+            int s = (cy - CHROMA_SMOOTH_R + j) % CHROMA_SMOOTH_ROWS;
+            dr_rows[j] = ring_dr[s];
+            db_rows[j] = ring_db[s];
+        }
+        int* ge_row = ring_ge[cy % CHROMA_SMOOTH_ROWS];
+        int y = 2 * cy;
+        int cx = cx_start;
+
+#if defined(__SSE2__)
+        /* 4 cells at a time */
+        for ( ; cx + 4 <= cx_end; cx += 4)
         {
-            int g1 = inp[x+1 +     y * w];
-            int g2 = inp[x   + (y+1) * w];
-            int ge = (raw2ev[g1] + raw2ev[g2]) / 2;
-            
+            /* looks ugly in darkness */
+            if (ge_row[cx] < 2*EV_RESOLUTION && ge_row[cx+1] < 2*EV_RESOLUTION &&
+                ge_row[cx+2] < 2*EV_RESOLUTION && ge_row[cx+3] < 2*EV_RESOLUTION)
+                continue;
+
+            __m128 med_r[CHROMA_SMOOTH_FILTER_SIZE];
+            __m128 med_b[CHROMA_SMOOTH_FILTER_SIZE];
+            k = 0;
+            for (j = 0; j < CHROMA_SMOOTH_ROWS; j++)
+            {
+                for (i = -CHROMA_SMOOTH_R; i <= CHROMA_SMOOTH_R; i++)
+                {
+                    #ifdef CHROMA_SMOOTH_2X2
+                    if (ABS(i) + ABS(j - CHROMA_SMOOTH_R) == 2)
+                        continue;
+                    #endif
+
+                    med_r[k] = _mm_cvtepi32_ps(_mm_loadu_si128((__m128i*)&dr_rows[j][cx+i]));
+                    med_b[k] = _mm_cvtepi32_ps(_mm_loadu_si128((__m128i*)&db_rows[j][cx+i]));
+                    k++;
+                }
+            }
+
+            int dr[4], db[4];
+            _mm_storeu_si128((__m128i*)dr, _mm_cvtps_epi32(CHROMA_SMOOTH_MEDIAN_SSE2(med_r)));
+            _mm_storeu_si128((__m128i*)db, _mm_cvtps_epi32(CHROMA_SMOOTH_MEDIAN_SSE2(med_b)));
+
+            for (k = 0; k < 4; k++)
+            {
+                int ge = ge_row[cx+k];
+                if (ge < 2*EV_RESOLUTION) continue;
+                chroma_smooth_put(out, w, 2*(cx+k), y, ge, dr[k], db[k], ev2raw);
+            }
+        }
+#endif
+
+        for ( ; cx < cx_end; cx++)
+        {
+            int ge = ge_row[cx];
+
             /* looks ugly in darkness */
             if (ge < 2*EV_RESOLUTION) continue;
 
-            int i,j;
-            int k = 0;
             int med_r[CHROMA_SMOOTH_FILTER_SIZE];
             int med_b[CHROMA_SMOOTH_FILTER_SIZE];
-            for (i = -CHROMA_SMOOTH_MAX_IJ; i <= CHROMA_SMOOTH_MAX_IJ; i += 2)
+            k = 0;
+            for (j = 0; j < CHROMA_SMOOTH_ROWS; j++)
             {
-                for (j = -CHROMA_SMOOTH_MAX_IJ; j <= CHROMA_SMOOTH_MAX_IJ; j += 2)
+                for (i = -CHROMA_SMOOTH_R; i <= CHROMA_SMOOTH_R; i++)
                 {
                     #ifdef CHROMA_SMOOTH_2X2
-                    if (ABS(i) + ABS(j) == 4)
+                    if (ABS(i) + ABS(j - CHROMA_SMOOTH_R) == 2)
                         continue;
                     #endif
-                    
-                    int r  = inp[x+i   +   (y+j) * w];
-                    int g1 = inp[x+i+1 +   (y+j) * w];
-                    int g2 = inp[x+i   + (y+j+1) * w];
-                    int b  = inp[x+i+1 + (y+j+1) * w];
-                    
-                    int ge = (raw2ev[g1] + raw2ev[g2]) / 2;
-                    med_r[k] = raw2ev[r] - ge;
-                    med_b[k] = raw2ev[b] - ge;
+
+                    med_r[k] = dr_rows[j][cx+i];
+                    med_b[k] = db_rows[j][cx+i];
                     k++;
                 }
             }
+
             int dr = CHROMA_SMOOTH_MEDIAN(med_r);
             int db = CHROMA_SMOOTH_MEDIAN(med_b);
-
-            if (ge + dr <= EV_RESOLUTION) continue;
-            if (ge + db <= EV_RESOLUTION) continue;
-
-            out[x   +     y * w] = ev2raw[COERCE(ge + dr, 0, 14*EV_RESOLUTION-1)];
-            out[x+1 + (y+1) * w] = ev2raw[COERCE(ge + db, 0, 14*EV_RESOLUTION-1)];
+            chroma_smooth_put(out, w, 2*cx, y, ge, dr, db, ev2raw);
         }
     }
 }
@@ -72,3 +237,6 @@ static void CHROMA_SMOOTH_FUNC(uint32_t * inp, uint32_t * out, int* raw2ev, int*
 #undef CHROMA_SMOOTH_MAX_IJ
 #undef CHROMA_SMOOTH_FILTER_SIZE
 #undef CHROMA_SMOOTH_MEDIAN
+#undef CHROMA_SMOOTH_MEDIAN_SSE2
+#undef CHROMA_SMOOTH_R
+#undef CHROMA_SMOOTH_ROWS
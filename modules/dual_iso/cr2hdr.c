@@ -52,6 +52,7 @@ static int is_bright[4];
 #include "dither.h"
 #include "timing.h"
 #include "kelvin.h"
+#include "../lv_rec/defect_map.h"
 
 #define MODULE_STRINGS_PREFIX dual_iso_strings
 #include "../module_strings_wrapper.h"
@@ -64,6 +65,10 @@ int interp_method = 0;          /* 0:amaze-edge, 1:mean23 */
 int chroma_smooth_method = 2;
 int fix_pink_dots = 0;
 int fix_bad_pixels = 1;
+int use_defect_map = 0;
+char* defect_map_filename = 0;
+struct defect_map defect_map;
+char camera_serial[100];        /* for the defect map; empty if unknown */
 int use_fullres = 1;
 int use_alias_map = 1;
 int use_stripe_fix = 1;
@@ -158,6 +163,8 @@ struct cmd_group options[] = {
             { &fix_bad_pixels, 2, "--really-bad-pix",   "aggressive bad pixel fix, at the expense of detail and aliasing" },
             { &fix_bad_pixels, 0, "--no-bad-pix",       "disable bad pixel fixing (try it if you shoot stars)" },
             { &debug_bad_pixels,1,"--black-bad-pix",    "mark all bad pixels as black (for troubleshooting)" },
+            { &use_defect_map, 1, "--defect-map=FILE",  "fix the bad pixels listed in a defect map (shared with mlv_dump/raw2dng)\n"
+                                  "                  instead of scanning; if the map has no full-res list yet, it is created" },
             OPTION_EOL
         },
     },
@@ -318,7 +325,14 @@ static void print_sscanf_option(char* format, void* ptr, int num_vars, char* hel
 
 static void parse_commandline_option(char* option)
 {
-    
+    /* the only option with a string value */
+    if (startswith(option, "--defect-map="))
+    {
+        defect_map_filename = option + strlen("--defect-map=");
+        use_defect_map = 1;
+        return;
+    }
+
     for (struct cmd_group * g = options; g->name; g++)
     {
         for (struct cmd_option * o = g->options; o->option; o++)
@@ -591,6 +605,11 @@ int main(int argc, char** argv)
     
     solve_commandline_deps();
     show_active_options();
+
+    if (use_defect_map && defect_map_load(&defect_map, defect_map_filename) != 0)
+    {
+        return 1;
+    }
     
     /* keep track of black and white levels (useful for deflicker) */
     /* (we will not have more than "argc" files) */
@@ -663,6 +682,13 @@ int main(int argc, char** argv)
         
         const char * model = get_camera_model(filename);
         get_raw_info(model, &raw_info);
+        
+        if (use_defect_map)
+        {
+            snprintf(camera_serial, sizeof(camera_serial), "%s", get_camera_serial(filename));
+            if (!camera_serial[0])
+                printf("Defect map      : camera serial unknown, not used\n");
+        }
 
         int raw_width = 0, raw_height = 0;
         int out_width = 0, out_height = 0;
@@ -912,6 +938,15 @@ int main(int argc, char** argv)
     free(whites);
     free(blacks);
     free(file_indices);
+
+    if (use_defect_map)
+    {
+        if (defect_map.dirty && defect_map_save(&defect_map, defect_map_filename) == 0)
+        {
+            printf("\nDefect map updated: %s\n", defect_map_filename);
+        }
+        defect_map_free(&defect_map);
+    }
     
     return 0;
 }
@@ -1865,12 +1900,91 @@ static inline int FC(int row, int col)
         return 1;  /* green */
 }
 
+/* fix the pixels listed in the defect map, without scanning the image */
+static void fix_bad_pixels_from_map(struct defect_list * list, struct defect_clip * clip)
+{
+    int w = raw_info.width;
+    int h = raw_info.height;
+    int black = raw_info.black_level;
+
+    struct defect_xy * defects;
+    int n = defect_map_get_pixels(list, clip, &defects);
+
+    /* compute all the replacements first, then apply them */
+    int* fixed = malloc(MAX(n, 1) * sizeof(fixed[0]));
+    int count = 0;
+
+    for (int d = 0; d < n; d++)
+    {
+        int x = defects[d].x;
+        int y = defects[d].y;
+        fixed[d] = -1;
+
+        if (x < 6 || y < 6 || x >= w-6 || y >= h-6)
+            continue;
+
+        /* same color and same brightness (ISO) as the bad pixel */
+        int neighbours[100];
+        int k = 0;
+        int fc0 = FC(x, y);
+        int b0 = is_bright[y%4];
+        for (int i = -4; i <= 4; i++)
+        {
+            if (is_bright[(y+i)%4] != b0)
+                continue;
+
+            for (int j = -4; j <= 4; j++)
+            {
+                if (i == 0 && j == 0)
+                    continue;
+
+                if (FC(x+j, y+i) != fc0)
+                    continue;
+
+                neighbours[k++] = -raw_get_pixel20(x+j, y+i);
+            }
+        }
+
+        fixed[d] = (defects[d].type & DEFECT_HOT)
+            ? -kth_smallest_int(neighbours, k, 2)
+            : -median_int_wirth(neighbours, k);
+        count++;
+    }
+
+    for (int d = 0; d < n; d++)
+        if (fixed[d] >= 0)
+            raw_set_pixel20(defects[d].x, defects[d].y, debug_bad_pixels ? black : fixed[d]);
+
+    printf("Bad pixels      : %d (from defect map)\n", count);
+
+    free(fixed);
+    free(defects);
+}
+
 static void find_and_fix_bad_pixels(int dark_noise, int bright_noise, int* raw2ev, int* ev2raw)
 {
     int w = raw_info.width;
     int h = raw_info.height;
     
     int black = raw_info.black_level;
+
+    /* defect map: CR2 files are full-res (no binning, no crop offset);
+     * lists are per camera, so nothing will match if the serial is unknown */
+    struct defect_clip clip;
+    struct defect_list * list = 0;
+    if (use_defect_map)
+    {
+        defect_clip_init(&clip, camera_serial, 1, 1, 0, 0, w, h, raw_info.active_area.x1, raw_info.active_area.y1);
+        list = defect_map_find(&defect_map, &clip);
+        if (list && list->frames)
+        {
+            fix_bad_pixels_from_map(list, &clip);
+            return;
+        }
+
+        /* aggressive mode has too many false positives to be remembered */
+        list = (fix_bad_pixels == 1) ? defect_map_get(&defect_map, &clip) : 0;
+    }
     
     printf("Looking for hot/cold pixels...\n");
 
@@ -1959,6 +2073,11 @@ static void find_and_fix_bad_pixels(int dark_noise, int bright_noise, int* raw2e
                     cold_pixels++;
                     hotpixel[x + y*w] = -median_int_wirth(neighbours, k);
                 }
+
+                if (list && (is_hot || is_cold))
+                {
+                    defect_map_add(&defect_map, list, &clip, x, y, is_cold ? DEFECT_COLD : DEFECT_HOT);
+                }
             }
         }
     }
@@ -1974,6 +2093,9 @@ static void find_and_fix_bad_pixels(int dark_noise, int bright_noise, int* raw2e
 
     if (cold_pixels)
         printf("Cold pixels     : %d\n", cold_pixels);
+
+    if (list)
+        defect_map_end_frame(&defect_map, list);
     
     free(hotpixel);
 }
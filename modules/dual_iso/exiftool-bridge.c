@@ -45,6 +45,25 @@ const char * get_camera_model(const char* filename)
     return model;
 }
 
+/* empty string if unknown */
+const char * get_camera_serial(const char* filename)
+{
+    static char serial[100];
+    char exif_cmd[10000];
+    serial[0] = 0;
+    snprintf(exif_cmd, sizeof(exif_cmd), "exiftool -SerialNumber -b \"%s\"", filename);
+    FILE* exif_file = popen(exif_cmd, "r");
+    if(exif_file) 
+    {
+        if (fgets(serial, sizeof(serial), exif_file) == NULL)
+            serial[0] = 0;
+        pclose(exif_file);
+    }
+    
+    serial[strcspn(serial, "\r\n")] = 0;
+    return serial;
+}
+
 /*
 This function uses EXIF information to calculate the following two ratios:
   Red balance is the ratio G/R for a neutral color (typically > 1)
@@ -3,6 +3,7 @@
 
 void copy_tags_from_source(const char* source, const char* dest);
 const char * get_camera_model(const char* filename);
+const char * get_camera_serial(const char* filename);
 
 /*
 This function uses EXIF information to calculate the following two ratios:
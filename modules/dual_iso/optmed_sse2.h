@@ -0,0 +1,77 @@
+/*
+ * SSE2 versions of the median networks from optmed.h,
+ * computing 4 medians at once (one per lane).
+ *
+ * Same compare-exchange sequence as the scalar versions, so each lane
+ * returns exactly what opt_medN would return for the same inputs.
+ * Values are stored as floats; integers up to 2^24 are represented exactly.
+ */
+
+#ifndef _optmed_sse2_h_
+#define _optmed_sse2_h_
+
+#include <emmintrin.h>
+
+#define VEC_SORT(a,b) { __m128 temp = _mm_min_ps((a),(b)); (b) = _mm_max_ps((a),(b)); (a) = temp; }
+
+static inline __m128 opt_med5_sse2(__m128 * p)
+{
+    VEC_SORT(p[0], p[1]) ; VEC_SORT(p[3], p[4]) ; VEC_SORT(p[0], p[3]) ;
+    VEC_SORT(p[1], p[4]) ; VEC_SORT(p[1], p[2]) ; VEC_SORT(p[2], p[3]) ;
+    VEC_SORT(p[1], p[2]) ;
+    return (p[2]) ;
+}
+
+static inline __m128 opt_med9_sse2(__m128 * p)
+{
+    VEC_SORT(p[1], p[2]) ; VEC_SORT(p[4], p[5]) ; VEC_SORT(p[7], p[8]) ;
+    VEC_SORT(p[0], p[1]) ; VEC_SORT(p[3], p[4]) ; VEC_SORT(p[6], p[7]) ;
+    VEC_SORT(p[1], p[2]) ; VEC_SORT(p[4], p[5]) ; VEC_SORT(p[7], p[8]) ;
+    VEC_SORT(p[0], p[3]) ; VEC_SORT(p[5], p[8]) ; VEC_SORT(p[4], p[7]) ;
+    VEC_SORT(p[3], p[6]) ; VEC_SORT(p[1], p[4]) ; VEC_SORT(p[2], p[5]) ;
+    VEC_SORT(p[4], p[7]) ; VEC_SORT(p[4], p[2]) ; VEC_SORT(p[6], p[4]) ;
+    VEC_SORT(p[4], p[2]) ;
+    return (p[4]) ;
+}
+
+static inline __m128 opt_med25_sse2(__m128 * p)
+{
+    VEC_SORT(p[0], p[1]) ; VEC_SORT(p[3], p[4]) ; VEC_SORT(p[2], p[4]) ;
+    VEC_SORT(p[2], p[3]) ; VEC_SORT(p[6], p[7]) ; VEC_SORT(p[5], p[7]) ;
+    VEC_SORT(p[5], p[6]) ; VEC_SORT(p[9], p[10]) ; VEC_SORT(p[8], p[10]) ;
+    VEC_SORT(p[8], p[9]) ; VEC_SORT(p[12], p[13]) ; VEC_SORT(p[11], p[13]) ;
+    VEC_SORT(p[11], p[12]) ; VEC_SORT(p[15], p[16]) ; VEC_SORT(p[14], p[16]) ;
+    VEC_SORT(p[14], p[15]) ; VEC_SORT(p[18], p[19]) ; VEC_SORT(p[17], p[19]) ;
+    VEC_SORT(p[17], p[18]) ; VEC_SORT(p[21], p[22]) ; VEC_SORT(p[20], p[22]) ;
+    VEC_SORT(p[20], p[21]) ; VEC_SORT(p[23], p[24]) ; VEC_SORT(p[2], p[5]) ;
+    VEC_SORT(p[3], p[6]) ; VEC_SORT(p[0], p[6]) ; VEC_SORT(p[0], p[3]) ;
+    VEC_SORT(p[4], p[7]) ; VEC_SORT(p[1], p[7]) ; VEC_SORT(p[1], p[4]) ;
+    VEC_SORT(p[11], p[14]) ; VEC_SORT(p[8], p[14]) ; VEC_SORT(p[8], p[11]) ;
+    VEC_SORT(p[12], p[15]) ; VEC_SORT(p[9], p[15]) ; VEC_SORT(p[9], p[12]) ;
+    VEC_SORT(p[13], p[16]) ; VEC_SORT(p[10], p[16]) ; VEC_SORT(p[10], p[13]) ;
+    VEC_SORT(p[20], p[23]) ; VEC_SORT(p[17], p[23]) ; VEC_SORT(p[17], p[20]) ;
+    VEC_SORT(p[21], p[24]) ; VEC_SORT(p[18], p[24]) ; VEC_SORT(p[18], p[21]) ;
+    VEC_SORT(p[19], p[22]) ; VEC_SORT(p[8], p[17]) ; VEC_SORT(p[9], p[18]) ;
+    VEC_SORT(p[0], p[18]) ; VEC_SORT(p[0], p[9]) ; VEC_SORT(p[10], p[19]) ;
+    VEC_SORT(p[1], p[19]) ; VEC_SORT(p[1], p[10]) ; VEC_SORT(p[11], p[20]) ;
+    VEC_SORT(p[2], p[20]) ; VEC_SORT(p[2], p[11]) ; VEC_SORT(p[12], p[21]) ;
+    VEC_SORT(p[3], p[21]) ; VEC_SORT(p[3], p[12]) ; VEC_SORT(p[13], p[22]) ;
+    VEC_SORT(p[4], p[22]) ; VEC_SORT(p[4], p[13]) ; VEC_SORT(p[14], p[23]) ;
+    VEC_SORT(p[5], p[23]) ; VEC_SORT(p[5], p[14]) ; VEC_SORT(p[15], p[24]) ;
+    VEC_SORT(p[6], p[24]) ; VEC_SORT(p[6], p[15]) ; VEC_SORT(p[7], p[16]) ;
+    VEC_SORT(p[7], p[19]) ; VEC_SORT(p[13], p[21]) ; VEC_SORT(p[15], p[23]) ;
+    VEC_SORT(p[7], p[13]) ; VEC_SORT(p[7], p[15]) ; VEC_SORT(p[1], p[9]) ;
+    VEC_SORT(p[3], p[11]) ; VEC_SORT(p[5], p[17]) ; VEC_SORT(p[11], p[17]) ;
+    VEC_SORT(p[9], p[17]) ; VEC_SORT(p[4], p[10]) ; VEC_SORT(p[6], p[12]) ;
+    VEC_SORT(p[7], p[14]) ; VEC_SORT(p[4], p[6]) ; VEC_SORT(p[4], p[7]) ;
+    VEC_SORT(p[12], p[14]) ; VEC_SORT(p[10], p[14]) ; VEC_SORT(p[6], p[7]) ;
+    VEC_SORT(p[10], p[12]) ; VEC_SORT(p[6], p[10]) ; VEC_SORT(p[6], p[17]) ;
+    VEC_SORT(p[12], p[17]) ; VEC_SORT(p[7], p[17]) ; VEC_SORT(p[7], p[10]) ;
+    VEC_SORT(p[12], p[18]) ; VEC_SORT(p[7], p[12]) ; VEC_SORT(p[10], p[18]) ;
+    VEC_SORT(p[12], p[20]) ; VEC_SORT(p[10], p[20]) ; VEC_SORT(p[10], p[12]) ;
+    return (p[12]) ;
+}
+
+#undef VEC_SORT
+
+#endif
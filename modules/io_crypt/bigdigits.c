@@ -2672,6 +2672,9 @@ DIGIT_T spSimpleRand(DIGIT_T lower, DIGIT_T upper)
 
 static int mpModExp_1(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], size_t ndigits);
 static int mpModExp_windowed(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], size_t ndigits);
+#ifndef NO_MONTGOMERY
+static int mpModExp_montgomery(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], size_t ndigits);
+#endif
 
 int mpModExp(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], size_t ndigits)
 	/* Computes y = x^n mod d */
@@ -2679,6 +2682,11 @@ int mpModExp(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], siz
 #ifdef NO_ALLOCS
 	return mpModExp_1(y, x, n, d, ndigits);
 #else
+#ifndef NO_MONTGOMERY
+	/* Montgomery reduction needs an odd modulus, which is always the case for RSA and Rabin-Miller */
+	if (mpISODD(d, ndigits) && mpShortCmp(d, 1, ndigits) > 0)
+		return mpModExp_montgomery(y, x, n, d, ndigits);
+#endif
 	return mpModExp_windowed(y, x, n, d, ndigits);
 #endif
 }
@@ -3002,4 +3010,199 @@ static int mpModExp_windowed(DIGIT_T yout[], const DIGIT_T g[],
 	return 0;
 }
 
+#ifndef NO_MONTGOMERY
+/*
+MONTGOMERY EXPONENTIATION
+Ref: Koc, Acar, Kaliski, "Analyzing and Comparing Montgomery Multiplication
+Algorithms", IEEE Micro 1996 (CIOS method), and Menezes, chap 14, p600.
+
+All operands are kept in Montgomery form aR mod m with R = 2^(32k), k = the
+number of significant digits of m. A product then only needs k single-digit
+multiply-accumulate passes instead of a long division, and the inner loops
+are plain 32x32->64 multiply-accumulates (UMLAL on ARM).
+*/
+
+/* -m^{-1} mod 2^32, for odd m0 (Newton iteration, each step doubles the correct bits) */
+static DIGIT_T mont_inverse(DIGIT_T m0)
+{
+	DIGIT_T inv = m0;	/* correct to 3 bits, as m0 * m0 = 1 mod 8 */
+	int i;
+
+	for (i = 0; i < 4; i++)
+		inv *= 2 - m0 * inv;
+
+	return (DIGIT_T)0 - inv;
+}
+
+/* r = a * b * R^{-1} mod m, with a, b < m. t is a scratch array of k+2 digits. r may alias a or b. */
+static void mont_mult(DIGIT_T r[], const DIGIT_T a[], const DIGIT_T b[], const DIGIT_T m[],
+			DIGIT_T minv, DIGIT_T t[], size_t k)
+{
+	size_t i, j;
+	uint64_t acc;
+	DIGIT_T carry, q;
+
+	for (j = 0; j < k + 2; j++)
+		t[j] = 0;
+
+	for (i = 0; i < k; i++)
+	{
+		/* t += a * b[i] */
+		DIGIT_T bi = b[i];
+		carry = 0;
+		for (j = 0; j < k; j++)
+		{
+			acc = (uint64_t)a[j] * bi + t[j] + carry;
+			t[j] = (DIGIT_T)acc;
+			carry = (DIGIT_T)(acc >> 32);
+		}
+		acc = (uint64_t)t[k] + carry;
+		t[k] = (DIGIT_T)acc;
+		t[k+1] = (DIGIT_T)(acc >> 32);
+
+		/* t = (t + q * m) / 2^32, with q chosen so that the low digit vanishes */
+		q = t[0] * minv;
+		acc = (uint64_t)m[0] * q + t[0];
+		carry = (DIGIT_T)(acc >> 32);
+		for (j = 1; j < k; j++)
+		{
+			acc = (uint64_t)m[j] * q + t[j] + carry;
+			t[j-1] = (DIGIT_T)acc;
+			carry = (DIGIT_T)(acc >> 32);
+		}
+		acc = (uint64_t)t[k] + carry;
+		t[k-1] = (DIGIT_T)acc;
+		t[k] = t[k+1] + (DIGIT_T)(acc >> 32);
+	}
+
+	/* t < 2m, one final subtraction at most */
+	if (t[k] || mpCompare(t, m, k) >= 0)
+		mpSubtract(r, t, m, k);
+	else
+		mpSetEqual(r, t, k);
+}
+
+static int mpModExp_montgomery(DIGIT_T yout[], const DIGIT_T x[],
+			const DIGIT_T e[], DIGIT_T m[], size_t ndigits)
+/* Computes y = x^e mod m, m odd, using sliding-window exponentiation on Montgomery residues */
+{
+	size_t k;		/* Significant digits in m */
+	size_t nbits;	/* Significant bits in e */
+	size_t winlen;	/* Window size */
+	size_t ngt;		/* No of elements in gtable: g1, g3, g5,... */
+	DIGIT_T minv;	/* -m^{-1} mod 2^32 */
+	DIGIT_T *gtable[(1 << (WINLENTBLMAX-1))];
+	DIGIT_T *r2, *a, *t, *tmp;
+	int aisone;
+	size_t i;
+	long bit;
+
+	k = mpSizeof(m, ndigits);
+	nbits = mpBitLength(e, ndigits);
+
+	/* Catch easy ones */
+	if (nbits == 0)
+	{	/* g^0 = 1 */
+		mpSetDigit(yout, 1, ndigits);
+		return 0;
+	}
+
+	/* Window length, same table as the plain sliding-window method */
+	for (winlen = 0; winlen < WINLENTBLMAX && winlen < BITS_PER_DIGIT; winlen++)
+	{
+		if (WindowLenTable[winlen] > nbits)
+			break;
+	}
+	if (winlen < 1)
+		winlen = 1;
+	ngt = ((size_t)1 << (winlen - 1));
+
+	minv = mont_inverse(m[0]);
+	t = mpAlloc(k + 2);
+	a = mpAlloc(k);
+	r2 = mpAlloc(2 * k + 1);
+	tmp = mpAlloc(ndigits > k ? ndigits : k);
+
+	/* R^2 mod m, to convert into Montgomery form */
+	mpSetZero(r2, 2 * k + 1);
+	r2[2 * k] = 1;
+	mpModulo(r2, r2, 2 * k + 1, m, k);
+
+	/* g1 = xR mod m; x may be >= m */
+	mpModulo(tmp, x, ndigits, m, k);
+	gtable[0] = mpAlloc(k);
+	mont_mult(gtable[0], tmp, r2, m, minv, t, k);
+
+	/* g2 = g1^2, then g_{2i+1} = g_{2i-1} * g2 */
+	if (ngt > 1)
+	{
+		mont_mult(tmp, gtable[0], gtable[0], m, minv, t, k);
+		for (i = 1; i < ngt; i++)
+		{
+			gtable[i] = mpAlloc(k);
+			mont_mult(gtable[i], gtable[i-1], tmp, m, minv, t, k);
+		}
+	}
+
+	/* Left to right over the bits of e */
+	aisone = 1;
+	bit = (long)nbits - 1;
+	while (bit >= 0)
+	{
+		if (!mpGetBit((DIGIT_T *)e, ndigits, bit))
+		{
+			if (!aisone)
+				mont_mult(a, a, a, m, minv, t, k);
+			bit--;
+			continue;
+		}
+
+		/* Longest window e_bit..e_low with at most winlen bits, ending in a '1' */
+		long low = bit - (long)winlen + 1;
+		if (low < 0)
+			low = 0;
+		while (!mpGetBit((DIGIT_T *)e, ndigits, low))
+			low++;
+
+		DIGIT_T win = 0;
+		for (long j = bit; j >= low; j--)
+		{
+			win = (win << 1) | mpGetBit((DIGIT_T *)e, ndigits, j);
+			if (!aisone)
+				mont_mult(a, a, a, m, minv, t, k);
+		}
+
+		if (aisone)
+		{
+			mpSetEqual(a, gtable[win >> 1], k);
+			aisone = 0;
+		}
+		else
+		{
+			mont_mult(a, a, gtable[win >> 1], m, minv, t, k);
+		}
+
+		bit = low - 1;
+	}
+
+	/* Back from Montgomery form: y = a * 1 * R^{-1} */
+	mpSetZero(tmp, k);
+	tmp[0] = 1;
+	mont_mult(a, a, tmp, m, minv, t, k);
+
+	mpSetZero(yout, ndigits);
+	mpSetEqual(yout, a, k);
+
+	/* Clean up */
+	mpDESTROY(t, k + 2);
+	mpDESTROY(a, k);
+	mpDESTROY(r2, 2 * k + 1);
+	mpDESTROY(tmp, ndigits > k ? ndigits : k);
+	for (i = 0; i < ngt; i++)
+		mpDESTROY(gtable[i], k);
+
+	return 0;
+}
+#endif /* !NO_MONTGOMERY */
+
 #endif /* !NO_ALLOCS */
@@ -56,6 +56,10 @@ typedef uint16_t HALF_DIGIT_T;
 #define MAX_FIXED_DIGITS (8192 / BITS_PER_DIGIT)
 #endif
 
+/*	[ML] mpModExp uses Montgomery multiplication for odd moduli.
+	Define NO_MONTGOMERY to always use the division based sliding-window method.
+*/
+
 /**** END OF USER CONFIGURABLE SECTION ****/
 
 /**** OPTIONAL PREPROCESSOR DEFINITIONS ****/
@@ -74,21 +74,47 @@ static void crypt_lfsr64_clock(lfsr64_ctx_t *ctx, uint32_t clocks)
     ctx->lfsr_state = lfsr;
 }
 
-/* xor the buffer with 8/64 bit alignment */
-static void crypt_lfsr64_xor_uint8(void *dst_in, void *src_in, lfsr64_ctx_t *ctx, uint32_t offset)
+/* xor a run of bytes that all lie in the same key block.
+   the key repeats every 8 bytes, so every 64 bit word starting at offset uses
+   key_uint64[offset % 8], regardless of the buffer alignment. */
+static void crypt_lfsr64_xor_run(uint8_t *dst, uint8_t *src, lfsr64_ctx_t *ctx, uint32_t offset, uint32_t length)
 {
-    uint8_t *dst = (uint8_t *)dst_in;
-    uint8_t *src = (uint8_t *)src_in;
+    uint64_t key = ctx->key_uint64[offset % 8];
     
-    *dst = *src ^ ctx->key_uint8[offset % 8];
-}
-
-static void crypt_lfsr64_xor_uint64(void *dst_in, void *src_in, lfsr64_ctx_t *ctx, uint32_t offset)
-{
-    uint64_t *dst = (uint64_t *)dst_in;
-    uint64_t *src = (uint64_t *)src_in;
+    if((((uintptr_t)dst | (uintptr_t)src) % 8) == 0)
+    {
+        /* both buffers 64 bit aligned, plain word accesses */
+        while(length >= 8)
+        {
+            *(uint64_t *)dst = *(uint64_t *)src ^ key;
+            dst += 8;
+            src += 8;
+            offset += 8;
+            length -= 8;
+        }
+    }
+    else
+    {
+        /* unaligned buffers, let the compiler pick the best unaligned access */
+        while(length >= 8)
+        {
+            uint64_t word;
+            
+            memcpy(&word, src, 8);
+            word ^= key;
+            memcpy(dst, &word, 8);
+            dst += 8;
+            src += 8;
+            offset += 8;
+            length -= 8;
+        }
+    }
     
-    *dst = *src ^ ctx->key_uint64[offset % 8];
+    /* less than one word left */
+    for(uint32_t pos = 0; pos < length; pos++)
+    {
+        dst[pos] = src[pos] ^ ctx->key_uint8[(offset + pos) % 8];
+    }
 }
 
 static void update_key(lfsr64_ctx_t *ctx, uint32_t offset, uint32_t force)
@@ -166,7 +192,7 @@ static void update_key(lfsr64_ctx_t *ctx, uint32_t offset, uint32_t force)
     /* build an array with key elements for every offset in uint64_t mode */
     for(int pos = 0; pos < 8; pos++)
     {
-        uint32_t elem_addr = (uint32_t)&ctx->key_uint64[pos];
+        uintptr_t elem_addr = (uintptr_t)&ctx->key_uint64[pos];
         
         memcpy((void*)elem_addr, &ctx->key_uint8[pos], 8 - pos);
         memcpy((void*)(elem_addr + (8 - pos)), &ctx->key_uint8[0], pos);
@@ -182,122 +208,23 @@ static uint32_t crypt_lfsr64_encrypt(crypt_priv_t *priv, uint8_t *dst_in, uint8_
     uint32_t length = in_length;
     uint32_t blocksize = ctx->blocksize;
     
-    //trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: dst 0x%08X, src 0x%08X, length: 0x%08X, offset: 0x%08X, cipher_ctx: 0x%08X, priv: 0x%08X, blocksize: 0x%08X", dst_in, src_in, in_length, offset, cipher_ctx, cipher_ctx->priv, blocksize);
-    
-    /* ensure initial key creation if necessary */
-    update_key(ctx, offset, 0); 
-    
-    //trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: dst 0x%08X, src 0x%08X, length: 0x%08X, offset: 0x%08X", dst, src, length, offset);
-    
-    /* try to get the addresses aligned */
-    while((((uint32_t)dst) % 8) && (length > 0))
-    {
-        /* at every block start, rerun key update */
-        if((offset % blocksize) == 0)
-        {
-            update_key(ctx, offset, 0);
-        }
-        
-        /* encrypt a single byte, thats very slow of course */
-        crypt_lfsr64_xor_uint8(dst, src, ctx, offset);
-        dst += 1;
-        src += 1;
-        offset += 1;
-        length -= 1;
-    }
-    
-    if(!length)
-    {
-        //trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: all done dst 0x%08X, src 0x%08X, length: 0x%08X, offset: 0x%08X", dst, src, length, offset);
-        return in_length;
-    }
-    
-    /* the pointers are 64 bit aligned now. do 64 bit writes if possible. */
-    if((offset % 8) == 0)
-    {
-        //trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: (offset mod 8) == 0) dst 0x%08X, src 0x%08X, length: 0x%08X, offset: 0x%08X", dst, src, length, offset);
-        /* processing loop for 64 bit writes at even file offsets. due to compiler optimizations this loop is faster */
-        while(length >= 8)
-        {
-            if((offset % blocksize) == 0)
-            {
-                update_key(ctx, offset, 0);
-            }
-            
-            crypt_lfsr64_xor_uint64(dst, src, ctx, 0);
-            dst += 8;
-            src += 8;
-            offset += 8;
-            length -= 8;
-        }
-    }
-    
-    //trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: (length >= 8) dst 0x%08X, src 0x%08X, length: 0x%08X, offset: 0x%08X", dst, src, length, offset);
-    /* processing loop for 64 bit writes at odd file offsets. this loop has to do an extra lookup */
-    while(length >= 8)
-    {
-        uint32_t block_remain = offset % blocksize;
-        
-        if(block_remain == 0)
-        {
-            update_key(ctx, offset, 0);
-        }
-        else if((block_remain + 8) > blocksize)
-        {
-            if(length < 8)
-            {
-                /* okay, do the rest with per-byte crypts */
-                break;
-            }
-            
-            for(int local_pos = 0; local_pos < 8; local_pos++)
-            {
-                if((offset % blocksize) == 0)
-                {
-                    update_key(ctx, offset, 0);
-                }
-                
-                crypt_lfsr64_xor_uint8(dst, src, ctx, offset);
-                dst += 1;
-                src += 1;
-                offset += 1;
-                length -= 1;                
-            }
-            continue;
-        }
-        
-        crypt_lfsr64_xor_uint64(dst, src, ctx, offset);
-        dst += 8;
-        src += 8;
-        offset += 8;
-        length -= 8;
-    }
-    
-    //trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: (length > 0) dst 0x%08X, src 0x%08X, length: 0x%08X, offset: 0x%08X", dst, src, length, offset);
-    /* do the rest, very slow */
+    /* the key only changes at block boundaries, so process one block run at a time */
     while(length > 0)
     {
-        uint32_t block_remain = offset % blocksize;
+        uint32_t run = blocksize - (offset % blocksize);
         
-        if(block_remain == 0)
+        if(run > length)
         {
-            update_key(ctx, offset, 0);
+            run = length;
         }
         
-        crypt_lfsr64_xor_uint8(dst, src, ctx, offset);
-        dst += 1;
-        src += 1;
-        offset += 1;
-        length -= 1;
-    }
-    
-    if((uint32_t)dst_in + in_length != (uint32_t)dst)
-    {
-        trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: ADDRESS ERROR dst 0x%08X/0x%08X, src 0x%08X/0x%08X, length: 0x%08X, offset: 0x%08X", dst, dst_in, src, src_in, length, offset);
-    }
-    if((uint32_t)src_in + in_length != (uint32_t)src)
-    {
-        trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: ADDRESS ERROR dst 0x%08X/0x%08X, src 0x%08X/0x%08X, length: 0x%08X, offset: 0x%08X", dst, dst_in, src, src_in, length, offset);
+        update_key(ctx, offset, 0);
+        crypt_lfsr64_xor_run(dst, src, ctx, offset, run);
+        
+        dst += run;
+        src += run;
+        offset += run;
+        length -= run;
     }
     
     return in_length;
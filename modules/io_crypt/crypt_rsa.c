@@ -104,28 +104,6 @@ static uint32_t crypt_rsa_keysize = 1024;
 extern uint32_t iocrypt_trace_ctx;
 
 
-static bdigit_t small_primes[] = {
-    3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43,
-    47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97, 101,
-    103, 107, 109, 113,
-    127, 131, 137, 139, 149, 151, 157, 163, 167, 173,
-    179, 181, 191, 193, 197, 199, 211, 223, 227, 229,
-    233, 239, 241, 251, 257, 263, 269, 271, 277, 281,
-    283, 293, 307, 311, 313, 317, 331, 337, 347, 349,
-    353, 359, 367, 373, 379, 383, 389, 397, 401, 409,
-    419, 421, 431, 433, 439, 443, 449, 457, 461, 463,
-    467, 479, 487, 491, 499, 503, 509, 521, 523, 541,
-    547, 557, 563, 569, 571, 577, 587, 593, 599, 601,
-    607, 613, 617, 619, 631, 641, 643, 647, 653, 659,
-    661, 673, 677, 683, 691, 701, 709, 719, 727, 733,
-    739, 743, 751, 757, 761, 769, 773, 787, 797, 809,
-    811, 821, 823, 827, 829, 839, 853, 857, 859, 863,
-    877, 881, 883, 887, 907, 911, 919, 929, 937, 941,
-    947, 953, 967, 971, 977, 983, 991, 997,
-};
-#define N_SMALL_PRIMES (sizeof(small_primes)/sizeof(bdigit_t))
-
-
 static int crypt_rsa_rand(unsigned char *bytes, size_t nbytes, const unsigned char *seed, size_t seedlen)
 {
     if(0 && seed)
@@ -160,6 +138,31 @@ static int crypt_rsa_rand(unsigned char *bytes, size_t nbytes, const unsigned ch
 }
 
 
+#if defined(IOCRYPT_RSA_REFERENCE)
+
+/* the original incremental trial division, only built for the rsa_bench_ref comparison */
+
+static bdigit_t small_primes[] = {
+    3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43,
+    47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97, 101,
+    103, 107, 109, 113,
+    127, 131, 137, 139, 149, 151, 157, 163, 167, 173,
+    179, 181, 191, 193, 197, 199, 211, 223, 227, 229,
+    233, 239, 241, 251, 257, 263, 269, 271, 277, 281,
+    283, 293, 307, 311, 313, 317, 331, 337, 347, 349,
+    353, 359, 367, 373, 379, 383, 389, 397, 401, 409,
+    419, 421, 431, 433, 439, 443, 449, 457, 461, 463,
+    467, 479, 487, 491, 499, 503, 509, 521, 523, 541,
+    547, 557, 563, 569, 571, 577, 587, 593, 599, 601,
+    607, 613, 617, 619, 631, 641, 643, 647, 653, 659,
+    661, 673, 677, 683, 691, 701, 709, 719, 727, 733,
+    739, 743, 751, 757, 761, 769, 773, 787, 797, 809,
+    811, 821, 823, 827, 829, 839, 853, 857, 859, 863,
+    877, 881, 883, 887, 907, 911, 919, 929, 937, 941,
+    947, 953, 967, 971, 977, 983, 991, 997,
+};
+#define N_SMALL_PRIMES (sizeof(small_primes)/sizeof(bdigit_t))
+
 int generateRSAPrime(BIGD p, size_t nbits, bdigit_t e, size_t ntests,
                  unsigned char *seed, size_t seedlen, BD_RANDFUNC randFunc)
 /* Create a prime p such that gcd(p-1, e) = 1.
@@ -257,6 +260,188 @@ int generateRSAPrime(BIGD p, size_t nbits, bdigit_t e, size_t ntests,
     return (done ? count : -1);
 }
 
+#else
+
+/* odd primes below this limit are sieved out of the prime candidates */
+#define SIEVE_PRIME_LIMIT   16384
+/* number of odd candidates per sieve window */
+#define SIEVE_WINDOW        4096
+
+static uint16_t *sieve_primes = NULL;
+static uint32_t sieve_prime_count = 0;
+
+/* build the table of small odd primes once (Eratosthenes) */
+static void crypt_rsa_sieve_init()
+{
+    if(sieve_primes)
+    {
+        return;
+    }
+
+    uint8_t *composite = malloc(SIEVE_PRIME_LIMIT);
+    if(!composite)
+    {
+        return;
+    }
+    memset(composite, 0x00, SIEVE_PRIME_LIMIT);
+
+    uint32_t count = 0;
+    for(uint32_t n = 3; n < SIEVE_PRIME_LIMIT; n += 2)
+    {
+        if(composite[n])
+        {
+            continue;
+        }
+        count++;
+        for(uint32_t k = n * n; k < SIEVE_PRIME_LIMIT; k += 2 * n)
+        {
+            composite[k] = 1;
+        }
+    }
+
+    uint16_t *primes = malloc(count * sizeof(uint16_t));
+    if(primes)
+    {
+        uint32_t pos = 0;
+        for(uint32_t n = 3; n < SIEVE_PRIME_LIMIT; n += 2)
+        {
+            if(!composite[n])
+            {
+                primes[pos++] = n;
+            }
+        }
+        sieve_prime_count = count;
+        sieve_primes = primes;
+    }
+
+    free(composite);
+}
+
+int generateRSAPrime(BIGD p, size_t nbits, bdigit_t e, size_t ntests,
+                 unsigned char *seed, size_t seedlen, BD_RANDFUNC randFunc)
+/* Create a prime p such that gcd(p-1, e) = 1.
+   Returns # prime tests carried out or -1 if failed.
+   Sets the TWO highest bits to ensure that the
+   product pq will always have its high bit set.
+   e MUST be a prime > 2.
+   This function assumes that e is prime so we can
+   do the less expensive test p mod e != 1 instead
+   of gcd(p-1, e) == 1.
+   Trial division is done as a sieve over a window of consecutive odd
+   candidates n0, n0+2, ... (Menezes 4.51 / 4.54): for every small prime q
+   only the candidates divisible by q are touched, so the cost per candidate
+   does not grow with the number of primes and far more of them can be used.
+  */
+{
+    BIGD u;
+    size_t i, iloop, maxloops, maxodd, tested;
+    int done = 0;
+    int count = 0;
+
+    crypt_rsa_sieve_init();
+
+    uint32_t *r = malloc(sieve_prime_count * sizeof(uint32_t));
+    uint8_t *sieve = malloc(SIEVE_WINDOW);
+
+    if(!sieve_primes || !r || !sieve)
+    {
+        free(r);
+        free(sieve);
+        return -1;
+    }
+
+    /* Create a temp */
+    u = bdNew();
+
+    maxodd = nbits * 100;
+    maxloops = 5;
+
+    for (iloop = 0; !done && iloop < maxloops; iloop++)
+    {
+        /* Set candidate n0 as random odd number */
+        bdRandomSeeded(p, nbits, seed, seedlen, randFunc);
+        /* Set two highest and low bits */
+        bdSetBit(p, nbits - 1, 1);
+        bdSetBit(p, nbits - 2, 1);
+        bdSetBit(p, 0, 1);
+
+        /* R[q] = start of the current window mod q */
+        for (i = 0; i < sieve_prime_count; i++)
+        {
+            r[i] = bdShortMod(u, p, sieve_primes[i]);
+        }
+
+        for (tested = 0; !done && tested < maxodd; tested += SIEVE_WINDOW)
+        {
+            /* sieve[j] is set if the candidate at window start + 2j has a small factor */
+            memset(sieve, 0x00, SIEVE_WINDOW);
+            for (i = 0; i < sieve_prime_count; i++)
+            {
+                uint32_t q = sieve_primes[i];
+
+                /* first j with R[q] + 2j = 0 mod q */
+                uint32_t j = (q - r[i]) % q;
+                j = (j & 1) ? (j + q) / 2 : j / 2;
+
+                for (; j < SIEVE_WINDOW; j += q)
+                {
+                    sieve[j] = 1;
+                }
+
+                /* R[q] for the next window */
+                r[i] = (r[i] + 2 * SIEVE_WINDOW) % q;
+            }
+
+            /* p walks along the window to the surviving candidates */
+            uint32_t pos = 0;
+            for (uint32_t j = 0; j < SIEVE_WINDOW && tested + j < maxodd; j++)
+            {
+                if (sieve[j])
+                    continue;
+
+                bdShortAdd(p, p, 2 * (j - pos));
+                pos = j;
+
+                /* Check for overflow */
+                if (bdBitLength(p) > nbits)
+                {
+                    tested = maxodd;
+                    break;
+                }
+
+                count++;
+
+                /* If p mod e = 1 then gcd(p, e) > 1, so try again */
+                bdShortMod(u, p, e);
+                if (bdShortCmp(u, 1) == 0)
+                    continue;
+
+                /* Do expensive primality test */
+                if (bdRabinMiller(p, ntests))
+                {    /* Success! - we have a prime */
+                    done = 1;
+                    break;
+                }
+            }
+
+            /* advance p to the start of the next window */
+            if (!done && tested < maxodd)
+            {
+                bdShortAdd(p, p, 2 * (SIEVE_WINDOW - pos));
+            }
+        }
+    }
+
+    /* Clear up */
+    bdFree(&u);
+    free(r);
+    free(sieve);
+
+    return (done ? count : -1);
+}
+
+#endif
+
 int generateRSAKey(BIGD n, BIGD e, BIGD d, BIGD p, BIGD q, BIGD dP, BIGD dQ, BIGD qInv,
     size_t nbits, bdigit_t ee, size_t ntests, unsigned char *seed, size_t seedlen,
     BD_RANDFUNC randFunc, uint32_t *progress)
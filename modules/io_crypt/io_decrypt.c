@@ -24,6 +24,16 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 
 #include "io_crypt.h"
 #include "crypt_lfsr64.h"
@@ -33,6 +43,11 @@
 
 
 #define BLOCKSIZE (8 * 1024)
+#define MAX_THREADS 64
+
+/* how the payload of a file is encrypted */
+#define CIPHER_LFSR64 0
+#define CIPHER_XTEA   1
 
 
 static const uint8_t cr2_magic[] = "\x49\x49\x2A\x00";
@@ -121,119 +136,74 @@ static void io_decrypt_test()
 }
 
 static crypt_cipher_t iocrypt_rsa_ctx;
-int main(int argc, char *argv[])
+static uint32_t iocrypt_rsa_loaded = 0;
+
+/* the RSA key and bignum code are shared, only one file may use them at a time */
+static pthread_mutex_t iocrypt_rsa_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* serializes the console output of the batch mode workers */
+static pthread_mutex_t io_decrypt_print_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* everything needed to decrypt the payload of one file */
+typedef struct
 {
-    //io_decrypt_test();
-    //crypt_rsa_test();
-    
-    if(argc < 2)
-    {
-        printf("Usage: '%s <infile> [outfile] [password]\n", argv[0]);
-        return -1;
-    }
-    
-    uint64_t key = 0;
-    uint32_t lfsr_blocksize = 0x00020000;
-    crypt_cipher_t crypt_ctx;
-    
-    char *in_filename = argv[1];
-    char *out_filename = malloc(strlen(in_filename) + 9);
-    
-    sprintf(out_filename, "%s_out.cr2", in_filename);
-    
-    if(argc >= 3)
-    {
-        out_filename = strdup(argv[2]);
-    }
-    
-    /* password is optional */
-    if(argc >= 4)
-    {
-        /* hash the password */
-        hash_password(argv[3], &key);
-    }
-    
-    /* open files */
-    FILE *in_file = fopen(in_filename, "rb");
-    if(!in_file)
-    {
-        printf("Could not open '%s'\n", in_filename);
-        return -1;
-    } 
-    
-    char *buffer = malloc(BLOCKSIZE);
+    uint32_t cipher;
+    uint64_t key;
+    uint32_t blocksize;
+    uint32_t data_offset;
+    const char *type_name;
+} io_decrypt_params_t;
+
+/* parse the file header. returns 0 if the file is encrypted, 1 if it is a plain file,
+   2 if the header is unknown (maybe LFSR64 without header), -1 on errors and -2 if a password is missing */
+static int io_decrypt_read_header(FILE *in_file, const char *in_filename, uint64_t key, io_decrypt_params_t *params)
+{
+    uint8_t magic[4];
     
+    params->key = key;
+    params->blocksize = 0x00020000;
+    params->data_offset = 0;
     
     /* try to detect file type */
-    if(fread(buffer, 1, 4, in_file) != 4)
+    if(fread(magic, 1, 4, in_file) != 4)
     {
         printf("Could not read '%s'\n", in_filename);
         return -1;
     }
     
-    if(!memcmp(buffer, jpg_magic, 4))
+    if(!memcmp(magic, jpg_magic, 4))
     {
-        printf("File type: JPEG (plain)\n");
-        return 0;
+        params->type_name = "JPEG (plain)";
+        return 1;
     }
-    else if(!memcmp(buffer, cr2_magic, 4))
+    else if(!memcmp(magic, cr2_magic, 4))
     {
-        printf("File type: CR2 (plain)\n");
-        return 0;
+        params->type_name = "CR2 (plain)";
+        return 1;
     }
-    else if(!memcmp(buffer, lfsr_magic, 4))
+    else if(!memcmp(magic, lfsr_magic, 4) || !memcmp(magic, xtea_magic, 4))
     {
-        printf("File type: LFSR64\n");
+        params->cipher = !memcmp(magic, lfsr_magic, 4) ? CIPHER_LFSR64 : CIPHER_XTEA;
+        params->type_name = (params->cipher == CIPHER_LFSR64) ? "LFSR64" : "XTEA";
         
         if(!key)
         {
             printf("Error: Please specify a password\n");
             return -2;
         }
-        if(fread(&lfsr_blocksize, 1, sizeof(uint32_t), in_file) != sizeof(uint32_t))
+        if(fread(&params->blocksize, 1, sizeof(uint32_t), in_file) != sizeof(uint32_t))
         {
             printf("Could not read '%s'\n", in_filename);
             return -1;
         }
         
-        fseek(in_file, 0x200, SEEK_SET);
-        crypt_lfsr64_init(&crypt_ctx, key);
-        crypt_ctx.set_blocksize(crypt_ctx.priv, lfsr_blocksize);
-    }
-    else if(!memcmp(buffer, xtea_magic, 4))
-    {
-        printf("File type: XTEA\n");
-        
-        if(!key)
-        {
-            printf("Error: Please specify a password\n");
-            return -2;
-        }
-        if(fread(&lfsr_blocksize, 1, sizeof(uint32_t), in_file) != sizeof(uint32_t))
-        {
-            printf("Could not read '%s'\n", in_filename);
-            return -1;
-        }
-        
-        fseek(in_file, 0x200, SEEK_SET);
-        
-        /* todo: fill it correctly */
-        uint32_t password[4];
-        memset(password, 0x00, sizeof(password));
-        crypt_xtea_init(&crypt_ctx, password, key);
+        params->data_offset = 0x200;
     }
-    else if(!memcmp(buffer, rsa_magic, 4))
+    else if(!memcmp(magic, rsa_magic, 4) || !memcmp(magic, rsaxtea_magic, 4))
     {
-        printf("File type: RSA+LFSR64\n");
-        
-        crypt_rsa_init(&iocrypt_rsa_ctx);
+        params->cipher = !memcmp(magic, rsa_magic, 4) ? CIPHER_LFSR64 : CIPHER_XTEA;
+        params->type_name = (params->cipher == CIPHER_LFSR64) ? "RSA+LFSR64" : "RSA+XTEA";
         
-        if(crypt_rsa_get_keysize(iocrypt_rsa_ctx.priv) < 64)
-        {
-            printf("Invalid key size\n");
-            return -1;
-        }
-
         uint32_t encrypted_size = 0;
         
         if(fread(&encrypted_size, 1, sizeof(uint32_t), in_file) != sizeof(uint32_t))
@@ -242,7 +212,7 @@ int main(int argc, char *argv[])
             return -1;
         }
         
-        if(fread(&lfsr_blocksize, 1, sizeof(uint32_t), in_file) != sizeof(uint32_t))
+        if(fread(&params->blocksize, 1, sizeof(uint32_t), in_file) != sizeof(uint32_t))
         {
             printf("Could not read '%s'\n", in_filename);
             return -1;
@@ -254,134 +224,118 @@ int main(int argc, char *argv[])
             return -1;
         }
         
-        if(!lfsr_blocksize || lfsr_blocksize > 0x10000000)
+        if(!params->blocksize || params->blocksize > 0x10000000)
         {
-            printf("lfsr_blocksize: %d\n", lfsr_blocksize);
+            printf("lfsr_blocksize: %d\n", params->blocksize);
             return -1;
         }
         
-        printf("lfsr_blocksize: %d\n", lfsr_blocksize);
-        printf("encrypted_size: %d\n", encrypted_size);
-        
         char *encrypted = malloc(encrypted_size);
-        if(fread(encrypted, 1, encrypted_size, in_file) != encrypted_size)
+        if(!encrypted || fread(encrypted, 1, encrypted_size, in_file) != encrypted_size)
         {
             printf("Could not read '%s'\n", in_filename);
+            free(encrypted);
             return -1;
         }
-        uint32_t decrypted_size = iocrypt_rsa_ctx.decrypt(iocrypt_rsa_ctx.priv, (uint8_t *)encrypted, (uint8_t *)encrypted, encrypted_size, 0);
-
-        if(!decrypted_size || decrypted_size > encrypted_size)
-        {
-            printf("decrypted_size: %d. maybe key mismatch?\n", decrypted_size);
-            return -1;
-        }
-        
-        /* that decrypted data is the file crypt key */
-        memcpy(&key, encrypted, sizeof(uint64_t));
-        
-        free(encrypted);
-    
-        uint32_t used_header = 4 + sizeof(uint32_t) + encrypted_size;
-        uint32_t aligned_header = (used_header + 0x1FF) & ~0x1FF;
-        
-        /* now skip that header and continue with LFSR64 decryption */
-        fseek(in_file, aligned_header, SEEK_SET);
-        
-        crypt_lfsr64_init(&crypt_ctx, key);
-        crypt_ctx.set_blocksize(crypt_ctx.priv, lfsr_blocksize);
-    }
-    else if(!memcmp(buffer, rsaxtea_magic, 4))
-    {
-        printf("File type: RSA+XTEA\n");
         
-        crypt_rsa_init(&iocrypt_rsa_ctx);
+        pthread_mutex_lock(&iocrypt_rsa_lock);
         
-        if(crypt_rsa_get_keysize(iocrypt_rsa_ctx.priv) < 64)
+        if(!iocrypt_rsa_loaded)
         {
-            printf("Invalid key size\n");
-            return -1;
+            crypt_rsa_init(&iocrypt_rsa_ctx);
+            iocrypt_rsa_loaded = 1;
         }
-
-        uint32_t encrypted_size = 0;
         
-        if(fread(&encrypted_size, 1, sizeof(uint32_t), in_file) != sizeof(uint32_t))
-        {
-            printf("Could not read '%s'\n", in_filename);
-            return -1;
-        }
-        
-        if(fread(&lfsr_blocksize, 1, sizeof(uint32_t), in_file) != sizeof(uint32_t))
-        {
-            printf("Could not read '%s'\n", in_filename);
-            return -1;
-        }
-
-        if(!encrypted_size || encrypted_size > 32768 * 4)
-        {
-            printf("encrypted_size: %d\n", encrypted_size);
-            return -1;
-        }
-        
-        if(!lfsr_blocksize || lfsr_blocksize > 0x10000000)
+        if(crypt_rsa_get_keysize(iocrypt_rsa_ctx.priv) < 64)
         {
-            printf("lfsr_blocksize: %d\n", lfsr_blocksize);
+            pthread_mutex_unlock(&iocrypt_rsa_lock);
+            printf("Invalid key size\n");
+            free(encrypted);
             return -1;
         }
         
-        printf("encrypted_size: %d\n", encrypted_size);
-        
-        char *encrypted = malloc(encrypted_size);
-        if(fread(encrypted, 1, encrypted_size, in_file) != encrypted_size)
-        {
-            printf("Could not read '%s'\n", in_filename);
-            return -1;
-        }
         uint32_t decrypted_size = iocrypt_rsa_ctx.decrypt(iocrypt_rsa_ctx.priv, (uint8_t *)encrypted, (uint8_t *)encrypted, encrypted_size, 0);
+        
+        pthread_mutex_unlock(&iocrypt_rsa_lock);
 
         if(!decrypted_size || decrypted_size > encrypted_size)
         {
             printf("decrypted_size: %d. maybe key mismatch?\n", decrypted_size);
+            free(encrypted);
             return -1;
         }
         
         /* that decrypted data is the file crypt key */
-        memcpy(&key, encrypted, sizeof(uint64_t));
+        memcpy(&params->key, encrypted, sizeof(uint64_t));
         
         free(encrypted);
     
+        /* the payload starts after the header, 512 byte aligned */
         uint32_t used_header = 4 + sizeof(uint32_t) + encrypted_size;
-        uint32_t aligned_header = (used_header + 0x1FF) & ~0x1FF;
-        
-        /* now skip that header and continue with LFSR113 decryption */
-        fseek(in_file, aligned_header, SEEK_SET);
-        
+        params->data_offset = (used_header + 0x1FF) & ~0x1FF;
+    }
+    else
+    {
+        params->cipher = CIPHER_LFSR64;
+        params->type_name = "unknown. assuming LFSR64";
+        return 2;
+    }
+    
+    return 0;
+}
+
+/* set up a cipher context for the payload */
+static void io_decrypt_init_cipher(crypt_cipher_t *crypt_ctx, io_decrypt_params_t *params)
+{
+    if(params->cipher == CIPHER_XTEA)
+    {
         /* todo: fill it correctly */
         uint32_t password[4];
         memset(password, 0x00, sizeof(password));
-        crypt_xtea_init(&crypt_ctx, password, key);
+        crypt_xtea_init(crypt_ctx, password, params->key);
     }
     else
     {
-        if(key)
-        {
-            printf("File type: unknown. assuming LFSR64\n");
-            crypt_lfsr64_init(&crypt_ctx, key);
-        }
-        else
-        {
-            printf("File type: unknown. assuming LFSR64. Please specify a password\n");
-            return -2;
-        }
+        crypt_lfsr64_init(crypt_ctx, params->key);
+        crypt_ctx->set_blocksize(crypt_ctx->priv, params->blocksize);
+    }
+}
+
+/* check the first decrypted bytes for a known file type */
+static int io_decrypt_check_magic(uint8_t *buffer, uint32_t length, const char **type_name)
+{
+    if(length >= 4 && !memcmp(buffer, jpg_magic, 4))
+    {
+        *type_name = "JPEG (decrypted)";
+        return 1;
+    }
+    else if(length >= 4 && !memcmp(buffer, cr2_magic, 4))
+    {
+        *type_name = "CR2 (decrypted)";
+        return 1;
     }
     
-    /* setup cipher with that hash */
+    *type_name = "unknown. invalid key?";
+    return 0;
+}
+
+/* sequential decryption through stdio, for systems without mmap or when mapping fails.
+   returns -3 if the decrypted data is no known file type (wrong key), without creating the output. */
+static int io_decrypt_stream(FILE *in_file, const char *in_filename, const char *out_filename, io_decrypt_params_t *params, int verbose)
+{
+    crypt_cipher_t crypt_ctx;
     uint32_t first = 1;
+    uint32_t file_offset = 0;
     FILE *out_file = NULL;
+    uint8_t *buffer = malloc(BLOCKSIZE);
     
+    if(!buffer)
+    {
+        return -1;
+    }
     
-    uint32_t file_offset = 0;
-    
+    io_decrypt_init_cipher(&crypt_ctx, params);
+    fseek(in_file, params->data_offset, SEEK_SET);
     
     while(!feof(in_file))
     {
@@ -389,33 +343,32 @@ int main(int argc, char *argv[])
         
         if(ret > 0)
         {
-            crypt_ctx.decrypt(crypt_ctx.priv, (uint8_t *)buffer, (uint8_t *)buffer, ret, file_offset);
+            crypt_ctx.decrypt(crypt_ctx.priv, buffer, buffer, ret, file_offset);
             
-            /* try to detect file type */
             if(first)
             {
+                const char *type_name = NULL;
+                
                 first = 0;
                 
-                if(!memcmp(buffer, jpg_magic, 4))
+                if(!io_decrypt_check_magic(buffer, ret, &type_name))
                 {
-                    printf("File type: JPEG (decrypted)\n");
+                    crypt_ctx.deinit(crypt_ctx.priv);
+                    free(buffer);
+                    return -3;
                 }
-                else if(!memcmp(buffer, cr2_magic, 4))
-                {
-                    printf("File type: CR2 (decrypted)\n");
-                }
-                else
+                
+                if(verbose)
                 {
-                    printf("File type: unknown. invalid key?\n");
-                    fclose(in_file);
-                    free(out_filename);
-                    return 0;
+                    printf("File type: %s\n", type_name);
                 }
                 
-                out_file = fopen(out_filename, "w");
+                out_file = fopen(out_filename, "wb");
                 if(!out_file)
                 {
                     printf("Could not open '%s'\n", out_filename);
+                    crypt_ctx.deinit(crypt_ctx.priv);
+                    free(buffer);
                     return -1;
                 }
             }
@@ -430,8 +383,557 @@ int main(int argc, char *argv[])
         }
     }
     
-    fclose(in_file);
+    if(out_file)
+    {
+        fclose(out_file);
+    }
+    crypt_ctx.deinit(crypt_ctx.priv);
+    free(buffer);
+    return 0;
+}
+
+#if !defined(_WIN32)
+
+/* one slice of a mapped file, processed by one worker thread */
+typedef struct
+{
+    io_decrypt_params_t *params;
+    uint8_t *src;
+    uint8_t *dst;
+    uint32_t offset;
+    uint32_t length;
+} io_decrypt_slice_t;
+
+static void *io_decrypt_slice_thread(void *arg)
+{
+    io_decrypt_slice_t *slice = (io_decrypt_slice_t *)arg;
+    crypt_cipher_t crypt_ctx;
+    uint32_t done = 0;
+    
+    /* every thread has its own cipher context, the LFSR64 one keeps per-block key state */
+    io_decrypt_init_cipher(&crypt_ctx, slice->params);
+    
+    /* go in BLOCKSIZE steps, so XTEA (which copies first, then decrypts in place) stays cache friendly */
+    while(done < slice->length)
+    {
+        uint32_t length = slice->length - done;
+        
+        if(length > BLOCKSIZE)
+        {
+            length = BLOCKSIZE;
+        }
+        
+        crypt_ctx.decrypt(crypt_ctx.priv, slice->dst + done, slice->src + done, length, slice->offset + done);
+        done += length;
+    }
+    
+    crypt_ctx.deinit(crypt_ctx.priv);
+    return NULL;
+}
+
+/* decrypt with both files memory mapped, the payload is split into block aligned slices
+   that are processed in parallel. returns 1 if mapping failed and the caller should fall back to stdio,
+   -3 like io_decrypt_stream if the key check fails. */
+static int io_decrypt_mapped(FILE *in_file, const char *in_filename, const char *out_filename, io_decrypt_params_t *params, int threads, int verbose)
+{
+    struct stat st;
+    int in_fd = fileno(in_file);
+    
+    if(fstat(in_fd, &st) || (uint64_t)st.st_size > 0xFFFFFFFFULL || st.st_size <= params->data_offset)
+    {
+        return 1;
+    }
+    
+    uint32_t file_size = st.st_size;
+    uint32_t data_size = file_size - params->data_offset;
+    
+    uint8_t *in_map = mmap(NULL, file_size, PROT_READ, MAP_SHARED, in_fd, 0);
+    if(in_map == MAP_FAILED)
+    {
+        return 1;
+    }
+    madvise(in_map, file_size, MADV_SEQUENTIAL);
+    uint8_t *src = in_map + params->data_offset;
+    
+    /* decrypt the first bytes on their own to validate the key before creating the output */
+    crypt_cipher_t crypt_ctx;
+    uint8_t first[8];
+    uint32_t first_length = (data_size < sizeof(first)) ? data_size : sizeof(first);
+    const char *type_name = NULL;
+    
+    io_decrypt_init_cipher(&crypt_ctx, params);
+    crypt_ctx.decrypt(crypt_ctx.priv, first, src, first_length, 0);
+    crypt_ctx.deinit(crypt_ctx.priv);
+    
+    if(!io_decrypt_check_magic(first, first_length, &type_name))
+    {
+        munmap(in_map, file_size);
+        return -3;
+    }
+    
+    if(verbose)
+    {
+        printf("File type: %s\n", type_name);
+    }
+    
+    int out_fd = open(out_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(out_fd < 0)
+    {
+        printf("Could not open '%s'\n", out_filename);
+        munmap(in_map, file_size);
+        return -1;
+    }
+    
+    if(ftruncate(out_fd, data_size))
+    {
+        close(out_fd);
+        munmap(in_map, file_size);
+        return 1;
+    }
+    
+    uint8_t *dst = mmap(NULL, data_size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+    if(dst == MAP_FAILED)
+    {
+        close(out_fd);
+        munmap(in_map, file_size);
+        return 1;
+    }
+    
+    /* slices start at cipher block boundaries (LFSR64 key blocks, 8 byte XTEA counters),
+       so no two threads ever need the same key */
+    uint32_t align = (params->cipher == CIPHER_LFSR64) ? params->blocksize : 8;
+    uint32_t slice_size = (data_size + threads - 1) / threads;
+    slice_size = ((slice_size + align - 1) / align) * align;
+    
+    /* small files are not worth the thread startup */
+    if(slice_size < 1024 * 1024)
+    {
+        slice_size = data_size;
+    }
+    
+    pthread_t tids[MAX_THREADS];
+    io_decrypt_slice_t slices[MAX_THREADS];
+    int started = 0;
+    
+    for(uint32_t offset = 0; offset < data_size && started < MAX_THREADS; offset += slice_size)
+    {
+        io_decrypt_slice_t *slice = &slices[started];
+        
+        slice->params = params;
+        slice->src = src + offset;
+        slice->dst = dst + offset;
+        slice->offset = offset;
+        slice->length = (data_size - offset < slice_size) ? data_size - offset : slice_size;
+        
+        /* the last slice runs in this thread */
+        if(offset + slice->length >= data_size)
+        {
+            io_decrypt_slice_thread(slice);
+            break;
+        }
+        
+        if(pthread_create(&tids[started], NULL, io_decrypt_slice_thread, slice))
+        {
+            io_decrypt_slice_thread(slice);
+            continue;
+        }
+        started++;
+    }
+    
+    for(int thread = 0; thread < started; thread++)
+    {
+        pthread_join(tids[thread], NULL);
+    }
+    
+    munmap(dst, data_size);
+    close(out_fd);
+    munmap(in_map, file_size);
+    return 0;
+}
+
+#endif
+
+/* copy a plain file unchanged */
+static int io_decrypt_copy(FILE *in_file, const char *in_filename, const char *out_filename)
+{
+    uint8_t *buffer = malloc(BLOCKSIZE);
+    FILE *out_file = NULL;
+    int ret = 0;
+    
+    if(!buffer)
+    {
+        return -1;
+    }
+    
+    out_file = fopen(out_filename, "wb");
+    if(!out_file)
+    {
+        printf("Could not open '%s'\n", out_filename);
+        free(buffer);
+        return -1;
+    }
+    
+    fseek(in_file, 0, SEEK_SET);
+    
+    while(1)
+    {
+        size_t read = fread(buffer, 1, BLOCKSIZE, in_file);
+        
+        if(read && fwrite(buffer, 1, read, out_file) != read)
+        {
+            printf("Could not write '%s'\n", out_filename);
+            ret = -1;
+            break;
+        }
+        if(read < BLOCKSIZE)
+        {
+            if(ferror(in_file))
+            {
+                printf("Could not read '%s'\n", in_filename);
+                ret = -1;
+            }
+            break;
+        }
+    }
+    
     fclose(out_file);
-    free(out_filename);
+    free(buffer);
+    return ret;
+}
+
+/* decrypt a single file. threads > 1 splits the payload among several threads.
+   plain files are copied to out_filename if copy_plain is set, else ignored.
+   so are files with an unknown header that don't decrypt to a known type. */
+static int io_decrypt_file(const char *in_filename, const char *out_filename, uint64_t key, int threads, int verbose, int copy_plain)
+{
+    io_decrypt_params_t params;
+    
+    FILE *in_file = fopen(in_filename, "rb");
+    if(!in_file)
+    {
+        printf("Could not open '%s'\n", in_filename);
+        return -1;
+    }
+    
+    int ret = io_decrypt_read_header(in_file, in_filename, key, &params);
+    int unknown = (ret == 2);
+    
+    if(verbose || ret == 1)
+    {
+        printf("%s%sFile type: %s\n", verbose ? "" : in_filename, verbose ? "" : ": ", params.type_name);
+    }
+    if(ret == 1 && copy_plain)
+    {
+        ret = io_decrypt_copy(in_file, in_filename, out_filename);
+        fclose(in_file);
+        return ret;
+    }
+    if(unknown && !key && !copy_plain)
+    {
+        printf("Error: Please specify a password\n");
+        ret = -2;
+    }
+    if(ret == 1 || ret < 0)
+    {
+        fclose(in_file);
+        return (ret == 1) ? 0 : ret;
+    }
+    
+    if(unknown && !key)
+    {
+        /* nothing to try, it gets copied below */
+        ret = -3;
+    }
+    else
+    {
+        ret = 1;
+#if !defined(_WIN32)
+        ret = io_decrypt_mapped(in_file, in_filename, out_filename, &params, threads, verbose);
+#endif
+        if(ret == 1)
+        {
+            ret = io_decrypt_stream(in_file, in_filename, out_filename, &params, verbose);
+        }
+    }
+    
+    if(ret == -3 && unknown && copy_plain)
+    {
+        /* not encrypted by io_crypt, e.g. a .CTG or .MOV file */
+        printf("%s: File type: unknown. copied unchanged\n", in_filename);
+        ret = io_decrypt_copy(in_file, in_filename, out_filename);
+    }
+    else if(ret == -3)
+    {
+        printf("%s: File type: unknown. invalid key?\n", in_filename);
+    }
+    
+    fclose(in_file);
+    return ret;
+}
+
+/* batch mode: list of files found in a directory tree */
+typedef struct
+{
+    char **in_names;
+    char **out_names;
+    uint32_t count;
+    uint32_t allocated;
+    uint32_t next;
+    uint64_t key;
+    int failed;
+    pthread_mutex_t lock;
+} io_decrypt_batch_t;
+
+static int io_decrypt_mkdir(const char *path)
+{
+#if defined(_WIN32)
+    int ret = mkdir(path);
+#else
+    int ret = mkdir(path, 0755);
+#endif
+    
+    struct stat st;
+    return (ret && (stat(path, &st) || !S_ISDIR(st.st_mode))) ? -1 : 0;
+}
+
+static int io_decrypt_scan(io_decrypt_batch_t *batch, const char *in_dir, const char *out_dir)
+{
+    DIR *dir = opendir(in_dir);
+    struct dirent *entry;
+    
+    if(!dir)
+    {
+        printf("Could not open directory '%s'\n", in_dir);
+        return -1;
+    }
+    
+    if(io_decrypt_mkdir(out_dir))
+    {
+        printf("Could not create directory '%s'\n", out_dir);
+        closedir(dir);
+        return -1;
+    }
+    
+    while((entry = readdir(dir)) != NULL)
+    {
+        struct stat st;
+        
+        if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+        {
+            continue;
+        }
+        
+        char *in_name = malloc(strlen(in_dir) + strlen(entry->d_name) + 2);
+        char *out_name = malloc(strlen(out_dir) + strlen(entry->d_name) + 2);
+        
+        sprintf(in_name, "%s/%s", in_dir, entry->d_name);
+        sprintf(out_name, "%s/%s", out_dir, entry->d_name);
+        
+        if(stat(in_name, &st))
+        {
+            free(in_name);
+            free(out_name);
+            continue;
+        }
+        
+        if(S_ISDIR(st.st_mode))
+        {
+            io_decrypt_scan(batch, in_name, out_name);
+            free(in_name);
+            free(out_name);
+            continue;
+        }
+        
+        if(batch->count == batch->allocated)
+        {
+            batch->allocated = batch->allocated ? batch->allocated * 2 : 64;
+            batch->in_names = realloc(batch->in_names, batch->allocated * sizeof(char *));
+            batch->out_names = realloc(batch->out_names, batch->allocated * sizeof(char *));
+        }
+        
+        batch->in_names[batch->count] = in_name;
+        batch->out_names[batch->count] = out_name;
+        batch->count++;
+    }
+    
+    closedir(dir);
+    return 0;
+}
+
+static void *io_decrypt_batch_thread(void *arg)
+{
+    io_decrypt_batch_t *batch = (io_decrypt_batch_t *)arg;
+    
+    while(1)
+    {
+        pthread_mutex_lock(&batch->lock);
+        uint32_t file = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+        
+        if(file >= batch->count)
+        {
+            break;
+        }
+        
+        /* there is already one file per thread, no need to split files any further;
+           plain files are copied, so the output tree is complete */
+        int ret = io_decrypt_file(batch->in_names[file], batch->out_names[file], batch->key, 1, 0, 1);
+        
+        pthread_mutex_lock(&io_decrypt_print_lock);
+        printf("[%d/%d] %s%s\n", file + 1, batch->count, batch->in_names[file], ret ? " FAILED" : "");
+        pthread_mutex_unlock(&io_decrypt_print_lock);
+        
+        if(ret)
+        {
+            pthread_mutex_lock(&batch->lock);
+            batch->failed++;
+            pthread_mutex_unlock(&batch->lock);
+        }
+    }
+    
+    return NULL;
+}
+
+/* decrypt every file below in_dir into the same structure below out_dir */
+static int io_decrypt_batch(const char *in_dir, const char *out_dir, uint64_t key, int threads)
+{
+    io_decrypt_batch_t batch;
+    pthread_t tids[MAX_THREADS];
+    int started = 0;
+    
+    memset(&batch, 0x00, sizeof(batch));
+    batch.key = key;
+    pthread_mutex_init(&batch.lock, NULL);
+    
+    if(io_decrypt_scan(&batch, in_dir, out_dir))
+    {
+        return -1;
+    }
+    
+    printf("Decrypting %d files using %d threads\n", batch.count, threads);
+    
+    for(int thread = 1; thread < threads; thread++)
+    {
+        if(pthread_create(&tids[started], NULL, io_decrypt_batch_thread, &batch))
+        {
+            break;
+        }
+        started++;
+    }
+    
+    io_decrypt_batch_thread(&batch);
+    
+    for(int thread = 0; thread < started; thread++)
+    {
+        pthread_join(tids[thread], NULL);
+    }
+    
+    for(uint32_t file = 0; file < batch.count; file++)
+    {
+        free(batch.in_names[file]);
+        free(batch.out_names[file]);
+    }
+    free(batch.in_names);
+    free(batch.out_names);
+    pthread_mutex_destroy(&batch.lock);
+    
+    if(batch.failed)
+    {
+        printf("%d files failed\n", batch.failed);
+        return -1;
+    }
+    
     return 0;
 }
+
+static void show_usage(char *executable)
+{
+    printf("Usage: '%s [-j threads] <infile> [outfile] [password]\n", executable);
+    printf("       '%s [-j threads] -r <indir> [outdir] [password]\n", executable);
+    printf("\n");
+    printf("  -j threads  number of threads (default: number of CPUs)\n");
+    printf("  -r          decrypt all files below <indir> (e.g. a DCIM folder) into <outdir>,\n");
+    printf("              plain (not encrypted) and unknown files are copied unchanged\n");
+    printf("\n");
+    printf("Exits with a nonzero status if a file could not be decrypted (e.g. wrong password).\n");
+}
+
+int main(int argc, char *argv[])
+{
+    //io_decrypt_test();
+    //crypt_rsa_test();
+    
+    uint64_t key = 0;
+    int threads = 1;
+    int recursive = 0;
+    int opt = 0;
+    
+#if defined(_SC_NPROCESSORS_ONLN)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    
+    while((opt = getopt(argc, argv, "j:r")) != -1)
+    {
+        switch(opt)
+        {
+            case 'j':
+                threads = atoi(optarg);
+                break;
+                
+            case 'r':
+                recursive = 1;
+                break;
+                
+            default:
+                show_usage(argv[0]);
+                return -1;
+        }
+    }
+    
+    if(threads < 1)
+    {
+        threads = 1;
+    }
+    if(threads > MAX_THREADS)
+    {
+        threads = MAX_THREADS;
+    }
+    
+    if(argc - optind < 1)
+    {
+        show_usage(argv[0]);
+        return -1;
+    }
+    
+    char *in_filename = argv[optind];
+    char *out_filename = malloc(strlen(in_filename) + 9);
+    
+    sprintf(out_filename, "%s%s", in_filename, recursive ? "_out" : "_out.cr2");
+    
+    if(argc - optind >= 2)
+    {
+        free(out_filename);
+        out_filename = strdup(argv[optind + 1]);
+    }
+    
+    /* password is optional */
+    if(argc - optind >= 3)
+    {
+        /* hash the password */
+        hash_password(argv[optind + 2], &key);
+    }
+    
+    int ret = 0;
+    
+    if(recursive)
+    {
+        ret = io_decrypt_batch(in_filename, out_filename, key, threads);
+    }
+    else
+    {
+        ret = io_decrypt_file(in_filename, out_filename, key, threads, 1, 0);
+    }
+    
+    free(out_filename);
+    return ret;
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* host benchmark for the RSA code used by io_crypt:
+     - key generation, as done by "Generate RSA key" in the menu
+     - per-file setup, i.e. encrypting a file key with the public key (iocrypt_asym_init)
+       and decrypting it again with the private key (io_decrypt)
+
+   rsa_bench is built from the current sources, rsa_bench_ref with the previous
+   modexp and trial division code (-DIOCRYPT_RSA_REFERENCE -DNO_MONTGOMERY).
+   The RNG is seeded with a constant, so both generate the same keys:
+
+     make -f Makefile.io_decrypt rsa_bench rsa_bench_ref
+     ./rsa_bench_ref 1024 2048 && ./rsa_bench 1024 2048
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "io_crypt.h"
+#include "crypt_rsa.h"
+
+/* from crypt_rsa.c */
+int crypt_rsa_generate(int nbits, t_crypt_key *priv_key, t_crypt_key *pub_key, uint32_t *progress);
+unsigned int crypt_rsa_crypt(uint8_t *dst, uint8_t *src, int length, t_crypt_key *key);
+
+uint32_t iocrypt_trace_ctx = 0;
+
+/* same RNG as on the camera and in io_decrypt */
+static uint32_t lfsr113[] = { 0x00009821, 0x00098722, 0x00986332, 0x961FEFA7 };
+
+void rand_fill(uint32_t *buffer, uint32_t length)
+{
+    for(uint32_t pos = 0; pos < length; pos++)
+    {
+        lfsr113[0] = ((lfsr113[0] & 0xFFFFFFFE) << 18) ^ (((lfsr113[0] <<  6) ^ lfsr113[0]) >> 13);
+        lfsr113[1] = ((lfsr113[1] & 0xFFFFFFF8) <<  2) ^ (((lfsr113[1] <<  2) ^ lfsr113[1]) >> 27);
+        lfsr113[2] = ((lfsr113[2] & 0xFFFFFFF0) <<  7) ^ (((lfsr113[2] << 13) ^ lfsr113[2]) >> 21);
+        lfsr113[3] = ((lfsr113[3] & 0xFFFFFF80) << 13) ^ (((lfsr113[3] <<  3) ^ lfsr113[3]) >> 12);
+
+        buffer[pos] = lfsr113[0] ^ lfsr113[1] ^ lfsr113[2] ^ lfsr113[3];
+    }
+}
+
+void rand_seed(uint32_t seed)
+{
+    uint32_t tmp = 0;
+
+    for(int loops = 0; loops < 128; loops++)
+    {
+        lfsr113[loops%4] ^= seed;
+        rand_fill((uint32_t *)&tmp, 1);
+    }
+}
+
+static double get_time()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* short fingerprint of the modulus, to check that both builds generated the same key */
+static uint32_t key_hash(const char *str)
+{
+    uint32_t hash = 2166136261u;
+    while(*str)
+    {
+        hash = (hash ^ (uint8_t)*str++) * 16777619;
+    }
+    return hash;
+}
+
+static int bench_keysize(int nbits, int loops)
+{
+    t_crypt_key priv_key;
+    t_crypt_key pub_key;
+    uint32_t progress = 0;
+
+    rand_seed(0x12341234 + nbits);
+
+    double start = get_time();
+    if(crypt_rsa_generate(nbits, &priv_key, &pub_key, &progress))
+    {
+        printf("%5d bit: key generation failed\n", nbits);
+        return -1;
+    }
+    double keygen = get_time() - start;
+
+    /* per-file setup: a random file key, padded to the RSA block size like iocrypt_asym_init does */
+    uint32_t blocksize = nbits / 8;
+    uint8_t *plain = malloc(blocksize + 8);
+    uint8_t *encrypted = malloc(blocksize * 2 + 8);
+    uint8_t *decrypted = malloc(blocksize * 2 + 8);
+    int failed = 0;
+
+    double enc_time = 0;
+    double dec_time = 0;
+
+    for(int loop = 0; loop < loops; loop++)
+    {
+        memset(plain, 0x00, blocksize);
+        rand_fill((uint32_t *)plain, 2);
+
+        start = get_time();
+        uint32_t enc_len = crypt_rsa_crypt(encrypted, plain, blocksize, &pub_key);
+        enc_time += get_time() - start;
+
+        start = get_time();
+        uint32_t dec_len = crypt_rsa_crypt(decrypted, encrypted, enc_len, &priv_key);
+        dec_time += get_time() - start;
+
+        if(dec_len < 8 || memcmp(decrypted, plain, 8))
+        {
+            failed++;
+        }
+    }
+
+    printf("%5d bit: key 0x%08X, keygen %8.3f s, setup: encrypt %8.3f ms, decrypt %8.3f ms%s\n",
+        nbits, key_hash(pub_key.primefac), keygen, enc_time * 1000 / loops, dec_time * 1000 / loops,
+        failed ? ", ROUND TRIP FAILED" : "");
+
+    free(plain);
+    free(encrypted);
+    free(decrypted);
+
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = 0;
+
+#if defined(IOCRYPT_RSA_REFERENCE)
+    printf("reference build (previous modexp and trial division)\n");
+#else
+    printf("Montgomery modexp, sieved prime search\n");
+#endif
+
+    if(argc < 2)
+    {
+        ret |= bench_keysize(512, 20);
+        ret |= bench_keysize(1024, 10);
+        return ret;
+    }
+
+    for(int arg = 1; arg < argc; arg++)
+    {
+        ret |= bench_keysize(atoi(argv[arg]), 4);
+    }
+
+    return ret;
+}
@@ -36,6 +36,7 @@
 #include <powersave.h>
 #include "lua_common.h"
 #include "umm_malloc/umm_malloc.h"
+#include "umm_malloc/umm_pool.h"
 
 struct lua_script
 {
@@ -61,6 +62,8 @@ struct lua_script
     struct semaphore * sem;
     struct msg_queue * key_mq;
     struct menu_entry * menu_entry;
+    struct umm_pool heap;       /* all allocations of this script's Lua state */
+    size_t heap_peak;           /* from the last run, if no longer running */
     struct lua_script * next;
 };
 
@@ -454,11 +457,13 @@ static const luaL_Reg alllibs[] =
     {"battery", luaopen_battery},
     {"task", luaopen_task},
     {"property", luaopen_property},
+    {"image", luaopen_image},
     {"constants", luaopen_constants},
     {"MODE", luaopen_MODE},
     {"ICON_TYPE", luaopen_ICON_TYPE},
     {"UNIT", luaopen_UNIT},
     {"DEPENDS_ON", luaopen_DEPENDS_ON},
+    {"PROJECTION", luaopen_PROJECTION},
     {"FONT", luaopen_FONT},
     {"COLOR", luaopen_COLOR},
     {"KEY", luaopen_KEY},
@@ -581,9 +586,213 @@ static int pushargs (lua_State *L) {
   return n;
 }
 
-static lua_State * load_lua_state(int argc, char** argv)
+/* bytecode cache: compiled chunks are saved with the size, time stamp and hash of their source,
+ * and loaded from there without parsing as long as the source is unchanged
+ * library chunks are saved with a '_' prefix; scripts starting with '_' are never loaded,
+ * so the names of these can't clash with script names
+ */
+#define LUA_CACHE_DIR SCRIPTS_DIR "/CACHE"
+#define LUA_CACHE_MAGIC 0x4342554C  /* "LUBC" */
+
+struct lua_cache_hdr
+{
+    uint32_t magic;
+    uint32_t src_size;
+    uint32_t src_timestamp;
+    uint32_t src_hash;
+    uint32_t code_size;
+};
+
+struct lua_cache_buf
+{
+    char * data;
+    int size;
+    int allocated;
+};
+
+static int lua_cache_writer(lua_State * L, const void * p, size_t sz, void * ud)
+{
+    struct lua_cache_buf * buf = ud;
+
+    if (buf->size + (int) sz > buf->allocated)
+    {
+        int allocated = MAX(buf->allocated * 2, buf->size + (int) sz + 1024);
+        char * data = realloc(buf->data, allocated);
+        if (!data) return 1;
+        buf->data = data;
+        buf->allocated = allocated;
+    }
+
+    memcpy(buf->data + buf->size, p, sz);
+    buf->size += sz;
+    return 0;
+}
+
+/* FNV-1a */
+static uint32_t lua_source_hash(const char * src, int size)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < size; i++)
+    {
+        hash = (hash ^ (uint8_t) src[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* modification time of dir/filename, from the directory listing (0 if not found) */
+static uint32_t lua_file_timestamp(const char * dir, const char * filename)
+{
+    struct fio_file file;
+    struct fio_dirent * dirent = FIO_FindFirstEx(dir, &file);
+    uint32_t timestamp = 0;
+
+    if (IS_ERROR(dirent))
+    {
+        return 0;
+    }
+
+    do
+    {
+        if (strcasecmp(file.name, filename) == 0)
+        {
+            timestamp = file.timestamp;
+            break;
+        }
+    }
+    while (FIO_FindNextEx(dirent, &file) == 0);
+    FIO_FindClose(dirent);
+
+    return timestamp;
+}
+
+/* dump the function on top of the stack into the cache (header first, so it's written at once)
+ * optionally hands over the bytecode (without header) to code */
+static void lua_cache_store(lua_State * L, const char * cache_path, struct lua_cache_hdr * key, struct lua_cache_buf * code)
+{
+    struct lua_cache_buf buf = { 0 };
+
+    if (lua_cache_writer(L, key, sizeof(struct lua_cache_hdr), &buf) || lua_dump(L, lua_cache_writer, &buf, 0))
+    {
+        free(buf.data);
+        return;
+    }
+
+    struct lua_cache_hdr * hdr = (struct lua_cache_hdr *) buf.data;
+    hdr->code_size = buf.size - sizeof(struct lua_cache_hdr);
+
+    if (!is_dir(LUA_CACHE_DIR))
+    {
+        FIO_CreateDirectory(LUA_CACHE_DIR);
+    }
+
+    FILE * f = FIO_CreateFile(cache_path);
+    if (f)
+    {
+        FIO_WriteFile(f, buf.data, buf.size);
+        FIO_CloseFile(f);
+    }
+
+    if (code)
+    {
+        code->size = hdr->code_size;
+        code->allocated = buf.allocated;
+        memmove(buf.data, buf.data + sizeof(struct lua_cache_hdr), code->size);
+        code->data = buf.data;
+        return;
+    }
+
+    free(buf.data);
+}
+
+/* like luaL_loadfile for dir/filename, but from the bytecode cache if it matches the source
+ * (otherwise the source is compiled and the cache updated)
+ * if code is not NULL, the bytecode is returned there, to load the chunk into other states */
+static int lua_load_cached(lua_State * L, const char * dir, const char * filename, const char * cache_name, struct lua_cache_buf * code)
+{
+    char full_path[MAX_PATH_LEN];
+    char cache_path[MAX_PATH_LEN];
+    char chunk_name[MAX_PATH_LEN + 1];
+    snprintf(full_path, MAX_PATH_LEN, "%s/%s", dir, filename);
+    snprintf(cache_path, MAX_PATH_LEN, LUA_CACHE_DIR "/%s", cache_name);
+    snprintf(chunk_name, sizeof(chunk_name), "@%s", full_path);
+
+    int src_size = 0;
+    char * src = (char *) read_entire_file(full_path, &src_size);
+    if (!src)
+    {
+        lua_pushfstring(L, "cannot open %s", full_path);
+        return LUA_ERRFILE;
+    }
+
+    struct lua_cache_hdr key = {
+        .magic          = LUA_CACHE_MAGIC,
+        .src_size       = src_size,
+        .src_timestamp  = lua_file_timestamp(dir, filename),
+        .src_hash       = lua_source_hash(src, src_size),
+    };
+
+    int status = LUA_ERRFILE;
+    int cache_size = 0;
+    char * cache = (char *) read_entire_file(cache_path, &cache_size);
+    struct lua_cache_hdr * hdr = (struct lua_cache_hdr *) cache;
+
+    if (cache && cache_size > (int) sizeof(struct lua_cache_hdr) &&
+        hdr->magic == key.magic && hdr->src_size == key.src_size &&
+        hdr->src_timestamp == key.src_timestamp && hdr->src_hash == key.src_hash &&
+        hdr->code_size == cache_size - sizeof(struct lua_cache_hdr))
+    {
+        char * bytecode = cache + sizeof(struct lua_cache_hdr);
+        status = luaL_loadbufferx(L, bytecode, hdr->code_size, chunk_name, "b");
+
+        if (status != LUA_OK)
+        {
+            /* e.g. from a different Lua build; compile it again */
+            lua_pop(L, 1);
+        }
+        else if (code && lua_cache_writer(L, bytecode, hdr->code_size, code))
+        {
+            free(code->data);
+            memset(code, 0, sizeof(struct lua_cache_buf));
+        }
+    }
+
+    if (cache)
+    {
+        fio_free(cache);
+    }
+
+    if (status != LUA_OK)
+    {
+        status = luaL_loadbufferx(L, src, src_size, chunk_name, NULL);
+        if (status == LUA_OK)
+        {
+            lua_cache_store(L, cache_path, &key, code);
+        }
+    }
+
+    fio_free(src);
+    return status;
+}
+
+/* lua_Alloc for the script heaps; calls are serialized by the script semaphore */
+static void * lua_heap_alloc(void * ud, void * ptr, size_t osize, size_t nsize)
 {
-    lua_State* L = luaL_newstate();
+    /* without a block, osize is the type of the object to be created */
+    return umm_pool_realloc((struct umm_pool *) ud, ptr, ptr ? osize : 0, nsize);
+}
+
+/* the one from lauxlib is static */
+static int lua_heap_panic(lua_State * L)
+{
+    fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(L, -1));
+    return 0;
+}
+
+static lua_State * load_lua_state(struct umm_pool * heap, int argc, char** argv)
+{
+    lua_State* L = lua_newstate(lua_heap_alloc, heap);
+    if (!L) return NULL;
+    lua_atpanic(L, lua_heap_panic);
     luaL_requiref(L, "_G", luaopen_base, 1);
     luaL_requiref(L, LUA_LOADLIBNAME, luaopen_package, 1);
     luaL_requiref(L, "globals", luaopen_globals, 0);
@@ -605,25 +814,32 @@ static lua_State * load_lua_state(int argc, char** argv)
     lua_setmetatable(L, -2);
     lua_pop(L, 1);
     
-    /* preload strict.lua once, since it will be used in all scripts */
-    int bufsize;
-    static char * strict_lua = (void*) 0xFFFFFFFF;
-    if (strict_lua == (void*) 0xFFFFFFFF)
+    /* compile strict.lua once, since it will be used in all scripts;
+     * the other states load its bytecode, without parsing it again */
+    static struct lua_cache_buf strict_code = { 0 };
+    static int strict_loaded = 0;
+    if (!strict_loaded)
     {
-        strict_lua = (char*) read_entire_file(SCRIPTS_DIR "/lib/strict.lua", &bufsize);
-        
-        if (!strict_lua)
+        int status = lua_load_cached(L, SCRIPTS_DIR "/lib", "strict.lua", "_STRICT.LBC", &strict_code);
+
+        if (status == LUA_ERRFILE)
         {
             /* allow scripts to run without strict.lua, if not present */
             printf("[Lua] warning: strict.lua not found.\n");
         }
+        else if (status != LUA_OK)
+        {
+            fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        }
+        lua_pop(L, 1);
+        strict_loaded = 1;
         
-        /* note: strict_lua is never freed */
+        /* note: strict_code is never freed */
     }
     
-    if (strict_lua)
+    if (strict_code.data)
     {
-        if (luaL_loadstring(L, strict_lua) || docall(L, 0, LUA_MULTRET))
+        if (luaL_loadbufferx(L, strict_code.data, strict_code.size, "@" SCRIPTS_DIR "/lib/strict.lua", "b") || docall(L, 0, LUA_MULTRET))
         {
             fprintf(stderr, "%s\n", lua_tostring(L, -1));
         }
@@ -767,7 +983,16 @@ static void load_script(struct lua_script * script)
 
     script->load_time = get_seconds_clock();
     script->state = SCRIPT_STATE_LOADING_OR_RUNNING;
-    lua_State* L = script->L = load_lua_state(script->argc, script->argv);
+    lua_State* L = script->L = load_lua_state(&script->heap, script->argc, script->argv);
+    if (!L)
+    {
+        fprintf(stderr, "[%s] not enough memory.\n", script->filename);
+        umm_pool_release(&script->heap);
+        script->state = SCRIPT_STATE_NOT_RUNNING;
+        script->load_time = 0;
+        powersave_permit();
+        return;
+    }
     script->cant_unload = 0;
     script->cant_yield = 0;
     script->tasks_started = 0;
@@ -787,11 +1012,13 @@ static void load_script(struct lua_script * script)
         ASSERT(script->key_mq);
     }
     
-    char full_path[MAX_PATH_LEN];
-    snprintf(full_path, MAX_PATH_LEN, SCRIPTS_DIR "/%s", script->filename);
+    /* same name as the script, in the bytecode cache */
+    char cache_name[MAX_PATH_LEN];
+    snprintf(cache_name, MAX_PATH_LEN, "%s", script->filename);
+    memcpy(&cache_name[strlen(cache_name) - 3], "LBC", 3);
     printf("[%s] script starting.\n", script->filename);
 
-    int status = luaL_loadfile(L, full_path);
+    int status = lua_load_cached(L, SCRIPTS_DIR, script->filename, cache_name, NULL);
     if (status == LUA_OK) {
         int n = pushargs(L);  /* push arguments to script */
         status = docall(L, n, LUA_MULTRET);
@@ -845,7 +1072,11 @@ static void load_script(struct lua_script * script)
         /* unregister the config_save event, if any */
         set_event_script_entry(&config_save_cbr_scripts, L, LUA_NOREF);
 
+        /* the whole heap is returned at once, after closing the state */
+        umm_pool_close(&script->heap);
         lua_close(L);
+        script->heap_peak = script->heap.peak;
+        umm_pool_release(&script->heap);
         script->L = NULL;
         script->menu_entry->icon_type = IT_ACTION;
         script->state = SCRIPT_STATE_NOT_RUNNING;
@@ -1052,6 +1283,30 @@ static MENU_SELECT_FUNC(lua_script_edit)
     }
 }
 
+static MENU_UPDATE_FUNC(lua_script_memory_update)
+{
+    struct lua_script * script = (struct lua_script *)(entry->priv);
+    if (!script) return;
+
+    if (script->L)
+    {
+        /* format_memory_size uses a static buffer */
+        MENU_SET_VALUE("%s", format_memory_size(script->heap.used));
+        MENU_APPEND_VALUE(", peak %s", format_memory_size(script->heap.peak));
+        MENU_SET_RINFO("%s", format_memory_size(script->heap.reserved));
+        MENU_SET_HELP("Lua objects in use, peak, and memory reserved (right).");
+    }
+    else if (script->heap_peak)
+    {
+        MENU_SET_VALUE("peak %s", format_memory_size(script->heap_peak));
+        MENU_SET_HELP("Peak memory usage during the last run.");
+    }
+    else
+    {
+        MENU_SET_VALUE("N/A");
+    }
+}
+
 static MENU_UPDATE_FUNC(menu_no_value)
 {
     MENU_SET_VALUE("");
@@ -1084,6 +1339,12 @@ static struct menu_entry script_submenu_template[] = {
         .max        = 1,
         .help       = "Select whether this script will be loaded at camera startup."
     },
+    {
+        .name       = "Memory",
+        .update     = lua_script_memory_update,
+        .icon_type  = IT_ALWAYS_ON,
+        .help       = "[READ-ONLY] Memory used by this script."
+    },
     MENU_EOL,
 };
 
@@ -1230,6 +1491,7 @@ static void add_script(const char * filename)
     new_script->menu_entry->children[0].priv = new_script;
     new_script->menu_entry->children[1].priv = new_script;
     new_script->menu_entry->children[2].priv = &new_script->autorun;
+    new_script->menu_entry->children[3].priv = new_script;
     menu_add("Scripts", new_script->menu_entry, 1);
     return;
 
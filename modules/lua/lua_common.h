@@ -133,11 +133,13 @@ int luaopen_battery(lua_State * L);
 int luaopen_task(lua_State * L);
 int luaopen_property(lua_State *L);
 int luaopen_constants(lua_State *L);
+int luaopen_image(lua_State * L);
 
 int luaopen_MODE(lua_State * L);
 int luaopen_ICON_TYPE(lua_State * L);
 int luaopen_UNIT(lua_State * L);
 int luaopen_DEPENDS_ON(lua_State * L);
+int luaopen_PROJECTION(lua_State * L);
 int luaopen_FONT(lua_State * L);
 int luaopen_COLOR(lua_State * L);
 int luaopen_KEY(lua_State * L);
@@ -13,6 +13,7 @@
 #include <bmp.h>
 #include <menu.h>
 #include <property.h>
+#include <raw.h>
 
 #include "lua_common.h"
 
@@ -311,6 +312,35 @@ int luaopen_UNIT(lua_State * L)
     return 1;
 }
 
+/// How to get a gray value from the RGB pixels, for raw image analysis (@{image})
+///
+/// For dual ISO images, the dark exposure is analyzed by default;
+/// add BRIGHT_ONLY (or DARK_AND_BRIGHT) to one of the others to change that.
+// @field RED
+// @field GREEN
+// @field BLUE
+// @field AVERAGE_RGB
+// @field MAX_RGB
+// @field MAX_RB
+// @field MEDIAN_RGB
+// @field BRIGHT_ONLY
+// @field DARK_AND_BRIGHT
+// @table PROJECTION
+int luaopen_PROJECTION(lua_State * L)
+{
+    lua_newtable(L);
+    LUA_CONSTANT(RED, GRAY_PROJECTION_RED);
+    LUA_CONSTANT(GREEN, GRAY_PROJECTION_GREEN);
+    LUA_CONSTANT(BLUE, GRAY_PROJECTION_BLUE);
+    LUA_CONSTANT(AVERAGE_RGB, GRAY_PROJECTION_AVERAGE_RGB);
+    LUA_CONSTANT(MAX_RGB, GRAY_PROJECTION_MAX_RGB);
+    LUA_CONSTANT(MAX_RB, GRAY_PROJECTION_MAX_RB);
+    LUA_CONSTANT(MEDIAN_RGB, GRAY_PROJECTION_MEDIAN_RGB);
+    LUA_CONSTANT(BRIGHT_ONLY, GRAY_PROJECTION_BRIGHT_ONLY);
+    LUA_CONSTANT(DARK_AND_BRIGHT, GRAY_PROJECTION_DARK_AND_BRIGHT);
+    return 1;
+}
+
 /// Dependency for a menu item
 // @field GLOBAL_DRAW
 // @field LIVEVIEW
@@ -404,6 +434,7 @@ int luaopen_constants(lua_State *L)
     luaL_requiref(L, "ICON_TYPE", luaopen_ICON_TYPE, 1);
     luaL_requiref(L, "UNIT", luaopen_UNIT, 1);
     luaL_requiref(L, "DEPENDS_ON", luaopen_DEPENDS_ON, 1);
+    luaL_requiref(L, "PROJECTION", luaopen_PROJECTION, 1);
     
     //just return true
     lua_pushboolean(L, 1);
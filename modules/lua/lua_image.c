@@ -0,0 +1,529 @@
+/***
+ Image analysis functions
+
+ Statistics, histograms, percentiles, motion and focus scores
+ for a rectangle of the raw or YUV image, computed in one call.
+
+ Rectangles are given in BMP (@{display}) coordinates: x, y, width, height.
+ They are clipped to the image area; without a rectangle, the entire image
+ area is analyzed. Large rectangles are subsampled, so a call never looks
+ at more than about 64K pixels.
+
+ The raw functions need raw data: in LiveView, raw video is enabled
+ on the fly while computing; outside LiveView, the last picture is used
+ (during image review).
+
+ @author Magic Lantern Team
+ @copyright 2014
+ @license GPL
+ @module image
+ */
+
+#include <dryos.h>
+#include <string.h>
+#include <math.h>
+#include <bmp.h>
+#include <raw.h>
+#include <vram.h>
+#include <propvalues.h>
+
+#include "lua_common.h"
+
+/** Some cameras do not have raw liveview **/
+extern WEAK_FUNC(ret_0) void raw_lv_request();
+extern WEAK_FUNC(ret_0) void raw_lv_release();
+
+/* in vram.c */
+void* get_lcd_422_buf();
+
+#define IMAGE_MAX_SAMPLES 65536
+
+struct image_rect
+{
+    int x1, y1;     /* BMP coordinates */
+    int x2, y2;     /* exclusive */
+    int step;       /* subsampling */
+};
+
+/* optional x, y, w, h at index */
+static void image_get_rect(lua_State * L, int index, struct image_rect * rect)
+{
+    LUA_PARAM_INT_OPTIONAL(x, index, os.x0);
+    LUA_PARAM_INT_OPTIONAL(y, index + 1, os.y0);
+    LUA_PARAM_INT_OPTIONAL(w, index + 2, os.x_max - x);
+    LUA_PARAM_INT_OPTIONAL(h, index + 3, os.y_max - y);
+
+    rect->x1 = MAX(x, os.x0);
+    rect->y1 = MAX(y, os.y0);
+    rect->x2 = MIN(x + w, os.x_max);
+    rect->y2 = MIN(y + h, os.y_max);
+
+    if (rect->x2 <= rect->x1 || rect->y2 <= rect->y1)
+    {
+        luaL_error(L, "rectangle outside the image area");
+    }
+
+    rect->step = 1;
+    while (((rect->x2 - rect->x1 + rect->step - 1) / rect->step) *
+           ((rect->y2 - rect->y1 + rect->step - 1) / rect->step) > IMAGE_MAX_SAMPLES)
+    {
+        rect->step++;
+    }
+}
+
+/* 16384-bin histogram of raw levels (as seen by the gray projection); caller frees it */
+static uint32_t * image_raw_histogram(struct image_rect * rect, int gray_projection, int * samples)
+{
+    uint32_t * hist = malloc(16384 * sizeof(hist[0]));
+    if (!hist) return NULL;
+    memset(hist, 0, 16384 * sizeof(hist[0]));
+
+    int requested = lv;
+    if (requested) raw_lv_request();
+
+    if (!raw_update_params())
+    {
+        if (requested) raw_lv_release();
+        free(hist);
+        return NULL;
+    }
+
+    /* for BM2RAW */
+    get_yuv422_vram();
+
+    int n = 0;
+    for (int y = rect->y1; y < rect->y2; y += rect->step)
+    {
+        int ry = BM2RAW_Y(y);
+        for (int x = rect->x1; x < rect->x2; x += rect->step)
+        {
+            int px = raw_get_gray_pixel(BM2RAW_X(x), ry, gray_projection);
+            hist[px & 16383]++;
+            n++;
+        }
+    }
+
+    if (requested) raw_lv_release();
+
+    *samples = n;
+    return hist;
+}
+
+/* lowest level that has at least this percentage of the samples at or below it */
+static int image_percentile(uint32_t * hist, int levels, int samples, float percentile)
+{
+    uint64_t thr = MAX((uint64_t)(samples * COERCE(percentile, 0, 100) / 100), 1);
+    uint64_t n = 0;
+
+    for (int i = 0; i < levels; i++)
+    {
+        n += hist[i];
+        if (n >= thr) return i;
+    }
+    return levels - 1;
+}
+
+/* pushes a table with the common statistics; returns the mean */
+static float image_push_stats(lua_State * L, uint32_t * hist, int levels, int samples)
+{
+    uint64_t sum = 0, sum2 = 0;
+    int min = -1, max = 0;
+
+    for (int i = 0; i < levels; i++)
+    {
+        if (!hist[i]) continue;
+        if (min < 0) min = i;
+        max = i;
+        sum += (uint64_t) hist[i] * i;
+        sum2 += (uint64_t) hist[i] * i * i;
+    }
+
+    float mean = (float) sum / samples;
+    float var = (float) sum2 / samples - mean * mean;
+
+    lua_newtable(L);
+    lua_pushnumber(L, mean);
+    lua_setfield(L, -2, "mean");
+    lua_pushnumber(L, var > 0 ? sqrtf(var) : 0);
+    lua_setfield(L, -2, "stdev");
+    lua_pushinteger(L, min);
+    lua_setfield(L, -2, "min");
+    lua_pushinteger(L, max);
+    lua_setfield(L, -2, "max");
+    lua_pushinteger(L, image_percentile(hist, levels, samples, 50));
+    lua_setfield(L, -2, "median");
+    lua_pushinteger(L, samples);
+    lua_setfield(L, -2, "samples");
+    return mean;
+}
+
+static int image_param_projection(lua_State * L, int index)
+{
+    LUA_PARAM_INT_OPTIONAL(gray_projection, index, GRAY_PROJECTION_GREEN);
+    return gray_projection;
+}
+
+/***
+ Get statistics of the raw image.
+
+ Returns a table with the fields `mean`, `stdev`, `min`, `max`, `median` (raw levels),
+ `ev` (mean, in EV below the white level), `overexposed` (percentage of samples at the white level),
+ `black` and `white` (levels) and `samples` (number of pixels analyzed).
+ @tparam[opt] int x
+ @tparam[opt] int y
+ @tparam[opt] int w
+ @tparam[opt] int h
+ @tparam[opt] int projection how to get a gray value from the RGB pixels (@{PROJECTION}); default: green
+ @treturn table
+ @function raw_stats
+ */
+static int luaCB_image_raw_stats(lua_State * L)
+{
+    struct image_rect rect;
+    image_get_rect(L, 1, &rect);
+    int gray_projection = image_param_projection(L, 5);
+
+    int samples = 0;
+    uint32_t * hist = image_raw_histogram(&rect, gray_projection, &samples);
+    if (!hist) return luaL_error(L, "raw data not available");
+    if (!samples) { free(hist); return luaL_error(L, "no samples"); }
+
+    int over = 0;
+    for (int i = MIN(raw_info.white_level, 16383); i < 16384; i++)
+    {
+        over += hist[i];
+    }
+
+    float mean = image_push_stats(L, hist, 16384, samples);
+    free(hist);
+
+    lua_pushnumber(L, raw_to_ev((int) mean));
+    lua_setfield(L, -2, "ev");
+    lua_pushnumber(L, 100.0f * over / samples);
+    lua_setfield(L, -2, "overexposed");
+    lua_pushinteger(L, raw_info.black_level);
+    lua_setfield(L, -2, "black");
+    lua_pushinteger(L, raw_info.white_level);
+    lua_setfield(L, -2, "white");
+    return 1;
+}
+
+/***
+ Get a histogram of the raw image.
+
+ The levels between black and white are split into `bins` equal intervals;
+ levels below black are counted in the first bin, and levels above white, in the last one.
+ @tparam int bins number of bins (1-1024)
+ @tparam[opt] int x
+ @tparam[opt] int y
+ @tparam[opt] int w
+ @tparam[opt] int h
+ @tparam[opt] int projection (@{PROJECTION}); default: green
+ @treturn table number of samples in each bin (1-based)
+ @function raw_histogram
+ */
+static int luaCB_image_raw_histogram(lua_State * L)
+{
+    LUA_PARAM_INT(bins, 1);
+    if (bins < 1 || bins > 1024) return luaL_argerror(L, 1, "expected 1-1024 bins");
+    struct image_rect rect;
+    image_get_rect(L, 2, &rect);
+    int gray_projection = image_param_projection(L, 6);
+
+    int samples = 0;
+    uint32_t * hist = image_raw_histogram(&rect, gray_projection, &samples);
+    if (!hist) return luaL_error(L, "raw data not available");
+
+    int black = raw_info.black_level;
+    int range = MAX(MIN(raw_info.white_level, 16384) - black, 1);
+
+    /* bins are increasing with the level, so each one is filled in one go */
+    lua_createtable(L, bins, 0);
+    int bin = 0;
+    int count = 0;
+    for (int i = 0; i < 16384; i++)
+    {
+        int b = COERCE((i - black) * bins / range, 0, bins - 1);
+        for (; bin < b; bin++, count = 0)
+        {
+            lua_pushinteger(L, count);
+            lua_rawseti(L, -2, bin + 1);
+        }
+        count += hist[i];
+    }
+    for (; bin < bins; bin++, count = 0)
+    {
+        lua_pushinteger(L, count);
+        lua_rawseti(L, -2, bin + 1);
+    }
+    free(hist);
+    return 1;
+}
+
+/***
+ Get percentiles of the raw image.
+
+ For ETTR-like metering: e.g. image.raw_percentiles({50, 99.9}) returns the median
+ and the level of the brightest highlights (ignoring the top 0.1%).
+ @tparam table percentiles list of percentiles (0-100)
+ @tparam[opt] int x
+ @tparam[opt] int y
+ @tparam[opt] int w
+ @tparam[opt] int h
+ @tparam[opt] int projection (@{PROJECTION}); default: green
+ @treturn table raw levels, one for each percentile; use @{raw_to_ev} to get EV values
+ @function raw_percentiles
+ */
+static int luaCB_image_raw_percentiles(lua_State * L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    struct image_rect rect;
+    image_get_rect(L, 2, &rect);
+    int gray_projection = image_param_projection(L, 6);
+
+    int samples = 0;
+    uint32_t * hist = image_raw_histogram(&rect, gray_projection, &samples);
+    if (!hist) return luaL_error(L, "raw data not available");
+
+    int n = luaL_len(L, 1);
+    lua_createtable(L, n, 0);
+    for (int i = 1; i <= n; i++)
+    {
+        lua_rawgeti(L, 1, i);
+        float percentile = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        lua_pushinteger(L, image_percentile(hist, 16384, samples, percentile));
+        lua_rawseti(L, -2, i);
+    }
+    free(hist);
+    return 1;
+}
+
+/***
+ Convert a raw level to EV (0 = white level, negative values below that).
+ @tparam int raw
+ @treturn number
+ @function raw_to_ev
+ */
+static int luaCB_image_raw_to_ev(lua_State * L)
+{
+    LUA_PARAM_INT(raw, 1);
+    lua_pushnumber(L, raw_to_ev(raw));
+    return 1;
+}
+
+/***
+ Convert EV (0 = white level) to a raw level.
+ @tparam number ev
+ @treturn int
+ @function ev_to_raw
+ */
+static int luaCB_image_ev_to_raw(lua_State * L)
+{
+    LUA_PARAM_NUMBER(ev, 1);
+    lua_pushinteger(L, ev_to_raw(ev));
+    return 1;
+}
+
+/* luma histogram (256 levels) and chroma sums from the LiveView (or playback) YUV buffer */
+static int image_yuv_histogram(struct image_rect * rect, uint32_t * hist, int * u_sum, int * v_sum)
+{
+    struct vram_info * vram = get_yuv422_vram();
+    if (!vram || !vram->vram) return 0;
+
+    const uint16_t * buf = (const uint16_t *) vram->vram;
+    int pitch = vram->pitch / 2;
+    int n = 0, su = 0, sv = 0;
+
+    for (int y = rect->y1; y < rect->y2; y += rect->step)
+    {
+        const uint16_t * row = buf + BM2LV_Y(y) * pitch;
+        for (int x = rect->x1; x < rect->x2; x += rect->step)
+        {
+            int lx = BM2LV_X(x);
+            hist[(row[lx] >> 8) & 0xFF]++;
+            /* UYVY: U in the even pixel, V in the odd one */
+            su += (int8_t)(row[lx & ~1] & 0xFF);
+            sv += (int8_t)(row[lx | 1] & 0xFF);
+            n++;
+        }
+    }
+
+    *u_sum = su;
+    *v_sum = sv;
+    return n;
+}
+
+/***
+ Get statistics of the YUV image (as displayed in LiveView or playback).
+
+ Returns a table with the fields `mean`, `stdev`, `min`, `max`, `median` (luma, 0-255),
+ `u`, `v` (mean chroma, -128...127) and `samples`.
+ @tparam[opt] int x
+ @tparam[opt] int y
+ @tparam[opt] int w
+ @tparam[opt] int h
+ @treturn table
+ @function yuv_stats
+ */
+static int luaCB_image_yuv_stats(lua_State * L)
+{
+    struct image_rect rect;
+    image_get_rect(L, 1, &rect);
+
+    uint32_t hist[256] = {0};
+    int su = 0, sv = 0;
+    int samples = image_yuv_histogram(&rect, hist, &su, &sv);
+    if (!samples) return luaL_error(L, "image buffer not available");
+
+    image_push_stats(L, hist, 256, samples);
+    lua_pushnumber(L, (float) su / samples);
+    lua_setfield(L, -2, "u");
+    lua_pushnumber(L, (float) sv / samples);
+    lua_setfield(L, -2, "v");
+    return 1;
+}
+
+/***
+ Get a luma histogram of the YUV image.
+ @tparam int bins number of bins (1-256)
+ @tparam[opt] int x
+ @tparam[opt] int y
+ @tparam[opt] int w
+ @tparam[opt] int h
+ @treturn table number of samples in each bin (1-based)
+ @function yuv_histogram
+ */
+static int luaCB_image_yuv_histogram(lua_State * L)
+{
+    LUA_PARAM_INT(bins, 1);
+    if (bins < 1 || bins > 256) return luaL_argerror(L, 1, "expected 1-256 bins");
+    struct image_rect rect;
+    image_get_rect(L, 2, &rect);
+
+    uint32_t hist[256] = {0};
+    int su = 0, sv = 0;
+    if (!image_yuv_histogram(&rect, hist, &su, &sv)) return luaL_error(L, "image buffer not available");
+
+    lua_createtable(L, bins, 0);
+    for (int b = 0; b < bins; b++)
+    {
+        int n = 0;
+        for (int i = b * 256 / bins; i < (b + 1) * 256 / bins; i++)
+        {
+            n += hist[i];
+        }
+        lua_pushinteger(L, n);
+        lua_rawseti(L, -2, b + 1);
+    }
+    return 1;
+}
+
+/***
+ Get a motion score: the mean luma difference (0-255) between the current LiveView frame and the previous one.
+
+ Same as ML's motion detection (frame difference), without drawing anything.
+ @tparam[opt] int x
+ @tparam[opt] int y
+ @tparam[opt] int w
+ @tparam[opt] int h
+ @treturn number
+ @function motion
+ */
+static int luaCB_image_motion(lua_State * L)
+{
+    if (!lv) return luaL_error(L, "LiveView must be enabled");
+    struct image_rect rect;
+    image_get_rect(L, 1, &rect);
+
+    struct vram_info * vram = get_yuv422_vram();
+    const uint16_t * current = get_lcd_422_buf();
+    const uint16_t * previous = get_fastrefresh_422_buf();
+    if (!vram || !current || !previous) return luaL_error(L, "image buffer not available");
+
+    int pitch = vram->pitch / 2;
+    unsigned int diff = 0;
+    int n = 0;
+
+    for (int y = rect.y1; y < rect.y2; y += rect.step)
+    {
+        int off = BM2LV_Y(y) * pitch;
+        for (int x = rect.x1; x < rect.x2; x += rect.step)
+        {
+            int pos = off + BM2LV_X(x);
+            int p1 = (current[pos] >> 8) & 0xFF;
+            int p2 = (previous[pos] >> 8) & 0xFF;
+            diff += ABS(p1 - p2);
+            n++;
+        }
+    }
+
+    lua_pushnumber(L, (float) diff / n);
+    return 1;
+}
+
+/***
+ Get a focus (sharpness) score.
+
+ Sum of the luma gradients, divided by the brightness (so it doesn't change much with exposure),
+ from the high-resolution LiveView buffer. The value is only meaningful when compared to
+ other scores of the same scene, e.g. while focusing; higher is sharper.
+ @tparam[opt] int x
+ @tparam[opt] int y
+ @tparam[opt] int w
+ @tparam[opt] int h
+ @treturn number
+ @function focus
+ */
+static int luaCB_image_focus(lua_State * L)
+{
+    struct image_rect rect;
+    image_get_rect(L, 1, &rect);
+
+    struct vram_info * hd = get_yuv422_hd_vram();
+    if (!hd || !hd->vram) return luaL_error(L, "image buffer not available");
+
+    const uint16_t * buf = (const uint16_t *) hd->vram;
+    int pitch = hd->pitch / 2;
+    uint64_t grad = 0;
+    uint64_t bright = 0;
+
+    for (int y = rect.y1; y < rect.y2; y += rect.step)
+    {
+        int hy = COERCE(BM2HD_Y(y), 0, hd->height - 2);
+        const uint16_t * row = buf + hy * pitch;
+        const uint16_t * next = row + pitch;
+        for (int x = rect.x1; x < rect.x2; x += rect.step)
+        {
+            int hx = COERCE(BM2HD_X(x), 0, hd->width - 2);
+            int p  = (row[hx] >> 8) & 0xFF;
+            int px = (row[hx + 1] >> 8) & 0xFF;
+            int py = (next[hx] >> 8) & 0xFF;
+            grad += ABS(px - p) + ABS(py - p);
+            bright += p;
+        }
+    }
+
+    lua_pushnumber(L, bright ? 1000.0f * grad / bright : 0);
+    return 1;
+}
+
+static const luaL_Reg imagelib[] =
+{
+    { "raw_stats", luaCB_image_raw_stats },
+    { "raw_histogram", luaCB_image_raw_histogram },
+    { "raw_percentiles", luaCB_image_raw_percentiles },
+    { "raw_to_ev", luaCB_image_raw_to_ev },
+    { "ev_to_raw", luaCB_image_ev_to_raw },
+    { "yuv_stats", luaCB_image_yuv_stats },
+    { "yuv_histogram", luaCB_image_yuv_histogram },
+    { "motion", luaCB_image_motion },
+    { "focus", luaCB_image_focus },
+    { NULL, NULL }
+};
+
+int luaopen_image(lua_State * L)
+{
+    luaL_newlib(L, imagelib);
+    return 1;
+}
@@ -83,9 +83,27 @@ extern void umm_corruption(void);
  * called from within umm_malloc()
  */
 
+#ifdef UMM_COUNT_CRITICAL
+/* the benchmark counts how often the heap would disable interrupts */
+extern unsigned long umm_critical_entries;
+#define UMM_CRITICAL_ENTRY() umm_critical_entries++;
+#else
 #define UMM_CRITICAL_ENTRY()
+#endif
 #define UMM_CRITICAL_EXIT()
 
+/*
+ * umm_pool: where blocks go that are too large for the umm heap
+ */
+
+#include <stdlib.h>
+
+/* set by the tests to run out of memory */
+extern int umm_pool_fallback_fail;
+
+#define UMM_POOL_FALLBACK_MALLOC(size) (umm_pool_fallback_fail ? NULL : malloc(size))
+#define UMM_POOL_FALLBACK_FREE(ptr)    free(ptr)
+
 /*
  * -D UMM_INTEGRITY_CHECK :
  *
@@ -5,6 +5,7 @@
 #include <stdbool.h>
 
 #include "umm_malloc.h"
+#include "umm_pool.h"
 
 #define TRY(v)   do { \
   bool res = v;\
@@ -15,6 +16,7 @@
 } while (0)
 
 char test_umm_heap[UMM_MALLOC_CFG__HEAP_SIZE];
+int umm_pool_fallback_fail = 0;
 static int corruption_cnt = 0;
 
 void umm_corruption(void) {
@@ -186,6 +188,179 @@ bool random_stress(void) {
   return (corruption_cnt == 0);
 }
 
+bool pool_stress(void) {
+  struct umm_pool pools[4];
+  void * ptr_array[4][64];
+  size_t size_array[4][64];
+  size_t i;
+  int p;
+
+  corruption_cnt = 0;
+  umm_init();
+
+  size_t free_size = umm_free_heap_size();
+
+  memset(ptr_array, 0, sizeof(ptr_array));
+  memset(size_array, 0, sizeof(size_array));
+  for (p = 0; p < 4; p++) {
+    umm_pool_init(&pools[p]);
+  }
+
+  for (i = 0; i < 100000; i++) {
+    p = rand() % 4;
+    int j = rand() % 64;
+    void *ptr = ptr_array[p][j];
+    size_t old_size = size_array[p][j];
+    size_t size = (rand() % 8) ? (size_t)(rand() % 300) : (size_t)(rand() % 3000);
+
+    /* the block must still hold its pattern */
+    size_t a;
+    for (a = 0; a < old_size; a++) {
+      if (((unsigned char *)ptr)[a] != (unsigned char)(p * 64 + j)) {
+        printf("pool block %d/%d corrupted\n", p, j);
+        return false;
+      }
+    }
+
+    if (rand() % 2) {
+      umm_pool_free(&pools[p], ptr, old_size);
+      ptr = umm_pool_malloc(&pools[p], size);
+      old_size = 0;
+    } else {
+      ptr = umm_pool_realloc(&pools[p], ptr, old_size, size);
+    }
+
+    if (size && !ptr) {
+      printf("pool allocation of %u bytes failed\n", (unsigned int)size);
+      return false;
+    }
+
+    memset(ptr, p * 64 + j, size);
+    ptr_array[p][j] = size ? ptr : NULL;
+    size_array[p][j] = size;
+
+    if (i % 10000 == 9999) {
+      /* unload a script */
+      umm_pool_close(&pools[p]);
+      for (j = 0; j < 64; j++) {
+        umm_pool_free(&pools[p], ptr_array[p][j], size_array[p][j]);
+        ptr_array[p][j] = NULL;
+        size_array[p][j] = 0;
+      }
+      if (pools[p].used != 0) {
+        printf("pool still uses %u bytes after freeing everything\n", (unsigned int)pools[p].used);
+        return false;
+      }
+      umm_pool_release(&pools[p]);
+    }
+  }
+
+  for (p = 0; p < 4; p++) {
+    umm_pool_release(&pools[p]);
+  }
+
+  if (umm_free_heap_size() != free_size) {
+    printf("umm heap has %u bytes free after releasing all pools, expected %u\n",
+           (unsigned int)umm_free_heap_size(), (unsigned int)free_size);
+    return false;
+  }
+
+  return (corruption_cnt == 0);
+}
+
+static bool pool_check_pattern(void *ptr, size_t size, unsigned char value) {
+  size_t a;
+  for (a = 0; a < size; a++) {
+    if (((unsigned char *)ptr)[a] != value) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Lua expects realloc to never fail when shrinking a block */
+bool pool_shrink_oom(void) {
+  struct umm_pool pool;
+  void *fill = NULL;
+  void *block;
+  size_t fill_size;
+
+  umm_init();
+  size_t free_size = umm_free_heap_size();
+  umm_pool_init(&pool);
+
+  void *big1 = umm_pool_malloc(&pool, 2000);
+  void *big2 = umm_pool_malloc(&pool, 2000);
+  void *small = umm_pool_malloc(&pool, 200);
+  if (!big1 || !big2 || !small) {
+    printf("pool allocation failed\n");
+    return false;
+  }
+  memset(big1, 1, 2000);
+  memset(big2, 2, 2000);
+  memset(small, 3, 200);
+
+  /* use up the umm heap (blocks chained through their first word) and the fallback */
+  umm_pool_fallback_fail = 1;
+  for (fill_size = 1024; fill_size >= sizeof(void *); fill_size /= 2) {
+    while ((block = umm_malloc(fill_size)) != NULL) {
+      *(void **)block = fill;
+      fill = block;
+    }
+  }
+
+  /* large to large, large to small, small to a smaller class without slab */
+  if (umm_pool_realloc(&pool, big1, 2000, 1000) != big1 ||
+      umm_pool_realloc(&pool, big2, 2000, 100) != big2 ||
+      umm_pool_realloc(&pool, small, 200, 20) != small) {
+    printf("shrinking failed without memory\n");
+    return false;
+  }
+
+  if (!pool_check_pattern(big1, 1000, 1) || !pool_check_pattern(big2, 100, 2) ||
+      !pool_check_pattern(small, 20, 3)) {
+    printf("shrunk block corrupted\n");
+    return false;
+  }
+
+  /* growing may fail, the block stays valid */
+  if (umm_pool_realloc(&pool, small, 20, 250) != NULL || !pool_check_pattern(small, 20, 3)) {
+    printf("growing without memory did not fail cleanly\n");
+    return false;
+  }
+
+  if (pool.used != 1000 + 100 + 20) {
+    printf("pool accounts %u bytes, expected %u\n", (unsigned int)pool.used, 1000 + 100 + 20);
+    return false;
+  }
+
+  /* freed with the new sizes, as Lua does */
+  umm_pool_free(&pool, big1, 1000);
+  umm_pool_free(&pool, big2, 100);
+  umm_pool_free(&pool, small, 20);
+
+  umm_pool_fallback_fail = 0;
+  while (fill) {
+    block = *(void **)fill;
+    umm_free(fill);
+    fill = block;
+  }
+
+  if (pool.used != 0) {
+    printf("pool still uses %u bytes after freeing everything\n", (unsigned int)pool.used);
+    return false;
+  }
+  umm_pool_release(&pool);
+
+  if (umm_free_heap_size() != free_size) {
+    printf("umm heap has %u bytes free after releasing the pool, expected %u\n",
+           (unsigned int)umm_free_heap_size(), (unsigned int)free_size);
+    return false;
+  }
+
+  return (corruption_cnt == 0);
+}
+
 int main(void) {
 #if defined(UMM_INTEGRITY_CHECK)
   TRY(test_integrity_check());
@@ -196,6 +371,8 @@ int main(void) {
 #endif
 
   TRY(random_stress());
+  TRY(pool_stress());
+  TRY(pool_shrink_oom());
 
   return 0;
 }
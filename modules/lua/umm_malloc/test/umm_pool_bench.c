@@ -0,0 +1,180 @@
+/*
+ * Throughput and fragmentation of a Lua-like workload: a few scripts
+ * (Lua states) allocating, resizing and freeing small objects in the shared
+ * umm heap, every now and then one of them unloading and loading again.
+ *
+ * The same sequence runs through umm_malloc directly (one heap for all
+ * scripts, as before) and through one umm_pool per script.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "umm_malloc.h"
+#include "umm_pool.h"
+
+#define SCRIPTS     4
+#define SLOTS       128         /* live objects per script */
+#define ROUNDS      400000
+#define UNLOAD_EVERY 25000
+
+char test_umm_heap[UMM_MALLOC_CFG__HEAP_SIZE];
+unsigned long umm_critical_entries = 0;
+int umm_pool_fallback_fail = 0;
+
+void umm_corruption(void) {
+  printf("heap corruption!\n");
+  abort();
+}
+
+struct object {
+  void *ptr;
+  size_t size;
+};
+
+struct script {
+  struct umm_pool pool;
+  struct object slots[SLOTS];
+};
+
+struct result {
+  double seconds;
+  double unloadSeconds;
+  unsigned long ops;
+  unsigned long failed;
+  unsigned long criticals;
+  unsigned long outside;        /* live blocks not in the umm heap */
+  unsigned int freeBlocks;
+  unsigned int maxFreeBlocks;
+};
+
+static struct script scripts[SCRIPTS];
+
+/* mostly strings, tables and closures, some arrays and buffers */
+static size_t lua_like_size(void) {
+  int r = rand() % 100;
+
+  if (r < 40) return 16 + rand() % 17;
+  if (r < 75) return 32 + rand() % 33;
+  if (r < 95) return 64 + rand() % 193;
+  return 256 + rand() % 769;
+}
+
+static void *bench_realloc(int pooled, struct script *s, void *ptr, size_t oldSize, size_t size) {
+  if (pooled) {
+    return umm_pool_realloc(&s->pool, ptr, oldSize, size);
+  }
+
+  if (!size) {
+    umm_free(ptr);
+    return NULL;
+  }
+  return umm_realloc(ptr, size);
+}
+
+static void bench_unload(int pooled, struct script *s) {
+  if (pooled) {
+    umm_pool_close(&s->pool);
+  }
+
+  for (int i = 0; i < SLOTS; i++) {
+    bench_realloc(pooled, s, s->slots[i].ptr, s->slots[i].size, 0);
+    s->slots[i].ptr = NULL;
+    s->slots[i].size = 0;
+  }
+
+  if (pooled) {
+    umm_pool_release(&s->pool);
+  }
+}
+
+static void bench_run(int pooled, struct result *res) {
+  memset(res, 0, sizeof(*res));
+  memset(scripts, 0, sizeof(scripts));
+  umm_init();
+  srand(1);
+  umm_critical_entries = 0;
+
+  clock_t start = clock();
+
+  for (unsigned long round = 0; round < ROUNDS; round++) {
+    struct script *s = &scripts[rand() % SCRIPTS];
+    struct object *o = &s->slots[rand() % SLOTS];
+    int op = rand() % 100;
+    size_t size = (op < 85) ? lua_like_size() : 0;
+
+    if (round % UNLOAD_EVERY == UNLOAD_EVERY - 1) {
+      clock_t unloadStart = clock();
+      bench_unload(pooled, s);
+      res->unloadSeconds += (double)(clock() - unloadStart) / CLOCKS_PER_SEC;
+      continue;
+    }
+
+    if (op < 60 && o->ptr) {
+      /* garbage collected, something else allocated */
+      bench_realloc(pooled, s, o->ptr, o->size, 0);
+      o->ptr = NULL;
+      o->size = 0;
+      res->ops++;
+    }
+
+    void *ptr = bench_realloc(pooled, s, o->ptr, o->size, size);
+    res->ops++;
+
+    if (size && !ptr) {
+      /* the old block, if any, is still valid */
+      res->failed++;
+      continue;
+    }
+
+    if (ptr) {
+      memset(ptr, 0x5A, size);
+    }
+    o->ptr = ptr;
+    o->size = size;
+  }
+
+  res->seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  res->criticals = umm_critical_entries;
+
+  for (int j = 0; j < SCRIPTS; j++) {
+    for (int i = 0; i < SLOTS; i++) {
+      if (scripts[j].slots[i].ptr && !umm_ptr_in_heap(scripts[j].slots[i].ptr)) {
+        res->outside++;
+      }
+    }
+  }
+
+  umm_info(NULL, 0);
+  res->freeBlocks = ummHeapInfo.freeBlocks;
+  res->maxFreeBlocks = ummHeapInfo.maxFreeContiguousBlocks;
+
+  for (int j = 0; j < SCRIPTS; j++) {
+    bench_unload(pooled, &scripts[j]);
+  }
+}
+
+static void bench_print(const char *name, struct result *res) {
+  printf("%-10s %6.0f kops/s  unload %6.2f ms  failed %5lu  outside umm %4lu  criticals/op %.2f  free %6u B, largest %6u B (%.0f%% fragmented)\n",
+    name, res->ops / res->seconds / 1000, res->unloadSeconds * 1000,
+    res->failed, res->outside, (double)res->criticals / res->ops,
+    res->freeBlocks * 8, res->maxFreeBlocks * 8,
+    res->freeBlocks ? 100.0 * (1.0 - (double)res->maxFreeBlocks / res->freeBlocks) : 0.0);
+}
+
+int main(void) {
+  struct result direct, pooled;
+
+  printf("%d scripts, %d live objects each, %d operations, %u bytes umm heap\n",
+    SCRIPTS, SLOTS, ROUNDS, (unsigned int)sizeof(test_umm_heap));
+
+  bench_run(0, &direct);
+  bench_print("umm_malloc", &direct);
+
+  bench_run(1, &pooled);
+  bench_print("umm_pool", &pooled);
+
+  return 0;
+}
@@ -76,6 +76,16 @@ extern void * __mem_malloc( size_t len, unsigned int flags, const char *file, un
 #define UMM_CRITICAL_ENTRY() uint32_t old_int = cli();
 #define UMM_CRITICAL_EXIT()  sei(old_int);
 
+/*
+ * umm_pool: where blocks go that are too large for the umm heap
+ * (or when the umm heap is full)
+ */
+
+extern void __mem_free( void * buf);
+
+#define UMM_POOL_FALLBACK_MALLOC(size) __mem_malloc(size, 0, "lua", __LINE__)
+#define UMM_POOL_FALLBACK_FREE(ptr)    __mem_free(ptr)
+
 /*
  * -D UMM_INTEGRITY_CHECK :
  *
@@ -0,0 +1,274 @@
+/* ----------------------------------------------------------------------------
+ * umm_pool.c - size-class small object pools in front of umm_malloc
+ *
+ * See copyright notice in LICENSE.TXT
+ * ----------------------------------------------------------------------------
+ *
+ * Small blocks (up to UMM_POOL_MAX_SMALL bytes) are rounded up to one of
+ * UMM_POOL_CLASSES size classes. Each class has a free list, threaded through
+ * the free blocks themselves, and a slab it carves new blocks from. Slabs
+ * start small and double in size (up to UMM_POOL_SLAB_MAX), so a pool that
+ * only needs a few blocks of a class does not reserve much memory for it.
+ *
+ * All slabs of a pool are chained through a small header, and so are the
+ * large blocks, so umm_pool_release can return everything without knowing
+ * which blocks are still in use.
+ * ----------------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "umm_malloc.h"
+#include "umm_pool.h"
+
+/* ------------------------------------------------------------------------ */
+
+#define UMM_POOL_SLAB_MIN   512
+#define UMM_POOL_SLAB_MAX   4096
+
+/* large blocks smaller than this are taken from the umm heap, the rest from
+ * UMM_POOL_FALLBACK_MALLOC */
+#define UMM_POOL_BIG_IN_UMM 1024
+
+struct umm_pool_slab {
+  struct umm_pool_slab *next;
+  size_t bytes;
+};
+
+struct umm_pool_big {
+  struct umm_pool_big *next;
+  struct umm_pool_big *prev;
+};
+
+static const unsigned short umm_pool_class_size[UMM_POOL_CLASSES] = {
+  8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256
+};
+
+/* size class for (size + 7) / 8 */
+static const unsigned char umm_pool_class_of[UMM_POOL_MAX_SMALL / 8 + 1] = {
+  0,                                /* 0 */
+  0, 1, 2, 3, 4, 5, 6, 7,           /* 8 ... 64 */
+  8, 8, 9, 9, 10, 10, 11, 11,       /* 72 ... 128 */
+  12, 12, 12, 12, 13, 13, 13, 13,   /* 136 ... 192 */
+  14, 14, 14, 14, 15, 15, 15, 15,   /* 200 ... 256 */
+};
+
+#define UMM_POOL_CLASS(size) (umm_pool_class_of[((size) + 7) >> 3])
+
+/* ------------------------------------------------------------------------ */
+
+static void *umm_pool_get( size_t size, int tryUmm ) {
+  void *ptr = NULL;
+
+  if( tryUmm ) {
+    ptr = umm_malloc( size );
+  }
+
+  if( !ptr ) {
+    ptr = UMM_POOL_FALLBACK_MALLOC( size );
+  }
+
+  return( ptr );
+}
+
+static void umm_pool_put( void *ptr ) {
+  if( umm_ptr_in_heap( ptr ) ) {
+    umm_free( ptr );
+  } else {
+    UMM_POOL_FALLBACK_FREE( ptr );
+  }
+}
+
+static void umm_pool_count( struct umm_pool *pool, size_t size ) {
+  pool->used += size;
+  if( pool->used > pool->peak ) {
+    pool->peak = pool->used;
+  }
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* a new slab for class c; the rest of the previous one is abandoned */
+static int umm_pool_new_slab( struct umm_pool *pool, int c ) {
+  size_t classSize = umm_pool_class_size[c];
+  size_t bytes = pool->slabBytes[c] ? pool->slabBytes[c] : UMM_POOL_SLAB_MIN;
+
+  bytes -= bytes % classSize;
+
+  struct umm_pool_slab *slab = umm_pool_get( sizeof(struct umm_pool_slab) + bytes, 1 );
+  if( !slab ) {
+    return( 0 );
+  }
+
+  slab->next = pool->slabs;
+  slab->bytes = bytes;
+  pool->slabs = slab;
+  pool->reserved += sizeof(struct umm_pool_slab) + bytes;
+
+  pool->bump[c] = (char *)(slab + 1);
+  pool->bumpEnd[c] = pool->bump[c] + bytes;
+
+  if( pool->slabBytes[c] < UMM_POOL_SLAB_MAX ) {
+    pool->slabBytes[c] = (pool->slabBytes[c] ? pool->slabBytes[c] : UMM_POOL_SLAB_MIN) * 2;
+  }
+
+  return( 1 );
+}
+
+static void *umm_pool_malloc_big( struct umm_pool *pool, size_t size ) {
+  size_t total = sizeof(struct umm_pool_big) + size;
+  struct umm_pool_big *big = umm_pool_get( total, total < UMM_POOL_BIG_IN_UMM );
+
+  if( !big ) {
+    return( NULL );
+  }
+
+  big->prev = NULL;
+  big->next = pool->big;
+  if( pool->big ) {
+    pool->big->prev = big;
+  }
+  pool->big = big;
+  pool->reserved += total;
+
+  return( big + 1 );
+}
+
+static void umm_pool_free_big( struct umm_pool *pool, void *ptr, size_t size ) {
+  struct umm_pool_big *big = (struct umm_pool_big *)ptr - 1;
+
+  if( big->prev ) {
+    big->prev->next = big->next;
+  } else {
+    pool->big = big->next;
+  }
+  if( big->next ) {
+    big->next->prev = big->prev;
+  }
+
+  pool->reserved -= sizeof(struct umm_pool_big) + size;
+  umm_pool_put( big );
+}
+
+/* ------------------------------------------------------------------------ */
+
+void umm_pool_init( struct umm_pool *pool ) {
+  memset( pool, 0x00, sizeof(struct umm_pool) );
+}
+
+void *umm_pool_malloc( struct umm_pool *pool, size_t size ) {
+  void *ptr;
+
+  if( size > UMM_POOL_MAX_SMALL ) {
+    ptr = umm_pool_malloc_big( pool, size );
+  } else {
+    int c = UMM_POOL_CLASS( size ? size : 1 );
+
+    if( pool->freeList[c] ) {
+      ptr = pool->freeList[c];
+      pool->freeList[c] = *(void **)ptr;
+    } else {
+      if( (size_t)(pool->bumpEnd[c] - pool->bump[c]) < umm_pool_class_size[c] &&
+          !umm_pool_new_slab( pool, c ) ) {
+        return( NULL );
+      }
+      ptr = pool->bump[c];
+      pool->bump[c] += umm_pool_class_size[c];
+    }
+  }
+
+  if( ptr ) {
+    umm_pool_count( pool, size );
+  }
+
+  return( ptr );
+}
+
+void umm_pool_free( struct umm_pool *pool, void *ptr, size_t size ) {
+  if( !ptr ) {
+    return;
+  }
+
+  pool->used -= size;
+
+  if( pool->closing ) {
+    /* umm_pool_release will take care of it */
+    return;
+  }
+
+  if( size > UMM_POOL_MAX_SMALL ) {
+    umm_pool_free_big( pool, ptr, size );
+  } else {
+    int c = UMM_POOL_CLASS( size ? size : 1 );
+    *(void **)ptr = pool->freeList[c];
+    pool->freeList[c] = ptr;
+  }
+}
+
+void *umm_pool_realloc( struct umm_pool *pool, void *ptr, size_t oldSize, size_t size ) {
+  if( !size ) {
+    umm_pool_free( pool, ptr, oldSize );
+    return( NULL );
+  }
+
+  if( !ptr ) {
+    return( umm_pool_malloc( pool, size ) );
+  }
+
+  /* same size class: nothing to move */
+  if( oldSize <= UMM_POOL_MAX_SMALL && size <= UMM_POOL_MAX_SMALL &&
+      UMM_POOL_CLASS( oldSize ? oldSize : 1 ) == UMM_POOL_CLASS( size ) ) {
+    pool->used -= oldSize;
+    umm_pool_count( pool, size );
+    return( ptr );
+  }
+
+  /* on failure, the old block stays valid */
+  void *newPtr = umm_pool_malloc( pool, size );
+  if( newPtr ) {
+    memcpy( newPtr, ptr, oldSize < size ? oldSize : size );
+    umm_pool_free( pool, ptr, oldSize );
+    return( newPtr );
+  }
+
+  /* Lua requires that shrinking never fails: keep the old block. It will be
+   * freed with the new size, i.e. to a smaller class, or as a large block of
+   * that size, and it is large enough for either */
+  if( size <= oldSize ) {
+    pool->used -= oldSize;
+    umm_pool_count( pool, size );
+    if( size > UMM_POOL_MAX_SMALL ) {
+      /* umm_pool_free_big will only subtract the new size */
+      pool->reserved -= oldSize - size;
+    }
+    return( ptr );
+  }
+
+  return( NULL );
+}
+
+void umm_pool_close( struct umm_pool *pool ) {
+  pool->closing = 1;
+}
+
+void umm_pool_release( struct umm_pool *pool ) {
+  struct umm_pool_slab *slab = pool->slabs;
+  while( slab ) {
+    struct umm_pool_slab *next = slab->next;
+    umm_pool_put( slab );
+    slab = next;
+  }
+
+  struct umm_pool_big *big = pool->big;
+  while( big ) {
+    struct umm_pool_big *next = big->next;
+    umm_pool_put( big );
+    big = next;
+  }
+
+  umm_pool_init( pool );
+}
+
+/* ------------------------------------------------------------------------ */
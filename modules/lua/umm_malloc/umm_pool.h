@@ -0,0 +1,67 @@
+/* ----------------------------------------------------------------------------
+ * umm_pool.h - size-class small object pools in front of umm_malloc
+ *
+ * See copyright notice in LICENSE.TXT
+ * ----------------------------------------------------------------------------
+ *
+ * One pool per user (e.g. one per Lua state). Small blocks are carved out of
+ * slabs taken from the umm heap, one free list per size class, so malloc and
+ * free of small blocks neither search the heap nor enter its critical
+ * section. Larger blocks go to umm_malloc (or to UMM_POOL_FALLBACK_MALLOC
+ * when they are too large, or the umm heap is full).
+ *
+ * A pool is not thread safe; its user must serialize the calls.
+ *
+ * The caller passes the size of the block to umm_pool_free/umm_pool_realloc
+ * (like Lua's allocator interface does), so small blocks need no header.
+ *
+ * Slabs are kept by the pool until umm_pool_release, which returns all
+ * memory of the pool at once. After umm_pool_close, frees are only counted,
+ * so tearing down a pool with many blocks costs nothing per block.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef UMM_POOL_H
+#define UMM_POOL_H
+
+/* ------------------------------------------------------------------------ */
+
+#include "umm_malloc_cfg.h"   /* user-dependent */
+
+#define UMM_POOL_CLASSES    16
+#define UMM_POOL_MAX_SMALL  256   /* larger blocks are not pooled */
+
+struct umm_pool_big;
+
+struct umm_pool {
+  void *freeList[UMM_POOL_CLASSES];
+  char *bump[UMM_POOL_CLASSES];       /* unused part of the newest slab */
+  char *bumpEnd[UMM_POOL_CLASSES];
+  unsigned short slabBytes[UMM_POOL_CLASSES];
+
+  void *slabs;                        /* all slabs, for umm_pool_release */
+  struct umm_pool_big *big;           /* all large blocks */
+  int closing;
+
+  /* accounting, in bytes */
+  size_t used;                        /* as requested by the user */
+  size_t peak;
+  size_t reserved;                    /* slabs and large blocks, with headers */
+};
+
+void umm_pool_init( struct umm_pool *pool );
+
+void *umm_pool_malloc( struct umm_pool *pool, size_t size );
+void umm_pool_free( struct umm_pool *pool, void *ptr, size_t size );
+/* like Lua's allocator: shrinking never fails, growing returns NULL and keeps ptr */
+void *umm_pool_realloc( struct umm_pool *pool, void *ptr, size_t oldSize, size_t size );
+
+/* from now on, umm_pool_free only updates the accounting */
+void umm_pool_close( struct umm_pool *pool );
+
+/* return all memory of the pool; the pool can be used again afterwards */
+void umm_pool_release( struct umm_pool *pool );
+
+/* ------------------------------------------------------------------------ */
+
+#endif /* UMM_POOL_H */
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defect_map.h"
+
+/* file layout (little endian):
+ *   "DFMP", version, number of lists
+ *   for each list: struct defect_key, frames, count, struct defect_pixel[count]
+ */
+#define DEFECT_MAP_MAGIC    "DFMP"
+#define DEFECT_MAP_VERSION  1
+
+static int key_matches(struct defect_key * a, struct defect_key * b)
+{
+    /* without a serial number, we can't tell whose defects these are */
+    if (!a->serial[0] || !b->serial[0] || strncmp(a->serial, b->serial, sizeof(a->serial)))
+    {
+        return 0;
+    }
+
+    if (a->sampling_x != b->sampling_x || a->sampling_y != b->sampling_y ||
+        a->phase_x != b->phase_x || a->phase_y != b->phase_y)
+    {
+        return 0;
+    }
+
+    /* without RAWC, we can only match the exact frame size */
+    if (a->sampling_x == 0 && (a->width != b->width || a->height != b->height))
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+static int grow_list(struct defect_list * list, uint32_t count)
+{
+    if (count <= list->max)
+    {
+        return 1;
+    }
+
+    uint32_t max = list->max ? list->max : 1024;
+    while (max < count)
+    {
+        max *= 2;
+    }
+
+    struct defect_pixel * pixels = realloc(list->pixels, max * sizeof(pixels[0]));
+    if (!pixels)
+    {
+        return 0;
+    }
+
+    list->pixels = pixels;
+    list->max = max;
+    return 1;
+}
+
+static struct defect_list * add_list(struct defect_map * map, struct defect_key * key)
+{
+    struct defect_list * lists = realloc(map->lists, (map->num_lists + 1) * sizeof(lists[0]));
+    if (!lists)
+    {
+        return 0;
+    }
+
+    map->lists = lists;
+    struct defect_list * list = &map->lists[map->num_lists++];
+    memset(list, 0, sizeof(*list));
+    list->key = *key;
+    return list;
+}
+
+int defect_map_load(struct defect_map * map, const char * filename)
+{
+    memset(map, 0, sizeof(*map));
+
+    FILE * f = fopen(filename, "rb");
+    if (!f)
+    {
+        /* will be created */
+        return 0;
+    }
+
+    char magic[4];
+    uint32_t version, num_lists;
+    if (fread(magic, 4, 1, f) != 1 || memcmp(magic, DEFECT_MAP_MAGIC, 4) ||
+        fread(&version, 4, 1, f) != 1 || version != DEFECT_MAP_VERSION ||
+        fread(&num_lists, 4, 1, f) != 1)
+    {
+        fprintf(stderr, "%s: not a defect map\n", filename);
+        fclose(f);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < num_lists; i++)
+    {
+        struct defect_key key;
+        uint32_t hdr[2];
+        if (fread(&key, sizeof(key), 1, f) != 1 || fread(hdr, sizeof(hdr), 1, f) != 1)
+        {
+            goto err;
+        }
+
+        struct defect_list * list = add_list(map, &key);
+        if (!list || !grow_list(list, hdr[1]))
+        {
+            goto err;
+        }
+
+        list->frames = hdr[0];
+        list->count = hdr[1];
+        if (list->count && fread(list->pixels, sizeof(list->pixels[0]), list->count, f) != list->count)
+        {
+            goto err;
+        }
+    }
+
+    fclose(f);
+    return 0;
+
+err:
+    fprintf(stderr, "%s: truncated defect map\n", filename);
+    fclose(f);
+    defect_map_free(map);
+    return -1;
+}
+
+int defect_map_save(struct defect_map * map, const char * filename)
+{
+    FILE * f = fopen(filename, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "%s: could not create defect map\n", filename);
+        return -1;
+    }
+
+    uint32_t version = DEFECT_MAP_VERSION;
+    uint32_t num_lists = map->num_lists;
+    int ok = fwrite(DEFECT_MAP_MAGIC, 4, 1, f) == 1 &&
+             fwrite(&version, 4, 1, f) == 1 &&
+             fwrite(&num_lists, 4, 1, f) == 1;
+
+    for (int i = 0; ok && i < map->num_lists; i++)
+    {
+        struct defect_list * list = &map->lists[i];
+        uint32_t hdr[2] = { list->frames, list->count };
+        ok = fwrite(&list->key, sizeof(list->key), 1, f) == 1 &&
+             fwrite(hdr, sizeof(hdr), 1, f) == 1 &&
+             (!list->count || fwrite(list->pixels, sizeof(list->pixels[0]), list->count, f) == list->count);
+    }
+
+    fclose(f);
+
+    if (!ok)
+    {
+        fprintf(stderr, "%s: could not write defect map\n", filename);
+        return -1;
+    }
+
+    map->dirty = 0;
+    return 0;
+}
+
+void defect_map_free(struct defect_map * map)
+{
+    for (int i = 0; i < map->num_lists; i++)
+    {
+        free(map->lists[i].pixels);
+    }
+    free(map->lists);
+    memset(map, 0, sizeof(*map));
+}
+
+void defect_clip_init(struct defect_clip * clip, const char * serial,
+    int sampling_x, int sampling_y, int offset_x, int offset_y,
+    int width, int height, int x1, int y1)
+{
+    memset(clip, 0, sizeof(*clip));
+    if (serial)
+    {
+        strncpy(clip->key.serial, serial, sizeof(clip->key.serial) - 1);
+    }
+
+    clip->x1 = x1;
+    clip->y1 = y1;
+    clip->width = width;
+    clip->height = height;
+
+    if (sampling_x > 0 && sampling_y > 0)
+    {
+        /* position on the subsampled sensor grid; floor division, offsets may be negative */
+        int px = ((offset_x % sampling_x) + sampling_x) % sampling_x;
+        int py = ((offset_y % sampling_y) + sampling_y) % sampling_y;
+        clip->key.sampling_x = sampling_x;
+        clip->key.sampling_y = sampling_y;
+        clip->key.phase_x = px;
+        clip->key.phase_y = py;
+        clip->grid_x = (offset_x - px) / sampling_x;
+        clip->grid_y = (offset_y - py) / sampling_y;
+    }
+    else
+    {
+        clip->key.width = width;
+        clip->key.height = height;
+    }
+}
+
+struct defect_list * defect_map_find(struct defect_map * map, struct defect_clip * clip)
+{
+    for (int i = 0; i < map->num_lists; i++)
+    {
+        if (key_matches(&map->lists[i].key, &clip->key))
+        {
+            return &map->lists[i];
+        }
+    }
+    return 0;
+}
+
+struct defect_list * defect_map_get(struct defect_map * map, struct defect_clip * clip)
+{
+    struct defect_list * list = defect_map_find(map, clip);
+    if (!list && clip->key.serial[0])
+    {
+        list = add_list(map, &clip->key);
+        map->dirty = 1;
+    }
+    return list;
+}
+
+void defect_map_add(struct defect_map * map, struct defect_list * list, struct defect_clip * clip, int x, int y, int type)
+{
+    /* only the active area is stored */
+    int gx = clip->grid_x + x - clip->x1;
+    int gy = clip->grid_y + y - clip->y1;
+    if (x < clip->x1 || y < clip->y1 || gx < 0 || gy < 0 || gx > 0xFFFF || gy > 0xFFFF)
+    {
+        return;
+    }
+
+    if (!grow_list(list, list->count + 1))
+    {
+        return;
+    }
+
+    struct defect_pixel * p = &list->pixels[list->count++];
+    p->x = gx;
+    p->y = gy;
+    p->hits = 1;
+    p->type = type;
+    p->reserved = 0;
+    map->dirty = 1;
+}
+
+static int defect_cmp(const void * a, const void * b)
+{
+    const struct defect_pixel * pa = a;
+    const struct defect_pixel * pb = b;
+    if (pa->y != pb->y) return pa->y - pb->y;
+    return pa->x - pb->x;
+}
+
+void defect_map_end_frame(struct defect_map * map, struct defect_list * list)
+{
+    /* sort by position and merge duplicates */
+    qsort(list->pixels, list->count, sizeof(list->pixels[0]), defect_cmp);
+
+    uint32_t out = 0;
+    for (uint32_t i = 0; i < list->count; i++)
+    {
+        struct defect_pixel * p = &list->pixels[i];
+        if (out && p->x == list->pixels[out-1].x && p->y == list->pixels[out-1].y)
+        {
+            struct defect_pixel * q = &list->pixels[out-1];
+            q->hits = (q->hits + p->hits > 0xFFFF) ? 0xFFFF : q->hits + p->hits;
+            q->type |= p->type;
+            continue;
+        }
+        list->pixels[out++] = *p;
+    }
+    list->count = out;
+    list->frames++;
+    map->dirty = 1;
+}
+
+int defect_map_get_pixels(struct defect_list * list, struct defect_clip * clip, struct defect_xy ** out)
+{
+    *out = 0;
+    if (!list || !list->count)
+    {
+        return 0;
+    }
+
+    struct defect_xy * xy = malloc(list->count * sizeof(xy[0]));
+    if (!xy)
+    {
+        return 0;
+    }
+
+    int n = 0;
+    for (uint32_t i = 0; i < list->count; i++)
+    {
+        int x = list->pixels[i].x - clip->grid_x + clip->x1;
+        int y = list->pixels[i].y - clip->grid_y + clip->y1;
+        if (x >= 0 && y >= 0 && x < clip->width && y < clip->height)
+        {
+            xy[n].x = x;
+            xy[n].y = y;
+            xy[n].type = list->pixels[i].type;
+            n++;
+        }
+    }
+
+    *out = xy;
+    return n;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* Persistent defect (cold/hot) pixel map, shared by raw2dng, mlv_dump and cr2hdr.
+ *
+ * Defects are stored per camera (serial number from IDNT) and per capture
+ * geometry (sampling = binning + skipping, from RAWC), in the coordinates of
+ * the subsampled sensor grid, relative to the top-left active pixel of a
+ * full-res image. Clips recorded with the same sampling but a different crop
+ * window share the same list; each clip maps it to its own raw buffer.
+ *
+ * Without RAWC (e.g. legacy .RAW files), the list is tied to the exact
+ * frame size instead.
+ */
+
+#ifndef _defect_map_h_
+#define _defect_map_h_
+
+#include <stdint.h>
+
+#define DEFECT_COLD     1
+#define DEFECT_HOT      2
+
+/* which sensor pixels end up in the image */
+struct defect_key
+{
+    char serial[32];            /* camera serial; empty = unknown (never matches, nothing is stored) */
+    uint8_t sampling_x;         /* binning + skipping; 1 = full-res, 0 = unknown geometry */
+    uint8_t sampling_y;
+    uint8_t phase_x;            /* crop offset modulo sampling */
+    uint8_t phase_y;
+    uint16_t width;             /* frame size, only used when the geometry is unknown */
+    uint16_t height;
+};
+
+/* one defect, in sensor grid coordinates */
+struct defect_pixel
+{
+    uint16_t x;
+    uint16_t y;
+    uint16_t hits;              /* how many analysed frames showed it */
+    uint8_t  type;              /* DEFECT_COLD / DEFECT_HOT */
+    uint8_t  reserved;
+};
+
+struct defect_list
+{
+    struct defect_key key;
+    uint32_t frames;            /* number of frames analysed */
+    uint32_t count;
+    uint32_t max;
+    struct defect_pixel * pixels;
+};
+
+struct defect_map
+{
+    int num_lists;
+    struct defect_list * lists;
+    int dirty;                  /* modified since loaded */
+};
+
+/* how a clip's raw buffer maps onto the sensor grid */
+struct defect_clip
+{
+    struct defect_key key;
+    int grid_x;                 /* sensor grid position of the top-left active pixel */
+    int grid_y;
+    int x1;                     /* top-left active pixel in the raw buffer */
+    int y1;
+    int width;                  /* raw buffer size */
+    int height;
+};
+
+/* a defect mapped into a clip's raw buffer */
+struct defect_xy
+{
+    int x;
+    int y;
+    int type;
+};
+
+/* missing file = empty map; returns 0 on success */
+int defect_map_load(struct defect_map * map, const char * filename);
+int defect_map_save(struct defect_map * map, const char * filename);
+void defect_map_free(struct defect_map * map);
+
+/* sampling_x/y = binning + skipping (0 if unknown); offset_x/y = RAWC crop offset */
+void defect_clip_init(struct defect_clip * clip, const char * serial,
+    int sampling_x, int sampling_y, int offset_x, int offset_y,
+    int width, int height, int x1, int y1);
+
+/* defect list matching the clip, or NULL */
+struct defect_list * defect_map_find(struct defect_map * map, struct defect_clip * clip);
+
+/* same, but creates an empty list if there is none (NULL if the camera serial is unknown) */
+struct defect_list * defect_map_get(struct defect_map * map, struct defect_clip * clip);
+
+/* record a defect found at (x,y) in the clip's raw buffer */
+void defect_map_add(struct defect_map * map, struct defect_list * list, struct defect_clip * clip, int x, int y, int type);
+
+/* call after analysing one frame: merges the defects found with the previous ones */
+void defect_map_end_frame(struct defect_map * map, struct defect_list * list);
+
+/* defects from the list that fall inside the clip's raw buffer; returns their count
+ * (out is malloc'ed, caller frees it) */
+int defect_map_get_pixels(struct defect_list * list, struct defect_clip * clip, struct defect_xy ** out);
+
+#endif
@@ -22,6 +22,7 @@
 #include "stdio.h"
 #include "stdlib.h"
 #include <time.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "string.h"
@@ -34,6 +35,7 @@
 #include "../dual_iso/optmed.h"
 #include "../dual_iso/wirth.h"
 #include "../mlv_rec/mlv.h"
+#include "defect_map.h"
 
 
 /* useful to clean pink dots, may also help with color aliasing, but it's best turned off if you don't have these problems */
@@ -49,6 +51,12 @@ void fix_vertical_stripes();
 void find_and_fix_cold_pixels(int force_analysis);
 void chroma_smooth();
 
+/* optional persistent defect map, set up by the caller (see defect_map.h) */
+struct defect_map * defect_map = 0;
+struct defect_clip defect_clip;
+int defect_map_update = 0;      /* analyse the frame even if the map knows this clip */
+int defect_map_dark = 0;        /* frames are dark frames: also record hot pixels */
+
 #define EV_RESOLUTION 32768
 
 #ifndef MLV2DNG
@@ -81,18 +89,42 @@ uint32_t file_set_pos(FILE *stream, uint64_t offset, int whence);
 
 int main(int argc, char** argv)
 {
+    /* --defect-map=FILE and --serial=SN may appear anywhere; strip them before looking at the positional arguments */
+    char* defect_map_name = 0;
+    char* camera_serial = "";
+    struct defect_map map;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--defect-map=", 13) == 0)
+        {
+            defect_map_name = argv[i] + 13;
+            memmove(&argv[i], &argv[i+1], (argc - i) * sizeof(argv[0]));
+            argc--; i--;
+        }
+        else if (strncmp(argv[i], "--serial=", 9) == 0)
+        {
+            camera_serial = argv[i] + 9;
+            memmove(&argv[i], &argv[i+1], (argc - i) * sizeof(argv[0]));
+            argc--; i--;
+        }
+    }
+
     if (argc < 2)
     {
         printf(
             "\n"
             "usage:\n"
             "\n"
-            "%s file.raw [prefix|--mlv [sidecar]]\n"
+            "%s file.raw [prefix|--mlv [sidecar]] [--defect-map=FILE --serial=SN]\n"
             "\n"
             "  prefix    will create prefix000000.dng, prefix0000001.dng and so on.\n"
             "   --mlv    will output MLV with unprocessed raw data and the same name as input.\n"
             " sidecar    if needed specify (prerecorded or any) MLV file to override meaningless\n"
             "            metadata values in IDNT, EXPO, LENS and WBAL blocks\n"
+            " --defect-map=FILE\n"
+            "            fix cold pixels from (and add new ones to) a persistent defect map\n"
+            " --serial=SN\n"
+            "            camera serial number for the defect map (.RAW files don't record it)\n"
             "\n",
             argv[0]
         );
@@ -264,6 +296,19 @@ int main(int argc, char** argv)
 
         raw_info.frame_size = lv_rec_footer.frameSize;
         set_idnt_block(); // get the camera name to fill appropriate DNG tag
+
+        /* no serial number or crop info in .RAW files, so the map can only match by frame size,
+         * and only for the camera given on the command line */
+        if (defect_map_name && !camera_serial[0])
+        {
+            printf("Defect map: camera serial unknown (use --serial=SN), not used\n");
+        }
+        else if (defect_map_name && defect_map_load(&map, defect_map_name) == 0)
+        {
+            defect_map = &map;
+            defect_clip_init(&defect_clip, camera_serial, 0, 0, 0, 0,
+                raw_info.width, raw_info.height, raw_info.active_area.x1, raw_info.active_area.y1);
+        }
     }
 
     int framenumber;
@@ -347,6 +392,15 @@ abort:
     
     free(raw);
 
+    if (defect_map)
+    {
+        if (defect_map->dirty)
+        {
+            defect_map_save(defect_map, defect_map_name);
+        }
+        defect_map_free(defect_map);
+    }
+
     if (!mlvout)
     {
         printf(" Done.\n");
@@ -858,15 +912,32 @@ void raw_set_pixel(int x, int y, int value)
  * whether to apply the correction or not.
  * 
  * For speed reasons:
- * - Correction factors are computed from the first frame only.
+ * - Correction factors are computed from the first frame only, or from one frame
+ *   every stripes_sample_interval frames (combined with a running median).
  * - Only channels with error greater than 0.2% are corrected.
+ * - The correction is applied from a lookup table, only on the channels that need it.
  */
 
 #define FIXP_ONE 65536
 #define FIXP_RANGE 65536
 
+/* re-estimate the correction factors every N frames (0 = first frame only) */
+int stripes_sample_interval = 0;
+
+/* the last few estimates are combined with a median; a large jump
+ * (e.g. the video mode changed) restarts it from the new estimate */
+#define STRIPES_HISTORY 7
+#define STRIPES_CHANGE_THR (FIXP_ONE / 200)
+
 static int stripes_coeffs[8] = {0};
 static int stripes_correction_needed = 0;
+static int stripes_history[STRIPES_HISTORY][8];
+static int stripes_history_len = 0;
+
+/* corrected value for each raw value, for the channels that need it */
+static uint16_t stripes_lut[8][16384];
+static int stripes_active[8] = {0};
+static int stripes_lut_black = -1;      /* black level the LUT was built for */
 
 /* do not use typeof in macros, use __typeof__ instead.
    see: http://gcc.gnu.org/onlinedocs/gcc-4.1.2/gcc/Alternate-Keywords.html#Alternate-Keywords
@@ -908,6 +979,25 @@ static int stripes_correction_needed = 0;
 #define SET_PH(x) { int v = (x); p->h = v; }
 
 #define RAW_MUL(p, x) ((((int)(p) - raw_info.black_level) * (int)(x) / FIXP_ONE) + raw_info.black_level)
+
+/* RAW_MUL depends on the black level, so the LUT must follow it */
+static void stripes_build_lut()
+{
+    int j, k;
+
+    /* channels with unity (or unknown) gain are left alone */
+    for (j = 0; j < 8; j++)
+    {
+        stripes_active[j] = stripes_coeffs[j] && stripes_coeffs[j] != FIXP_ONE;
+        if (stripes_active[j])
+        {
+            for (k = 0; k < 16384; k++)
+                stripes_lut[j][k] = COERCE(RAW_MUL(k, stripes_coeffs[j]), 0, 16383);
+        }
+    }
+    stripes_lut_black = raw_info.black_level;
+}
+
 #define F2H(ev) COERCE((int)(FIXP_RANGE/2 + ev * FIXP_RANGE/2), 0, FIXP_RANGE-1)
 #define H2F(x) ((double)((x) - FIXP_RANGE/2) / (FIXP_RANGE/2))
 
@@ -946,7 +1036,7 @@ static void add_pixel(int hist[8][FIXP_RANGE], int num[8], int offset, int pa, i
 }
 
 
-static void detect_vertical_stripes_coeffs()
+static void detect_vertical_stripes_coeffs(int coeffs[8])
 {
     static int hist[8][FIXP_RANGE];
     static int num[8];
@@ -1032,7 +1122,7 @@ static void detect_vertical_stripes_coeffs()
             if (t >= num[j]/2)
             {
                 int c = pow(2, H2F(k)) * FIXP_ONE;
-                stripes_coeffs[j] = c;
+                coeffs[j] = c;
                 break;
             }
         }
@@ -1057,7 +1147,7 @@ static void detect_vertical_stripes_coeffs()
             fprintf(f, "%f ", H2F(k) );
         }
         fprintf(f, "];\n");
-        fprintf(f, "plot(log2(%d/%d) + [0 0], [0 %d], ['*-' c(%d)]); hold on;\n", stripes_coeffs[j], FIXP_ONE, max[j], j-1);
+        fprintf(f, "plot(log2(%d/%d) + [0 0], [0 %d], ['*-' c(%d)]); hold on;\n", coeffs[j], FIXP_ONE, max[j], j-1);
     }
     fprintf(f, "for i = 1:6, plot(x{i}, h{i}, c(i)); hold on; end;");
     fprintf(f, "axis([-0.05 0.05])");
@@ -1065,7 +1155,48 @@ static void detect_vertical_stripes_coeffs()
     system("octave-cli --persist raw2dng.m");
 #endif
 
-    stripes_coeffs[0] = FIXP_ONE;
+    coeffs[0] = FIXP_ONE;
+}
+
+static void update_vertical_stripes_coeffs(int coeffs[8])
+{
+    int j, k;
+
+    /* channels without enough data keep their previous estimate */
+    for (j = 0; j < 8; j++)
+    {
+        if (!coeffs[j])
+            coeffs[j] = stripes_coeffs[j];
+    }
+
+    /* did the correction change a lot since last time? start over */
+    int changed = (stripes_history_len == 0);
+    for (j = 0; j < 8; j++)
+    {
+        if (stripes_coeffs[j] && coeffs[j] && ABS(coeffs[j] - stripes_coeffs[j]) > STRIPES_CHANGE_THR)
+            changed = 1;
+    }
+
+    if (changed)
+    {
+        stripes_history_len = 0;
+    }
+    else if (stripes_history_len == STRIPES_HISTORY)
+    {
+        memmove(stripes_history[0], stripes_history[1], sizeof(stripes_history[0]) * (STRIPES_HISTORY - 1));
+        stripes_history_len--;
+    }
+
+    memcpy(stripes_history[stripes_history_len++], coeffs, sizeof(stripes_history[0]));
+
+    /* running median of the last estimates */
+    for (j = 0; j < 8; j++)
+    {
+        int values[STRIPES_HISTORY];
+        for (k = 0; k < stripes_history_len; k++)
+            values[k] = stripes_history[k][j];
+        stripes_coeffs[j] = median_int_wirth(values, stripes_history_len);
+    }
 
     /* do we really need stripe correction, or it won't be noticeable? or maybe it's just computation error? */
     stripes_correction_needed = 0;
@@ -1075,8 +1206,10 @@ static void detect_vertical_stripes_coeffs()
         if (c < 0.998 || c > 1.002)
             stripes_correction_needed = 1;
     }
+
+    stripes_build_lut();
     
-    if (stripes_correction_needed)
+    if (stripes_correction_needed && changed)
     {
         printf("\n\nVertical stripes correction:\n");
         for (j = 0; j < 8; j++)
@@ -1125,48 +1258,51 @@ static void apply_vertical_stripes_correction()
     }
     
     int black = raw_info.black_level;
+    if (black != stripes_lut_black)
+        stripes_build_lut();
+
     for (row = raw_info.buffer; (void*)row < (void*)raw_info.buffer + raw_info.pitch * raw_info.height; row += raw_info.pitch / sizeof(struct raw_pixblock))
     {
         struct raw_pixblock * p;
         for (p = row; (void*)p < (void*)row + raw_info.pitch; p++)
         {
-            int pa = PA;
-            int pb = PB;
-            int pc = PC;
-            int pd = PD;
-            int pe = PE;
-            int pf = PF;
-            int pg = PG;
-            int ph = PH;
-            
             /**
              * Thou shalt not exceed the white level (the exact one, not the exif one)
              * otherwise you'll be blessed with banding instead of nice and smooth highlight recovery
              * 
              * At very dark levels, you will introduce roundoff errors, so don't correct there
              */
-            
-            if (stripes_coeffs[0] && pa && pa < white && pa > black + 64) SET_PA(MIN(white, RAW_MUL(pa, stripes_coeffs[0])));
-            if (stripes_coeffs[1] && pb && pb < white && pa > black + 64) SET_PB(MIN(white, RAW_MUL(pb, stripes_coeffs[1])));
-            if (stripes_coeffs[2] && pc && pc < white && pa > black + 64) SET_PC(MIN(white, RAW_MUL(pc, stripes_coeffs[2])));
-            if (stripes_coeffs[3] && pd && pd < white && pa > black + 64) SET_PD(MIN(white, RAW_MUL(pd, stripes_coeffs[3])));
-            if (stripes_coeffs[4] && pe && pe < white && pa > black + 64) SET_PE(MIN(white, RAW_MUL(pe, stripes_coeffs[4])));
-            if (stripes_coeffs[5] && pf && pf < white && pa > black + 64) SET_PF(MIN(white, RAW_MUL(pf, stripes_coeffs[5])));
-            if (stripes_coeffs[6] && pg && pg < white && pa > black + 64) SET_PG(MIN(white, RAW_MUL(pg, stripes_coeffs[6])));
-            if (stripes_coeffs[7] && ph && ph < white && pa > black + 64) SET_PH(MIN(white, RAW_MUL(ph, stripes_coeffs[7])));
+            int pa = PA;
+            if (pa <= black + 64)
+                continue;
+
+            /* channels with unity gain are skipped (RAW_MUL would be a no-op) */
+            #define STRIPE_FIX(j, P, SET_P) if (stripes_active[j]) { int sv = P; if (sv && sv < white) SET_P(MIN(white, stripes_lut[j][sv])); }
+            STRIPE_FIX(0, PA, SET_PA);
+            STRIPE_FIX(1, PB, SET_PB);
+            STRIPE_FIX(2, PC, SET_PC);
+            STRIPE_FIX(3, PD, SET_PD);
+            STRIPE_FIX(4, PE, SET_PE);
+            STRIPE_FIX(5, PF, SET_PF);
+            STRIPE_FIX(6, PG, SET_PG);
+            STRIPE_FIX(7, PH, SET_PH);
+            #undef STRIPE_FIX
         }
     }
 }
 
 void fix_vertical_stripes()
 {
-    /* for speed: only detect correction factors from the first frame */
-    static int first_time = 1;
-    if (first_time)
+    /* for speed: only detect correction factors from the first frame,
+     * or from one frame out of stripes_sample_interval */
+    static int frame = 0;
+    if (frame == 0 || (stripes_sample_interval > 0 && frame % stripes_sample_interval == 0))
     {
-        detect_vertical_stripes_coeffs();
-        first_time = 0;
+        int coeffs[8] = {0};
+        detect_vertical_stripes_coeffs(coeffs);
+        update_vertical_stripes_coeffs(coeffs);
     }
+    frame++;
     
     /* only apply stripe correction if we need it, since it takes a little CPU time */
     if (stripes_correction_needed)
@@ -1204,6 +1340,24 @@ void find_and_fix_cold_pixels(int force_analysis)
     int w = raw_info.width;
     int h = raw_info.height;
     
+    /* use the defect map, if it already knows this camera and crop window */
+    struct defect_list * list = defect_map ? defect_map_find(defect_map, &defect_clip) : 0;
+    if (cold_pixels < 0 && list && list->frames && !defect_map_update && !force_analysis)
+    {
+        cold_pixels = 0;
+
+        struct defect_xy * defects;
+        int n = defect_map_get_pixels(list, &defect_clip, &defects);
+        for (int i = 0; i < n && cold_pixels < MAX_COLD_PIXELS; i++)
+        {
+            cold_pixel_list[cold_pixels].x = defects[i].x;
+            cold_pixel_list[cold_pixels].y = defects[i].y;
+            cold_pixels++;
+        }
+        free(defects);
+        printf("\rBad pixels  : %d (from defect map)                \n", (cold_pixels));
+    }
+
     /* scan for bad pixels in the first frame only, or on request*/
     if (cold_pixels < 0 || force_analysis)
     {
@@ -1211,6 +1365,7 @@ void find_and_fix_cold_pixels(int force_analysis)
         
         /* at sane ISOs, noise stdev is well less than 50, so 200 should be enough */
         int cold_thr = MAX(0, raw_info.black_level - 200);
+        int hot_thr = defect_map_dark ? raw_info.black_level + 200 : INT_MAX;
 
         /* analyse all pixels of the frame */
         for (int y = 0; y < h; y++)
@@ -1219,17 +1374,47 @@ void find_and_fix_cold_pixels(int force_analysis)
             {
                 int p = raw_get_pixel(x, y);
                 int is_cold = (p < cold_thr);
+                int is_hot = (p > hot_thr);
 
                 /* create a list containing the cold pixels */
-                if (is_cold && cold_pixels < MAX_COLD_PIXELS)
+                if ((is_cold || is_hot) && cold_pixels < MAX_COLD_PIXELS)
                 {
                     cold_pixel_list[cold_pixels].x = x;
                     cold_pixel_list[cold_pixels].y = y;
                     cold_pixels++;
+
+                    if (defect_map)
+                    {
+                        if (!list)
+                        {
+                            list = defect_map_get(defect_map, &defect_clip);
+                        }
+                        if (list)
+                        {
+                            defect_map_add(defect_map, list, &defect_clip, x, y, is_cold ? DEFECT_COLD : DEFECT_HOT);
+                        }
+                    }
                 }
             }
         }
         printf("\rCold pixels : %d                             \n", (cold_pixels));
+
+        /* merge with what the map already knew (e.g. from other clips), and fix all of them */
+        if (defect_map && (list || (list = defect_map_get(defect_map, &defect_clip))))
+        {
+            defect_map_end_frame(defect_map, list);
+
+            struct defect_xy * defects;
+            int n = defect_map_get_pixels(list, &defect_clip, &defects);
+            cold_pixels = 0;
+            for (int i = 0; i < n && cold_pixels < MAX_COLD_PIXELS; i++)
+            {
+                cold_pixel_list[cold_pixels].x = defects[i].x;
+                cold_pixel_list[cold_pixels].y = defects[i].y;
+                cold_pixels++;
+            }
+            free(defects);
+        }
     }  
 
     /* repair the cold pixels */
@@ -108,6 +108,15 @@ static uint32_t mlv_play_paused = 0;
 static uint32_t mlv_play_info = 1;
 static uint32_t mlv_play_timer_stop = 1;
 static uint32_t mlv_play_frames_skipped = 0;
+static volatile uint32_t mlv_play_timer_running = 0;
+
+/* frames read ahead of the renderer; fewer are used if memory runs out */
+#define MLV_PLAY_BUFFERS 4
+static uint32_t mlv_play_buffers = 0;
+
+/* playback statistics for the info display, averaged over the last few frames */
+static uint32_t mlv_play_read_kbs = 0;
+static uint32_t mlv_play_render_us = 0;
 
 /* this structure is used to build the mlv_xref_t table */
 typedef struct 
@@ -1372,6 +1381,70 @@ static void mlv_play_close_chunks(FILE **chunk_files, uint32_t chunk_count)
     }
 }
 
+/* FIO_ReadFile for frame data, keeping track of the read speed */
+static int32_t mlv_play_read_frame(FILE *f, void *buf, uint32_t size)
+{
+    uint64_t t0 = get_us_clock();
+    int32_t r = FIO_ReadFile(f, buf, size);
+    uint64_t dt = get_us_clock() - t0;
+    
+    if(r > 0 && dt > 0)
+    {
+        uint32_t kbs = (uint64_t) r * 1000000 / 1024 / dt;
+        mlv_play_read_kbs = mlv_play_read_kbs ? (mlv_play_read_kbs * 7 + kbs) / 8 : kbs;
+    }
+    
+    return r;
+}
+
+/* get an empty buffer that can hold frame_size bytes. if memory runs out, play with fewer buffers */
+static frame_buf_t *mlv_play_get_buffer(uint32_t frame_size)
+{
+    while(!mlv_play_should_stop())
+    {
+        frame_buf_t *buffer = NULL;
+        
+        if(msg_queue_receive(mlv_play_queue_empty, &buffer, 100))
+        {
+            continue;
+        }
+        
+        /* check if the queued buffer has the correct size */
+        if(buffer->frameSize != frame_size)
+        {
+            /* the first few queued don't have anything allocated, so don't free */
+            if(buffer->frameBuffer)
+            {
+                fio_free(buffer->frameBuffer);
+            }
+            
+            buffer->frameSize = frame_size;
+            buffer->frameBuffer = fio_malloc(buffer->frameSize);
+        }
+        
+        if(buffer->frameBuffer)
+        {
+            return buffer;
+        }
+        
+        buffer->frameSize = 0;
+        if(mlv_play_buffers > 1)
+        {
+            free(buffer);
+            mlv_play_buffers--;
+            continue;
+        }
+        
+        msg_queue_post(mlv_play_queue_empty, (uint32_t) buffer);
+        bmp_printf(FONT_MED, 30, 400, "allocation failed");
+        beep();
+        msleep(1000);
+        return NULL;
+    }
+    
+    return NULL;
+}
+
 static void mlv_play_render_frame(frame_buf_t *buffer)
 {
     raw_info.buffer = buffer->frameBuffer;
@@ -1436,6 +1509,9 @@ static void mlv_play_render_task(uint32_t priv)
             /* free the pause display buffer */
             msg_queue_post(mlv_play_queue_empty, (uint32_t) buffer_paused);
             buffer_paused = NULL;
+            
+            /* don't count the pause as lag */
+            mlv_play_flush_queue(mlv_play_queue_fps);
         }
 
         if(!buffer->frameBuffer)
@@ -1447,7 +1523,36 @@ static void mlv_play_render_task(uint32_t priv)
             break;
         }
 
+        /* frames are read ahead, the fps timer tells when to show them */
+        if(mlv_play_exact_fps && mlv_play_timer_running)
+        {
+            uint32_t temp = 0;
+            while(mlv_play_timer_running && msg_queue_receive(mlv_play_queue_fps, &temp, 50))
+            {
+                if(mlv_play_render_abort || mlv_play_should_stop())
+                {
+                    break;
+                }
+            }
+            
+            /* behind schedule and the next frame is ready? drop this one instead of falling further behind */
+            uint32_t late = 0;
+            uint32_t ready = 0;
+            msg_queue_count(mlv_play_queue_fps, &late);
+            msg_queue_count(mlv_play_queue_render, &ready);
+            
+            if(late && ready)
+            {
+                mlv_play_frames_skipped++;
+                msg_queue_post(mlv_play_queue_empty, (uint32_t) buffer);
+                continue;
+            }
+        }
+        
+        uint64_t t0 = get_us_clock();
         mlv_play_render_frame(buffer);
+        uint32_t render_us = get_us_clock() - t0;
+        mlv_play_render_us = mlv_play_render_us ? (mlv_play_render_us * 7 + render_us) / 8 : render_us;
         
         /* if info display is requested, paint it. todo: thats OSD stuff, so it should be removed from here */
         if(mlv_play_info)
@@ -1459,6 +1564,9 @@ static void mlv_play_render_task(uint32_t priv)
                 mlv_play_info = 1;
             }
             
+            char stats[SCREEN_MSG_LEN];
+            snprintf(stats, sizeof(stats), "%d.%d MB/s, %d ms, %d dropped", mlv_play_read_kbs / 1024, mlv_play_read_kbs % 1024 * 10 / 1024, mlv_play_render_us / 1000, mlv_play_frames_skipped);
+            
             /* cheap redraw every time, sometimes do a more expensive clearing too */
             if(redraw_loop % 10)
             {
@@ -1466,7 +1574,7 @@ static void mlv_play_render_task(uint32_t priv)
                 bmp_printf(FONT(FONT_MED,COLOR_WHITE,COLOR_BG) | FONT_ALIGN_RIGHT, os.x_max, 0, buffer->messages.topRight);
                 bmp_printf(FONT(FONT_MED,COLOR_WHITE,COLOR_BG), 0, font_med.height, buffer->messages.botLeft);
                 bmp_printf(FONT(FONT_MED,COLOR_WHITE,COLOR_BG) | FONT_ALIGN_RIGHT, os.x_max, font_med.height, buffer->messages.botRight);
-                //bmp_printf(FONT(FONT_MED,COLOR_WHITE,COLOR_BG) | FONT_ALIGN_RIGHT, os.x_max, 2 * font_med.height, "pl: %d", mlv_playlist_entries);
+                bmp_printf(FONT(FONT_MED,COLOR_WHITE,COLOR_BG) | FONT_ALIGN_RIGHT, os.x_max, 2 * font_med.height, stats);
             }
             else
             {
@@ -1474,11 +1582,12 @@ static void mlv_play_render_task(uint32_t priv)
                 (
                     bmp_idle_copy(0,1);
                     bmp_draw_to_idle(1);
-                    bmp_fill(COLOR_BG, 0, 0, 720, 2 * font_med.height);
+                    bmp_fill(COLOR_BG, 0, 0, 720, 3 * font_med.height);
                     bmp_printf(FONT(FONT_MED,COLOR_WHITE,COLOR_BG), 0, 0, buffer->messages.topLeft);
                     bmp_printf(FONT(FONT_MED,COLOR_WHITE,COLOR_BG) | FONT_ALIGN_RIGHT, os.x_max, 0, buffer->messages.topRight);
                     bmp_printf(FONT(FONT_MED,COLOR_WHITE,COLOR_BG), 0, font_med.height, buffer->messages.botLeft);
                     bmp_printf(FONT(FONT_MED,COLOR_WHITE,COLOR_BG) | FONT_ALIGN_RIGHT, os.x_max, font_med.height, buffer->messages.botRight);
+                    bmp_printf(FONT(FONT_MED,COLOR_WHITE,COLOR_BG) | FONT_ALIGN_RIGHT, os.x_max, 2 * font_med.height, stats);
                     bmp_draw_to_idle(0);
                     bmp_idle_copy(1,0);
                 )
@@ -1571,6 +1680,7 @@ static void mlv_play_fps_tick(int expiry_value, void *priv)
 
 static void mlv_play_stop_fps_timer()
 {
+    mlv_play_timer_running = 0;
     mlv_play_timer_stop = 1;
     while(mlv_play_timer_stop)
     {
@@ -1609,6 +1719,7 @@ static void mlv_play_start_fps_timer(uint32_t fps_nom, uint32_t fps_denom)
     mlv_play_frames_skipped = 0;
     
     /* and finally start timer in 1 us */
+    mlv_play_timer_running = 1;
     SetHPTimerAfterNow(1, &mlv_play_fps_tick, &mlv_play_fps_tick, NULL);
 }
 
@@ -1687,10 +1798,12 @@ static void mlv_play_mlv(char *filename, FILE **chunk_files, uint32_t chunk_coun
             if (xrefs[block_xref_pos].frameType == MLV_FRAME_VIDF)
             {
                 uint32_t frames_to_skip = 0;
+                uint32_t frames_queued = 0;
                 msg_queue_count(mlv_play_queue_fps, &frames_to_skip);
+                msg_queue_count(mlv_play_queue_render, &frames_queued);
 
-                /* skip this frame if we are behind */
-                if(frames_to_skip > 0)
+                /* skip reading this frame if we are behind even after showing the frames already read */
+                if(frames_to_skip > frames_queued)
                 {
                     uint32_t temp = 0;
                     msg_queue_receive(mlv_play_queue_fps, &temp, 50);
@@ -1718,14 +1831,23 @@ static void mlv_play_mlv(char *filename, FILE **chunk_files, uint32_t chunk_coun
         mlv_hdr_t buf;
         
         FIO_SeekSkipFile(in_file, position, SEEK_SET);
-        if(FIO_ReadFile(in_file, &buf, sizeof(mlv_hdr_t)) != sizeof(mlv_hdr_t))
+        
+        /* the index already knows the video frames, no need to peek at their header */
+        if(xrefs[block_xref_pos].frameType == MLV_FRAME_VIDF)
         {
-            bmp_printf(FONT_MED, 30, 190, "File ends prematurely during block header");
-            beep();
-            msleep(1000);
-            break;
+            memcpy(buf.blockType, "VIDF", 4);
+        }
+        else
+        {
+            if(FIO_ReadFile(in_file, &buf, sizeof(mlv_hdr_t)) != sizeof(mlv_hdr_t))
+            {
+                bmp_printf(FONT_MED, 30, 190, "File ends prematurely during block header");
+                beep();
+                msleep(1000);
+                break;
+            }
+            FIO_SeekSkipFile(in_file, position, SEEK_SET);
         }
-        FIO_SeekSkipFile(in_file, position, SEEK_SET);
         
         /* special case: if first block read, reset frame count as all MLVI blocks frame count will get accumulated */
         if(block_xref_pos == 0)
@@ -1816,35 +1938,13 @@ static void mlv_play_mlv(char *filename, FILE **chunk_files, uint32_t chunk_coun
         }
         else if(!memcmp(buf.blockType, "VIDF", 4))
         {
-            frame_buf_t *buffer = NULL;
             mlv_vidf_hdr_t vidf_block;
             
             /* now get a buffer from the queue */
-            while (msg_queue_receive(mlv_play_queue_empty, &buffer, 100) && !mlv_play_should_stop());
-
-            if (mlv_play_should_stop())
-            {
-                break;
-            }
+            frame_buf_t *buffer = mlv_play_get_buffer(frame_size);
             
-            /* check if the queued buffer has the correct size */
-            if(buffer->frameSize != frame_size)
-            {
-                /* the first few queued don't have anything allocated, so don't free */
-                if(buffer->frameBuffer)
-                {
-                    fio_free(buffer->frameBuffer);
-                }
-                
-                buffer->frameSize = frame_size;
-                buffer->frameBuffer = fio_malloc(buffer->frameSize);
-            }
-
-            if(!buffer->frameBuffer)
+            if(!buffer)
             {
-                bmp_printf(FONT_MED, 30, 400, "allocation failed");
-                beep();
-                msleep(1000);
                 break;
             }
             
@@ -1869,7 +1969,7 @@ static void mlv_play_mlv(char *filename, FILE **chunk_files, uint32_t chunk_coun
             FIO_SeekSkipFile(in_file, position + sizeof(mlv_vidf_hdr_t) + vidf_block.frameSpace, SEEK_SET);
 
             /* finally read the raw data */
-            if(FIO_ReadFile(in_file, buffer->frameBuffer, buffer->frameSize) != (int32_t)buffer->frameSize)
+            if(mlv_play_read_frame(in_file, buffer->frameBuffer, buffer->frameSize) != (int32_t)buffer->frameSize)
             {
                 bmp_printf(FONT_MED, 30, 190, "File ends prematurely during VIDF raw data");
                 beep();
@@ -1914,26 +2014,11 @@ static void mlv_play_mlv(char *filename, FILE **chunk_files, uint32_t chunk_coun
             raw_info.black_level = rawi_block.raw_info.black_level;
             raw_info.white_level = rawi_block.raw_info.white_level;
             
-            if (mlv_play_exact_fps)
+            /* the render task waits until it is time to show the frame */
+            if (mlv_play_exact_fps && !fps_timer_started)
             {
-                if (!fps_timer_started)
-                {
-                    mlv_play_start_fps_timer(main_header.sourceFpsNom, main_header.sourceFpsDenom);
-                    fps_timer_started = 1;
-                }
-                
-                if (fps_timer_started)
-                {
-                    /* wait till it is time to render */
-                    uint32_t temp = 0;
-                    while(msg_queue_receive(mlv_play_queue_fps, &temp, 50))
-                    {
-                        if(mlv_play_should_stop())
-                        {
-                            break;
-                        }
-                    }
-                }
+                mlv_play_start_fps_timer(main_header.sourceFpsNom, main_header.sourceFpsDenom);
+                fps_timer_started = 1;
             }
             
             /* queue frame buffer for rendering, retry if queue is full (happens in pause or for slow rendering) */
@@ -2004,10 +2089,12 @@ static void mlv_play_raw(char *filename, FILE **chunk_files, uint32_t chunk_coun
         if(mlv_play_exact_fps)
         {
             uint32_t frames_to_skip = 0;
+            uint32_t frames_queued = 0;
             msg_queue_count(mlv_play_queue_fps, &frames_to_skip);
+            msg_queue_count(mlv_play_queue_render, &frames_queued);
 
-            /* skip frame if we should play at exact fps and we already should be one frame farther */
-            if(frames_to_skip > 0)
+            /* skip frame if we should play at exact fps and we are behind even after showing the frames already read */
+            if(frames_to_skip > frames_queued)
             {
                 uint32_t temp = 0;
                 msg_queue_receive(mlv_play_queue_fps, &temp, 50);
@@ -2049,43 +2136,20 @@ static void mlv_play_raw(char *filename, FILE **chunk_files, uint32_t chunk_coun
             break;
         }
         
-        frame_buf_t *buffer = NULL;
-        
         while(mlv_play_paused && !mlv_play_should_stop())
         {
             msleep(100);
         }
         
         /* now get a buffer from the queue */
-        while (msg_queue_receive(mlv_play_queue_empty, &buffer, 100) && !mlv_play_should_stop());
-        
-        if (mlv_play_should_stop())
-        {
-            break;
-        }
+        frame_buf_t *buffer = mlv_play_get_buffer(frame_size);
         
-        /* check if the queued buffer has the correct size */
-        if((int32_t)buffer->frameSize != frame_size)
-        {
-            /* the first few queued dont have anything allocated, so dont free */
-            if(buffer->frameBuffer)
-            {
-                free(buffer->frameBuffer);
-            }
-            
-            buffer->frameSize = frame_size;
-            buffer->frameBuffer = fio_malloc(buffer->frameSize);
-        }
-
-        if(!buffer->frameBuffer)
+        if(!buffer)
         {
-            bmp_printf(FONT_MED, 30, 400, "allocation failed");
-            beep();
-            msleep(1000);
             break;
         }
         
-        int32_t r = FIO_ReadFile(chunk_files[chunk_num], buffer->frameBuffer, frame_size);
+        int32_t r = mlv_play_read_frame(chunk_files[chunk_num], buffer->frameBuffer, frame_size);
         
         /* reading failed */
         if(r < 0)
@@ -2108,7 +2172,7 @@ static void mlv_play_raw(char *filename, FILE **chunk_files, uint32_t chunk_coun
             /* read remaining block from next chunk */
             chunk_num++;
             int remain = frame_size - r;
-            r = FIO_ReadFile(chunk_files[chunk_num], (void*)((uint32_t)buffer->frameBuffer + r), remain);
+            r = mlv_play_read_frame(chunk_files[chunk_num], (void*)((uint32_t)buffer->frameBuffer + r), remain);
             
             /* it doesnt have enough data. thats enough errors... */
             if(r != remain)
@@ -2134,26 +2198,11 @@ static void mlv_play_raw(char *filename, FILE **chunk_files, uint32_t chunk_coun
         buffer->bitDepth = 14;
         buffer->blackLevel = raw_info.black_level;
         
-        if (mlv_play_exact_fps)
+        /* the render task waits until it is time to show the frame */
+        if (mlv_play_exact_fps && !fps_timer_started)
         {
-            if (!fps_timer_started)
-            {
-                mlv_play_start_fps_timer(fps1000, 1000);
-                fps_timer_started = 1;
-            }
-
-            if (fps_timer_started)
-            {
-                /* wait till it is time to render */
-                uint32_t temp = 0;
-                while(msg_queue_receive(mlv_play_queue_fps, &temp, 50))
-                {
-                    if(mlv_play_should_stop())
-                    {
-                        break;
-                    }
-                }
-            }
+            mlv_play_start_fps_timer(fps1000, 1000);
+            fps_timer_started = 1;
         }
 
         /* requeue frame buffer for rendering */
@@ -2171,6 +2220,9 @@ static void mlv_play_raw(char *filename, FILE **chunk_files, uint32_t chunk_coun
 static void mlv_play(char *filename, FILE **chunk_files, uint32_t chunk_count)
 {
     mlv_play_stopfile = 0;
+    mlv_play_read_kbs = 0;
+    mlv_play_render_us = 0;
+    mlv_play_frames_skipped = 0;
     
     if(mlv_play_is_mlv(chunk_files[0]))
     {
@@ -2396,7 +2448,8 @@ static void mlv_play_enter_playback()
     raw_twk_set_zoom(mlv_play_zoom, mlv_play_zoom_x_pct, mlv_play_zoom_y_pct);
     
     /* queue a few buffers that are not allocated yet */
-    for(int num = 0; num < 3; num++)
+    mlv_play_buffers = 0;
+    for(int num = 0; num < MLV_PLAY_BUFFERS; num++)
     {
         frame_buf_t *buffer = malloc(sizeof(frame_buf_t));
         if (buffer)
@@ -2405,6 +2458,7 @@ static void mlv_play_enter_playback()
             buffer->frameBuffer = NULL;
             
             msg_queue_post(mlv_play_queue_empty, (uint32_t) buffer);
+            mlv_play_buffers++;
         }
     }
     
@@ -0,0 +1,676 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "calib_lib.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* file layout (little endian):
+ *   "MCAL", version, number of entries
+ *   struct calib_entry[number of entries]
+ *   uint16_t data of all entries, at the offsets given in the index
+ */
+#define CALIB_LIB_MAGIC     "MCAL"
+#define CALIB_LIB_VERSION   1
+
+int calib_lib_load(struct calib_lib * lib, const char * filename)
+{
+    memset(lib, 0, sizeof(*lib));
+    lib->filename = strdup(filename);
+
+    FILE * f = fopen(filename, "rb");
+    if (!f)
+    {
+        /* will be created */
+        return 0;
+    }
+
+    char magic[4];
+    uint32_t version, num_entries;
+    if (fread(magic, 4, 1, f) != 1 || memcmp(magic, CALIB_LIB_MAGIC, 4) ||
+        fread(&version, 4, 1, f) != 1 || version != CALIB_LIB_VERSION ||
+        fread(&num_entries, 4, 1, f) != 1)
+    {
+        fprintf(stderr, "%s: not a calibration library\n", filename);
+        fclose(f);
+        calib_lib_free(lib);
+        return -1;
+    }
+
+    lib->entries = malloc(num_entries * sizeof(lib->entries[0]));
+    lib->data = calloc(num_entries, sizeof(lib->data[0]));
+    if (num_entries && (!lib->entries || !lib->data ||
+        fread(lib->entries, sizeof(lib->entries[0]), num_entries, f) != num_entries))
+    {
+        fprintf(stderr, "%s: truncated calibration library\n", filename);
+        fclose(f);
+        calib_lib_free(lib);
+        return -1;
+    }
+
+    lib->num_entries = num_entries;
+    fclose(f);
+    return 0;
+}
+
+/* number of values a master with this key must have */
+static uint32_t calib_key_count(struct calib_key * key)
+{
+    switch (key->mode)
+    {
+        case CALIB_FULL:        return (uint32_t) key->width * key->height;
+        case CALIB_VERTICAL:    return key->width;
+        case CALIB_HORIZONTAL:  return key->height;
+    }
+    return 0;
+}
+
+const uint16_t * calib_lib_get_data(struct calib_lib * lib, struct calib_entry * entry)
+{
+    int i = entry - lib->entries;
+    if (lib->data[i])
+    {
+        return lib->data[i];
+    }
+
+    /* the index comes from the file, don't trust it */
+    if (!entry->count || entry->count != calib_key_count(&entry->key))
+    {
+        fprintf(stderr, "%s: calibration frame %d has %u values, expected %u\n",
+            lib->filename, i, entry->count, calib_key_count(&entry->key));
+        return 0;
+    }
+
+    FILE * f = fopen(lib->filename, "rb");
+    long file_size = -1;
+    if (f && !fseek(f, 0, SEEK_END))
+    {
+        file_size = ftell(f);
+    }
+    if (!f || file_size < 0 || (uint64_t) entry->offset + (uint64_t) entry->count * sizeof(uint16_t) > (uint64_t) file_size)
+    {
+        fprintf(stderr, "%s: calibration frame %d is outside the file\n", lib->filename, i);
+        if (f) fclose(f);
+        return 0;
+    }
+
+    uint16_t * data = malloc(entry->count * sizeof(data[0]));
+    if (!data || fseek(f, entry->offset, SEEK_SET) ||
+        fread(data, sizeof(data[0]), entry->count, f) != entry->count)
+    {
+        fprintf(stderr, "%s: could not read calibration frame %d\n", lib->filename, i);
+        fclose(f);
+        free(data);
+        return 0;
+    }
+
+    fclose(f);
+    lib->data[i] = data;
+    return data;
+}
+
+int calib_lib_save(struct calib_lib * lib)
+{
+    /* we are about to overwrite the file the data is loaded from */
+    for (int i = 0; i < lib->num_entries; i++)
+    {
+        if (!calib_lib_get_data(lib, &lib->entries[i]))
+        {
+            return -1;
+        }
+    }
+
+    FILE * f = fopen(lib->filename, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "%s: could not create calibration library\n", lib->filename);
+        return -1;
+    }
+
+    uint32_t version = CALIB_LIB_VERSION;
+    uint32_t num_entries = lib->num_entries;
+    uint32_t offset = 12 + num_entries * sizeof(lib->entries[0]);
+    for (int i = 0; i < lib->num_entries; i++)
+    {
+        lib->entries[i].offset = offset;
+        offset += lib->entries[i].count * sizeof(uint16_t);
+    }
+
+    int ok = fwrite(CALIB_LIB_MAGIC, 4, 1, f) == 1 &&
+             fwrite(&version, 4, 1, f) == 1 &&
+             fwrite(&num_entries, 4, 1, f) == 1 &&
+             (!num_entries || fwrite(lib->entries, sizeof(lib->entries[0]), num_entries, f) == num_entries);
+
+    for (int i = 0; ok && i < lib->num_entries; i++)
+    {
+        uint32_t count = lib->entries[i].count;
+        ok = fwrite(lib->data[i], sizeof(uint16_t), count, f) == count;
+    }
+
+    fclose(f);
+
+    if (!ok)
+    {
+        fprintf(stderr, "%s: could not write calibration library\n", lib->filename);
+        return -1;
+    }
+
+    lib->dirty = 0;
+    return 0;
+}
+
+void calib_lib_free(struct calib_lib * lib)
+{
+    for (int i = 0; i < lib->num_entries; i++)
+    {
+        free(lib->data[i]);
+    }
+    free(lib->data);
+    free(lib->entries);
+    free(lib->filename);
+    memset(lib, 0, sizeof(*lib));
+}
+
+int calib_lib_add(struct calib_lib * lib, struct calib_key * key, uint32_t frames,
+    int black_level, int bits_per_pixel, const uint16_t * values, uint32_t count)
+{
+    /* a master without camera serial would be used for any camera */
+    if (!key->serial[0])
+    {
+        fprintf(stderr, "%s: camera serial unknown, master frame not stored\n", lib->filename);
+        return -1;
+    }
+
+    uint16_t * data = malloc(count * sizeof(data[0]));
+    if (!data)
+    {
+        return -1;
+    }
+    memcpy(data, values, count * sizeof(data[0]));
+
+    int i;
+    for (i = 0; i < lib->num_entries; i++)
+    {
+        if (!memcmp(&lib->entries[i].key, key, sizeof(*key)))
+        {
+            break;
+        }
+    }
+
+    if (i == lib->num_entries)
+    {
+        struct calib_entry * entries = realloc(lib->entries, (i + 1) * sizeof(entries[0]));
+        if (entries)
+        {
+            lib->entries = entries;
+        }
+        uint16_t ** ptrs = realloc(lib->data, (i + 1) * sizeof(ptrs[0]));
+        if (ptrs)
+        {
+            lib->data = ptrs;
+        }
+        if (!entries || !ptrs)
+        {
+            free(data);
+            return -1;
+        }
+        lib->data[i] = 0;
+        lib->num_entries++;
+    }
+
+    struct calib_entry * entry = &lib->entries[i];
+    memset(entry, 0, sizeof(*entry));
+    entry->key = *key;
+    entry->frames = frames;
+    entry->black_level = black_level;
+    entry->bits_per_pixel = bits_per_pixel;
+    entry->count = count;
+
+    free(lib->data[i]);
+    lib->data[i] = data;
+    lib->dirty = 1;
+    return 0;
+}
+
+/* distance between two exposure times, in EV */
+static float shutter_distance(uint32_t a, uint32_t b)
+{
+    if (!a || !b)
+    {
+        return 0;
+    }
+    return fabsf(log2f((float)a / b));
+}
+
+struct calib_entry * calib_lib_find(struct calib_lib * lib, struct calib_key * key, int type)
+{
+    struct calib_entry * best = 0;
+    float best_score = 0;
+
+    for (int i = 0; i < lib->num_entries; i++)
+    {
+        struct calib_key * k = &lib->entries[i].key;
+
+        /* the frame geometry must match exactly */
+        if (k->type != type || k->width != key->width || k->height != key->height ||
+            k->crop_x != key->crop_x || k->crop_y != key->crop_y ||
+            k->sampling_x != key->sampling_x || k->sampling_y != key->sampling_y)
+        {
+            continue;
+        }
+
+        /* only masters from the same camera; an unknown serial matches nothing */
+        if (!k->serial[0] || !key->serial[0] || strncmp(k->serial, key->serial, sizeof(k->serial)))
+        {
+            continue;
+        }
+        if (k->camera_model && key->camera_model && k->camera_model != key->camera_model)
+        {
+            continue;
+        }
+
+        int iso_differs = k->iso && key->iso && k->iso != key->iso;
+        float score;
+
+        if (type == CALIB_DARK)
+        {
+            /* dark signal depends on gain: same ISO only, then the closest exposure time,
+             * full frames before banding profiles */
+            if (iso_differs)
+            {
+                continue;
+            }
+            score = shutter_distance(k->shutter_us, key->shutter_us) + (k->mode != CALIB_FULL ? 0.01f : 0);
+        }
+        else
+        {
+            /* vignetting and dust don't depend on exposure, prefer the same ISO anyway */
+            score = (iso_differs ? 1.0f : 0) + shutter_distance(k->shutter_us, key->shutter_us) / 1000;
+        }
+
+        if (!best || score < best_score)
+        {
+            best = &lib->entries[i];
+            best_score = score;
+        }
+    }
+
+    return best;
+}
+
+/* flat-field gains: normalize the flat frame on each Bayer channel (median)
+ * and adjust all medians using green's 5th percentile to prevent whites from clipping.
+ * the gain is kept as an integer ratio, so the result is the same as with the old -t code */
+static int calib_flat_gains(struct calib_master * master, const uint16_t * flat, int black, int bpp)
+{
+    int w = master->width;
+    int h = master->height;
+    int levels = 1 << bpp;
+    int32_t med[2][2] = {{0,0},{0,0}};
+    int32_t pr5[2][2] = {{0,0},{0,0}};
+
+    /* normalize using frame center only (also works on lenses with heavy vignetting) */
+    int * hist = calloc(4 * levels, sizeof(int));
+    if (!hist)
+    {
+        return -1;
+    }
+
+    int total[2][2] = {{0,0},{0,0}};
+    for (int y = h/4; y < h*3/4; y++)
+    {
+        for (int x = w/4; x < w*3/4; x++)
+        {
+            hist[((y%2)*2 + x%2) * levels + (flat[x + y*w] & (levels-1))]++;
+            total[y%2][x%2]++;
+        }
+    }
+
+    for (int dy = 0; dy < 2; dy++)
+    {
+        for (int dx = 0; dx < 2; dx++)
+        {
+            int * ch = &hist[(dy*2 + dx) * levels];
+            int acc = 0;
+            for (int i = 0; i < levels; i++)
+            {
+                acc += ch[i];
+
+                if (acc < total[dy][dx]/20)
+                {
+                    /* 5th percentile */
+                    pr5[dy][dx] = i - black;
+                }
+
+                if (acc < total[dy][dx]/2)
+                {
+                    /* median */
+                    med[dy][dx] = i - black;
+                }
+            }
+        }
+    }
+    free(hist);
+
+    int32_t adj_num = (pr5[0][1] + pr5[1][0]) / 2;
+    int32_t adj_den = (med[0][1] + med[1][0]) / 2;
+
+    printf("Flat-field median: [%d %d; %d %d], adjusted by %d/%d\n",
+        med[0][0], med[0][1],
+        med[1][0], med[1][1],
+        adj_num, adj_den
+    );
+
+    if (adj_num <= 0 || adj_den <= 0)
+    {
+        fprintf(stderr, "Flat-field frame is too dark, not used\n");
+        return -1;
+    }
+
+    for (int y = 0; y < h; y++)
+    {
+        const uint16_t * line = &flat[y * w];
+        for (int x = 0; x < w; x++)
+        {
+            int flat_value = line[x];
+
+            if (flat_value - black <= 0)
+            {
+                int left  = line[x > 0 ? x-1 : 0];
+                int right = line[x < w-1 ? x+1 : w-1];
+                flat_value = left > right ? left : right;
+            }
+
+            master->flat[x + y*w] = (flat_value - black > 0) ? flat_value - black : 0;
+        }
+    }
+
+    for (int dy = 0; dy < 2; dy++)
+    {
+        for (int dx = 0; dx < 2; dx++)
+        {
+            master->flat_num[dy][dx] = (int64_t) med[dy][dx] * adj_num;
+        }
+    }
+    master->flat_den = adj_den;
+
+    return 0;
+}
+
+static int scale_level(int value, int src_bpp, int bpp)
+{
+    return (bpp >= src_bpp) ? value << (bpp - src_bpp) : value >> (src_bpp - bpp);
+}
+
+int calib_master_init(struct calib_master * master, int type, int mode, int width, int height,
+    const uint16_t * values, int src_black, int src_bpp, int black, int bpp)
+{
+    memset(master, 0, sizeof(*master));
+    master->type = type;
+    master->mode = mode;
+    master->width = width;
+    master->height = height;
+    master->black = black;
+    master->max_value = (1 << bpp) - 1;
+
+    if (type == CALIB_FLAT)
+    {
+        if (mode != CALIB_FULL)
+        {
+            fprintf(stderr, "Flat-field profiles are not supported\n");
+            return -1;
+        }
+
+        master->flat = malloc(width * height * sizeof(master->flat[0]));
+        if (!master->flat || calib_flat_gains(master, values, src_black, src_bpp))
+        {
+            calib_master_free(master);
+            return -1;
+        }
+        return 0;
+    }
+
+    int count = (mode == CALIB_VERTICAL) ? width : (mode == CALIB_HORIZONTAL) ? height : width * height;
+    master->dark = malloc(count * sizeof(master->dark[0]));
+    if (!master->dark)
+    {
+        return -1;
+    }
+
+    /* dark values are converted to the bit depth of the clip once, here */
+    for (int i = 0; i < count; i++)
+    {
+        master->dark[i] = scale_level(values[i], src_bpp, bpp);
+    }
+    return 0;
+}
+
+int calib_master_init_entry(struct calib_master * master, struct calib_lib * lib,
+    struct calib_entry * entry, int black, int bpp)
+{
+    const uint16_t * values = calib_lib_get_data(lib, entry);
+    if (!values)
+    {
+        return -1;
+    }
+
+    return calib_master_init(master, entry->key.type, entry->key.mode, entry->key.width, entry->key.height,
+        values, entry->black_level, entry->bits_per_pixel, black, bpp);
+}
+
+void calib_master_free(struct calib_master * master)
+{
+    free(master->dark);
+    free(master->flat);
+    memset(master, 0, sizeof(*master));
+}
+
+/* MLV image data is a stream of little endian 16-bit words, pixels are stored MSB first */
+void calib_unpack_line(uint16_t * dst, const uint16_t * src, int width, int bpp)
+{
+    uint32_t mask = (1 << bpp) - 1;
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for (int x = 0; x < width; x++)
+    {
+        if (bits < bpp)
+        {
+            acc = (acc << 16) | *src++;
+            bits += 16;
+        }
+        bits -= bpp;
+        dst[x] = (acc >> bits) & mask;
+    }
+}
+
+void calib_pack_line(uint16_t * dst, const uint16_t * src, int width, int bpp)
+{
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for (int x = 0; x < width; x++)
+    {
+        acc = (acc << bpp) | src[x];
+        bits += bpp;
+        if (bits >= 16)
+        {
+            bits -= 16;
+            *dst++ = acc >> bits;
+        }
+    }
+
+    /* last, partial word: keep the bits that belong to the next line */
+    if (bits)
+    {
+        uint32_t keep = (1 << (16 - bits)) - 1;
+        *dst = ((acc << (16 - bits)) & ~keep & 0xFFFF) | (*dst & keep);
+    }
+}
+
+/* value + black - dark, clamped to 0 .. max_value */
+static void dark_kernel(uint16_t * line, const uint16_t * dark, int width, int black, int max_value)
+{
+    int x = 0;
+
+#if defined(__SSE2__)
+    /* unsigned saturation does the clamping at 0; min() only exists for signed words */
+    __m128i vblack = _mm_set1_epi16(black);
+    __m128i vsign = _mm_set1_epi16(0x8000);
+    __m128i vmax = _mm_set1_epi16(max_value ^ 0x8000);
+    for ( ; x + 8 <= width; x += 8)
+    {
+        __m128i v = _mm_loadu_si128((__m128i *)&line[x]);
+        __m128i d = _mm_loadu_si128((__m128i *)&dark[x]);
+        v = _mm_subs_epu16(_mm_adds_epu16(v, vblack), d);
+        v = _mm_xor_si128(_mm_min_epi16(_mm_xor_si128(v, vsign), vmax), vsign);
+        _mm_storeu_si128((__m128i *)&line[x], v);
+    }
+#endif
+
+    for ( ; x < width; x++)
+    {
+        int value = line[x] + black;
+        value = (value > 0xFFFF ? 0xFFFF : value) - dark[x];
+        line[x] = value < 0 ? 0 : value > max_value ? max_value : value;
+    }
+}
+
+/* same, with one dark value for the whole line */
+static void dark_kernel_const(uint16_t * line, int dark, int width, int black, int max_value)
+{
+    int x = 0;
+
+#if defined(__SSE2__)
+    __m128i vblack = _mm_set1_epi16(black);
+    __m128i vdark = _mm_set1_epi16(dark);
+    __m128i vsign = _mm_set1_epi16(0x8000);
+    __m128i vmax = _mm_set1_epi16(max_value ^ 0x8000);
+    for ( ; x + 8 <= width; x += 8)
+    {
+        __m128i v = _mm_loadu_si128((__m128i *)&line[x]);
+        v = _mm_subs_epu16(_mm_adds_epu16(v, vblack), vdark);
+        v = _mm_xor_si128(_mm_min_epi16(_mm_xor_si128(v, vsign), vmax), vsign);
+        _mm_storeu_si128((__m128i *)&line[x], v);
+    }
+#endif
+
+    for ( ; x < width; x++)
+    {
+        int value = line[x] + black;
+        value = (value > 0xFFFF ? 0xFFFF : value) - dark;
+        line[x] = value < 0 ? 0 : value > max_value ? max_value : value;
+    }
+}
+
+void calib_apply_dark(struct calib_master * master, uint16_t * line, int y)
+{
+    int w = master->width;
+
+    switch (master->mode)
+    {
+        case CALIB_FULL:
+            dark_kernel(line, &master->dark[y * w], w, master->black, master->max_value);
+            break;
+        case CALIB_VERTICAL:
+            dark_kernel(line, master->dark, w, master->black, master->max_value);
+            break;
+        case CALIB_HORIZONTAL:
+            dark_kernel_const(line, master->dark[y], w, master->black, master->max_value);
+            break;
+    }
+}
+
+/* (value - black) * num / den / flat + black, clamped to 0 .. max_value
+ * rounded like the old -t code: both divisions truncate towards zero */
+void calib_apply_flat(struct calib_master * master, uint16_t * line, int y)
+{
+    int w = master->width;
+    int black = master->black;
+    int max_value = master->max_value;
+    const uint16_t * flat = &master->flat[y * w];
+    const int64_t * num = master->flat_num[y%2];
+    int64_t den = master->flat_den;
+    int x = 0;
+
+#if defined(__SSE2__)
+    /* 2 pixels per double vector. (value - black) * num and den * flat are exact in a double,
+     * and for results below 2^20 the rounded quotient can't cross an integer, so truncating it
+     * gives the same as the integer divisions; larger results are clipped anyway.
+     * the results are packed back with signed saturation, after moving the unsigned range down by 0x8000 */
+    __m128i zero = _mm_setzero_si128();
+    __m128i vblack = _mm_set1_epi32(black - 0x8000);
+    __m128i vblack_in = _mm_set1_epi32(black);
+    __m128i vsign = _mm_set1_epi16(0x8000);
+    __m128i vmax = _mm_set1_epi16(max_value ^ 0x8000);
+    __m128d vnum = _mm_set_pd(num[1], num[0]);
+    __m128d vden = _mm_set1_pd(den);
+    __m128d vlimit = _mm_set1_pd(65536);
+    __m128d vlimit_neg = _mm_set1_pd(-65536);
+    for ( ; x + 8 <= w; x += 8)
+    {
+        __m128i v = _mm_loadu_si128((__m128i *)&line[x]);
+        __m128i f = _mm_loadu_si128((__m128i *)&flat[x]);
+        __m128i a[2] = {
+            _mm_sub_epi32(_mm_unpacklo_epi16(v, zero), vblack_in),
+            _mm_sub_epi32(_mm_unpackhi_epi16(v, zero), vblack_in),
+        };
+        __m128i d[2] = {
+            _mm_unpacklo_epi16(f, zero),
+            _mm_unpackhi_epi16(f, zero),
+        };
+        __m128i q[4];
+        for (int i = 0; i < 4; i++)
+        {
+            __m128i ai = (i & 1) ? _mm_srli_si128(a[i/2], 8) : a[i/2];
+            __m128i di = (i & 1) ? _mm_srli_si128(d[i/2], 8) : d[i/2];
+            __m128d r = _mm_div_pd(
+                _mm_mul_pd(_mm_cvtepi32_pd(ai), vnum),
+                _mm_mul_pd(_mm_cvtepi32_pd(di), vden)
+            );
+            r = _mm_min_pd(_mm_max_pd(r, vlimit_neg), vlimit);
+            q[i] = _mm_cvttpd_epi32(r);
+        }
+        __m128i lo = _mm_add_epi32(_mm_unpacklo_epi64(q[0], q[1]), vblack);
+        __m128i hi = _mm_add_epi32(_mm_unpacklo_epi64(q[2], q[3]), vblack);
+        __m128i r = _mm_xor_si128(_mm_min_epi16(_mm_packs_epi32(lo, hi), vmax), vsign);
+
+        /* pixels without a valid flat value are left as is */
+        __m128i keep = _mm_cmpeq_epi16(f, zero);
+        v = _mm_or_si128(_mm_and_si128(keep, v), _mm_andnot_si128(keep, r));
+        _mm_storeu_si128((__m128i *)&line[x], v);
+    }
+#endif
+
+    for ( ; x < w; x++)
+    {
+        if (flat[x])
+        {
+            int64_t value = (int64_t) (line[x] - black) * num[x%2] / den / flat[x] + black;
+            line[x] = value < 0 ? 0 : value > max_value ? max_value : value;
+        }
+    }
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* Calibration library for mlv_dump: master dark and flat frames.
+ *
+ * Masters are averaged from a calibration clip (mlv_dump -a) and stored
+ * in one indexed file, keyed by camera, ISO, shutter, frame size and crop
+ * position. When processing a clip, the best matching master is picked
+ * automatically. Darks may also be stored as banding profiles only
+ * (one value per column or per row, from --avg-vertical / --avg-horizontal).
+ *
+ * The index is read when the library is opened; the frame data of an
+ * entry is only read when it is used.
+ *
+ * A master is turned into a struct calib_master for the clip being
+ * processed; the correction kernels then work on unpacked image lines
+ * (see calib_unpack_line / calib_pack_line).
+ */
+
+#ifndef _calib_lib_h_
+#define _calib_lib_h_
+
+#include <stdint.h>
+
+#define CALIB_DARK          1
+#define CALIB_FLAT          2
+
+#define CALIB_FULL          0   /* one value per pixel */
+#define CALIB_VERTICAL      1   /* one value per column (vertical banding) */
+#define CALIB_HORIZONTAL    2   /* one value per row (horizontal banding) */
+
+/* capture settings a master is valid for */
+struct calib_key
+{
+    char serial[32];            /* camera serial; required, masters are never shared between cameras */
+    uint32_t camera_model;      /* 0 = unknown */
+    uint32_t iso;
+    uint32_t shutter_us;
+    uint16_t width;
+    uint16_t height;
+    int16_t crop_x;             /* sensor offset of the frame (RAWC, or VIDF pan position) */
+    int16_t crop_y;
+    uint8_t sampling_x;         /* binning + skipping; 0 = unknown */
+    uint8_t sampling_y;
+    uint8_t type;               /* CALIB_DARK / CALIB_FLAT */
+    uint8_t mode;               /* CALIB_FULL / CALIB_VERTICAL / CALIB_HORIZONTAL */
+};
+
+struct calib_entry
+{
+    struct calib_key key;
+    uint32_t frames;            /* number of frames averaged */
+    uint16_t black_level;
+    uint16_t bits_per_pixel;
+    uint32_t offset;            /* file position of the data */
+    uint32_t count;             /* number of uint16_t values */
+};
+
+struct calib_lib
+{
+    char * filename;
+    int num_entries;
+    struct calib_entry * entries;
+    uint16_t ** data;           /* per entry, NULL until loaded */
+    int dirty;                  /* modified since loaded */
+};
+
+/* a master prepared for one clip */
+struct calib_master
+{
+    int type;
+    int mode;
+    int width;
+    int height;
+    int black;                  /* black level the dark values are relative to */
+    int max_value;              /* (1 << bits_per_pixel) - 1 of the clip */
+    uint16_t * dark;            /* dark: width * height, width or height values, depending on the mode */
+    uint16_t * flat;            /* flat: width * height, flat value - black; 0 = pixel is left as is */
+    int64_t flat_num[2][2];     /* flat: per Bayer channel, median * adjustment numerator */
+    int32_t flat_den;           /* flat: adjustment denominator */
+};
+
+/* missing file = empty library; returns 0 on success */
+int calib_lib_load(struct calib_lib * lib, const char * filename);
+int calib_lib_save(struct calib_lib * lib);
+void calib_lib_free(struct calib_lib * lib);
+
+/* stores a master (count = width * height, width or height values, depending on the mode);
+ * replaces an entry with the same key. fails if the camera serial is unknown */
+int calib_lib_add(struct calib_lib * lib, struct calib_key * key, uint32_t frames,
+    int black_level, int bits_per_pixel, const uint16_t * values, uint32_t count);
+
+/* best matching entry of the given type from the same camera, or NULL */
+struct calib_entry * calib_lib_find(struct calib_lib * lib, struct calib_key * key, int type);
+
+/* frame data of an entry, read from the file on first use */
+const uint16_t * calib_lib_get_data(struct calib_lib * lib, struct calib_entry * entry);
+
+/* prepare a master for a clip with the given black level and bit depth;
+ * values are in the master's own bit depth (src_bpp). returns 0 on success */
+int calib_master_init(struct calib_master * master, int type, int mode, int width, int height,
+    const uint16_t * values, int src_black, int src_bpp, int black, int bpp);
+
+/* same, from a library entry */
+int calib_master_init_entry(struct calib_master * master, struct calib_lib * lib,
+    struct calib_entry * entry, int black, int bpp);
+
+void calib_master_free(struct calib_master * master);
+
+/* packed MLV image line <-> one uint16_t per pixel */
+void calib_unpack_line(uint16_t * dst, const uint16_t * src, int width, int bpp);
+void calib_pack_line(uint16_t * dst, const uint16_t * src, int width, int bpp);
+
+/* in-place correction of one unpacked image line */
+void calib_apply_dark(struct calib_master * master, uint16_t * line, int y);
+void calib_apply_flat(struct calib_master * master, uint16_t * line, int y);
+
+#endif
@@ -0,0 +1,1054 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "frame_codec.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#endif
+
+#ifdef MLV_USE_LZMA
+#include <LzmaEnc.h>
+#include <LzmaLib.h>
+#endif
+
+/* FRAME_CODEC_HUFF: residuals need 0..16 bits */
+#define HUFF_SYMBOLS        17
+
+/* longest code; also the size of the decoder lookup table */
+#define HUFF_MAX_LEN        12
+
+#define HUFF_MODE_STORED    0
+#define HUFF_MODE_CODED     1
+
+struct frame_huff_hdr
+{
+    uint16_t width;
+    uint16_t height;
+    uint8_t bpp;
+    uint8_t mode;                       /* HUFF_MODE_STORED / HUFF_MODE_CODED */
+    uint8_t code_len[HUFF_SYMBOLS];     /* per residual bit count, 0 = not used */
+    uint8_t reserved;
+};
+
+#ifdef MLV_USE_LZMA
+static void *frame_lzma_alloc(void *p, size_t size) { (void)p; return malloc(size); }
+static void frame_lzma_free(void *p, void *address) { (void)p; free(address); }
+static ISzAlloc frame_lzma_allocator = { frame_lzma_alloc, frame_lzma_free };
+
+static int frame_compress_lzma(struct frame_codec_params * params, const uint8_t * in, uint32_t in_size, uint8_t ** out, uint32_t * out_size)
+{
+    SizeT dest_len = in_size + in_size / 2 + 1024;
+    size_t props_size = LZMA_PROPS_SIZE;
+    uint8_t * buf = malloc(4 + LZMA_PROPS_SIZE + dest_len);
+    if (!buf)
+    {
+        return SZ_ERROR_MEM;
+    }
+
+    CLzmaEncProps props;
+    LzmaEncProps_Init(&props);
+    props.level = params->lzma_level;
+    props.dictSize = params->lzma_dict;
+    props.lc = params->lzma_lc;
+    props.lp = params->lzma_lp;
+    props.pb = params->lzma_pb;
+    props.fb = params->lzma_fb;
+    props.numThreads = params->lzma_threads;
+
+    /* the dictionary (and the match finder memory) never has to be larger than one frame,
+     * this matters when several frames are compressed at once */
+    props.reduceSize = in_size;
+
+    int ret = LzmaEncode(&buf[4 + LZMA_PROPS_SIZE], &dest_len, in, in_size, &props,
+        &buf[4], &props_size, 0, NULL, &frame_lzma_allocator, &frame_lzma_allocator);
+
+    if (ret != SZ_OK)
+    {
+        free(buf);
+        return ret;
+    }
+
+    *(uint32_t *)buf = in_size;
+    *out = buf;
+    *out_size = 4 + LZMA_PROPS_SIZE + dest_len;
+    return SZ_OK;
+}
+
+static int frame_decompress_lzma(const uint8_t * in, uint32_t in_size, uint8_t ** out, uint32_t * out_size)
+{
+    if (in_size < 4 + LZMA_PROPS_SIZE)
+    {
+        return SZ_ERROR_DATA;
+    }
+
+    size_t dest_len = *(uint32_t *)in;
+    size_t src_len = in_size - 4 - LZMA_PROPS_SIZE;
+    uint8_t * buf = malloc(dest_len);
+    if (!buf)
+    {
+        return SZ_ERROR_MEM;
+    }
+
+    int ret = LzmaUncompress(buf, &dest_len, &in[4 + LZMA_PROPS_SIZE], &src_len, &in[4], LZMA_PROPS_SIZE);
+    if (ret != SZ_OK)
+    {
+        free(buf);
+        return ret;
+    }
+
+    *out = buf;
+    *out_size = dest_len;
+    return SZ_OK;
+}
+#endif
+
+/* MLV image lines: little endian 16-bit words, pixels stored MSB first */
+static void frame_unpack_line(uint16_t * dst, const uint16_t * src, int width, int bpp)
+{
+    uint32_t mask = (1 << bpp) - 1;
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for (int x = 0; x < width; x++)
+    {
+        if (bits < bpp)
+        {
+            acc = (acc << 16) | *src++;
+            bits += 16;
+        }
+        bits -= bpp;
+        dst[x] = (acc >> bits) & mask;
+    }
+}
+
+/* whole words only, the line pitch is a multiple of 16 bits here */
+static void frame_pack_line(uint16_t * dst, const uint16_t * src, int width, int bpp)
+{
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for (int x = 0; x < width; x++)
+    {
+        acc = (acc << bpp) | src[x];
+        bits += bpp;
+        if (bits >= 16)
+        {
+            bits -= 16;
+            *dst++ = acc >> bits;
+        }
+    }
+}
+
+static inline int huff_bit_count(uint32_t value)
+{
+    int bits = 0;
+    while (value)
+    {
+        bits++;
+        value >>= 1;
+    }
+    return bits;
+}
+
+/* code lengths from symbol counts, limited to HUFF_MAX_LEN */
+static void huff_build_lengths(const uint32_t * counts, uint8_t * lengths)
+{
+    uint32_t freq[HUFF_SYMBOLS];
+    memcpy(freq, counts, sizeof(freq));
+
+    while (1)
+    {
+        /* plain Huffman construction; 17 symbols, so a quadratic search is fine */
+        uint32_t weight[2 * HUFF_SYMBOLS];
+        int parent[2 * HUFF_SYMBOLS];
+        int active[2 * HUFF_SYMBOLS];
+        int nodes = 0;
+        int used = 0;
+
+        for (int i = 0; i < HUFF_SYMBOLS; i++)
+        {
+            weight[i] = freq[i];
+            parent[i] = -1;
+            active[i] = freq[i] > 0;
+            used += active[i];
+        }
+        nodes = HUFF_SYMBOLS;
+
+        memset(lengths, 0, HUFF_SYMBOLS);
+        if (used <= 1)
+        {
+            for (int i = 0; i < HUFF_SYMBOLS; i++)
+            {
+                if (freq[i])
+                {
+                    lengths[i] = 1;
+                }
+            }
+            return;
+        }
+
+        for (int merges = 0; merges < used - 1; merges++)
+        {
+            int a = -1, b = -1;
+            for (int i = 0; i < nodes; i++)
+            {
+                if (!active[i]) continue;
+                if (a < 0 || weight[i] < weight[a]) { b = a; a = i; }
+                else if (b < 0 || weight[i] < weight[b]) { b = i; }
+            }
+            weight[nodes] = weight[a] + weight[b];
+            parent[nodes] = -1;
+            active[nodes] = 1;
+            parent[a] = parent[b] = nodes;
+            active[a] = active[b] = 0;
+            nodes++;
+        }
+
+        int max_len = 0;
+        for (int i = 0; i < HUFF_SYMBOLS; i++)
+        {
+            if (!freq[i]) continue;
+            int len = 0;
+            for (int n = i; parent[n] >= 0; n = parent[n])
+            {
+                len++;
+            }
+            lengths[i] = len;
+            max_len = len > max_len ? len : max_len;
+        }
+
+        if (max_len <= HUFF_MAX_LEN)
+        {
+            return;
+        }
+
+        /* flatten the distribution and try again */
+        for (int i = 0; i < HUFF_SYMBOLS; i++)
+        {
+            if (freq[i])
+            {
+                freq[i] = (freq[i] + 1) / 2;
+            }
+        }
+    }
+}
+
+/* canonical codes: shorter codes first, then by symbol */
+static void huff_build_codes(const uint8_t * lengths, uint32_t * codes)
+{
+    uint32_t code = 0;
+    for (int len = 1; len <= HUFF_MAX_LEN; len++)
+    {
+        for (int i = 0; i < HUFF_SYMBOLS; i++)
+        {
+            if (lengths[i] == len)
+            {
+                codes[i] = code++;
+            }
+        }
+        code <<= 1;
+    }
+}
+
+static int frame_compress_huff(struct frame_codec_params * params, const uint8_t * in, uint32_t in_size, uint8_t ** out, uint32_t * out_size)
+{
+    int w = params->width;
+    int h = params->height;
+    int bpp = params->bpp;
+    uint32_t pixels = w * h;
+
+    uint32_t bound = 4 + sizeof(struct frame_huff_hdr) + in_size;
+    uint8_t * buf = malloc(bound);
+    if (!buf)
+    {
+        return -1;
+    }
+
+    *(uint32_t *)buf = in_size;
+    struct frame_huff_hdr * hdr = (struct frame_huff_hdr *)&buf[4];
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->width = w;
+    hdr->height = h;
+    hdr->bpp = bpp;
+    hdr->mode = HUFF_MODE_STORED;
+
+    uint8_t * data = &buf[4 + sizeof(struct frame_huff_hdr)];
+    int codable = bpp >= 1 && bpp <= 16 && w >= 2 && h >= 1 && w <= 0xFFFF && h <= 0xFFFF &&
+        (w * bpp) % 16 == 0 && (uint64_t)pixels * bpp == (uint64_t)in_size * 8;
+
+    int16_t * residuals = codable ? malloc(pixels * sizeof(int16_t)) : NULL;
+    uint16_t * lines = codable ? malloc(3 * w * sizeof(uint16_t)) : NULL;
+
+    if (residuals && lines)
+    {
+        uint32_t counts[HUFF_SYMBOLS];
+        uint8_t lengths[HUFF_SYMBOLS];
+        uint32_t codes[HUFF_SYMBOLS];
+        int half = 1 << (bpp - 1);
+        int mask = (1 << bpp) - 1;
+        int pitch = w * bpp / 8;
+
+        memset(counts, 0, sizeof(counts));
+
+        /* residuals to the previous pixel of the same color */
+        for (int y = 0; y < h; y++)
+        {
+            uint16_t * line = &lines[(y % 3) * w];
+            uint16_t * above = &lines[((y + 1) % 3) * w];
+            int16_t * res = &residuals[y * w];
+
+            frame_unpack_line(line, (const uint16_t *)&in[y * pitch], w, bpp);
+
+            for (int x = 0; x < w; x++)
+            {
+                int pred = (x >= 2) ? line[x - 2] : (y >= 2) ? above[x] : half;
+                int d = ((line[x] - pred + half) & mask) - half;
+                res[x] = d;
+                counts[huff_bit_count(d < 0 ? -d : d)]++;
+            }
+        }
+
+        huff_build_lengths(counts, lengths);
+        huff_build_codes(lengths, codes);
+
+        /* the coded size is known in advance; store the frame if coding doesn't help */
+        uint64_t coded_bits = 0;
+        for (int i = 0; i < HUFF_SYMBOLS; i++)
+        {
+            coded_bits += (uint64_t)counts[i] * (lengths[i] + i);
+        }
+
+        if ((coded_bits + 7) / 8 < in_size)
+        {
+            uint64_t acc = 0;
+            int bits = 0;
+            uint8_t * ptr = data;
+
+            for (uint32_t i = 0; i < pixels; i++)
+            {
+                int d = residuals[i];
+                int k = huff_bit_count(d < 0 ? -d : d);
+
+                /* negative residuals are stored as d - 1, JPEG style */
+                uint32_t extra = (d < 0 ? d - 1 : d) & ((1 << k) - 1);
+                acc = (acc << (lengths[k] + k)) | ((uint64_t)codes[k] << k) | extra;
+                bits += lengths[k] + k;
+
+                if (bits >= 32)
+                {
+                    bits -= 32;
+                    uint32_t word = acc >> bits;
+                    ptr[0] = word >> 24;
+                    ptr[1] = word >> 16;
+                    ptr[2] = word >> 8;
+                    ptr[3] = word;
+                    ptr += 4;
+                }
+            }
+
+            while (bits > 0)
+            {
+                *ptr++ = (bits >= 8) ? (acc >> (bits - 8)) : (acc << (8 - bits));
+                bits -= 8;
+            }
+
+            hdr->mode = HUFF_MODE_CODED;
+            memcpy(hdr->code_len, lengths, HUFF_SYMBOLS);
+            *out_size = ptr - buf;
+        }
+    }
+
+    free(residuals);
+    free(lines);
+
+    if (hdr->mode == HUFF_MODE_STORED)
+    {
+        memcpy(data, in, in_size);
+        *out_size = 4 + sizeof(struct frame_huff_hdr) + in_size;
+    }
+
+    *out = buf;
+    return 0;
+}
+
+static int frame_decompress_huff(const uint8_t * in, uint32_t in_size, uint8_t ** out, uint32_t * out_size)
+{
+    if (in_size < 4 + sizeof(struct frame_huff_hdr))
+    {
+        return -1;
+    }
+
+    uint32_t size = *(uint32_t *)in;
+    const struct frame_huff_hdr * hdr = (const struct frame_huff_hdr *)&in[4];
+    const uint8_t * data = &in[4 + sizeof(struct frame_huff_hdr)];
+    const uint8_t * end = &in[in_size];
+
+    uint8_t * buf = malloc(size ? size : 1);
+    if (!buf)
+    {
+        return -1;
+    }
+
+    if (hdr->mode == HUFF_MODE_STORED)
+    {
+        if ((uint32_t)(end - data) < size)
+        {
+            free(buf);
+            return -1;
+        }
+        memcpy(buf, data, size);
+        *out = buf;
+        *out_size = size;
+        return 0;
+    }
+
+    int w = hdr->width;
+    int h = hdr->height;
+    int bpp = hdr->bpp;
+    if (hdr->mode != HUFF_MODE_CODED || bpp < 1 || bpp > 16 || w < 2 || (w * bpp) % 16 ||
+        (uint64_t)w * h * bpp != (uint64_t)size * 8)
+    {
+        free(buf);
+        return -1;
+    }
+
+    /* lookup table: the next HUFF_MAX_LEN bits give symbol and code length */
+    uint8_t table_sym[1 << HUFF_MAX_LEN];
+    uint8_t table_len[1 << HUFF_MAX_LEN];
+    uint32_t codes[HUFF_SYMBOLS];
+
+    memset(table_len, 0, sizeof(table_len));
+    huff_build_codes(hdr->code_len, codes);
+    for (int i = 0; i < HUFF_SYMBOLS; i++)
+    {
+        int len = hdr->code_len[i];
+        if (!len) continue;
+        if (len > HUFF_MAX_LEN)
+        {
+            free(buf);
+            return -1;
+        }
+        uint32_t first = codes[i] << (HUFF_MAX_LEN - len);
+        uint32_t count = 1 << (HUFF_MAX_LEN - len);
+        for (uint32_t j = 0; j < count && first + j < (1 << HUFF_MAX_LEN); j++)
+        {
+            table_sym[first + j] = i;
+            table_len[first + j] = len;
+        }
+    }
+
+    uint16_t * lines = malloc(3 * w * sizeof(uint16_t));
+    if (!lines)
+    {
+        free(buf);
+        return -1;
+    }
+
+    int half = 1 << (bpp - 1);
+    int mask = (1 << bpp) - 1;
+    int pitch = w * bpp / 8;
+    const uint8_t * ptr = data;
+    uint64_t acc = 0;
+    int bits = 0;
+    int ret = 0;
+
+    for (int y = 0; y < h && !ret; y++)
+    {
+        uint16_t * line = &lines[(y % 3) * w];
+        uint16_t * above = &lines[((y + 1) % 3) * w];
+
+        for (int x = 0; x < w; x++)
+        {
+            /* at most HUFF_MAX_LEN + 16 bits per pixel; past the end, zeros are read and caught below */
+            while (bits <= 56)
+            {
+                acc = (acc << 8) | (ptr < end ? *ptr : 0);
+                ptr++;
+                bits += 8;
+            }
+
+            uint32_t peek = (acc >> (bits - HUFF_MAX_LEN)) & ((1 << HUFF_MAX_LEN) - 1);
+            int len = table_len[peek];
+            if (!len)
+            {
+                ret = -1;
+                break;
+            }
+            int k = table_sym[peek];
+            bits -= len;
+
+            int d = 0;
+            if (k)
+            {
+                d = (acc >> (bits - k)) & ((1 << k) - 1);
+                bits -= k;
+                if (!(d >> (k - 1)))
+                {
+                    d = d - (1 << k) + 1;
+                }
+            }
+
+            int pred = (x >= 2) ? line[x - 2] : (y >= 2) ? above[x] : half;
+            line[x] = (pred + d) & mask;
+        }
+
+        frame_pack_line((uint16_t *)&buf[y * pitch], line, w, bpp);
+    }
+
+    free(lines);
+
+    /* bits still buffered were read ahead, but not used */
+    if (ret || ptr - (bits + 7) / 8 > end)
+    {
+        free(buf);
+        return -1;
+    }
+
+    *out = buf;
+    *out_size = size;
+    return 0;
+}
+
+/* FRAME_CODEC_LOCO: lines per independently coded group */
+#define LOCO_GROUP_LINES    16
+
+/* contexts: 4 Bayer colors x 8 activity classes */
+#define LOCO_CONTEXTS       32
+
+/* longer unary codes are escaped, the value follows verbatim */
+#define LOCO_LIMIT          24
+
+/* halve the context statistics after that many samples */
+#define LOCO_RESET          64
+
+#define LOCO_MODE_STORED    0
+#define LOCO_MODE_CODED     1
+
+struct frame_loco_hdr
+{
+    uint16_t width;
+    uint16_t height;
+    uint8_t bpp;
+    uint8_t mode;                       /* LOCO_MODE_STORED / LOCO_MODE_CODED */
+    uint16_t group_lines;
+    uint32_t groups;                    /* followed by the end offset of each group (uint32_t), then the groups */
+};
+
+struct loco_context
+{
+    uint32_t sum;                       /* sum of the mapped residuals seen */
+    uint32_t count;
+};
+
+static void loco_init_contexts(struct loco_context * ctx, int bpp)
+{
+    for (int i = 0; i < LOCO_CONTEXTS; i++)
+    {
+        ctx[i].sum = MAX(2, ((1 << bpp) + 32) / 64);
+        ctx[i].count = 1;
+    }
+}
+
+/* Rice parameter for the expected magnitude in this context: smallest k with count << k >= sum */
+static inline int loco_rice_k(const struct loco_context * ctx)
+{
+    if (ctx->count >= ctx->sum)
+    {
+        return 0;
+    }
+    int k = __builtin_clz(ctx->count) - __builtin_clz(ctx->sum);
+    return k + ((ctx->count << k) < ctx->sum);
+}
+
+static inline void loco_update(struct loco_context * ctx, uint32_t value)
+{
+    ctx->sum += value;
+    if (++ctx->count >= LOCO_RESET)
+    {
+        ctx->sum >>= 1;
+        ctx->count >>= 1;
+    }
+}
+
+/* gradient activity |a-c| + |b-c|, in 8 classes */
+static inline int loco_activity_class(uint32_t activity)
+{
+    return activity ? MIN(7, 32 - __builtin_clz(activity)) : 0;
+}
+
+/* median edge detector (LOCO-I) on the same-color neighbors: a left, b above, c above left */
+static inline int loco_predict(int a, int b, int c)
+{
+    int mx = a > b ? a : b;
+    int mn = a > b ? b : a;
+    return (c >= mx) ? mn : (c <= mn) ? mx : a + b - c;
+}
+
+/* prediction for one line of a group; line j of the group uses line j-2 (same colors) above it.
+ * res = residual mapped to unsigned (zigzag), act = gradient activity */
+static void loco_residuals(const uint16_t * line, const uint16_t * above, int w, int bpp, uint16_t * res, uint16_t * act)
+{
+    int half = 1 << (bpp - 1);
+    int mask = (1 << bpp) - 1;
+    int x = 0;
+
+    for (; x < w && (x < 2 || !above); x++)
+    {
+        int a = (x >= 2) ? line[x - 2] : above ? above[x] : half;
+        int b = above ? above[x] : a;
+        int c = (above && x >= 2) ? above[x - 2] : b;
+        int d = ((line[x] - loco_predict(a, b, c) + half) & mask) - half;
+        res[x] = ((uint32_t) d << 1) ^ (d >> 31);
+        act[x] = MIN(0xFFFF, abs(a - c) + abs(b - c));
+    }
+
+#if defined(__SSE2__)
+    /* a + b - c must not overflow signed 16 bits */
+    if (bpp <= 14)
+    {
+        __m128i v_half = _mm_set1_epi16(half);
+        __m128i v_mask = _mm_set1_epi16(mask);
+        for (; x + 8 <= w; x += 8)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)&line[x - 2]);
+            __m128i b = _mm_loadu_si128((const __m128i *)&above[x]);
+            __m128i c = _mm_loadu_si128((const __m128i *)&above[x - 2]);
+            __m128i v = _mm_loadu_si128((const __m128i *)&line[x]);
+
+            __m128i mx = _mm_max_epi16(a, b);
+            __m128i mn = _mm_min_epi16(a, b);
+            __m128i grad = _mm_sub_epi16(_mm_add_epi16(a, b), c);
+
+            /* c >= max: min, c <= min: max, else a + b - c */
+            __m128i pred = _mm_min_epi16(_mm_max_epi16(grad, mn), mx);
+
+            __m128i d = _mm_sub_epi16(_mm_and_si128(_mm_add_epi16(_mm_sub_epi16(v, pred), v_half), v_mask), v_half);
+            __m128i zz = _mm_xor_si128(_mm_add_epi16(d, d), _mm_srai_epi16(d, 15));
+
+            __m128i ac = _mm_sub_epi16(_mm_max_epi16(a, c), _mm_min_epi16(a, c));
+            __m128i bc = _mm_sub_epi16(_mm_max_epi16(b, c), _mm_min_epi16(b, c));
+
+            _mm_storeu_si128((__m128i *)&res[x], zz);
+            _mm_storeu_si128((__m128i *)&act[x], _mm_adds_epu16(ac, bc));
+        }
+    }
+#endif
+
+    for (; x < w; x++)
+    {
+        int a = line[x - 2];
+        int b = above[x];
+        int c = above[x - 2];
+        int d = ((line[x] - loco_predict(a, b, c) + half) & mask) - half;
+        res[x] = ((uint32_t) d << 1) ^ (d >> 31);
+        act[x] = MIN(0xFFFF, abs(a - c) + abs(b - c));
+    }
+}
+
+struct loco_writer
+{
+    uint8_t * ptr;
+    uint8_t * end;
+    uint64_t acc;
+    int bits;
+};
+
+/* up to 32 bits at once */
+static inline void loco_put(struct loco_writer * wr, uint32_t value, int bits)
+{
+    wr->acc = (wr->acc << bits) | value;
+    wr->bits += bits;
+
+    if (wr->bits >= 32)
+    {
+        wr->bits -= 32;
+        if (wr->ptr + 4 <= wr->end)
+        {
+            uint32_t word = wr->acc >> wr->bits;
+            wr->ptr[0] = word >> 24;
+            wr->ptr[1] = word >> 16;
+            wr->ptr[2] = word >> 8;
+            wr->ptr[3] = word;
+        }
+        wr->ptr += 4;
+    }
+}
+
+static void loco_flush(struct loco_writer * wr)
+{
+    while (wr->bits > 0)
+    {
+        if (wr->ptr < wr->end)
+        {
+            *wr->ptr = (wr->bits >= 8) ? (wr->acc >> (wr->bits - 8)) : (wr->acc << (8 - wr->bits));
+        }
+        wr->ptr++;
+        wr->bits -= 8;
+    }
+    wr->bits = 0;
+}
+
+static int frame_compress_loco(struct frame_codec_params * params, const uint8_t * in, uint32_t in_size, uint8_t ** out, uint32_t * out_size)
+{
+    int w = params->width;
+    int h = params->height;
+    int bpp = params->bpp;
+    int groups = (h + LOCO_GROUP_LINES - 1) / LOCO_GROUP_LINES;
+
+    int codable = bpp >= 2 && bpp <= 16 && w >= 2 && h >= 1 && w <= 0xFFFF && h <= 0xFFFF &&
+        (w * bpp) % 16 == 0 && (uint64_t)w * h * bpp == (uint64_t)in_size * 8;
+
+    uint32_t table_size = codable ? groups * sizeof(uint32_t) : 0;
+    uint32_t head_size = 4 + sizeof(struct frame_loco_hdr) + table_size;
+    uint8_t * buf = malloc(head_size + in_size);
+    if (!buf)
+    {
+        return -1;
+    }
+
+    *(uint32_t *)buf = in_size;
+    struct frame_loco_hdr * hdr = (struct frame_loco_hdr *)&buf[4];
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->width = w;
+    hdr->height = h;
+    hdr->bpp = bpp;
+    hdr->mode = LOCO_MODE_STORED;
+    hdr->group_lines = LOCO_GROUP_LINES;
+
+    uint32_t * group_end = (uint32_t *)&buf[4 + sizeof(struct frame_loco_hdr)];
+    uint16_t * lines = codable ? malloc(3 * w * sizeof(uint16_t)) : NULL;
+    uint16_t * res = codable ? malloc(2 * w * sizeof(uint16_t)) : NULL;
+
+    if (lines && res)
+    {
+        uint16_t * act = &res[w];
+        int pitch = w * bpp / 8;
+        struct loco_writer wr = { &buf[head_size], &buf[head_size + in_size], 0, 0 };
+
+        /* the coded frame must be smaller than the original, else it is stored */
+        for (int g = 0; g < groups && wr.ptr < wr.end; g++)
+        {
+            struct loco_context ctx[LOCO_CONTEXTS];
+            int first = g * LOCO_GROUP_LINES;
+            int last = MIN(h, first + LOCO_GROUP_LINES);
+
+            loco_init_contexts(ctx, bpp);
+
+            for (int y = first; y < last; y++)
+            {
+                uint16_t * line = &lines[(y % 3) * w];
+                uint16_t * above = (y - first >= 2) ? &lines[((y + 1) % 3) * w] : NULL;
+                struct loco_context * row_ctx = &ctx[(y & 1) * 16];
+
+                frame_unpack_line(line, (const uint16_t *)&in[y * pitch], w, bpp);
+                loco_residuals(line, above, w, bpp, res, act);
+
+                for (int x = 0; x < w; x++)
+                {
+                    struct loco_context * c = &row_ctx[(x & 1) * 8 + loco_activity_class(act[x])];
+                    uint32_t value = res[x];
+                    int k = loco_rice_k(c);
+                    uint32_t q = value >> k;
+
+                    if (q < LOCO_LIMIT)
+                    {
+                        /* q zeros, a one, then the k low bits */
+                        loco_put(&wr, 1, q + 1);
+                        if (k)
+                        {
+                            loco_put(&wr, value & ((1 << k) - 1), k);
+                        }
+                    }
+                    else
+                    {
+                        loco_put(&wr, 1, LOCO_LIMIT + 1);
+                        loco_put(&wr, value, bpp);
+                    }
+                    loco_update(c, value);
+                }
+            }
+
+            loco_flush(&wr);
+            group_end[g] = wr.ptr - &buf[head_size];
+        }
+
+        if (wr.ptr < wr.end)
+        {
+            hdr->mode = LOCO_MODE_CODED;
+            hdr->groups = groups;
+            *out_size = wr.ptr - buf;
+        }
+    }
+
+    free(lines);
+    free(res);
+
+    if (hdr->mode == LOCO_MODE_STORED)
+    {
+        hdr->groups = 0;
+        memcpy(&buf[4 + sizeof(struct frame_loco_hdr)], in, in_size);
+        *out_size = 4 + sizeof(struct frame_loco_hdr) + in_size;
+    }
+
+    *out = buf;
+    return 0;
+}
+
+/* the unread bits are kept left aligned in acc */
+struct loco_reader
+{
+    const uint8_t * ptr;
+    const uint8_t * end;
+    uint64_t acc;
+    int bits;
+};
+
+/* at least 56 bits in the buffer afterwards; past the end, zeros are read */
+static inline void loco_refill(struct loco_reader * rd)
+{
+    if (rd->ptr + 8 <= rd->end)
+    {
+        uint64_t word;
+        memcpy(&word, rd->ptr, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        rd->acc |= word >> rd->bits;
+        rd->ptr += (63 - rd->bits) >> 3;
+        rd->bits |= 56;
+        return;
+    }
+
+    while (rd->bits <= 56)
+    {
+        uint64_t byte = (rd->ptr < rd->end) ? *rd->ptr : 0;
+        rd->acc |= byte << (56 - rd->bits);
+        rd->ptr++;
+        rd->bits += 8;
+    }
+}
+
+/* one mapped residual, LOCO_LIMIT + 1 + 16 bits at most; -1 on invalid data */
+static inline int32_t loco_get(struct loco_reader * rd, struct loco_context * ctx, int bpp)
+{
+    loco_refill(rd);
+
+    int q = rd->acc ? __builtin_clzll(rd->acc) : 64;
+    if (q > LOCO_LIMIT)
+    {
+        return -1;
+    }
+    rd->acc <<= q + 1;
+    rd->bits -= q + 1;
+
+    int k = (q < LOCO_LIMIT) ? loco_rice_k(ctx) : bpp;
+    uint32_t value = 0;
+    if (k)
+    {
+        value = rd->acc >> (64 - k);
+        rd->acc <<= k;
+        rd->bits -= k;
+    }
+    if (q < LOCO_LIMIT)
+    {
+        value |= q << k;
+    }
+
+    loco_update(ctx, value);
+    return value;
+}
+
+static int loco_decode_group(const uint8_t * ptr, const uint8_t * end, uint8_t * out, uint16_t * lines,
+    int w, int first, int last, int bpp)
+{
+    struct loco_context ctx[LOCO_CONTEXTS];
+    struct loco_reader rd = { ptr, end, 0, 0 };
+    int half = 1 << (bpp - 1);
+    int mask = (1 << bpp) - 1;
+    int pitch = w * bpp / 8;
+
+    loco_init_contexts(ctx, bpp);
+
+    for (int y = first; y < last; y++)
+    {
+        uint16_t * line = &lines[(y % 3) * w];
+        uint16_t * above = (y - first >= 2) ? &lines[((y + 1) % 3) * w] : NULL;
+        struct loco_context * row_ctx = &ctx[(y & 1) * 16];
+        int x = 0;
+
+        /* no left (or upper) neighbors, same as the encoder */
+        for (; x < w && (x < 2 || !above); x++)
+        {
+            int a = (x >= 2) ? line[x - 2] : above ? above[x] : half;
+            int b = above ? above[x] : a;
+            int c = (above && x >= 2) ? above[x - 2] : b;
+            int32_t value = loco_get(&rd, &row_ctx[(x & 1) * 8 + loco_activity_class(abs(a - c) + abs(b - c))], bpp);
+            if (value < 0)
+            {
+                return -1;
+            }
+            int d = (value >> 1) ^ -(value & 1);
+            line[x] = (loco_predict(a, b, c) + d) & mask;
+        }
+
+        for (; x < w; x++)
+        {
+            int a = line[x - 2];
+            int b = above[x];
+            int c = above[x - 2];
+            int32_t value = loco_get(&rd, &row_ctx[(x & 1) * 8 + loco_activity_class(abs(a - c) + abs(b - c))], bpp);
+            if (value < 0)
+            {
+                return -1;
+            }
+            int d = (value >> 1) ^ -(value & 1);
+            line[x] = (loco_predict(a, b, c) + d) & mask;
+        }
+
+        frame_pack_line((uint16_t *)&out[y * pitch], line, w, bpp);
+    }
+
+    /* bits still buffered were read ahead, but not used */
+    if (rd.ptr - rd.bits / 8 > end)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int frame_decompress_loco(const uint8_t * in, uint32_t in_size, uint8_t ** out, uint32_t * out_size)
+{
+    if (in_size < 4 + sizeof(struct frame_loco_hdr))
+    {
+        return -1;
+    }
+
+    uint32_t size = *(uint32_t *)in;
+    const struct frame_loco_hdr * hdr = (const struct frame_loco_hdr *)&in[4];
+    const uint8_t * data = &in[4 + sizeof(struct frame_loco_hdr)];
+    const uint8_t * end = &in[in_size];
+
+    uint8_t * buf = malloc(size ? size : 1);
+    if (!buf)
+    {
+        return -1;
+    }
+
+    if (hdr->mode == LOCO_MODE_STORED)
+    {
+        if ((uint32_t)(end - data) < size)
+        {
+            free(buf);
+            return -1;
+        }
+        memcpy(buf, data, size);
+        *out = buf;
+        *out_size = size;
+        return 0;
+    }
+
+    int w = hdr->width;
+    int h = hdr->height;
+    int bpp = hdr->bpp;
+    int group_lines = hdr->group_lines;
+    uint32_t groups = hdr->groups;
+
+    if (hdr->mode != LOCO_MODE_CODED || bpp < 2 || bpp > 16 || w < 2 || (w * bpp) % 16 || group_lines < 1 ||
+        (uint64_t)w * h * bpp != (uint64_t)size * 8 || groups != (uint32_t)(h + group_lines - 1) / group_lines ||
+        (uint64_t)groups * sizeof(uint32_t) > (uint64_t)(end - data))
+    {
+        free(buf);
+        return -1;
+    }
+
+    const uint32_t * group_end = (const uint32_t *)data;
+    const uint8_t * stream = data + groups * sizeof(uint32_t);
+    uint16_t * lines = malloc(3 * w * sizeof(uint16_t));
+    uint32_t start = 0;
+    int ret = lines ? 0 : -1;
+
+    /* every group can be decoded on its own */
+    for (uint32_t g = 0; g < groups && !ret; g++)
+    {
+        if (group_end[g] < start || group_end[g] > (uint32_t)(end - stream))
+        {
+            ret = -1;
+            break;
+        }
+        int first = g * group_lines;
+        ret = loco_decode_group(&stream[start], &stream[group_end[g]], buf, lines, w, first, MIN(h, first + group_lines), bpp);
+        start = group_end[g];
+    }
+
+    free(lines);
+
+    if (ret)
+    {
+        free(buf);
+        return -1;
+    }
+
+    *out = buf;
+    *out_size = size;
+    return 0;
+}
+
+int frame_compress(int codec, struct frame_codec_params * params,
+    const uint8_t * in, uint32_t in_size, uint8_t ** out, uint32_t * out_size)
+{
+    switch (codec)
+    {
+#ifdef MLV_USE_LZMA
+        case FRAME_CODEC_LZMA:
+            return frame_compress_lzma(params, in, in_size, out, out_size);
+#endif
+        case FRAME_CODEC_HUFF:
+            return frame_compress_huff(params, in, in_size, out, out_size);
+        case FRAME_CODEC_LOCO:
+            return frame_compress_loco(params, in, in_size, out, out_size);
+    }
+    return -1;
+}
+
+int frame_decompress(int codec, const uint8_t * in, uint32_t in_size, uint8_t ** out, uint32_t * out_size)
+{
+    switch (codec)
+    {
+#ifdef MLV_USE_LZMA
+        case FRAME_CODEC_LZMA:
+            return frame_decompress_lzma(in, in_size, out, out_size);
+#endif
+        case FRAME_CODEC_HUFF:
+            return frame_decompress_huff(in, in_size, out, out_size);
+        case FRAME_CODEC_LOCO:
+            return frame_decompress_loco(in, in_size, out, out_size);
+    }
+    return -1;
+}
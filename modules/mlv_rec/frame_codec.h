@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* Frame codecs used by mlv_dump for compressed VIDF payloads.
+ *
+ * Every compressed frame starts with its uncompressed size (uint32_t),
+ * followed by the codec data:
+ *
+ *   FRAME_CODEC_LZMA (MLV_VIDEO_CLASS_FLAG_LZMA):
+ *     LZMA properties (LZMA_PROPS_SIZE bytes), LZMA stream
+ *
+ *   FRAME_CODEC_HUFF (MLV_VIDEO_CLASS_FLAG_HUFF):
+ *     struct frame_huff_hdr, bit stream
+ *     Each pixel is predicted from the previous pixel of the same Bayer
+ *     color in its line (at the start of a line: the same pixel two lines
+ *     above). The residuals are stored JPEG-style, as a Huffman coded bit
+ *     count followed by that many raw bits, with one code table per frame.
+ *     Much faster than LZMA, for intermediate files.
+ *
+ *   FRAME_CODEC_LOCO (MLV_VIDEO_CLASS_FLAG_LOCO):
+ *     struct frame_loco_hdr, end offset of each line group, line groups
+ *     LOCO-I style: each pixel is predicted by the median edge detector
+ *     from its left, upper and upper left neighbors of the same Bayer
+ *     color, and the residual is Rice coded with a parameter adapted per
+ *     color and local gradient. Every group of lines is coded on its own,
+ *     so a damaged group does not affect the rest of the frame, and the
+ *     groups could be decoded in parallel. Better ratios than LZMA, at
+ *     the speed of FRAME_CODEC_HUFF.
+ *
+ * All functions are reentrant; independent frames may be processed by
+ * several threads at once.
+ */
+
+#ifndef _frame_codec_h_
+#define _frame_codec_h_
+
+#include <stdint.h>
+
+#define FRAME_CODEC_LZMA    1
+#define FRAME_CODEC_HUFF    2
+#define FRAME_CODEC_LOCO    3
+
+struct frame_codec_params
+{
+    /* image layout, needed by FRAME_CODEC_HUFF */
+    int width;
+    int height;
+    int bpp;
+
+    /* LzmaCompress parameters */
+    int lzma_level;
+    int lzma_dict;
+    int lzma_lc;
+    int lzma_lp;
+    int lzma_pb;
+    int lzma_fb;
+    int lzma_threads;
+};
+
+/* out is malloc'ed, caller frees it. return 0 on success */
+int frame_compress(int codec, struct frame_codec_params * params,
+    const uint8_t * in, uint32_t in_size, uint8_t ** out, uint32_t * out_size);
+
+int frame_decompress(int codec, const uint8_t * in, uint32_t in_size, uint8_t ** out, uint32_t * out_size);
+
+#endif
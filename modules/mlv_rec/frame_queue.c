@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "frame_queue.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define SLOT_PENDING    0
+#define SLOT_BUSY       1
+#define SLOT_DONE       2
+
+struct frame_slot
+{
+    struct frame_job * job;
+    int state;
+};
+
+struct frame_queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;       /* a job was queued, or shutdown */
+    pthread_cond_t done_cond;       /* a job was finished */
+    pthread_t threads[FRAME_QUEUE_MAX_THREADS];
+    int num_threads;
+    int stop;
+
+    /* ring of queued jobs, oldest at head */
+    struct frame_slot * slots;
+    int depth;
+    int head;
+    int count;
+};
+
+static void frame_job_run(struct frame_job * job)
+{
+    switch (job->op)
+    {
+        case FRAME_JOB_COMPRESS:
+            job->ret = frame_compress(job->codec, &job->params, job->in, job->in_size, &job->out, &job->out_size);
+            break;
+
+        case FRAME_JOB_DECOMPRESS:
+            job->ret = frame_decompress(job->codec, job->in, job->in_size, &job->out, &job->out_size);
+            break;
+
+        default:
+            job->out = job->in;
+            job->out_size = job->in_size;
+            job->ret = 0;
+            if (!job->in_owned)
+            {
+                job->out = malloc(job->in_size ? job->in_size : 1);
+                job->ret = job->out ? 0 : -1;
+                if (job->out)
+                {
+                    memcpy(job->out, job->in, job->in_size);
+                }
+            }
+            job->in = NULL;
+            break;
+    }
+}
+
+static void * frame_queue_worker(void * ctx)
+{
+    struct frame_queue * queue = ctx;
+
+    pthread_mutex_lock(&queue->lock);
+    while (1)
+    {
+        /* oldest job nobody works on yet */
+        struct frame_slot * slot = NULL;
+        for (int i = 0; i < queue->count; i++)
+        {
+            struct frame_slot * s = &queue->slots[(queue->head + i) % queue->depth];
+            if (s->state == SLOT_PENDING)
+            {
+                slot = s;
+                break;
+            }
+        }
+
+        if (!slot)
+        {
+            if (queue->stop)
+            {
+                break;
+            }
+            pthread_cond_wait(&queue->work_cond, &queue->lock);
+            continue;
+        }
+
+        slot->state = SLOT_BUSY;
+        struct frame_job * job = slot->job;
+        pthread_mutex_unlock(&queue->lock);
+
+        frame_job_run(job);
+
+        pthread_mutex_lock(&queue->lock);
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&queue->done_cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+struct frame_queue * frame_queue_create(int threads, int depth)
+{
+    struct frame_queue * queue = calloc(1, sizeof(struct frame_queue));
+    if (!queue)
+    {
+        return NULL;
+    }
+
+    threads = threads < 0 ? 0 : threads > FRAME_QUEUE_MAX_THREADS ? FRAME_QUEUE_MAX_THREADS : threads;
+    queue->depth = depth < 1 ? 1 : depth;
+    queue->slots = calloc(queue->depth, sizeof(struct frame_slot));
+    if (!queue->slots)
+    {
+        free(queue);
+        return NULL;
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->work_cond, NULL);
+    pthread_cond_init(&queue->done_cond, NULL);
+
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&queue->threads[queue->num_threads], NULL, frame_queue_worker, queue))
+        {
+            break;
+        }
+        queue->num_threads++;
+    }
+
+    return queue;
+}
+
+void frame_queue_destroy(struct frame_queue * queue)
+{
+    if (!queue)
+    {
+        return;
+    }
+
+    /* let the workers finish what is queued */
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = 1;
+    pthread_cond_broadcast(&queue->work_cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (int i = 0; i < queue->num_threads; i++)
+    {
+        pthread_join(queue->threads[i], NULL);
+    }
+
+    struct frame_job * job;
+    while ((job = frame_queue_pop(queue)))
+    {
+        frame_job_free(job);
+    }
+
+    pthread_cond_destroy(&queue->done_cond);
+    pthread_cond_destroy(&queue->work_cond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->slots);
+    free(queue);
+}
+
+int frame_queue_full(struct frame_queue * queue)
+{
+    return queue->count >= queue->depth;
+}
+
+int frame_queue_count(struct frame_queue * queue)
+{
+    return queue->count;
+}
+
+void frame_queue_push(struct frame_queue * queue, struct frame_job * job)
+{
+    int state = SLOT_PENDING;
+
+    if (!queue->num_threads)
+    {
+        frame_job_run(job);
+        state = SLOT_DONE;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    struct frame_slot * slot = &queue->slots[(queue->head + queue->count) % queue->depth];
+    slot->job = job;
+    slot->state = state;
+    queue->count++;
+    pthread_cond_signal(&queue->work_cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+struct frame_job * frame_queue_pop(struct frame_queue * queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    if (!queue->count)
+    {
+        pthread_mutex_unlock(&queue->lock);
+        return NULL;
+    }
+
+    struct frame_slot * slot = &queue->slots[queue->head];
+    while (slot->state != SLOT_DONE)
+    {
+        /* after shutdown, nobody else will run it */
+        if (!queue->num_threads || (queue->stop && slot->state == SLOT_PENDING))
+        {
+            slot->state = SLOT_BUSY;
+            pthread_mutex_unlock(&queue->lock);
+            frame_job_run(slot->job);
+            pthread_mutex_lock(&queue->lock);
+            slot->state = SLOT_DONE;
+            break;
+        }
+        pthread_cond_wait(&queue->done_cond, &queue->lock);
+    }
+
+    struct frame_job * job = slot->job;
+    slot->job = NULL;
+    queue->head = (queue->head + 1) % queue->depth;
+    queue->count--;
+    pthread_mutex_unlock(&queue->lock);
+
+    return job;
+}
+
+struct frame_job * frame_queue_peek(struct frame_queue * queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    struct frame_job * job = queue->count ? queue->slots[queue->head].job : NULL;
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+struct frame_job * frame_job_create(int op, const void * hdr, uint32_t hdr_size, const void * data, uint32_t size)
+{
+    struct frame_job * job = calloc(1, sizeof(struct frame_job));
+    if (!job || hdr_size > sizeof(job->hdr))
+    {
+        free(job);
+        return NULL;
+    }
+
+    job->op = op;
+    job->hdr_size = hdr_size;
+    if (hdr_size)
+    {
+        memcpy(job->hdr, hdr, hdr_size);
+    }
+
+    if (size)
+    {
+        job->in = malloc(size);
+        if (!job->in)
+        {
+            free(job);
+            return NULL;
+        }
+        memcpy(job->in, data, size);
+        job->in_size = size;
+    }
+    job->in_owned = 1;
+
+    return job;
+}
+
+struct frame_job * frame_job_create_ref(int op, const void * hdr, uint32_t hdr_size, const void * data, uint32_t size)
+{
+    struct frame_job * job = frame_job_create(op, hdr, hdr_size, NULL, 0);
+    if (job)
+    {
+        job->in = (uint8_t *)data;
+        job->in_size = size;
+        job->in_owned = 0;
+    }
+    return job;
+}
+
+void frame_job_free(struct frame_job * job)
+{
+    if (job)
+    {
+        if (job->in_owned)
+        {
+            free(job->in);
+        }
+        free(job->out);
+        free(job);
+    }
+}
+
+int frame_queue_cpu_count()
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? cpus : 1;
+#endif
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* Ordered worker pool for mlv_dump: frames are (de)compressed by several
+ * threads, but handed back in the order they were queued.
+ *
+ * The queue holds at most 'depth' jobs (the reorder buffer). The caller
+ * pushes jobs while frame_queue_full() is false, and pops the oldest job
+ * (waiting for it if needed) to write it out or to use its result.
+ * With 0 threads, jobs are processed right away in frame_queue_push.
+ */
+
+#ifndef _frame_queue_h_
+#define _frame_queue_h_
+
+#include <stdint.h>
+#include "frame_codec.h"
+
+#define FRAME_JOB_STORE         0   /* nothing to do, keeps the data in order */
+#define FRAME_JOB_COMPRESS      1
+#define FRAME_JOB_DECOMPRESS    2
+
+#define FRAME_QUEUE_MAX_THREADS 64
+
+struct frame_job
+{
+    int op;                     /* FRAME_JOB_* */
+    int codec;                  /* FRAME_CODEC_* */
+    struct frame_codec_params params;
+
+    uint8_t hdr[64];            /* block header, written before the data */
+    uint32_t hdr_size;
+    uint64_t key;               /* caller defined, e.g. where the block was read from */
+
+    uint8_t * in;               /* owned by the job, unless created with frame_job_create_ref */
+    uint32_t in_size;
+    int in_owned;
+    uint8_t * out;              /* result (the input data for FRAME_JOB_STORE) */
+    uint32_t out_size;
+    int ret;                    /* 0 = ok */
+};
+
+struct frame_queue;
+
+/* threads = 0: no worker threads */
+struct frame_queue * frame_queue_create(int threads, int depth);
+void frame_queue_destroy(struct frame_queue * queue);
+
+int frame_queue_full(struct frame_queue * queue);
+int frame_queue_count(struct frame_queue * queue);
+
+/* takes ownership of the job; the queue must not be full */
+void frame_queue_push(struct frame_queue * queue, struct frame_job * job);
+
+/* oldest job, when it is done; NULL if the queue is empty */
+struct frame_job * frame_queue_pop(struct frame_queue * queue);
+
+/* the oldest job without removing it (may still be in progress); NULL if empty */
+struct frame_job * frame_queue_peek(struct frame_queue * queue);
+
+/* allocates a job; data is copied (size 0: no data) */
+struct frame_job * frame_job_create(int op, const void * hdr, uint32_t hdr_size, const void * data, uint32_t size);
+
+/* same, but data is only referenced, it must stay valid until the job is freed (e.g. a mapped file) */
+struct frame_job * frame_job_create_ref(int op, const void * hdr, uint32_t hdr_size, const void * data, uint32_t size);
+void frame_job_free(struct frame_job * job);
+
+/* number of CPUs, for the default thread count */
+int frame_queue_cpu_count();
+
+#endif
@@ -27,8 +27,11 @@
 #define MLV_VIDEO_CLASS_JPEG         0x03
 #define MLV_VIDEO_CLASS_H264         0x04
 
+/* class flags, ORed to the class; 0x20 is MLV_VIDEO_CLASS_FLAG_LJ92 in upstream tools, don't reuse it */
 #define MLV_VIDEO_CLASS_FLAG_LZMA    0x80
 #define MLV_VIDEO_CLASS_FLAG_DELTA   0x40
+#define MLV_VIDEO_CLASS_FLAG_HUFF    0x10
+#define MLV_VIDEO_CLASS_FLAG_LOCO    0x0100  /* videoClass is 16 bits; upper byte, clear of the classes and the flags above */
 
 #define MLV_AUDIO_CLASS_FLAG_LZMA    0x80
 
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* Block walk throughput of an MLV clip (all chunks):
+ *
+ *   fread   - like mlv_dump: fread every block into a malloc'ed buffer
+ *   read    - mlv_reader, blocks read into its buffer (32-bit fallback)
+ *   mmap    - mlv_reader, blocks looked at in place
+ *
+ * Every mode sums up all block data, so the data is really read.
+ * The first mode to run also pulls the clip into the page cache; use a
+ * clip larger than RAM (a few GB), or run it twice and look at the second
+ * run, depending on what should be measured.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "mlv_reader.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+struct bench_result
+{
+    uint64_t blocks;
+    uint64_t bytes;
+    uint64_t frames;
+    uint64_t checksum;
+};
+
+static double bench_time()
+{
+#if defined(_WIN32)
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static uint64_t bench_sum(const uint8_t *data, uint32_t size)
+{
+    uint64_t sum = 0;
+    uint32_t pos = 0;
+
+    for(; pos + 8 <= size; pos += 8)
+    {
+        uint64_t word;
+        memcpy(&word, &data[pos], sizeof(word));
+        sum += word;
+    }
+    for(; pos < size; pos++)
+    {
+        sum += data[pos];
+    }
+    return sum;
+}
+
+static void bench_account(struct bench_result *result, const uint8_t *block, uint32_t size)
+{
+    result->blocks++;
+    result->bytes += size;
+    result->frames += !memcmp(block, "VIDF", 4);
+    result->checksum += bench_sum(block, size);
+}
+
+/* the way mlv_dump reads: header, then the whole block into a malloc'ed buffer */
+static int bench_fread(const char *filename, struct bench_result *result)
+{
+    struct mlv_reader *reader = mlv_reader_open(filename, MLV_READER_NO_MMAP | MLV_READER_QUIET);
+    if(!reader)
+    {
+        return -1;
+    }
+
+    for(int chunk = 0; chunk < reader->chunk_count; chunk++)
+    {
+        FILE *file = reader->chunks[chunk].file;
+        mlv_hdr_t hdr;
+
+        fseek(file, 0, SEEK_SET);
+        while(fread(&hdr, sizeof(mlv_hdr_t), 1, file) == 1 && hdr.blockSize >= sizeof(mlv_hdr_t))
+        {
+            uint8_t *buf = malloc(hdr.blockSize);
+            if(!buf)
+            {
+                break;
+            }
+            memcpy(buf, &hdr, sizeof(mlv_hdr_t));
+            if(hdr.blockSize > sizeof(mlv_hdr_t) && fread(&buf[sizeof(mlv_hdr_t)], hdr.blockSize - sizeof(mlv_hdr_t), 1, file) != 1)
+            {
+                free(buf);
+                break;
+            }
+            bench_account(result, buf, hdr.blockSize);
+            free(buf);
+        }
+    }
+
+    mlv_reader_close(reader);
+    return 0;
+}
+
+static int bench_reader(const char *filename, int flags, int ordered, struct bench_result *result)
+{
+    struct mlv_reader *reader = mlv_reader_open(filename, flags | MLV_READER_QUIET);
+    struct mlv_iter iter;
+    struct mlv_block block;
+
+    if(!reader)
+    {
+        return -1;
+    }
+
+    if(!(flags & MLV_READER_NO_MMAP) && !reader->mapped)
+    {
+        printf("  (could not map all chunks, using read)\n");
+    }
+
+    if(ordered)
+    {
+        mlv_reader_index(reader, filename);
+    }
+
+    mlv_iter_init(reader, &iter, ordered);
+    while(mlv_iter_next(reader, &iter, &block) == 1)
+    {
+        bench_account(result, (const uint8_t *)block.hdr, block.hdr->blockSize);
+    }
+
+    mlv_reader_close(reader);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ordered = 0;
+    int runs = 1;
+    const char *filename = NULL;
+
+    for(int arg = 1; arg < argc; arg++)
+    {
+        if(!strcmp(argv[arg], "-o"))
+        {
+            ordered = 1;
+        }
+        else if(!strcmp(argv[arg], "-r") && arg + 1 < argc)
+        {
+            runs = atoi(argv[++arg]);
+        }
+        else
+        {
+            filename = argv[arg];
+        }
+    }
+
+    if(!filename)
+    {
+        printf("Usage: %s [-o] [-r runs] <clip.mlv>\n", argv[0]);
+        printf(" -o        walk in recording order (.IDX file, or index built on the fly)\n");
+        printf(" -r runs   repeat all modes this often\n");
+        return 1;
+    }
+
+    const char *modes[] = { "fread", "read", "mmap" };
+
+    for(int run = 0; run < runs; run++)
+    {
+        for(int mode = 0; mode < 3; mode++)
+        {
+            struct bench_result result;
+            memset(&result, 0x00, sizeof(result));
+
+            double start = bench_time();
+            int ret =
+                (mode == 0) ? bench_fread(filename, &result) :
+                (mode == 1) ? bench_reader(filename, MLV_READER_NO_MMAP, ordered, &result) :
+                              bench_reader(filename, 0, ordered, &result);
+            double elapsed = bench_time() - start;
+
+            if(ret)
+            {
+                printf("Failed to open '%s'\n", filename);
+                return 1;
+            }
+
+            printf("%-6s %8" PRIu64 " blocks %7" PRIu64 " frames %10.1f MiB  %7.3f s  %8.1f MiB/s  %10.0f blocks/s  (sum %016" PRIx64 ")\n",
+                modes[mode], result.blocks, result.frames, result.bytes / 1048576.0, elapsed,
+                result.bytes / 1048576.0 / elapsed, result.blocks / elapsed, result.checksum);
+        }
+    }
+
+    return 0;
+}
@@ -29,6 +29,7 @@
 #include <getopt.h>
 #include <inttypes.h>
 #include <time.h>
+#include <limits.h>
 
 /* dng related headers */
 #include <chdk-dng.h>
@@ -87,14 +88,15 @@ typedef void lua_State;
 /* some compile warning, why? */
 char *strdup(const char *s);
 
-#ifdef MLV_USE_LZMA
-#include <LzmaLib.h>
-#endif
-
 /* project includes */
 #include "../lv_rec/lv_rec.h"
+#include "../lv_rec/defect_map.h"
+#include "calib_lib.h"
+#include "frame_codec.h"
+#include "frame_queue.h"
 #include "../../src/raw.h"
 #include "mlv.h"
+#include "mlv_reader.h"
 #include "camera_id.h"
 
 enum bug_id
@@ -571,100 +573,79 @@ uint16_t bitextract(uint16_t *src, int position, int depth)
 
 int load_frame(char *filename, uint8_t **frame_buffer, uint32_t *frame_buffer_size)
 {
-    FILE *in_file = NULL;
-    int ret = 0;
+    struct mlv_reader *reader = mlv_reader_open(filename, MLV_READER_QUIET);
+    struct mlv_iter iter;
+    struct mlv_block block;
+    int ret = -1;
+    int next = 0;
 
-    /* open files */
-    in_file = fopen(filename, "rb");
-    if(!in_file)
+    if(!reader)
     {
         print_msg(MSG_ERROR, "Failed to open file '%s'\n", filename);
         return 1;
     }
 
-    do
+    mlv_iter_init(reader, &iter, 0);
+    while((next = mlv_iter_next(reader, &iter, &block)) == 1)
     {
-        mlv_hdr_t buf;
-        uint64_t position = 0;
-
-        position = file_get_pos(in_file);
-
-        if(fread(&buf, sizeof(mlv_hdr_t), 1, in_file) != 1)
+        /* the first frame is in the first chunk */
+        if(block.chunk > 0)
         {
-            print_msg(MSG_ERROR, "Failed to read from file '%s'\n", filename);
-            ret = 2;
-            goto load_frame_finish;
+            break;
         }
 
-        print_msg(MSG_INFO, "Block: %c%c%c%c\n", buf.blockType[0], buf.blockType[1], buf.blockType[2], buf.blockType[3]);
-        print_msg(MSG_INFO, "  Offset: 0x%08" PRIx64 "\n", position);
-        print_msg(MSG_INFO, "    Size: %d\n", buf.blockSize);
-        
-        /* jump back to the beginning of the block just read */
-        file_set_pos(in_file, position, SEEK_SET);
-
-        position = file_get_pos(in_file);
+        print_msg(MSG_INFO, "Block: %c%c%c%c\n", block.hdr->blockType[0], block.hdr->blockType[1], block.hdr->blockType[2], block.hdr->blockType[3]);
+        print_msg(MSG_INFO, "  Offset: 0x%08" PRIx64 "\n", block.offset);
+        print_msg(MSG_INFO, "    Size: %d\n", block.hdr->blockSize);
 
-        if(!memcmp(buf.blockType, "MLVI", 4))
+        if(!memcmp(block.hdr->blockType, "MLVI", 4))
         {
-            mlv_file_hdr_t file_hdr;
-            uint32_t hdr_size = MIN(sizeof(mlv_file_hdr_t), buf.blockSize);
-
-            /* read the whole header block, but limit size to either our local type size or the written block size */
-            if(fread(&file_hdr, hdr_size, 1, in_file) != 1)
-            {
-                print_msg(MSG_ERROR, "File ends in the middle of a block\n");
-                ret = 3;
-                goto load_frame_finish;
-            }
-            file_set_pos(in_file, position + file_hdr.blockSize, SEEK_SET);
-
-            if(file_hdr.videoClass & MLV_VIDEO_CLASS_FLAG_LZMA)
+            if(block.hdr->blockSize >= sizeof(mlv_file_hdr_t) &&
+               (MLV_BLOCK_HDR(&block, mlv_file_hdr_t)->videoClass & (MLV_VIDEO_CLASS_FLAG_LZMA | MLV_VIDEO_CLASS_FLAG_HUFF | MLV_VIDEO_CLASS_FLAG_LOCO)))
             {
                 print_msg(MSG_ERROR, "Compressed formats not supported for frame extraction\n");
                 ret = 5;
-                goto load_frame_finish;
+                break;
             }
         }
-        else if(!memcmp(buf.blockType, "VIDF", 4))
+        else if(!memcmp(block.hdr->blockType, "VIDF", 4))
         {
-            mlv_vidf_hdr_t block_hdr;
-            uint32_t hdr_size = MIN(sizeof(mlv_vidf_hdr_t), buf.blockSize);
+            uint32_t frame_size = 0;
+            const uint8_t *frame = mlv_block_frame(&block, &frame_size);
 
-            if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
+            if(!frame)
             {
-                print_msg(MSG_ERROR, "File '%s' ends in the middle of a block\n", filename);
-                ret = 3;
-                goto load_frame_finish;
+                print_msg(MSG_ERROR, "File '%s' has an invalid VIDF block\n", filename);
+                ret = 4;
+                break;
             }
 
-            int frame_size = block_hdr.blockSize - sizeof(mlv_vidf_hdr_t) - block_hdr.frameSpace;
-        
             /* loading the first frame. report frame size and allocate memory for that frame */
             *frame_buffer_size = frame_size;
             *frame_buffer = malloc(frame_size);
-
-            file_set_pos(in_file, block_hdr.frameSpace, SEEK_CUR);
-            if(fread(*frame_buffer, frame_size, 1, in_file) != 1)
-            {
-                print_msg(MSG_ERROR, "File '%s' ends in the middle of a block\n", filename);
-                ret = 4;
-                goto load_frame_finish;
-            }
+            memcpy(*frame_buffer, frame, frame_size);
 
             ret = 0;
-            goto load_frame_finish;
+            break;
+        }
+    }
+
+    /* no frame found */
+    if(ret == -1)
+    {
+        if(next < 0)
+        {
+            print_msg(MSG_ERROR, "File '%s' ends in the middle of a block\n", filename);
+            ret = 3;
         }
         else
         {
-            file_set_pos(in_file, position + buf.blockSize, SEEK_SET);
+            print_msg(MSG_ERROR, "Failed to read from file '%s'\n", filename);
+            ret = 2;
         }
     }
-    while(!feof(in_file));
-
-load_frame_finish:
 
-    fclose(in_file);
+    mlv_reader_close(reader);
 
     return ret;
 }
@@ -674,14 +655,16 @@ mlv_xref_hdr_t *load_index(char *base_filename)
     mlv_xref_hdr_t *block_hdr = NULL;
     int max_name_len = strlen(base_filename) + 16;
     char *filename = malloc(max_name_len);
-    FILE *in_file = NULL;
+    struct mlv_reader *reader = NULL;
+    struct mlv_iter iter;
+    struct mlv_block block;
 
     strncpy(filename, base_filename, max_name_len);
     strcpy(&filename[strlen(filename) - 3], "IDX");
 
-    in_file = fopen(filename, "rb");
+    reader = mlv_reader_open(filename, MLV_READER_QUIET);
 
-    if(!in_file)
+    if(!reader)
     {
         free(filename);
         return NULL;
@@ -689,53 +672,195 @@ mlv_xref_hdr_t *load_index(char *base_filename)
 
     print_msg(MSG_INFO, "File %s opened (XREF)\n", filename);
 
-    do
+    /* we should check the MLVI header for matching UID value to make sure its the right index... */
+    mlv_iter_init(reader, &iter, 0);
+    int ret = mlv_iter_next_type(reader, &iter, "XREF", &block);
+    if(ret == 1)
     {
-        mlv_hdr_t buf;
-        uint64_t position = 0;
+        block_hdr = malloc(block.hdr->blockSize);
+        memcpy(block_hdr, block.hdr, block.hdr->blockSize);
+    }
+    else if(ret < 0)
+    {
+        print_msg(MSG_ERROR, "File '%s' has invalid blocks\n", filename);
+    }
 
-        position = file_get_pos(in_file);
+    mlv_reader_close(reader);
 
-        if(fread(&buf, sizeof(mlv_hdr_t), 1, in_file) != 1)
+    free(filename);
+    return block_hdr;
+}
+
+/* RIFF/WAVE header with the audio format from WAVI, data_size bytes of samples following */
+int write_wav_header(FILE *out_file, mlv_wavi_hdr_t *wavi_info, uint32_t data_size)
+{
+    /* NOTE, assumes little endian system, fix for big endian */
+    uint32_t tmp_uint32;
+    uint16_t tmp_uint16;
+    int error = 1;
+
+    error &= fwrite("RIFF", 4, 1, out_file);
+    tmp_uint32 = data_size + 36; // Two headers combined size
+    error &= fwrite(&tmp_uint32, 4, 1, out_file);
+    error &= fwrite("WAVE", 4, 1, out_file);
+
+    error &= fwrite("fmt ", 4, 1, out_file);
+    tmp_uint32 = 16; // Header size
+    error &= fwrite(&tmp_uint32, 4, 1, out_file);
+    tmp_uint16 = wavi_info->format; // PCM
+    error &= fwrite(&tmp_uint16, 2, 1, out_file);
+    tmp_uint16 = wavi_info->channels; // Stereo
+    error &= fwrite(&tmp_uint16, 2, 1, out_file);
+    tmp_uint32 = wavi_info->samplingRate; // Sample rate
+    error &= fwrite(&tmp_uint32, 4, 1, out_file);
+    tmp_uint32 = wavi_info->bytesPerSecond; // Byte rate (16-bit data, stereo)
+    error &= fwrite(&tmp_uint32, 4, 1, out_file);
+    tmp_uint16 = wavi_info->blockAlign; // Block align
+    error &= fwrite(&tmp_uint16, 2, 1, out_file);
+    tmp_uint16 = wavi_info->bitsPerSample; // Bits per sample
+    error &= fwrite(&tmp_uint16, 2, 1, out_file);
+
+    error &= fwrite("data", 4, 1, out_file);
+    tmp_uint32 = data_size; // Audio data length
+    error &= fwrite(&tmp_uint32, 4, 1, out_file);
+
+    return (error == 1) ? 0 : -1;
+}
+
+/* --wav: copy the audio of a clip into a .wav file, reading only the WAVI and AUDF blocks.
+   the blocks are located with the index (the .IDX file, else one built from the block headers),
+   so this takes time proportional to the audio, not to the size of the clip */
+int extract_wav(char *input_filename, char *wav_filename)
+{
+    struct mlv_reader *reader = NULL;
+    FILE *out_file_wav = NULL;
+    mlv_wavi_hdr_t wavi_info;
+    int wavi_found = 0;
+    uint32_t audf_total = 0;
+    uint32_t audf_processed = 0;
+    uint64_t wav_data_size = 0;
+    int ret = ERR_FILE;
+
+    memset(&wavi_info, 0x00, sizeof(mlv_wavi_hdr_t));
+
+    /* only a small part of the clip is read, so reading beats mapping (and its read-ahead) */
+    reader = mlv_reader_open(input_filename, MLV_READER_NO_MMAP);
+    if(!reader)
+    {
+        print_msg(MSG_ERROR, "Failed to open file '%s'\n", input_filename);
+        return ERR_FILE;
+    }
+
+    if(mlv_reader_index(reader, input_filename))
+    {
+        print_msg(MSG_ERROR, "Failed to index file '%s'\n", input_filename);
+        goto done;
+    }
+
+    for(uint32_t pos = 0; pos < reader->xref_count; pos++)
+    {
+        mlv_xref_t *xref = &reader->xrefs[pos];
+        mlv_hdr_t hdr;
+
+        if(xref->frameType == MLV_FRAME_AUDF)
         {
-            break;
+            audf_total++;
         }
+        else if(!wavi_found && xref->frameType == MLV_FRAME_UNSPECIFIED &&
+                !mlv_reader_peek(reader, xref->fileNumber, xref->frameOffset, &hdr, sizeof(mlv_hdr_t)) &&
+                !memcmp(hdr.blockType, "WAVI", 4))
+        {
+            wavi_found = !mlv_reader_peek(reader, xref->fileNumber, xref->frameOffset, &wavi_info, MIN(sizeof(mlv_wavi_hdr_t), hdr.blockSize));
+        }
+    }
 
-        /* jump back to the beginning of the block just read */
-        file_set_pos(in_file, position, SEEK_SET);
+    if(!wavi_found)
+    {
+        print_msg(MSG_ERROR, "File '%s' contains no audio (no WAVI block)\n", input_filename);
+        goto done;
+    }
 
-        position = file_get_pos(in_file);
+    print_msg(MSG_INFO, "Audio: %d Hz, %d channels, %d bits, %d frames\n", wavi_info.samplingRate, wavi_info.channels, wavi_info.bitsPerSample, audf_total);
+
+    out_file_wav = fopen(wav_filename, "wb");
+    if(!out_file_wav)
+    {
+        print_msg(MSG_ERROR, "Failed to open file '%s'\n", wav_filename);
+        goto done;
+    }
+
+    /* sizes are patched when done */
+    if(write_wav_header(out_file_wav, &wavi_info, 0))
+    {
+        print_msg(MSG_ERROR, "Failed writing into .WAV file\n");
+        goto done;
+    }
+
+    uint32_t wav_header_size = file_get_pos(out_file_wav);
+
+    for(uint32_t pos = 0; pos < reader->xref_count; pos++)
+    {
+        mlv_xref_t *xref = &reader->xrefs[pos];
+        mlv_audf_hdr_t block_hdr;
 
-        /* we should check the MLVI header for matching UID value to make sure its the right index... */
-        if(!memcmp(buf.blockType, "XREF", 4))
+        if(xref->frameType != MLV_FRAME_AUDF)
         {
-            block_hdr = malloc(buf.blockSize);
+            continue;
+        }
 
-            if(fread(block_hdr, buf.blockSize, 1, in_file) != 1)
-            {
-                print_msg(MSG_ERROR, "File '%s' ends in the middle of a block\n", filename);
-                free(block_hdr);
-                block_hdr = NULL;
-            }
+        print_msg(MSG_PROGRESS, "A:%d/%d\n", audf_processed, audf_total);
+
+        if(mlv_reader_peek(reader, xref->fileNumber, xref->frameOffset, &block_hdr, sizeof(mlv_audf_hdr_t)) ||
+           block_hdr.blockSize < sizeof(mlv_audf_hdr_t))
+        {
+            print_msg(MSG_ERROR, "AUDF: File ends in the middle of a block\n");
+            goto done;
         }
-        else
+
+        if(block_hdr.frameSpace > block_hdr.blockSize - sizeof(mlv_audf_hdr_t))
         {
-            file_set_pos(in_file, position + buf.blockSize, SEEK_SET);
+            print_msg(MSG_ERROR, "AUDF: Frame space is larger than block size. Skipping\n");
+            continue;
         }
 
-        /* we are at the same position as before, so abort */
-        if(position == file_get_pos(in_file))
+        /* assume block size is uniform, this allows random access */
+        uint32_t frame_size = block_hdr.blockSize - sizeof(mlv_audf_hdr_t) - block_hdr.frameSpace;
+        uint64_t frame_pos = (uint64_t)frame_size * block_hdr.frameNumber;
+
+        if(frame_pos + frame_size > UINT32_MAX - wav_header_size)
         {
-            print_msg(MSG_ERROR, "File '%s' has invalid blocks\n", filename);
+            print_msg(MSG_ERROR, "AUDF: Audio exceeds the 4 GiB limit of .WAV files, stopping\n");
             break;
         }
+
+        if(mlv_reader_copy(reader, xref->fileNumber, xref->frameOffset + sizeof(mlv_audf_hdr_t) + block_hdr.frameSpace, frame_size, out_file_wav, wav_header_size + frame_pos))
+        {
+            print_msg(MSG_ERROR, "AUDF: Failed writing into .WAV file\n");
+            goto done;
+        }
+
+        wav_data_size = MAX(wav_data_size, frame_pos + frame_size);
+        audf_processed++;
     }
-    while(!feof(in_file));
 
-    fclose(in_file);
+    if(file_set_pos(out_file_wav, 0, SEEK_SET) || write_wav_header(out_file_wav, &wavi_info, wav_data_size))
+    {
+        print_msg(MSG_ERROR, "Failed writing into .WAV file\n");
+        goto done;
+    }
 
-    free(filename);
-    return block_hdr;
+    print_msg(MSG_INFO, "Wrote %d audio frames (%" PRIu64 " bytes) into '%s'\n", audf_processed, wav_data_size, wav_filename);
+    ret = ERR_OK;
+
+done:
+    if(out_file_wav && fclose(out_file_wav) && ret == ERR_OK)
+    {
+        print_msg(MSG_ERROR, "Failed writing into .WAV file\n");
+        ret = ERR_FILE;
+    }
+    mlv_reader_close(reader);
+
+    return ret;
 }
 
 void save_index(char *base_filename, mlv_file_hdr_t *ref_file_hdr, int fileCount, frame_xref_t *index, int entries)
@@ -891,6 +1016,9 @@ FILE **load_all_chunks(char *base_filename, int *entries)
 
 #define EV_RESOLUTION 32768
 
+/* filter raw_info in place, without full-frame copies */
+#define CHROMA_SMOOTH_RAW_INFO
+
 #define CHROMA_SMOOTH_2X2
 #include "../dual_iso/chroma_smooth.c"
 #undef CHROMA_SMOOTH_2X2
@@ -909,6 +1037,7 @@ void chroma_smooth(int method, struct raw_info *info)
     int black = info->black_level;
     static int raw2ev[16384];
     static int _ev2raw[24*EV_RESOLUTION];
+    static int tables_black = -1;
     int* ev2raw = _ev2raw + 10*EV_RESOLUTION;
     
     if(!method)
@@ -916,54 +1045,34 @@ void chroma_smooth(int method, struct raw_info *info)
         return;
     }
 
-    for(int i = 0; i < 16384; i++)
-    {
-        raw2ev[i] = log2(MAX(1, i - black)) * EV_RESOLUTION;
-    }
-
-    for(int i = -10*EV_RESOLUTION; i < 14*EV_RESOLUTION; i++)
+    /* the EV tables only depend on the black level, so they are normally computed once per clip */
+    if(black != tables_black)
     {
-        ev2raw[i] = black + pow(2, (float)i / EV_RESOLUTION);
-    }
-
-    int w = info->width;
-    int h = info->height;
-
-    uint32_t * aux = malloc(w * h * sizeof(uint32_t));
-    uint32_t * aux2 = malloc(w * h * sizeof(uint32_t));
+        for(int i = 0; i < 16384; i++)
+        {
+            raw2ev[i] = log2(MAX(1, i - black)) * EV_RESOLUTION;
+        }
 
-    int x,y;
-    for (y = 0; y < h; y++)
-    {
-        for (x = 0; x < w; x++)
+        for(int i = -10*EV_RESOLUTION; i < 14*EV_RESOLUTION; i++)
         {
-            aux[x + y*w] = aux2[x + y*w] = raw_get_pixel(x, y);
+            ev2raw[i] = black + pow(2, (float)i / EV_RESOLUTION);
         }
+
+        tables_black = black;
     }
 
     switch(method)
     {
         case 2:
-            chroma_smooth_2x2(aux, aux2, raw2ev, ev2raw);
+            chroma_smooth_2x2(NULL, NULL, raw2ev, ev2raw);
             break;
         case 3:
-            chroma_smooth_3x3(aux, aux2, raw2ev, ev2raw);
+            chroma_smooth_3x3(NULL, NULL, raw2ev, ev2raw);
             break;
         case 5:
-            chroma_smooth_5x5(aux, aux2, raw2ev, ev2raw);
+            chroma_smooth_5x5(NULL, NULL, raw2ev, ev2raw);
             break;
     }
-
-    for (y = 0; y < h; y++)
-    {
-        for (x = 0; x < w; x++)
-        {
-            raw_set_pixel(x, y, aux2[x + y*w]);
-        }
-    }
-
-    free(aux);
-    free(aux2);
 }
 
 void show_usage(char *executable)
@@ -983,12 +1092,22 @@ void show_usage(char *executable)
     print_msg(MSG_INFO, " --cs5x5             5x5 chroma smoothing\n");
     print_msg(MSG_INFO, " --no-fixcp          do not fix cold pixels\n");
     print_msg(MSG_INFO, " --fixcp2            fix non-static (moving) cold pixels (slow)\n");
+    print_msg(MSG_INFO, " --defect-map=file   fix cold pixels from a persistent per-camera defect map, instead of scanning\n");
+    print_msg(MSG_INFO, "                     (clips not yet known by the map are scanned and added to it)\n");
+    print_msg(MSG_INFO, " --defect-map-update scan the clip anyway and merge the defects found into the map\n");
+    print_msg(MSG_INFO, " --defect-map-dark   the clip is a dark frame: also record hot pixels into the map\n");
     print_msg(MSG_INFO, " --no-stripes        do not fix vertical stripes in highlights\n");
+    print_msg(MSG_INFO, " --stripes-interval=N  re-estimate the stripe correction every N frames (default: first frame only)\n");
 
     print_msg(MSG_INFO, "\n");
     print_msg(MSG_INFO, "-- RAW output --\n");
     print_msg(MSG_INFO, " -r                  output into a legacy raw file for e.g. raw2dng\n");
 
+    print_msg(MSG_INFO, "\n");
+    print_msg(MSG_INFO, "-- WAV output --\n");
+    print_msg(MSG_INFO, " --wav               only extract the audio into a .wav file (-o or <inputfile> with .wav extension)\n");
+    print_msg(MSG_INFO, "                     reads just the audio blocks, using the .idx file if there is one (see -x)\n");
+
     print_msg(MSG_INFO, "\n");
     print_msg(MSG_INFO, "-- MLV output --\n");
     print_msg(MSG_INFO, " -b bits             convert image data to given bit depth per channel (1-16)\n");
@@ -1006,6 +1125,9 @@ void show_usage(char *executable)
     print_msg(MSG_INFO, " --avg-horizontal    [DARKFRAME ONLY] average the resulting frame in horizontal direction, so we will extract horizontal banding\n");
     print_msg(MSG_INFO, " -s mlv_file         subtract the reference frame in given file from every single frame during processing\n");
     print_msg(MSG_INFO, " -t mlv_file         use the reference frame in given file as flat field (gain correction)\n");
+    print_msg(MSG_INFO, " --calib-lib=file    calibration library: subtract/flat-field the best matching master frames (unless -s/-t are given)\n");
+    print_msg(MSG_INFO, " --calib-add=type    average all frames into a master 'dark' or 'flat' frame and store it in the calibration library\n");
+    print_msg(MSG_INFO, "                     (with --avg-vertical or --avg-horizontal, only a banding profile is stored for darks)\n");
 
     print_msg(MSG_INFO, "\n");
     print_msg(MSG_INFO, "-- Processing --\n");
@@ -1017,11 +1139,15 @@ void show_usage(char *executable)
     //print_msg(MSG_INFO, " -u lut_file         look-up table with 4 * xRes * yRes 16-bit words that is applied before bit depth conversion\n");
 #ifdef MLV_USE_LZMA
     print_msg(MSG_INFO, " -c                  (re-)compress video and audio frames using LZMA (set bpp to 16 to improve compression rate)\n");
-    print_msg(MSG_INFO, " -d                  decompress compressed video and audio frames using LZMA\n");
+    print_msg(MSG_INFO, " -d                  decompress compressed video and audio frames\n");
     print_msg(MSG_INFO, " -l level            set compression level from 0=fastest to 9=best compression\n");
 #else
-    print_msg(MSG_INFO, " -c, -d, -l          NOT AVAILABLE: compression support was not compiled into this release\n");
+    print_msg(MSG_INFO, " -c, -l              NOT AVAILABLE: LZMA support was not compiled into this release, use -c --fast or --loco\n");
+    print_msg(MSG_INFO, " -d                  decompress compressed video frames (only --fast or --loco compressed ones)\n");
 #endif
+    print_msg(MSG_INFO, " --fast              with -c, use a fast lossless Bayer codec instead of LZMA (~50x faster)\n");
+    print_msg(MSG_INFO, " --loco              with -c, use a predictive lossless Bayer codec (LOCO-I style, coded in groups of lines)\n");
+    print_msg(MSG_INFO, " -j threads          number of threads to (de)compress frames with (default: number of CPUs, 1=serial)\n");
     print_msg(MSG_INFO, "\n");
 
     print_msg(MSG_INFO, "-- bugfixes --\n");
@@ -1030,6 +1156,256 @@ void show_usage(char *executable)
     print_msg(MSG_INFO, "\n");
 }
 
+/* settings of the clip being processed, to look up master frames in the calibration library */
+static void calib_clip_key(struct calib_key *key, int type, mlv_idnt_hdr_t *idnt, mlv_expo_hdr_t *expo,
+    mlv_rawc_hdr_t *rawc, mlv_vidf_hdr_t *vidf, int width, int height)
+{
+    memset(key, 0x00, sizeof(struct calib_key));
+    strncpy(key->serial, (char *)idnt->cameraSerial, sizeof(key->serial) - 1);
+    key->camera_model = idnt->cameraModel;
+    key->iso = expo->isoValue;
+    key->shutter_us = (uint32_t)expo->shutterValue;
+    key->width = width;
+    key->height = height;
+    key->type = type;
+
+    if(rawc->binning_x && rawc->binning_y && rawc->offset_x != SHRT_MIN && rawc->offset_y != SHRT_MIN)
+    {
+        key->sampling_x = rawc->binning_x + rawc->skipping_x;
+        key->sampling_y = rawc->binning_y + rawc->skipping_y;
+        key->crop_x = rawc->offset_x;
+        key->crop_y = rawc->offset_y;
+    }
+    else
+    {
+        key->crop_x = vidf->panPosX;
+        key->crop_y = vidf->panPosY;
+    }
+}
+
+/* reference frame loaded by load_frame, unpacked to one uint16_t per pixel */
+static uint16_t *calib_unpack_frame(uint8_t *frame, int width, int height, int depth)
+{
+    uint16_t *values = malloc(width * height * sizeof(uint16_t));
+    if(values)
+    {
+        int pitch = width * depth / 8;
+        for(int y = 0; y < height; y++)
+        {
+            calib_unpack_line(&values[y * width], (uint16_t *)&frame[y * pitch], width, depth);
+        }
+    }
+    return values;
+}
+
+/* codec used for VIDF payloads, from the video class flags */
+static int frame_codec_from_class(int video_class)
+{
+    if(video_class & MLV_VIDEO_CLASS_FLAG_LZMA)
+    {
+        return FRAME_CODEC_LZMA;
+    }
+    if(video_class & MLV_VIDEO_CLASS_FLAG_HUFF)
+    {
+        return FRAME_CODEC_HUFF;
+    }
+    if(video_class & MLV_VIDEO_CLASS_FLAG_LOCO)
+    {
+        return FRAME_CODEC_LOCO;
+    }
+    return 0;
+}
+
+static int frame_codec_class_flag(int codec)
+{
+    switch(codec)
+    {
+        case FRAME_CODEC_LZMA:
+            return MLV_VIDEO_CLASS_FLAG_LZMA;
+        case FRAME_CODEC_HUFF:
+            return MLV_VIDEO_CLASS_FLAG_HUFF;
+        case FRAME_CODEC_LOCO:
+            return MLV_VIDEO_CLASS_FLAG_LOCO;
+    }
+    return 0;
+}
+
+static const char *frame_codec_name(int codec)
+{
+    switch(codec)
+    {
+        case FRAME_CODEC_LZMA:
+            return "LZMA";
+        case FRAME_CODEC_HUFF:
+            return "HUFF";
+        case FRAME_CODEC_LOCO:
+            return "LOCO";
+    }
+    return "none";
+}
+
+/* write a finished job from the output queue: block header with the final size, then the data */
+static int write_queued_block(FILE *out_file, struct frame_job *job, lua_State *lua_state, int verbose)
+{
+    mlv_hdr_t *hdr = (mlv_hdr_t *)job->hdr;
+
+    if(job->ret)
+    {
+        print_msg(MSG_INFO, "    %s: Failed (%d)\n", frame_codec_name(job->codec), job->ret);
+        return -1;
+    }
+
+    hdr->blockSize = job->hdr_size + job->out_size;
+
+    if(job->op == FRAME_JOB_COMPRESS)
+    {
+        if(verbose)
+        {
+            print_msg(MSG_INFO, "    %s: %d -> %d  (%2.2f%%)\n", frame_codec_name(job->codec), job->in_size, job->out_size, ((float)job->out_size * 100.0f) / (float)job->in_size);
+        }
+        print_msg(MSG_INFO, "  saving: %d -> %d  (%2.2f%%)\n", job->in_size, job->out_size, ((float)job->out_size * 100.0f) / (float)job->in_size);
+
+        lua_handle_hdr_data(lua_state, hdr->blockType, "_data_write_mlv", job->hdr, job->hdr_size, job->out, job->out_size);
+    }
+
+    if(fwrite(job->hdr, job->hdr_size, 1, out_file) != 1 || (job->out_size && fwrite(job->out, job->out_size, 1, out_file) != 1))
+    {
+        print_msg(MSG_ERROR, "%c%c%c%c: Failed writing into .MLV file\n", hdr->blockType[0], hdr->blockType[1], hdr->blockType[2], hdr->blockType[3]);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* write out finished jobs from the output queue; all of them if 'all' is set, else only until there is a free slot */
+static int write_queue_drain(struct frame_queue *queue, FILE *out_file, lua_State *lua_state, int verbose, int all)
+{
+    int ret = 0;
+
+    while(queue && frame_queue_count(queue) && (all || frame_queue_full(queue)))
+    {
+        struct frame_job *job = frame_queue_pop(queue);
+        if(!ret && write_queued_block(out_file, job, lua_state, verbose))
+        {
+            ret = -1;
+        }
+        frame_job_free(job);
+    }
+
+    return ret;
+}
+
+/* read-ahead for compressed VIDF blocks: the blocks following the current one are queued
+ * for decompression, so worker threads decode them while the main loop processes this one */
+struct read_ahead
+{
+    struct frame_queue *queue;
+    struct mlv_reader *reader;  /* separate from the main loop's files, no seeking back and forth */
+    mlv_xref_t *xrefs;          /* follow the index if there is one, else scan the current file */
+    uint32_t xref_count;
+    int codec;
+
+    /* next block to look at */
+    int file;
+    uint64_t position;
+    uint32_t xref_pos;
+    int end;
+};
+
+static uint64_t read_ahead_key(int file, uint64_t position)
+{
+    return ((uint64_t)file << 48) | position;
+}
+
+static void read_ahead_fill(struct read_ahead *ra)
+{
+    while(!ra->end && !frame_queue_full(ra->queue))
+    {
+        int file = ra->file;
+        uint64_t position = ra->position;
+        struct mlv_block block;
+
+        if(ra->xrefs)
+        {
+            if(ra->xref_pos >= ra->xref_count)
+            {
+                ra->end = 1;
+                break;
+            }
+            file = ra->xrefs[ra->xref_pos].fileNumber;
+            position = ra->xrefs[ra->xref_pos].frameOffset;
+            ra->xref_pos++;
+
+            if(ra->xrefs[ra->xref_pos - 1].frameType != MLV_FRAME_VIDF)
+            {
+                continue;
+            }
+        }
+
+        if(mlv_reader_block(ra->reader, file, position, &block))
+        {
+            ra->end = 1;
+            break;
+        }
+
+        if(!ra->xrefs)
+        {
+            ra->position = position + block.hdr->blockSize;
+        }
+
+        uint32_t size = 0;
+        const uint8_t *data = mlv_block_frame(&block, &size);
+        if(!data || memcmp(block.hdr->blockType, "VIDF", 4))
+        {
+            continue;
+        }
+
+        /* mapped frames are decompressed right from the file, else the reader's buffer is reused */
+        struct frame_job *job = ra->reader->mapped ?
+            frame_job_create_ref(FRAME_JOB_DECOMPRESS, NULL, 0, data, size) :
+            frame_job_create(FRAME_JOB_DECOMPRESS, NULL, 0, data, size);
+        if(!job)
+        {
+            ra->end = 1;
+            break;
+        }
+        job->codec = ra->codec;
+        job->key = read_ahead_key(file, position);
+        frame_queue_push(ra->queue, job);
+    }
+}
+
+/* decompressed data of the block at (file, position), if it was read ahead. else NULL,
+ * and the read-ahead restarts after this block */
+static struct frame_job *read_ahead_get(struct read_ahead *ra, int file, uint64_t position, uint32_t xref_pos)
+{
+    struct frame_job *job = frame_queue_peek(ra->queue);
+
+    if(!job || job->key != read_ahead_key(file, position))
+    {
+        /* not what we expected (first frame or out of order), start over from here */
+        while((job = frame_queue_pop(ra->queue)))
+        {
+            frame_job_free(job);
+        }
+        ra->file = file;
+        ra->position = position;
+        ra->xref_pos = xref_pos;
+        ra->end = 0;
+        read_ahead_fill(ra);
+
+        job = frame_queue_peek(ra->queue);
+        if(!job || job->key != read_ahead_key(file, position))
+        {
+            return NULL;
+        }
+    }
+
+    job = frame_queue_pop(ra->queue);
+    read_ahead_fill(ra);
+    return job;
+}
+
 void print_sampling_info(int bin, int skip, char * what)
 {
     if (bin + skip == 1) {
@@ -1145,6 +1521,8 @@ int main (int argc, char *argv[])
     int lzma_fb = 16;
     int lzma_threads = 8;
 #endif
+    int output_codec = FRAME_CODEC_LZMA;
+    int threads = frame_queue_cpu_count();
 
     lua_State *lua_state = NULL;
 
@@ -1155,9 +1533,19 @@ int main (int argc, char *argv[])
     int fix_bug_1_offset = 0;
     int fix_bug_2_offset = 0;
     int dng_output = 0;
+    int wav_output = 0;
     int dump_xrefs = 0;
     int fix_cold_pixels = 1;
     int fix_vert_stripes = 1;
+    char *defect_map_filename = NULL;
+    struct defect_map defect_map_data;
+    char *calib_lib_filename = NULL;
+    int calib_add = 0;
+    extern struct defect_map * defect_map;
+    extern struct defect_clip defect_clip;
+    extern int defect_map_update;
+    extern int defect_map_dark;
+    extern int stripes_sample_interval;
     
     const char * unique_camname = "(unknown)";
 
@@ -1168,6 +1556,7 @@ int main (int argc, char *argv[])
         {"batch",  no_argument, &batch_mode,  1 },
         {"dump-xrefs",   no_argument, &dump_xrefs,  1 },
         {"dng",    no_argument, &dng_output,  1 },
+        {"wav",    no_argument, &wav_output,  1 },
         {"no-cs",  no_argument, &chroma_smooth_method,  0 },
         {"cs2x2",  no_argument, &chroma_smooth_method,  2 },
         {"cs3x3",  no_argument, &chroma_smooth_method,  3 },
@@ -1175,8 +1564,16 @@ int main (int argc, char *argv[])
         {"no-fixcp",  no_argument, &fix_cold_pixels,  0 },
         {"fixcp2",    no_argument, &fix_cold_pixels,  2 },
         {"no-stripes",  no_argument, &fix_vert_stripes,  0 },
+        {"stripes-interval",  required_argument, NULL,  'S' },
+        {"defect-map",  required_argument, NULL,  'D' },
+        {"defect-map-update",  no_argument, &defect_map_update,  1 },
+        {"defect-map-dark",  no_argument, &defect_map_dark,  1 },
         {"avg-vertical",  no_argument, &average_vert,  1 },
         {"avg-horizontal",  no_argument, &average_hor,  1 },
+        {"calib-lib",  required_argument, NULL,  'C' },
+        {"calib-add",  required_argument, NULL,  'K' },
+        {"fast",   no_argument, &output_codec,  FRAME_CODEC_HUFF },
+        {"loco",   no_argument, &output_codec,  FRAME_CODEC_LOCO },
         {0,         0,                 0,  0 }
     };
 
@@ -1191,7 +1588,7 @@ int main (int argc, char *argv[])
     }
 
     int index = 0;
-    while ((opt = getopt_long(argc, argv, "A:F:B:L:t:xz:emnas:X:I:uvrcdo:l:b:f:", long_options, &index)) != -1)
+    while ((opt = getopt_long(argc, argv, "A:F:B:L:t:xz:emnas:X:I:uvrcdo:l:b:f:j:", long_options, &index)) != -1)
     {
         switch (opt)
         {
@@ -1269,10 +1666,55 @@ int main (int argc, char *argv[])
                     print_msg(MSG_ERROR, "LUA: Failed to call 'init' in script\n");
                 }
                 break;
-#else
-                print_msg(MSG_ERROR, "LUA support not compiled into this binary\n");
-                return ERR_PARAM;
-#endif
+#else
+                print_msg(MSG_ERROR, "LUA support not compiled into this binary\n");
+                return ERR_PARAM;
+#endif
+
+            case 'S':
+                if(!optarg)
+                {
+                    print_msg(MSG_ERROR, "Error: Missing stripe correction interval\n");
+                    return ERR_PARAM;
+                }
+                stripes_sample_interval = MAX(0, atoi(optarg));
+                break;
+
+            case 'D':
+                if(!optarg)
+                {
+                    print_msg(MSG_ERROR, "Error: Missing defect map filename\n");
+                    return ERR_PARAM;
+                }
+                defect_map_filename = strdup(optarg);
+                break;
+
+            case 'C':
+                if(!optarg)
+                {
+                    print_msg(MSG_ERROR, "Error: Missing calibration library filename\n");
+                    return ERR_PARAM;
+                }
+                calib_lib_filename = strdup(optarg);
+                break;
+
+            case 'K':
+                if(optarg && !strcasecmp(optarg, "dark"))
+                {
+                    calib_add = CALIB_DARK;
+                }
+                else if(optarg && !strcasecmp(optarg, "flat"))
+                {
+                    calib_add = CALIB_FLAT;
+                }
+                else
+                {
+                    print_msg(MSG_ERROR, "Error: Calibration frame type must be 'dark' or 'flat'\n");
+                    return ERR_PARAM;
+                }
+                average_mode = 1;
+                decompress_output = 1;
+                break;
 
             case 'x':
                 xref_mode = 1;
@@ -1355,21 +1797,16 @@ int main (int argc, char *argv[])
                 break;
 
             case 'c':
-#ifdef MLV_USE_LZMA
+                /* LZMA availability is checked after parsing, --fast may follow */
                 compress_output = 1;
-#else
-                print_msg(MSG_ERROR, "Error: Compression support was not compiled into this release\n");
-                return ERR_PARAM;
-#endif
                 break;
 
             case 'd':
-#ifdef MLV_USE_LZMA
                 decompress_output = 1;
-#else
-                print_msg(MSG_ERROR, "Error: Compression support was not compiled into this release\n");
-                return ERR_PARAM;
-#endif
+                break;
+
+            case 'j':
+                threads = MIN(FRAME_QUEUE_MAX_THREADS, MAX(1, atoi(optarg)));
                 break;
 
             case 'o':
@@ -1441,6 +1878,33 @@ int main (int argc, char *argv[])
         return ERR_PARAM;
     }
 
+    if(calib_add)
+    {
+        if(!calib_lib_filename)
+        {
+            print_msg(MSG_ERROR, "Error: --calib-add needs a library (--calib-lib)\n");
+            return ERR_PARAM;
+        }
+        if(average_vert && average_hor)
+        {
+            print_msg(MSG_ERROR, "Error: A master frame can only have a vertical or a horizontal profile\n");
+            return ERR_PARAM;
+        }
+        if(calib_add == CALIB_FLAT && (average_vert || average_hor))
+        {
+            print_msg(MSG_ERROR, "Error: --avg-vertical/--avg-horizontal are only possible for dark frames\n");
+            return ERR_PARAM;
+        }
+    }
+
+#ifndef MLV_USE_LZMA
+    if(compress_output && output_codec == FRAME_CODEC_LZMA)
+    {
+        print_msg(MSG_ERROR, "Error: LZMA support was not compiled into this release, use -c --fast or -c --loco\n");
+        return ERR_PARAM;
+    }
+#endif
+
 
 
     print_msg(MSG_INFO, "\n");
@@ -1454,6 +1918,36 @@ int main (int argc, char *argv[])
     print_msg(MSG_INFO, "Mode of operation:\n");
     print_msg(MSG_INFO, "   - Input MLV file: '%s'\n", input_filename);
 
+    /* audio only, this does not need to walk through the video frames */
+    if(wav_output)
+    {
+        const char *base_filename = output_filename ? output_filename : input_filename;
+        int len = strlen(base_filename) + 5;
+        char *wav_filename = malloc(len);
+
+        strcpy(wav_filename, base_filename);
+
+        if(!output_filename)
+        {
+            char *ext_dot = strrchr(wav_filename, '.');
+            if(ext_dot)
+            {
+                *ext_dot = '\000';
+            }
+        }
+
+        if(strlen(wav_filename) < 4 || strcasecmp(&wav_filename[strlen(wav_filename) - 4], ".wav"))
+        {
+            strcat(wav_filename, ".wav");
+        }
+
+        print_msg(MSG_INFO, "   - Extract audio into '%s'\n", wav_filename);
+
+        int ret = extract_wav(input_filename, wav_filename);
+        free(wav_filename);
+        return ret;
+    }
+
     if(verbose)
     {
         print_msg(MSG_INFO, "   - Verbose messages\n");
@@ -1533,7 +2027,7 @@ int main (int argc, char *argv[])
             }
             if(compress_output)
             {
-                print_msg(MSG_INFO, "   - Compress frame data\n");
+                print_msg(MSG_INFO, "   - Compress frame data (%s, %d threads)\n", frame_codec_name(output_codec), threads);
             }
             if(average_mode)
             {
@@ -1586,6 +2080,15 @@ int main (int argc, char *argv[])
         print_msg(MSG_INFO, "   - Output .idx file for faster processing\n");
     }
 
+    if(calib_add)
+    {
+        print_msg(MSG_INFO, "   - Store averaged %s frame in calibration library '%s'\n", (calib_add == CALIB_DARK) ? "dark" : "flat-field", calib_lib_filename);
+    }
+    else if(calib_lib_filename)
+    {
+        print_msg(MSG_INFO, "   - Use master frames from calibration library '%s'\n", calib_lib_filename);
+    }
+
     /* start processing */
     lv_rec_file_footer_t lv_rec_footer;
     mlv_file_hdr_t main_header;
@@ -1596,8 +2099,10 @@ int main (int argc, char *argv[])
     mlv_wavi_hdr_t wavi_info;
     mlv_rtci_hdr_t rtci_info;
     mlv_vidf_hdr_t last_vidf;
+    mlv_rawc_hdr_t rawc_info;
 
     /* initialize stuff */
+    memset(&rawc_info, 0x00, sizeof(mlv_rawc_hdr_t));
     memset(&lv_rec_footer, 0x00, sizeof(lv_rec_file_footer_t));
     memset(&lens_info, 0x00, sizeof(mlv_lens_hdr_t));
     memset(&expo_info, 0x00, sizeof(mlv_expo_hdr_t));
@@ -1624,6 +2129,27 @@ int main (int argc, char *argv[])
     uint8_t *frame_buffer = NULL;
     uint8_t *prev_frame_buffer = NULL;
 
+    /* frames are (de)compressed by worker threads, in order */
+    struct frame_queue *write_queue = NULL;
+    struct read_ahead read_ahead;
+    memset(&read_ahead, 0x00, sizeof(read_ahead));
+    uint16_t output_video_class = 0;
+
+    /* dark and flat-field correction, prepared on the first frame */
+    struct calib_lib calib_lib_data;
+    struct calib_key calib_key;
+    struct calib_master calib_dark;
+    struct calib_master calib_flat;
+    int calib_lib_loaded = 0;
+    int calib_ready = 0;
+    int calib_depth = 0;
+    int calib_black = 0;
+    uint16_t *calib_line = NULL;
+
+    memset(&calib_key, 0x00, sizeof(calib_key));
+    memset(&calib_dark, 0x00, sizeof(calib_dark));
+    memset(&calib_flat, 0x00, sizeof(calib_flat));
+
     FILE *out_file = NULL;
     FILE *out_file_wav = NULL;
     FILE **in_files = NULL;
@@ -1683,7 +2209,7 @@ int main (int argc, char *argv[])
     /* this block will load an image from a MLV file, so use its reported frame size for future use */
     if(subtract_mode)
     {
-        printf("Loading subtract (dark) frame '%s'\n", flatfield_filename);
+        printf("Loading subtract (dark) frame '%s'\n", subtract_filename);
         int ret = load_frame(subtract_filename, &frame_sub_buffer, &subtract_frame_buffer_size);
 
         if(ret)
@@ -1731,7 +2257,7 @@ int main (int argc, char *argv[])
         memset(prev_frame_buffer, 0x00, frame_buffer_size);
     }
 
-    if(output_filename || lua_state)
+    if(output_filename || lua_state || calib_add)
     {
         frame_buffer = malloc(frame_buffer_size);
         if(!frame_buffer)
@@ -1752,6 +2278,40 @@ int main (int argc, char *argv[])
         }
     }
 
+    if(defect_map_filename && dng_output)
+    {
+        if(defect_map_load(&defect_map_data, defect_map_filename) != 0)
+        {
+            return ERR_FILE;
+        }
+        defect_map = &defect_map_data;
+    }
+
+    if(calib_lib_filename)
+    {
+        if(calib_lib_load(&calib_lib_data, calib_lib_filename) != 0)
+        {
+            return ERR_FILE;
+        }
+        calib_lib_loaded = 1;
+        print_msg(MSG_INFO, "Calibration library '%s' contains %d master frames\n", calib_lib_filename, calib_lib_data.num_entries);
+    }
+
+    if(mlv_output && compress_output)
+    {
+        /* a few frames per thread in flight, to keep all threads busy */
+        write_queue = frame_queue_create((threads > 1) ? threads : 0, 2 * threads);
+    }
+
+    /* the workarounds for broken files read the blocks differently, decompress those inline */
+    if(threads > 1 && fix_bug == BUG_ID_NONE)
+    {
+        read_ahead.reader = mlv_reader_open(input_filename, MLV_READER_QUIET);
+        read_ahead.queue = read_ahead.reader ? frame_queue_create(threads, 2 * threads) : NULL;
+        read_ahead.xrefs = xrefs;
+        read_ahead.xref_count = block_xref ? block_xref->entryCount : 0;
+    }
+
     print_msg(MSG_INFO, "Processing...\n");
     uint64_t position_previous = 0;
     do
@@ -1882,13 +2442,10 @@ read_headers:
                     }
 
                     /* set the output compression flag */
+                    file_hdr.videoClass &= ~(MLV_VIDEO_CLASS_FLAG_LZMA | MLV_VIDEO_CLASS_FLAG_HUFF | MLV_VIDEO_CLASS_FLAG_LOCO);
                     if(compress_output)
                     {
-                        file_hdr.videoClass |= MLV_VIDEO_CLASS_FLAG_LZMA;
-                    }
-                    else
-                    {
-                        file_hdr.videoClass &= ~MLV_VIDEO_CLASS_FLAG_LZMA;
+                        file_hdr.videoClass |= frame_codec_class_flag(output_codec);
                     }
 
                     if(delta_encode_mode)
@@ -1899,6 +2456,7 @@ read_headers:
                     {
                         file_hdr.videoClass &= ~MLV_VIDEO_CLASS_FLAG_DELTA;
                     }
+                    output_video_class = file_hdr.videoClass;
 
                     if(!extract_block || !strncasecmp(extract_block, (char*)file_hdr.fileMagic, 4))
                     {
@@ -1993,6 +2551,15 @@ read_headers:
                 goto abort;
             }
 
+            /* queued frames have to be written before any other block */
+            if(write_queue && memcmp(buf.blockType, "VIDF", 4) && memcmp(buf.blockType, "AUDF", 4))
+            {
+                if(write_queue_drain(write_queue, out_file, lua_state, verbose, 1))
+                {
+                    goto abort;
+                }
+            }
+
             if(verbose)
             {
                 print_msg(MSG_INFO, "Block: %c%c%c%c\n", buf.blockType[0], buf.blockType[1], buf.blockType[2], buf.blockType[3]);
@@ -2054,7 +2621,20 @@ read_headers:
                     }
 
 
-                    if(mlv_output && !only_metadata_mode && (!extract_block || !strncasecmp(extract_block, (char*)block_hdr.blockType, 4)))
+                    if(mlv_output && !only_metadata_mode && write_queue && (!extract_block || !strncasecmp(extract_block, (char*)block_hdr.blockType, 4)))
+                    {
+                        /* queued behind the video frames being compressed */
+                        struct frame_job *job = frame_job_create(FRAME_JOB_STORE, &block_hdr, sizeof(mlv_audf_hdr_t), buf, frame_size);
+                        if(!job || write_queue_drain(write_queue, out_file, lua_state, verbose, 0))
+                        {
+                            print_msg(MSG_ERROR, "AUDF: Failed writing into .MLV file\n");
+                            frame_job_free(job);
+                            free(buf);
+                            goto abort;
+                        }
+                        frame_queue_push(write_queue, job);
+                    }
+                    else if(mlv_output && !only_metadata_mode && (!extract_block || !strncasecmp(extract_block, (char*)block_hdr.blockType, 4)))
                     {
                         /* correct header size */
                         block_hdr.blockSize = sizeof(mlv_audf_hdr_t) + frame_size;
@@ -2132,15 +2712,24 @@ read_headers:
                     skip_block = 1;
                 }
 
-                if((raw_output || mlv_output || dng_output || lua_state) && !skip_block)
+                if((raw_output || mlv_output || dng_output || lua_state || calib_add) && !skip_block)
                 {
                     /* if already compressed, we have to decompress it first */
-                    int compressed = main_header.videoClass & MLV_VIDEO_CLASS_FLAG_LZMA;
+                    int compressed = frame_codec_from_class(main_header.videoClass);
                     int recompress = compressed && compress_output;
                     int decompress = compressed && decompress_output;
+                    int decode = recompress || decompress || ((raw_output || dng_output) && compressed);
 
                     int frame_size = block_hdr.blockSize - sizeof(mlv_vidf_hdr_t) - block_hdr.frameSpace;
                     int prev_frame_size = frame_size;
+                    uint32_t buffer_needed = frame_size;
+                    struct frame_job *decoded = NULL;
+
+                    if(decode && read_ahead.queue)
+                    {
+                        read_ahead.codec = compressed;
+                        decoded = read_ahead_get(&read_ahead, in_file_num, position, block_xref ? block_xref_pos : 0);
+                    }
 
                     uint64_t skipSize = block_hdr.frameSpace;
                     if(fix_bug == BUG_ID_FRAMEDATA_MISALIGN && (int)block_hdr.frameSpace >= fix_bug_2_offset)
@@ -2159,11 +2748,28 @@ read_headers:
                         fix_bug_1_offset = 0;
                     }
                     
+                    /* the frame buffer also has to hold the decompressed frame, its size is stored in front of the data */
+                    if(decoded)
+                    {
+                        buffer_needed = MAX(buffer_needed, decoded->out_size);
+                    }
+                    else if(decode && frame_size >= 4)
+                    {
+                        uint32_t decoded_size = 0;
+                        if(fread(&decoded_size, sizeof(uint32_t), 1, in_file) != 1)
+                        {
+                            print_msg(MSG_ERROR, "VIDF: File ends in the middle of a block\n");
+                            goto abort;
+                        }
+                        file_set_pos(in_file, -(int64_t)sizeof(uint32_t), SEEK_CUR);
+                        buffer_needed = MAX(buffer_needed, decoded_size);
+                    }
+
                     /* check if there is enough memory for that frame */
-                    if(frame_size > (int)frame_buffer_size)
+                    if(buffer_needed > frame_buffer_size)
                     {
                         /* no, set new size */
-                        frame_buffer_size = frame_size;
+                        frame_buffer_size = buffer_needed;
                         
                         /* realloc buffers */
                         frame_buffer = realloc(frame_buffer, frame_buffer_size);
@@ -2218,38 +2824,44 @@ read_headers:
                     
                     lua_handle_hdr_data(lua_state, buf.blockType, "_data_read", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
 
-                    if(recompress || decompress || ((raw_output || dng_output) && compressed))
+                    if(decode)
                     {
-#ifdef MLV_USE_LZMA
-                        size_t lzma_out_size = *(uint32_t *)frame_buffer;
-                        size_t lzma_in_size = frame_size - LZMA_PROPS_SIZE - 4;
-                        size_t lzma_props_size = LZMA_PROPS_SIZE;
-                        unsigned char *lzma_out = malloc(lzma_out_size);
-
-                        int ret = LzmaUncompress(
-                            lzma_out, &lzma_out_size,
-                            (unsigned char *)&frame_buffer[4 + LZMA_PROPS_SIZE], &lzma_in_size,
-                            (unsigned char *)&frame_buffer[4], lzma_props_size
-                            );
-
-                        if(ret == SZ_OK)
+                        struct frame_job *job = decoded;
+
+                        /* not read ahead, decompress it here */
+                        if(!job)
                         {
-                            frame_size = lzma_out_size;
-                            memcpy(frame_buffer, lzma_out, frame_size);
-                            if(verbose)
+                            job = frame_job_create_ref(FRAME_JOB_DECOMPRESS, NULL, 0, frame_buffer, frame_size);
+                            if(!job)
                             {
-                                print_msg(MSG_INFO, "    LZMA: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", lzma_in_size, lzma_out_size, ((float)lzma_out_size * 100.0f) / (float)lzma_in_size);
+                                print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", frame_size);
+                                goto abort;
                             }
+                            job->ret = frame_decompress(compressed, job->in, job->in_size, &job->out, &job->out_size);
                         }
-                        else
+
+                        if(job->ret || job->out_size > frame_buffer_size)
                         {
-                            print_msg(MSG_INFO, "    LZMA: Failed (%d)\n", ret);
+#ifndef MLV_USE_LZMA
+                            if(compressed == FRAME_CODEC_LZMA)
+                            {
+                                print_msg(MSG_INFO, "    LZMA: not compiled into this release, aborting.\n");
+                                frame_job_free(job);
+                                goto abort;
+                            }
+#endif
+                            print_msg(MSG_INFO, "    %s: Failed (%d)\n", frame_codec_name(compressed), job->ret);
+                            frame_job_free(job);
                             goto abort;
                         }
-#else
-                        print_msg(MSG_INFO, "    LZMA: not compiled into this release, aborting.\n");
-                        goto abort;
-#endif
+
+                        frame_size = job->out_size;
+                        memcpy(frame_buffer, job->out, frame_size);
+                        if(verbose)
+                        {
+                            print_msg(MSG_INFO, "    %s: %d -> %d  (%2.2f%%)\n", frame_codec_name(compressed), job->in_size, job->out_size, ((float)job->out_size * 100.0f) / (float)job->in_size);
+                        }
+                        frame_job_free(job);
                     }
 
                     int old_depth = lv_rec_footer.raw_info.bits_per_pixel;
@@ -2258,167 +2870,137 @@ read_headers:
                     /* this value changes in this context */
                     int current_depth = old_depth;
 
-                    /* in subtract mode, subtract reference frame. do that before averaging */
-                    if(subtract_mode)
+                    /* prepare dark and flat-field correction on the first frame, when the clip's settings are known:
+                     * the reference frames given with -s / -t, or the best matching masters from the library */
+                    if(!calib_ready)
                     {
-                        if((int)subtract_frame_buffer_size != frame_size)
-                        {
-                            print_msg(MSG_ERROR, "Error: Frame sizes of footage and subtract frame differ (%d, %d)", frame_size, subtract_frame_buffer_size);
-                            break;
-                        }
-                        
-                        int pitch = video_xRes * current_depth / 8;
+                        int black = lv_rec_footer.raw_info.black_level;
 
-                        for(int y = 0; y < video_yRes; y++)
+                        calib_ready = 1;
+                        calib_depth = current_depth;
+                        calib_black = black;
+
+                        if(subtract_mode)
                         {
-                            uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
-                            uint16_t *sub_line = (uint16_t *)&frame_sub_buffer[y * pitch];
+                            if((int)subtract_frame_buffer_size != frame_size)
+                            {
+                                print_msg(MSG_ERROR, "Error: Frame sizes of footage and subtract frame differ (%d, %d)", frame_size, subtract_frame_buffer_size);
+                                break;
+                            }
 
-                            for(int x = 0; x < video_xRes; x++)
+                            uint16_t *values = calib_unpack_frame(frame_sub_buffer, video_xRes, video_yRes, current_depth);
+                            if(!values || calib_master_init(&calib_dark, CALIB_DARK, CALIB_FULL, video_xRes, video_yRes, values, black, current_depth, black, current_depth))
                             {
-                                int32_t value = bitextract(src_line, x, current_depth);
-                                int32_t sub_value = bitextract(sub_line, x, current_depth);
+                                print_msg(MSG_ERROR, "Error: Failed to prepare subtract frame\n");
+                                free(values);
+                                break;
+                            }
+                            free(values);
+                        }
 
-                                value -= sub_value;
-                                value += lv_rec_footer.raw_info.black_level; /* should we really add it here? or better subtract it from averaged frame? */
-                                value = COERCE(value, 0, (1<<current_depth)-1);
+                        if(flatfield_mode)
+                        {
+                            if((int)flatfield_frame_buffer_size != frame_size)
+                            {
+                                print_msg(MSG_ERROR, "Error: Frame sizes of footage and flat-field frame differ (%d, %d)", frame_size, flatfield_frame_buffer_size);
+                                break;
+                            }
 
-                                bitinsert(src_line, x, current_depth, value);
+                            uint16_t *values = calib_unpack_frame(frame_flat_buffer, video_xRes, video_yRes, current_depth);
+                            if(!values || calib_master_init(&calib_flat, CALIB_FLAT, CALIB_FULL, video_xRes, video_yRes, values, black, current_depth, black, current_depth))
+                            {
+                                print_msg(MSG_ERROR, "Error: Failed to prepare flat-field frame\n");
+                                free(values);
+                                break;
                             }
+                            free(values);
                         }
-                    }
 
-                    /* in flat-field mode, divide each image by the normalized reference frame */
-                    if(flatfield_mode)
-                    {
-                        if((int)flatfield_frame_buffer_size != frame_size)
+                        if(calib_lib_loaded)
                         {
-                            print_msg(MSG_ERROR, "Error: Frame sizes of footage and flat-field frame differ (%d, %d)", frame_size, flatfield_frame_buffer_size);
-                            break;
-                        }
-                        
-                        int pitch = video_xRes * current_depth / 8;
+                            calib_clip_key(&calib_key, calib_add, &idnt_info, &expo_info, &rawc_info, &block_hdr, video_xRes, video_yRes);
 
-                        /* normalize flat frame on each Bayer channel (median) */
-                        /* and adjust all medians using green's 5th percentile to prevent whites from clipping */
-                        static int32_t med[2][2] = {{0,0},{0,0}};
-                        static int32_t pr5[2][2] = {{0,0},{0,0}};
-                        static int32_t adj_num = 0;
-                        static int32_t adj_den = 0;
+                            /* when building a master dark, nothing is subtracted; master flats get the matching dark subtracted */
+                            struct calib_entry *dark = (calib_dark.type || calib_add == CALIB_DARK) ? NULL : calib_lib_find(&calib_lib_data, &calib_key, CALIB_DARK);
+                            struct calib_entry *flat = (calib_flat.type || calib_add) ? NULL : calib_lib_find(&calib_lib_data, &calib_key, CALIB_FLAT);
 
-                        int black = lv_rec_footer.raw_info.black_level;
-                        
-                        if (!med[0][0])
-                        {
-                            /* normalize using frame center only
-                             * (also works on lenses with heavy vignetting) */
-                            
-                            int* hist[2][2];
-                            int total[2][2] = {{0,0},{0,0}};
-                            
-                            hist[0][0] = calloc(1 << current_depth, sizeof(int));
-                            hist[0][1] = calloc(1 << current_depth, sizeof(int));
-                            hist[1][0] = calloc(1 << current_depth, sizeof(int));
-                            hist[1][1] = calloc(1 << current_depth, sizeof(int));
-                            
-                            for(int y = video_yRes/4; y < video_yRes*3/4; y++)
+                            if(dark && calib_master_init_entry(&calib_dark, &calib_lib_data, dark, black, current_depth) == 0)
                             {
-                                uint16_t *flat_line = (uint16_t *)&frame_flat_buffer[y * pitch];
-                                for(int x = video_xRes/4; x < video_xRes*3/4; x++)
-                                {
-                                    uint32_t value = bitextract(flat_line, x, current_depth);
-                                    hist[y%2][x%2][value]++;
-                                    total[y%2][x%2]++;
-                                }
+                                print_msg(MSG_INFO, "Using master dark frame: ISO %d, %d us, %d frames%s\n", dark->key.iso, dark->key.shutter_us, dark->frames,
+                                    (dark->key.mode == CALIB_VERTICAL) ? ", vertical profile" : (dark->key.mode == CALIB_HORIZONTAL) ? ", horizontal profile" : "");
                             }
-                            
-                            for (int dy = 0; dy < 2; dy++)
+                            if(flat && calib_master_init_entry(&calib_flat, &calib_lib_data, flat, black, current_depth) == 0)
                             {
-                                for (int dx = 0; dx < 2; dx++)
-                                {
-                                    int acc = 0;
-                                    for (int i = 0; i < (1 << current_depth); i++)
-                                    {
-                                        acc += hist[dy][dx][i];
-                                        
-                                        if (acc < total[dy][dx]/20)
-                                        {
-                                            /* 5th percentile */
-                                            pr5[dy][dx] = i - black;
-                                        }
-                                        
-                                        if (acc < total[dy][dx]/2)
-                                        {
-                                            /* median */
-                                            med[dy][dx] = i - black;
-                                        }
-                                    }
-                                }
+                                print_msg(MSG_INFO, "Using master flat-field frame: ISO %d, %d us, %d frames\n", flat->key.iso, flat->key.shutter_us, flat->frames);
                             }
-                            
-                            free(hist[0][0]);
-                            free(hist[0][1]);
-                            free(hist[1][0]);
-                            free(hist[1][1]);
-                            
-                            adj_num = (pr5[0][1] + pr5[1][0]) / 2;
-                            adj_den = (med[0][1] + med[1][0]) / 2;
-
-                            printf("Flat-field median: [%d %d; %d %d], adjusted by %d/%d\n", 
-                                med[0][0], med[0][1],
-                                med[1][0], med[1][1],
-                                adj_num, adj_den
-                            );
-                        }
-                        
-                        for(int y = 0; y < video_yRes; y++)
-                        {
-                            uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
-                            uint16_t *flat_line = (uint16_t *)&frame_flat_buffer[y * pitch];
-
-                            for(int x = 0; x < video_xRes; x++)
+                            if(!dark && !flat && !calib_add)
                             {
-                                int32_t value = bitextract(src_line, x, current_depth);
-                                int32_t flat_value = bitextract(flat_line, x, current_depth);
-                                
-                                if (flat_value - black <= 0)
-                                {
-                                    int left  = bitextract(flat_line, MAX(x-1,0), current_depth);
-                                    int right = bitextract(flat_line, MIN(x+1,video_xRes-1), current_depth);
-                                    flat_value = MAX(left, right);
-                                }
-
-                                if (flat_value - black > 0)
-                                {
-                                    value -= black;
-                                    value = (int64_t) value * med[y%2][x%2] * adj_num / adj_den / (flat_value - black);
-                                    value += black;
-                                    value = COERCE(value, 0, (1<<current_depth)-1);
-                                }
-
-                                bitinsert(src_line, x, current_depth, value);
+                                print_msg(MSG_INFO, "No matching master frames in calibration library\n");
                             }
                         }
+
+                        /* the reference frames are not needed anymore */
+                        free(frame_sub_buffer);
+                        free(frame_flat_buffer);
+                        frame_sub_buffer = NULL;
+                        frame_flat_buffer = NULL;
                     }
 
-                    /* in average mode, sum up all pixel values of a pixel position */
-                    if(average_mode)
+                    if((calib_dark.type && (calib_dark.width != video_xRes || calib_dark.height != video_yRes)) ||
+                       (calib_flat.type && (calib_flat.width != video_xRes || calib_flat.height != video_yRes)) ||
+                       ((calib_dark.type || calib_flat.type || average_mode) && current_depth != calib_depth))
+                    {
+                        print_msg(MSG_ERROR, "Error: Frame size or bit depth changed, the calibration frames don't match anymore\n");
+                        break;
+                    }
+
+                    /* subtract dark frame, apply flat-field gain and sum up for averaging, line by line on unpacked pixels.
+                     * the dark frame is subtracted before averaging, so master flats can be dark corrected */
+                    if(calib_dark.type || calib_flat.type || average_mode)
                     {
                         int pitch = video_xRes * current_depth / 8;
 
+                        calib_line = realloc(calib_line, video_xRes * sizeof(uint16_t));
+                        if(!calib_line)
+                        {
+                            print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", (int)(video_xRes * sizeof(uint16_t)));
+                            goto abort;
+                        }
+
                         for(int y = 0; y < video_yRes; y++)
                         {
                             uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
 
-                            for(int x = 0; x < video_xRes; x++)
+                            calib_unpack_line(calib_line, src_line, video_xRes, current_depth);
+
+                            if(calib_dark.type)
+                            {
+                                calib_apply_dark(&calib_dark, calib_line, y);
+                            }
+                            if(calib_flat.type)
+                            {
+                                calib_apply_flat(&calib_flat, calib_line, y);
+                            }
+                            if(calib_dark.type || calib_flat.type)
+                            {
+                                calib_pack_line(src_line, calib_line, video_xRes, current_depth);
+                            }
+
+                            if(average_mode)
                             {
-                                uint16_t value = bitextract(src_line, x, current_depth);
+                                uint32_t *sum_line = &frame_arith_buffer[y * video_xRes];
 
-                                frame_arith_buffer[y * video_xRes + x] += value;
+                                for(int x = 0; x < video_xRes; x++)
+                                {
+                                    sum_line[x] += calib_line[x];
+                                }
                             }
                         }
 
-                        average_samples++;
+                        if(average_mode)
+                        {
+                            average_samples++;
+                        }
                     }
 
                     /* now resample bit depth if requested */
@@ -2649,6 +3231,17 @@ read_headers:
                             
                             if (fix_cold_pixels)
                             {
+                                if (defect_map)
+                                {
+                                    /* RAWC tells where this clip sits on the sensor; without it, match by frame size */
+                                    int known = rawc_info.binning_x && rawc_info.binning_y &&
+                                        rawc_info.offset_x != SHRT_MIN && rawc_info.offset_y != SHRT_MIN;
+                                    defect_clip_init(&defect_clip, (char *)idnt_info.cameraSerial,
+                                        known ? rawc_info.binning_x + rawc_info.skipping_x : 0,
+                                        known ? rawc_info.binning_y + rawc_info.skipping_y : 0,
+                                        rawc_info.offset_x, rawc_info.offset_y,
+                                        raw_info.width, raw_info.height, raw_info.active_area.x1, raw_info.active_area.y1);
+                                }
                                 find_and_fix_cold_pixels(fix_cold_pixels == 2);
                             }
 
@@ -2725,68 +3318,63 @@ read_headers:
 
                         if(mlv_output && !only_metadata_mode && !average_mode && (!extract_block || !strncasecmp(extract_block, (char*)block_hdr.blockType, 4)))
                         {
-                            if(compress_output)
+                            if(write_queue)
                             {
-#ifdef MLV_USE_LZMA
-                                size_t lzma_out_size = 2 * frame_size;
-                                size_t lzma_in_size = frame_size;
-                                size_t lzma_props_size = LZMA_PROPS_SIZE;
-                                unsigned char *lzma_out = malloc(lzma_out_size + LZMA_PROPS_SIZE);
-
-                                int ret = LzmaCompress(
-                                    &lzma_out[LZMA_PROPS_SIZE], &lzma_out_size,
-                                    (unsigned char *)frame_buffer, lzma_in_size,
-                                    &lzma_out[0], &lzma_props_size,
-                                    lzma_level, lzma_dict, lzma_lc, lzma_lp, lzma_pb, lzma_fb, lzma_threads
-                                    );
-
-                                if(ret == SZ_OK)
-                                {
-                                    /* store original frame size */
-                                    *(uint32_t *)frame_buffer = frame_size;
-
-                                    /* set new compressed size and copy buffers */
-                                    frame_size = lzma_out_size + LZMA_PROPS_SIZE + 4;
-                                    memcpy(&frame_buffer[4], lzma_out, frame_size - 4);
+                                /* compressed in the background, written in order by write_queue_drain */
+                                block_hdr.frameSpace = 0;
+                                block_hdr.frameNumber -= frame_start;
 
-                                    if(verbose)
-                                    {
-                                        print_msg(MSG_INFO, "    LZMA: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", lzma_in_size, frame_size, ((float)lzma_out_size * 100.0f) / (float)lzma_in_size);
-                                    }
-                                }
-                                else
+                                struct frame_job *job = frame_job_create(FRAME_JOB_COMPRESS, &block_hdr, sizeof(mlv_vidf_hdr_t), frame_buffer, frame_size);
+                                if(!job)
                                 {
-                                    print_msg(MSG_INFO, "    LZMA: Failed (%d)\n", ret);
+                                    print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", frame_size);
                                     goto abort;
                                 }
-                                free(lzma_out);
-#else
-                                print_msg(MSG_INFO, "    LZMA: not compiled into this release, aborting.\n");
-                                goto abort;
+                                job->codec = output_codec;
+                                job->params.width = video_xRes;
+                                job->params.height = video_yRes;
+                                job->params.bpp = current_depth;
+#ifdef MLV_USE_LZMA
+                                job->params.lzma_level = lzma_level;
+                                job->params.lzma_dict = lzma_dict;
+                                job->params.lzma_lc = lzma_lc;
+                                job->params.lzma_lp = lzma_lp;
+                                job->params.lzma_pb = lzma_pb;
+                                job->params.lzma_fb = lzma_fb;
+                                /* frames are compressed in parallel, each one by a single thread */
+                                job->params.lzma_threads = (threads > 1) ? 1 : lzma_threads;
 #endif
+                                if(write_queue_drain(write_queue, out_file, lua_state, verbose, 0))
+                                {
+                                    frame_job_free(job);
+                                    goto abort;
+                                }
+                                frame_queue_push(write_queue, job);
                             }
-
-                            if(frame_size != prev_frame_size)
+                            else
                             {
-                                print_msg(MSG_INFO, "  saving: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", prev_frame_size, frame_size, ((float)frame_size * 100.0f) / (float)prev_frame_size);
-                            }
+                                if(frame_size != prev_frame_size)
+                                {
+                                    print_msg(MSG_INFO, "  saving: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", prev_frame_size, frame_size, ((float)frame_size * 100.0f) / (float)prev_frame_size);
+                                }
 
-                            lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_mlv", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
+                                lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_mlv", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
 
-                            /* delete free space and correct header size if needed */
-                            block_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size;
-                            block_hdr.frameSpace = 0;
-                            block_hdr.frameNumber -= frame_start;
+                                /* delete free space and correct header size if needed */
+                                block_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size;
+                                block_hdr.frameSpace = 0;
+                                block_hdr.frameNumber -= frame_start;
 
-                            if(fwrite(&block_hdr, sizeof(mlv_vidf_hdr_t), 1, out_file) != 1)
-                            {
-                                print_msg(MSG_ERROR, "VIDF: Failed writing into .MLV file\n");
-                                goto abort;
-                            }
-                            if(fwrite(frame_buffer, frame_size, 1, out_file) != 1)
-                            {
-                                print_msg(MSG_ERROR, "VIDF: Failed writing into .MLV file\n");
-                                goto abort;
+                                if(fwrite(&block_hdr, sizeof(mlv_vidf_hdr_t), 1, out_file) != 1)
+                                {
+                                    print_msg(MSG_ERROR, "VIDF: Failed writing into .MLV file\n");
+                                    goto abort;
+                                }
+                                if(fwrite(frame_buffer, frame_size, 1, out_file) != 1)
+                                {
+                                    print_msg(MSG_ERROR, "VIDF: Failed writing into .MLV file\n");
+                                    goto abort;
+                                }
                             }
                         }
                     }
@@ -3357,6 +3945,9 @@ read_headers:
                 
                 lua_handle_hdr(lua_state, buf.blockType, &block_hdr, sizeof(block_hdr));
 
+                /* the defect map needs the crop window and binning */
+                rawc_info = block_hdr;
+
                 if(verbose)
                 {
                     print_capture_info(&block_hdr);
@@ -3406,9 +3997,6 @@ read_headers:
                 {
                     size_t name_len = strlen(output_filename) + 5;  // + .wav\0
                     char* wav_file_name = malloc(name_len);
-                    /* NOTE, assumes little endian system, fix for big endian */
-                    uint32_t tmp_uint32;
-                    uint16_t tmp_uint16;
 
                     strncpy(wav_file_name, output_filename, name_len);
                     strncat(wav_file_name, ".wav", name_len);
@@ -3420,42 +4008,15 @@ read_headers:
                         goto abort;
                     }
 
-                    int error = 1;
-                    
-                    /* Write header */
-                    error &= fwrite("RIFF", 4, 1, out_file_wav);
-                    tmp_uint32 = 36; // Two headers combined size, will be patched later
-                    error &= fwrite(&tmp_uint32, 4, 1, out_file_wav);
-                    error &= fwrite("WAVE", 4, 1, out_file_wav);
-
-                    error &= fwrite("fmt ", 4, 1, out_file_wav);
-                    tmp_uint32 = 16; // Header size
-                    error &= fwrite(&tmp_uint32, 4, 1, out_file_wav);
-                    tmp_uint16 = wavi_info.format; // PCM
-                    error &= fwrite(&tmp_uint16, 2, 1, out_file_wav);
-                    tmp_uint16 = wavi_info.channels; // Stereo
-                    error &= fwrite(&tmp_uint16, 2, 1, out_file_wav);
-                    tmp_uint32 = wavi_info.samplingRate; // Sample rate
-                    error &= fwrite(&tmp_uint32, 4, 1, out_file_wav);
-                    tmp_uint32 = wavi_info.bytesPerSecond; // Byte rate (16-bit data, stereo)
-                    error &= fwrite(&tmp_uint32, 4, 1, out_file_wav);
-                    tmp_uint16 = wavi_info.blockAlign; // Block align
-                    error &= fwrite(&tmp_uint16, 2, 1, out_file_wav);
-                    tmp_uint16 = wavi_info.bitsPerSample; // Bits per sample
-                    error &= fwrite(&tmp_uint16, 2, 1, out_file_wav);
-
-                    error &= fwrite("data", 4, 1, out_file_wav);
-                    tmp_uint32 = 0; // Audio data length, will be patched later
-                    error &= fwrite(&tmp_uint32, 4, 1, out_file_wav);
-
-                    wav_file_size = 0;
-                    wav_header_size = file_get_pos(out_file_wav);
-                    
-                    if(error != 1)
+                    /* sizes will be patched later */
+                    if(write_wav_header(out_file_wav, &wavi_info, 0))
                     {
                         print_msg(MSG_ERROR, "Failed writing into .WAV file\n");
                         goto abort;
                     }
+
+                    wav_file_size = 0;
+                    wav_header_size = file_get_pos(out_file_wav);
                 }
             }
             else if(!memcmp(buf.blockType, "NULL", 4))
@@ -3534,6 +4095,18 @@ read_headers:
 
 abort:
 
+    /* write the frames that are still being compressed */
+    if(write_queue)
+    {
+        write_queue_drain(write_queue, out_file, lua_state, verbose, 1);
+        frame_queue_destroy(write_queue);
+        write_queue = NULL;
+    }
+    frame_queue_destroy(read_ahead.queue);
+    read_ahead.queue = NULL;
+    mlv_reader_close(read_ahead.reader);
+    read_ahead.reader = NULL;
+
     print_msg(MSG_INFO, "Processed %d video frames\n", vidf_frames_processed);
 
     /* in average mode, finalize average calculation and output the resulting average */
@@ -3575,7 +4148,7 @@ abort:
                     {
                         line += frame_arith_buffer[y * video_xRes + x];
                     }
-                    line /= video_yRes;
+                    line /= video_xRes;
                     for(int x = 0; x < video_xRes; x++)
                     {
 
@@ -3597,23 +4170,53 @@ abort:
             }
             
 
-            int frame_size = ((video_xRes * video_yRes * lv_rec_footer.raw_info.bits_per_pixel + 7) / 8);
-
-            mlv_vidf_hdr_t hdr;
+            /* store the averaged frame, or only its banding profile, as master frame */
+            if(calib_add)
+            {
+                int mode = average_vert ? CALIB_VERTICAL : average_hor ? CALIB_HORIZONTAL : CALIB_FULL;
+                int count = (mode == CALIB_VERTICAL) ? video_xRes : (mode == CALIB_HORIZONTAL) ? video_yRes : video_xRes * video_yRes;
+                int step = (mode == CALIB_HORIZONTAL) ? video_xRes : 1;
+                uint16_t *values = malloc(count * sizeof(uint16_t));
 
-            memset(&hdr, 0x00, sizeof(mlv_vidf_hdr_t));
-            memcpy(hdr.blockType, "VIDF", 4);
-            hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size;
-            hdr.frameNumber = 0;
-            hdr.timestamp = last_vidf.timestamp;
+                if(values)
+                {
+                    for(int i = 0; i < count; i++)
+                    {
+                        values[i] = frame_arith_buffer[i * step] / average_samples;
+                    }
 
-            if(fwrite(&hdr, sizeof(mlv_vidf_hdr_t), 1, out_file) != 1)
-            {
-                print_msg(MSG_ERROR, "Failed writing average frame header into .MLV file\n");
+                    calib_key.mode = mode;
+                    if(calib_lib_add(&calib_lib_data, &calib_key, average_samples, calib_black, calib_depth, values, count) == 0)
+                    {
+                        print_msg(MSG_INFO, "Added master %s frame (ISO %d, %d us, %dx%d, %d frames) to '%s'\n",
+                            (calib_add == CALIB_DARK) ? "dark" : "flat-field", calib_key.iso, calib_key.shutter_us,
+                            video_xRes, video_yRes, average_samples, calib_lib_filename);
+                    }
+                    free(values);
+                }
             }
-            if(fwrite(frame_buffer, frame_size, 1, out_file) != 1)
+
+            /* --calib-add works without output file */
+            if(out_file)
             {
-                print_msg(MSG_ERROR, "Failed writing average frame data into .MLV file\n");
+                int frame_size = ((video_xRes * video_yRes * lv_rec_footer.raw_info.bits_per_pixel + 7) / 8);
+
+                mlv_vidf_hdr_t hdr;
+
+                memset(&hdr, 0x00, sizeof(mlv_vidf_hdr_t));
+                memcpy(hdr.blockType, "VIDF", 4);
+                hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size;
+                hdr.frameNumber = 0;
+                hdr.timestamp = last_vidf.timestamp;
+
+                if(fwrite(&hdr, sizeof(mlv_vidf_hdr_t), 1, out_file) != 1)
+                {
+                    print_msg(MSG_ERROR, "Failed writing average frame header into .MLV file\n");
+                }
+                if(fwrite(frame_buffer, frame_size, 1, out_file) != 1)
+                {
+                    print_msg(MSG_ERROR, "Failed writing average frame data into .MLV file\n");
+                }
             }
         }
     }
@@ -3654,6 +4257,8 @@ abort:
         
         main_header.videoFrameCount = vidf_frames_processed;
         main_header.audioFrameCount = audf_frames_processed;
+        /* the input header has the input file's compression flags */
+        main_header.videoClass = output_video_class;
 
         fseek(out_file, 0L, SEEK_SET);
         
@@ -3695,7 +4300,31 @@ abort:
         fclose(out_file_wav);
     }
 
+    if(defect_map)
+    {
+        if(defect_map->dirty && defect_map_save(defect_map, defect_map_filename) == 0)
+        {
+            print_msg(MSG_INFO, "Defect map '%s' updated\n", defect_map_filename);
+        }
+        defect_map_free(defect_map);
+        defect_map = NULL;
+    }
+
+    if(calib_lib_loaded)
+    {
+        if(calib_lib_data.dirty && calib_lib_save(&calib_lib_data) == 0)
+        {
+            print_msg(MSG_INFO, "Calibration library '%s' updated\n", calib_lib_filename);
+        }
+        calib_lib_free(&calib_lib_data);
+    }
+    calib_master_free(&calib_dark);
+    calib_master_free(&calib_flat);
+
     /* passing NULL to free is absolutely legal, so no check required */
+    free(calib_lib_filename);
+    free(calib_line);
+    free(defect_map_filename);
     free(lut_filename);
     free(subtract_filename);
     free(output_filename);
@@ -0,0 +1,621 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* mmap, strdup and copy_file_range are not part of C99 */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "mlv_reader.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+/* on 32-bit hosts, only map clips that leave some address space for everything else */
+#define MLV_READER_MAP_LIMIT_32     (512ULL * 1024 * 1024)
+
+/* mlv_reader_copy without copy_file_range: copy in parts of this size */
+#define MLV_READER_COPY_SIZE        (4 * 1024 * 1024)
+
+static uint64_t reader_get_pos(FILE *stream)
+{
+#if defined(__WIN32)
+    return ftello64(stream);
+#else
+    return ftello(stream);
+#endif
+}
+
+static int reader_set_pos(FILE *stream, uint64_t offset, int whence)
+{
+#if defined(__WIN32)
+    return fseeko64(stream, offset, whence);
+#else
+    return fseeko(stream, offset, whence);
+#endif
+}
+
+static void reader_map(struct mlv_chunk *chunk)
+{
+    if(!chunk->size || chunk->size != (size_t)chunk->size)
+    {
+        return;
+    }
+
+#if defined(_WIN32)
+    HANDLE mapping = CreateFileMapping((HANDLE)_get_osfhandle(fileno(chunk->file)), NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping)
+    {
+        chunk->map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if(chunk->map)
+        {
+            chunk->mapping = mapping;
+        }
+        else
+        {
+            CloseHandle(mapping);
+        }
+    }
+#else
+    void *map = mmap(NULL, chunk->size, PROT_READ, MAP_PRIVATE, fileno(chunk->file), 0);
+    if(map != MAP_FAILED)
+    {
+        /* blocks are mostly walked front to back */
+        madvise(map, chunk->size, MADV_SEQUENTIAL);
+        chunk->map = map;
+    }
+#endif
+}
+
+static void reader_unmap(struct mlv_chunk *chunk)
+{
+    if(!chunk->map)
+    {
+        return;
+    }
+
+#if defined(_WIN32)
+    UnmapViewOfFile(chunk->map);
+    CloseHandle(chunk->mapping);
+#else
+    munmap((void *)chunk->map, chunk->size);
+#endif
+    chunk->map = NULL;
+}
+
+static int reader_add_chunk(struct mlv_reader *reader, const char *filename, int flags)
+{
+    FILE *file = fopen(filename, "rb");
+    if(!file)
+    {
+        return -1;
+    }
+
+    if(!(flags & MLV_READER_QUIET))
+    {
+        fprintf(stderr, "File %s opened\n", filename);
+    }
+
+    struct mlv_chunk *chunk = &reader->chunks[reader->chunk_count++];
+    memset(chunk, 0x00, sizeof(struct mlv_chunk));
+    chunk->file = file;
+    reader_set_pos(file, 0, SEEK_END);
+    chunk->size = reader_get_pos(file);
+    reader_set_pos(file, 0, SEEK_SET);
+    return 0;
+}
+
+struct mlv_reader *mlv_reader_open(const char *filename, int flags)
+{
+    struct mlv_reader *reader = calloc(1, sizeof(struct mlv_reader));
+    if(!reader)
+    {
+        return NULL;
+    }
+
+    if(reader_add_chunk(reader, filename, flags))
+    {
+        free(reader);
+        return NULL;
+    }
+
+    /* .MLV files may continue in .M00, .M01 etc, like in load_all_chunks */
+    const char *dot = strrchr(filename, '.');
+    if(dot && !strcasecmp(dot + 1, "mlv"))
+    {
+        int len = strlen(filename);
+        char *chunk_name = strdup(filename);
+
+        for(int seq_number = 0; chunk_name && seq_number < 100 && reader->chunk_count < MLV_READER_MAX_CHUNKS; seq_number++)
+        {
+            char seq_name[8];
+            sprintf(seq_name, "%02d", seq_number);
+            memcpy(&chunk_name[len - 2], seq_name, 2);
+
+            if(reader_add_chunk(reader, chunk_name, flags))
+            {
+                break;
+            }
+        }
+        free(chunk_name);
+    }
+
+    uint64_t total_size = 0;
+    for(int chunk = 0; chunk < reader->chunk_count; chunk++)
+    {
+        total_size += reader->chunks[chunk].size;
+    }
+
+    /* map everything, if the address space allows; else (or if that fails) blocks are read */
+    if(!(flags & MLV_READER_NO_MMAP) && (sizeof(void *) >= 8 || total_size <= MLV_READER_MAP_LIMIT_32))
+    {
+        reader->mapped = 1;
+        for(int chunk = 0; chunk < reader->chunk_count; chunk++)
+        {
+            reader_map(&reader->chunks[chunk]);
+            reader->mapped &= (reader->chunks[chunk].map != NULL);
+        }
+    }
+
+    return reader;
+}
+
+void mlv_reader_close(struct mlv_reader *reader)
+{
+    if(!reader)
+    {
+        return;
+    }
+
+    for(int chunk = 0; chunk < reader->chunk_count; chunk++)
+    {
+        reader_unmap(&reader->chunks[chunk]);
+        fclose(reader->chunks[chunk].file);
+    }
+
+    free(reader->xrefs);
+    free(reader->buffer);
+    free(reader);
+}
+
+/* only the common header of a block, for walking the chunks */
+static int reader_block_hdr(struct mlv_reader *reader, int chunk_num, uint64_t offset, mlv_hdr_t *hdr)
+{
+    struct mlv_chunk *chunk = &reader->chunks[chunk_num];
+
+    if(offset + sizeof(mlv_hdr_t) > chunk->size)
+    {
+        return -1;
+    }
+
+    if(chunk->map)
+    {
+        memcpy(hdr, &chunk->map[offset], sizeof(mlv_hdr_t));
+    }
+    else if(reader_set_pos(chunk->file, offset, SEEK_SET) || fread(hdr, sizeof(mlv_hdr_t), 1, chunk->file) != 1)
+    {
+        return -1;
+    }
+
+    if(hdr->blockSize < sizeof(mlv_hdr_t) || offset + hdr->blockSize > chunk->size)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int reader_buffer(struct mlv_reader *reader, uint32_t size)
+{
+    if(size > reader->buffer_size)
+    {
+        uint8_t *buffer = realloc(reader->buffer, size);
+        if(!buffer)
+        {
+            return -1;
+        }
+        reader->buffer = buffer;
+        reader->buffer_size = size;
+    }
+    return 0;
+}
+
+int mlv_reader_block(struct mlv_reader *reader, int chunk_num, uint64_t offset, struct mlv_block *block)
+{
+    if(chunk_num < 0 || chunk_num >= reader->chunk_count)
+    {
+        return -1;
+    }
+
+    struct mlv_chunk *chunk = &reader->chunks[chunk_num];
+    mlv_hdr_t hdr;
+
+    if(reader_block_hdr(reader, chunk_num, offset, &hdr))
+    {
+        return -1;
+    }
+
+    block->chunk = chunk_num;
+    block->offset = offset;
+
+    if(chunk->map)
+    {
+        block->hdr = (const mlv_hdr_t *)&chunk->map[offset];
+        return 0;
+    }
+
+    if(reader_buffer(reader, hdr.blockSize))
+    {
+        return -1;
+    }
+
+    memcpy(reader->buffer, &hdr, sizeof(mlv_hdr_t));
+    if(hdr.blockSize > sizeof(mlv_hdr_t) &&
+       fread(&reader->buffer[sizeof(mlv_hdr_t)], hdr.blockSize - sizeof(mlv_hdr_t), 1, chunk->file) != 1)
+    {
+        return -1;
+    }
+
+    block->hdr = (const mlv_hdr_t *)reader->buffer;
+    return 0;
+}
+
+int mlv_reader_peek(struct mlv_reader *reader, int chunk_num, uint64_t offset, void *data, uint32_t size)
+{
+    if(chunk_num < 0 || chunk_num >= reader->chunk_count)
+    {
+        return -1;
+    }
+
+    struct mlv_chunk *chunk = &reader->chunks[chunk_num];
+
+    if(offset + size > chunk->size)
+    {
+        return -1;
+    }
+
+    if(chunk->map)
+    {
+        memcpy(data, &chunk->map[offset], size);
+        return 0;
+    }
+
+    if(reader_set_pos(chunk->file, offset, SEEK_SET) || fread(data, size, 1, chunk->file) != 1)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int mlv_reader_copy(struct mlv_reader *reader, int chunk_num, uint64_t offset, uint32_t size, FILE *out_file, uint64_t out_offset)
+{
+    if(chunk_num < 0 || chunk_num >= reader->chunk_count)
+    {
+        return -1;
+    }
+
+    struct mlv_chunk *chunk = &reader->chunks[chunk_num];
+
+    if(offset + size > chunk->size)
+    {
+        return -1;
+    }
+
+    if(chunk->map)
+    {
+        if(reader_set_pos(out_file, out_offset, SEEK_SET) || (size && fwrite(&chunk->map[offset], size, 1, out_file) != 1))
+        {
+            return -1;
+        }
+        return 0;
+    }
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+    /* let the kernel copy (or reflink) the data, without passing it through here */
+    if(size && !fflush(out_file))
+    {
+        int64_t in_pos = offset;
+        int64_t out_pos = out_offset;
+
+        while(size)
+        {
+            long copied = syscall(SYS_copy_file_range, fileno(chunk->file), &in_pos, fileno(out_file), &out_pos, (size_t)size, 0);
+            if(copied <= 0)
+            {
+                /* not supported by this kernel or file system, copy the rest below */
+                break;
+            }
+            size -= copied;
+        }
+
+        offset = in_pos;
+        out_offset = out_pos;
+    }
+#endif
+
+    if(reader_set_pos(out_file, out_offset, SEEK_SET) || reader_set_pos(chunk->file, offset, SEEK_SET))
+    {
+        return -1;
+    }
+
+    while(size)
+    {
+        uint32_t part = (size < MLV_READER_COPY_SIZE) ? size : MLV_READER_COPY_SIZE;
+
+        if(reader_buffer(reader, part) ||
+           fread(reader->buffer, part, 1, chunk->file) != 1 ||
+           fwrite(reader->buffer, part, 1, out_file) != 1)
+        {
+            return -1;
+        }
+        size -= part;
+    }
+    return 0;
+}
+
+const uint8_t *mlv_block_frame(const struct mlv_block *block, uint32_t *size)
+{
+    uint32_t hdr_size;
+    uint32_t frame_space;
+
+    if(!memcmp(block->hdr->blockType, "VIDF", 4) && block->hdr->blockSize >= sizeof(mlv_vidf_hdr_t))
+    {
+        hdr_size = sizeof(mlv_vidf_hdr_t);
+        frame_space = MLV_BLOCK_HDR(block, mlv_vidf_hdr_t)->frameSpace;
+    }
+    else if(!memcmp(block->hdr->blockType, "AUDF", 4) && block->hdr->blockSize >= sizeof(mlv_audf_hdr_t))
+    {
+        hdr_size = sizeof(mlv_audf_hdr_t);
+        frame_space = MLV_BLOCK_HDR(block, mlv_audf_hdr_t)->frameSpace;
+    }
+    else
+    {
+        return NULL;
+    }
+
+    if(frame_space > block->hdr->blockSize - hdr_size)
+    {
+        return NULL;
+    }
+
+    *size = block->hdr->blockSize - hdr_size - frame_space;
+    return (const uint8_t *)block->hdr + hdr_size + frame_space;
+}
+
+/* the XREF block from the .IDX file next to the clip */
+static int reader_load_idx(struct mlv_reader *reader, const char *filename)
+{
+    int len = strlen(filename);
+    if(len < 3)
+    {
+        return -1;
+    }
+
+    char *idx_name = strdup(filename);
+    if(!idx_name)
+    {
+        return -1;
+    }
+    strcpy(&idx_name[len - 3], "IDX");
+
+    struct mlv_reader *idx = mlv_reader_open(idx_name, MLV_READER_NO_MMAP | MLV_READER_QUIET);
+    free(idx_name);
+    if(!idx)
+    {
+        return -1;
+    }
+
+    struct mlv_iter iter;
+    struct mlv_block block;
+    int ret = -1;
+
+    mlv_iter_init(idx, &iter, 0);
+    while(mlv_iter_next_type(idx, &iter, "XREF", &block) == 1)
+    {
+        const mlv_xref_hdr_t *hdr = MLV_BLOCK_HDR(&block, mlv_xref_hdr_t);
+        if(hdr->blockSize < sizeof(mlv_xref_hdr_t) ||
+           (uint64_t)hdr->entryCount * sizeof(mlv_xref_t) > hdr->blockSize - sizeof(mlv_xref_hdr_t))
+        {
+            break;
+        }
+
+        reader->xrefs = malloc(hdr->entryCount * sizeof(mlv_xref_t) + 1);
+        if(reader->xrefs)
+        {
+            memcpy(reader->xrefs, (const uint8_t *)hdr + sizeof(mlv_xref_hdr_t), hdr->entryCount * sizeof(mlv_xref_t));
+            reader->xref_count = hdr->entryCount;
+            ret = 0;
+        }
+        break;
+    }
+
+    mlv_reader_close(idx);
+    return ret;
+}
+
+struct reader_xref
+{
+    uint64_t timestamp;
+    uint64_t offset;
+    uint16_t chunk;
+    uint16_t type;
+};
+
+static int reader_xref_cmp(const void *a, const void *b)
+{
+    const struct reader_xref *xa = a;
+    const struct reader_xref *xb = b;
+
+    /* by time, blocks with equal timestamps stay in file order */
+    if(xa->timestamp != xb->timestamp) return xa->timestamp < xb->timestamp ? -1 : 1;
+    if(xa->chunk != xb->chunk) return xa->chunk < xb->chunk ? -1 : 1;
+    if(xa->offset != xb->offset) return xa->offset < xb->offset ? -1 : 1;
+    return 0;
+}
+
+/* like mlv_dump -x: every block but NULL/BKUP, sorted by timestamp */
+static int reader_build_index(struct mlv_reader *reader)
+{
+    struct reader_xref *table = NULL;
+    uint32_t entries = 0;
+    uint32_t allocated = 0;
+
+    /* only the headers are needed, the walk stops at the first broken block of a chunk */
+    for(int chunk = 0; chunk < reader->chunk_count; chunk++)
+    {
+        mlv_hdr_t hdr;
+
+        for(uint64_t offset = 0; !reader_block_hdr(reader, chunk, offset, &hdr); offset += hdr.blockSize)
+        {
+            if(!memcmp(hdr.blockType, "NULL", 4) || !memcmp(hdr.blockType, "BKUP", 4))
+            {
+                continue;
+            }
+
+            if(entries >= allocated)
+            {
+                allocated = allocated ? 2 * allocated : 1024;
+                struct reader_xref *resized = realloc(table, allocated * sizeof(struct reader_xref));
+                if(!resized)
+                {
+                    free(table);
+                    return -1;
+                }
+                table = resized;
+            }
+
+            table[entries].timestamp = hdr.timestamp;
+            table[entries].offset = offset;
+            table[entries].chunk = chunk;
+            table[entries].type =
+                !memcmp(hdr.blockType, "VIDF", 4) ? MLV_FRAME_VIDF :
+                !memcmp(hdr.blockType, "AUDF", 4) ? MLV_FRAME_AUDF :
+                MLV_FRAME_UNSPECIFIED;
+            entries++;
+        }
+    }
+
+    if(entries)
+    {
+        qsort(table, entries, sizeof(struct reader_xref), reader_xref_cmp);
+    }
+
+    reader->xrefs = malloc(entries * sizeof(mlv_xref_t) + 1);
+    if(!reader->xrefs)
+    {
+        free(table);
+        return -1;
+    }
+
+    for(uint32_t pos = 0; pos < entries; pos++)
+    {
+        memset(&reader->xrefs[pos], 0x00, sizeof(mlv_xref_t));
+        reader->xrefs[pos].frameOffset = table[pos].offset;
+        reader->xrefs[pos].fileNumber = table[pos].chunk;
+        reader->xrefs[pos].frameType = table[pos].type;
+    }
+    reader->xref_count = entries;
+
+    free(table);
+    return 0;
+}
+
+int mlv_reader_index(struct mlv_reader *reader, const char *filename)
+{
+    if(reader->xrefs)
+    {
+        return 0;
+    }
+
+    if(filename && !reader_load_idx(reader, filename))
+    {
+        return 0;
+    }
+
+    return reader_build_index(reader);
+}
+
+void mlv_iter_init(struct mlv_reader *reader, struct mlv_iter *iter, int ordered)
+{
+    memset(iter, 0x00, sizeof(struct mlv_iter));
+
+    if(ordered && !mlv_reader_index(reader, NULL))
+    {
+        iter->ordered = 1;
+    }
+}
+
+int mlv_iter_next(struct mlv_reader *reader, struct mlv_iter *iter, struct mlv_block *block)
+{
+    if(iter->ordered)
+    {
+        if(iter->xref_pos >= reader->xref_count)
+        {
+            return 0;
+        }
+
+        mlv_xref_t *xref = &reader->xrefs[iter->xref_pos++];
+        return mlv_reader_block(reader, xref->fileNumber, xref->frameOffset, block) ? -1 : 1;
+    }
+
+    /* next chunk at the end of this one */
+    while(iter->chunk < reader->chunk_count && iter->offset >= reader->chunks[iter->chunk].size)
+    {
+        iter->chunk++;
+        iter->offset = 0;
+    }
+
+    if(iter->chunk >= reader->chunk_count)
+    {
+        return 0;
+    }
+
+    if(mlv_reader_block(reader, iter->chunk, iter->offset, block))
+    {
+        return -1;
+    }
+
+    iter->offset += block->hdr->blockSize;
+    return 1;
+}
+
+int mlv_iter_next_type(struct mlv_reader *reader, struct mlv_iter *iter, const char *type, struct mlv_block *block)
+{
+    int ret;
+
+    while((ret = mlv_iter_next(reader, iter, block)) == 1)
+    {
+        if(!memcmp(block->hdr->blockType, type, 4))
+        {
+            break;
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* MLV reader for host tools (libmlv).
+ *
+ * Opens a clip with all of its chunks (.MLV, .M00, .M01, ...) and maps
+ * them into memory, so blocks can be looked at in place, without copying.
+ * Where a chunk cannot be mapped (32-bit hosts, where a clip does not fit
+ * into the address space, or when mmap fails), blocks are read into a
+ * buffer owned by the reader instead; the API is the same.
+ *
+ * Blocks are walked either as stored (chunk by chunk, in file order), or
+ * in recording order using the XREF index from the .IDX file. If there is
+ * no .IDX file, the index is built by walking all chunks once and sorting
+ * the blocks by timestamp, so frames spanning several chunks or written
+ * out of order come out right.
+ *
+ * A struct mlv_block stays valid until the next call on the same reader
+ * (mapped blocks: until mlv_reader_close).
+ */
+
+#ifndef _mlv_reader_h_
+#define _mlv_reader_h_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../../src/raw.h"
+#include "mlv.h"
+
+#define MLV_READER_MAX_CHUNKS   101     /* .MLV and .M00 ... .M99 */
+
+/* mlv_reader_open flags */
+#define MLV_READER_NO_MMAP      1       /* always read blocks into a buffer */
+#define MLV_READER_QUIET        2       /* don't print the files opened */
+
+struct mlv_chunk
+{
+    FILE *file;
+    uint64_t size;
+    const uint8_t *map;                 /* whole file; NULL = read into the buffer */
+#if defined(_WIN32)
+    void *mapping;
+#endif
+};
+
+struct mlv_reader
+{
+    int chunk_count;
+    struct mlv_chunk chunks[MLV_READER_MAX_CHUNKS];
+    int mapped;                         /* all chunks are mapped */
+
+    /* recording order, from the .IDX file or built from the chunks */
+    mlv_xref_t *xrefs;
+    uint32_t xref_count;
+
+    /* blocks that are not mapped are read here */
+    uint8_t *buffer;
+    uint32_t buffer_size;
+};
+
+struct mlv_block
+{
+    const mlv_hdr_t *hdr;               /* the whole block, hdr->blockSize bytes */
+    int chunk;
+    uint64_t offset;
+};
+
+/* typed view of a block header, e.g. MLV_BLOCK_HDR(&block, mlv_vidf_hdr_t) */
+#define MLV_BLOCK_HDR(block, type)      ((const type *)(block)->hdr)
+
+/* position while walking the blocks */
+struct mlv_iter
+{
+    int ordered;                        /* follow the xrefs, else the chunks in file order */
+    int chunk;
+    uint64_t offset;
+    uint32_t xref_pos;
+};
+
+/* filename is the .MLV (or the only chunk); NULL on error */
+struct mlv_reader *mlv_reader_open(const char *filename, int flags);
+void mlv_reader_close(struct mlv_reader *reader);
+
+/* the block at chunk/offset. return 0 on success */
+int mlv_reader_block(struct mlv_reader *reader, int chunk, uint64_t offset, struct mlv_block *block);
+
+/* the first size bytes of the block at chunk/offset (e.g. its header), without reading the rest. return 0 on success */
+int mlv_reader_peek(struct mlv_reader *reader, int chunk, uint64_t offset, void *data, uint32_t size);
+
+/* copy size bytes at chunk/offset into out_file at out_offset, with copy_file_range where available. return 0 on success */
+int mlv_reader_copy(struct mlv_reader *reader, int chunk, uint64_t offset, uint32_t size, FILE *out_file, uint64_t out_offset);
+
+/* frame data of a VIDF/AUDF block (after the header and frameSpace); NULL if the block is broken */
+const uint8_t *mlv_block_frame(const struct mlv_block *block, uint32_t *size);
+
+/* load the .IDX file of the clip, or build the index from the chunks. return 0 on success */
+int mlv_reader_index(struct mlv_reader *reader, const char *filename);
+
+/* ordered: recording order (builds the index if needed), else file order */
+void mlv_iter_init(struct mlv_reader *reader, struct mlv_iter *iter, int ordered);
+
+/* next block; 1 = ok, 0 = end of clip, -1 = invalid block */
+int mlv_iter_next(struct mlv_reader *reader, struct mlv_iter *iter, struct mlv_block *block);
+
+/* like mlv_iter_next, but only returns blocks of the given type (e.g. "VIDF") */
+int mlv_iter_next_type(struct mlv_reader *reader, struct mlv_iter *iter, const char *type, struct mlv_block *block);
+
+#endif
@@ -97,14 +97,9 @@ static void FAST reverse_bytes_order(char* buf, int count)
     }
 }
 
-static int dng_show(char* filename)
+/* parse the DNG header (file position must be at the beginning) */
+static int dng_read_header(FILE* f, int* strip_offset)
 {
-    uint32_t size;
-    if( FIO_GetFileSize( filename, &size ) != 0 ) return 0;
-
-    FILE* f = FIO_OpenFile(filename, O_RDONLY | O_SYNC);
-    void* buf = 0;
-
     /* should be big enough for the header */
     int header_maxsize = 65536;
     int* header = fio_malloc(header_maxsize);
@@ -121,25 +116,54 @@ static int dng_show(char* filename)
 
     raw_info.width = 0;
     raw_info.height = 0;
+    memset(&raw_info.active_area, 0, sizeof(raw_info.active_area));
     
-    int strip_offset = 0;
+    *strip_offset = 0;
 
     int off = 8;
     for (int ifd = 0; off; ifd++)
-        off = tif_parse_ifd(ifd, (void*)header, off, &strip_offset);
+        off = tif_parse_ifd(ifd, (void*)header, off, strip_offset);
 
-    fio_free(header); header = 0;
+    fio_free(header);
 
-    if (!strip_offset) goto err;
-    if (!raw_info.width) goto err;
-    if (!raw_info.height) goto err;
+    if (!*strip_offset) return 0;
+    if (!raw_info.width) return 0;
+    if (!raw_info.height) return 0;
+
+    /* no crop info? use the full image */
+    if (raw_info.active_area.x2 <= raw_info.active_area.x1 || raw_info.active_area.y2 <= raw_info.active_area.y1)
+    {
+        raw_info.active_area.x1 = 0;
+        raw_info.active_area.y1 = 0;
+        raw_info.active_area.x2 = raw_info.width;
+        raw_info.active_area.y2 = raw_info.height;
+    }
+    return 1;
+
+err:
+    fio_free(header);
+    return 0;
+}
+
+/* full-res decode: reads the entire raw strip and renders it with the raw preview routines */
+static int dng_show_full(char* filename)
+{
+    uint32_t size;
+    if( FIO_GetFileSize( filename, &size ) != 0 ) return 0;
+
+    FILE* f = FIO_OpenFile(filename, O_RDONLY | O_SYNC);
+    if (!f) return 0;
+    void* buf = 0;
+
+    int strip_offset = 0;
+    if (!dng_read_header(f, &strip_offset)) goto err;
 
     int raw_size = raw_info.width * raw_info.height * 14/8;
     buf = fio_malloc(raw_size);
     if (!buf) goto err;
     
     FIO_SeekSkipFile(f, strip_offset, SEEK_SET);
-    rc = FIO_ReadFile(f, buf, raw_size);
+    int rc = FIO_ReadFile(f, buf, raw_size);
     if (rc != raw_size) goto err;
     FIO_CloseFile(f); f = 0;
 
@@ -161,12 +185,237 @@ static int dng_show(char* filename)
     return 1;
 err:
     if (f) FIO_CloseFile(f);
-    if (header) fio_free(header);
     if (buf) fio_free(buf);
     raw_set_dirty();
     return 0;
 }
 
+/* thumbnails of the last few DNG previews, for instant re-display */
+#define DNG_THUMBS 4
+
+static struct dng_thumb
+{
+    char filename[FIO_MAX_PATH_LENGTH];
+    uint32_t size;                  /* file size, to notice overwritten files */
+    uint32_t* yuv;                  /* UYVY, half the preview resolution */
+    int w, h;                       /* preview size on screen (thumbnail is w/2 x h/2) */
+    int raw_w, raw_h;               /* active area, for the info line */
+} dng_thumbs[DNG_THUMBS];
+
+static int dng_thumb_next = 0;
+
+static struct dng_thumb * dng_thumb_find(char* filename, uint32_t size)
+{
+    for (int i = 0; i < DNG_THUMBS; i++)
+    {
+        if (dng_thumbs[i].yuv && dng_thumbs[i].size == size && streq(dng_thumbs[i].filename, filename))
+        {
+            return &dng_thumbs[i];
+        }
+    }
+    return 0;
+}
+
+/* 14-bit pixel from a big-endian bit stream (DNG byte order) */
+static inline int dng_get_pixel(uint8_t* buf, int x)
+{
+    int bit = x * 14;
+    uint8_t* p = buf + (bit >> 3);
+    uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+    return (v >> (10 - (bit & 7))) & 0x3FFF;
+}
+
+static int dng_show_cached(char* filename)
+{
+    uint32_t size;
+    if( FIO_GetFileSize( filename, &size ) != 0 ) return 0;
+
+    struct dng_thumb * t = dng_thumb_find(filename, size);
+    if (!t) return 0;
+
+    struct vram_info * vram = get_yuv422_vram();
+    uint32_t * lvram = (uint32_t *)vram->vram;
+    if (!lvram) return 0;
+    if (t->w > vram->width || t->h > vram->height) return 0;
+
+    int ox = ((vram->width - t->w) / 2) & ~1;
+    int oy = (vram->height - t->h) / 2;
+
+    vram_clear_lv();
+
+    /* nearest-neighbour 2x upscale; each thumbnail word holds two pixels */
+    for (int y = 0; y < t->h; y++)
+    {
+        uint32_t* src = t->yuv + (y/2) * (t->w/4);
+        uint32_t* dst = &lvram[LV(ox, oy + y) / 4];
+        for (int j = 0; j < t->w/4; j++)
+        {
+            uint32_t uyvy = src[j];
+            dst[2*j]   = (uyvy & 0x00FFFFFF) | ((uyvy & 0x0000FF00) << 16);
+            dst[2*j+1] = (uyvy & 0xFFFF00FF) | ((uyvy >> 16) & 0x0000FF00);
+        }
+    }
+
+    bmp_printf(FONT_MED, 600, 460, " %dx%d ", t->raw_w, t->raw_h);
+    return 1;
+}
+
+/* screen-size decode: only reads the raw rows needed for the preview,
+ * and unpacks them straight from the file byte order (no byte swapping) */
+static int dng_show_fast(char* filename)
+{
+    uint32_t size;
+    if( FIO_GetFileSize( filename, &size ) != 0 ) return 0;
+
+    struct vram_info * vram = get_yuv422_vram();
+    uint32_t * lvram = (uint32_t *)vram->vram;
+    if (!lvram) return 0;
+
+    FILE* f = FIO_OpenFile(filename, O_RDONLY | O_SYNC);
+    if (!f) return 0;
+    uint8_t* buf = 0;
+    uint32_t* thumb = 0;
+
+    int strip_offset = 0;
+    if (!dng_read_header(f, &strip_offset)) goto err;
+
+    int x1 = raw_info.active_area.x1;
+    int y1 = raw_info.active_area.y1;
+    int aw = raw_info.active_area.x2 - x1;
+    int ah = raw_info.active_area.y2 - y1;
+    int pitch = raw_info.width * 14/8;
+
+    /* one output pixel per RGGB cell at most */
+    int step = MAX((aw + vram->width - 1) / vram->width, (ah + vram->height - 1) / vram->height);
+    step = MAX(step, 2);
+
+    /* multiples of 4 horizontally, so the half-res thumbnail still packs into UYVY words */
+    int ow = (aw / step) & ~3;
+    int oh = (ah / step) & ~1;
+    if (ow <= 0 || oh <= 0) goto err;
+    int ox = ((vram->width - ow) / 2) & ~1;
+    int oy = (vram->height - oh) / 2;
+
+    /* we only read the columns inside the active area, starting at a 8-pixel (14-byte) block */
+    int bx = x1 & ~7;
+    int span_start = bx * 14/8;
+    int span_end = MIN(pitch, ((x1 + aw + 7) & ~7) * 14/8);
+    int read_size = pitch + span_end - span_start;  /* two consecutive rows */
+
+    /* +4: dng_get_pixel reads one byte past the last pixel */
+    buf = fio_malloc(read_size + 4);
+    if (!buf) goto err;
+
+    thumb = fio_malloc(ow/2 * oh/2 * 2);
+
+    /* scale useful range (black...white) to 0...1023 or less; same curves as the raw color preview */
+    int black = raw_info.black_level;
+    int white = raw_info.white_level;
+    int div = 0;
+    while (((white-black) >> div) >= 1024)
+    {
+        div++;
+    }
+
+    /* white balance 2,1,2 => use two gamma curves to simplify code */
+    uint8_t gamma_rb[1024];
+    uint8_t gamma_g[1024];
+
+    for (int i = 0; i < 1024; i++)
+    {
+        /* only show 10 bits */
+        int g_rb = COERCE(raw_to_ev((i << div) + black) + 11, 0, 10) * 255 / 10;
+        int g_g  = COERCE(raw_to_ev((i << div) + black) + 10, 0, 10) * 255 / 10;
+        /* gamma 2 */
+        gamma_rb[i] = COERCE(g_rb * g_rb / 255, 0, 255);
+        gamma_g[i]  = COERCE(g_g  * g_g  / 255, 0, 255);
+    }
+
+    vram_clear_lv();
+    info_led_on();
+
+    for (int y = 0; y < oh; y++)
+    {
+        /* even row: RG, odd row: GB */
+        int ry = (y1 + y * step) & ~1;
+        FIO_SeekSkipFile(f, strip_offset + ry * pitch + span_start, SEEK_SET);
+        if (FIO_ReadFile(f, buf, read_size) != read_size)
+        {
+            info_led_off();
+            goto err;
+        }
+
+        uint8_t* row0 = buf;
+        uint8_t* row1 = buf + pitch;
+        uint32_t* dst = &lvram[LV(ox, oy + y) / 4];
+
+        for (int k = 0; k < ow/2; k++)
+        {
+            uint32_t yuv[2];
+            for (int i = 0; i < 2; i++)
+            {
+                int rx = ((x1 + (2*k + i) * step) & ~1) - bx;
+                int r = dng_get_pixel(row0, rx);
+                int g = (dng_get_pixel(row0, rx + 1) + dng_get_pixel(row1, rx)) >> 1;
+                int b = dng_get_pixel(row1, rx + 1);
+
+                /* div is chosen so that ((white-black) >> div) < 1024 */
+                r = gamma_rb[COERCE(r - black, 0, white-black) >> div];
+                g = gamma_g [COERCE(g - black, 0, white-black) >> div];
+                b = gamma_rb[COERCE(b - black, 0, white-black) >> div];
+                yuv[i] = rgb2yuv422(r, g, b);
+            }
+            dst[k] = (yuv[0] & 0x00FFFFFF) | (yuv[1] & 0xFF000000);
+        }
+
+        if (thumb && y % 2 == 0)
+        {
+            /* every other pixel of this row; chroma from the first pixel of each pair */
+            uint32_t* t = thumb + (y/2) * (ow/4);
+            for (int j = 0; j < ow/4; j++)
+            {
+                t[j] = (dst[2*j] & 0x00FFFFFF) | ((dst[2*j+1] & 0x0000FF00) << 16);
+            }
+        }
+    }
+
+    info_led_off();
+    FIO_CloseFile(f); f = 0;
+    fio_free(buf); buf = 0;
+    raw_set_dirty();
+
+    if (thumb)
+    {
+        struct dng_thumb * t = &dng_thumbs[dng_thumb_next];
+        dng_thumb_next = MOD(dng_thumb_next + 1, DNG_THUMBS);
+        if (t->yuv) fio_free(t->yuv);
+        snprintf(t->filename, sizeof(t->filename), "%s", filename);
+        t->size = size;
+        t->yuv = thumb;
+        t->w = ow;
+        t->h = oh;
+        t->raw_w = aw;
+        t->raw_h = ah;
+    }
+
+    bmp_printf(FONT_MED, 600, 460, " %dx%d ", aw, ah);
+    return 1;
+
+err:
+    if (f) FIO_CloseFile(f);
+    if (buf) fio_free(buf);
+    if (thumb) fio_free(thumb);
+    raw_set_dirty();
+    return 0;
+}
+
+static int dng_show(char* filename)
+{
+    if (dng_show_cached(filename)) return 1;
+    if (dng_show_fast(filename)) return 1;
+    return dng_show_full(filename);
+}
+
 static int bmp_show(char* file)
 {
     void* bmp = bmp_load(file, 1);
@@ -339,6 +588,14 @@ static unsigned int pic_view_init()
 
 static unsigned int pic_view_deinit()
 {
+    for (int i = 0; i < DNG_THUMBS; i++)
+    {
+        if (dng_thumbs[i].yuv)
+        {
+            fio_free(dng_thumbs[i].yuv);
+            dng_thumbs[i].yuv = 0;
+        }
+    }
     return 0;
 }
 
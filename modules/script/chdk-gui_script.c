@@ -221,6 +221,26 @@ static void process_values(const char *param)
 //                 SCRIPT LOADING FUNCTIONS
 //=======================================================
 
+static void script_scan_reset()
+{
+    register int i;
+
+    for (i=0; i<SCRIPT_NUM_PARAMS; ++i)
+    {
+        conf_script_vars[i] = 0;
+        script_loaded_params[i] = 0;
+        script_params[i][0]=0;
+        script_param_order[i]=0;
+        script_range_values[i] = 0;
+        if (script_named_values[i]) free(script_named_values[i]);
+        script_named_values[i] = 0;
+        if (script_named_strings[i]) free(script_named_strings[i]);
+        script_named_strings[i] = 0;
+        script_named_counts[i] = 0;
+        script_range_types[i] = 0;
+    }
+}
+
 //-------------------------------------------------------------------
 // PURPOSE: Parse script (script_source_str) for @xxx
 // PARAMETERS:  fn - full path of script
@@ -232,7 +252,7 @@ static void process_values(const char *param)
 static void script_scan(const char *fn, const char * script_source_str)
 {
     register const char *ptr = script_source_str;
-    register int i, j=0, n;
+    register int j=0, n;
     char *c;
 
     // Build title
@@ -243,20 +263,7 @@ static void script_scan(const char *fn, const char * script_source_str)
 
     // Reset everything
 
-    for (i=0; i<SCRIPT_NUM_PARAMS; ++i)
-    {
-        conf_script_vars[i] = 0;
-        script_loaded_params[i] = 0;
-        script_params[i][0]=0;
-        script_param_order[i]=0;
-        script_range_values[i] = 0;
-        if (script_named_values[i]) free(script_named_values[i]);
-        script_named_values[i] = 0;
-        if (script_named_strings[i]) free(script_named_strings[i]);
-        script_named_strings[i] = 0;
-        script_named_counts[i] = 0;
-        script_range_types[i] = 0;
-    }
+    script_scan_reset();
 
     // Fillup order, defaults
 
@@ -297,6 +304,150 @@ static void script_scan(const char *fn, const char * script_source_str)
 }
 
 
+//=======================================================
+//                 SCRIPT SCAN CACHE
+//=======================================================
+
+// What script_scan found in each script, so the menu can be set up
+// without reading the script again (kept in ML/SCRIPTS/CACHE/SCRIPTS.DAT,
+// to skip reading all scripts at startup, too)
+
+#define SCRIPT_SCAN_CACHE_FILE  SCRIPT_CACHE_DIR "/SCRIPTS.DAT"
+#define SCRIPT_SCAN_CACHE_MAGIC 0x4E435353      // "SSCN"
+
+struct script_scan_entry
+{
+    char filename[FILENAME_SIZE];
+    uint32_t size;                              // of the script file; 0 = unused entry
+    uint32_t timestamp;
+    char title[SCRIPT_TITLE_SIZE];
+    char params[SCRIPT_NUM_PARAMS][MAX_PARAM_NAME_LEN+1];
+    short param_order[SCRIPT_NUM_PARAMS];
+    int range_values[SCRIPT_NUM_PARAMS];
+    short range_types[SCRIPT_NUM_PARAMS];
+    int defaults[SCRIPT_NUM_PARAMS];
+};
+
+struct script_scan_cache_hdr
+{
+    uint32_t magic;
+    uint32_t entry_size;
+    uint32_t count;
+};
+
+static struct script_scan_entry script_scan_cache[MAX_SCRIPT_NUM];    // same index as script_list
+static int script_scan_cache_dirty = 0;
+
+//-------------------------------------------------------------------
+// Set up the globals filled by script_scan from the cache
+// RETURN VALUE: 1 if the script is unchanged since it was cached
+//-------------------------------------------------------------------
+static int script_scan_restore(int script_index, uint32_t size, uint32_t timestamp)
+{
+    struct script_scan_entry * e = &script_scan_cache[script_index];
+    if (!e->size || e->size != size || e->timestamp != timestamp || !streq(e->filename, script_list[script_index]))
+        return 0;
+
+    script_scan_reset();
+
+    memcpy(script_params, e->params, sizeof(script_params));
+    memcpy(script_param_order, e->param_order, sizeof(script_param_order));
+    memcpy(script_range_values, e->range_values, sizeof(script_range_values));
+    memcpy(script_range_types, e->range_types, sizeof(script_range_types));
+    memcpy(conf_script_vars, e->defaults, sizeof(conf_script_vars));
+    memcpy(script_loaded_params, e->defaults, sizeof(script_loaded_params));
+    snprintf(script_titles[script_index], SCRIPT_TITLE_SIZE, "%s", e->title);
+    return 1;
+}
+
+//-------------------------------------------------------------------
+// Remember the results of script_scan (call it before script_update_menu,
+// which pads the parameter names)
+//-------------------------------------------------------------------
+static void script_scan_store(int script_index, uint32_t size, uint32_t timestamp)
+{
+    struct script_scan_entry * e = &script_scan_cache[script_index];
+
+    snprintf(e->filename, FILENAME_SIZE, "%s", script_list[script_index]);
+    e->size = size;
+    e->timestamp = timestamp;
+    snprintf(e->title, SCRIPT_TITLE_SIZE, "%s", script_titles[script_index]);
+    memcpy(e->params, script_params, sizeof(script_params));
+    memcpy(e->param_order, script_param_order, sizeof(script_param_order));
+    memcpy(e->range_values, script_range_values, sizeof(script_range_values));
+    memcpy(e->range_types, script_range_types, sizeof(script_range_types));
+    memcpy(e->defaults, conf_script_vars, sizeof(conf_script_vars));
+
+    script_scan_cache_dirty = 1;
+}
+
+//-------------------------------------------------------------------
+// Load the cache file into script_scan_cache, matching entries to
+// script_list by file name (call it after find_scripts lists the files)
+//-------------------------------------------------------------------
+static void script_scan_cache_load()
+{
+    memset(script_scan_cache, 0, sizeof(script_scan_cache));
+    script_scan_cache_dirty = 0;
+
+    int size = 0;
+    char * buf = (char *) read_entire_file(SCRIPT_SCAN_CACHE_FILE, &size);
+    if (!buf)
+        return;
+
+    struct script_scan_cache_hdr * hdr = (struct script_scan_cache_hdr *) buf;
+    struct script_scan_entry * entries = (struct script_scan_entry *)(hdr + 1);
+
+    if (size >= (int) sizeof(struct script_scan_cache_hdr) &&
+        hdr->magic == SCRIPT_SCAN_CACHE_MAGIC &&
+        hdr->entry_size == sizeof(struct script_scan_entry) &&
+        size == (int)(sizeof(struct script_scan_cache_hdr) + hdr->count * sizeof(struct script_scan_entry)))
+    {
+        for (int k = 0; k < (int) hdr->count; k++)
+        {
+            entries[k].filename[FILENAME_SIZE-1] = 0;
+            entries[k].title[SCRIPT_TITLE_SIZE-1] = 0;
+            for (int i = 0; i < script_cnt; i++)
+            {
+                if (streq(entries[k].filename, script_list[i]))
+                {
+                    memcpy(&script_scan_cache[i], &entries[k], sizeof(struct script_scan_entry));
+                    break;
+                }
+            }
+        }
+    }
+
+    fio_free(buf);
+}
+
+//-------------------------------------------------------------------
+// Write script_scan_cache back, if any script had to be scanned
+//-------------------------------------------------------------------
+static void script_scan_cache_save()
+{
+    if (!script_scan_cache_dirty)
+        return;
+
+    struct script_scan_cache_hdr hdr = {
+        .magic      = SCRIPT_SCAN_CACHE_MAGIC,
+        .entry_size = sizeof(struct script_scan_entry),
+        .count      = script_cnt,
+    };
+
+    if (!is_dir(SCRIPT_CACHE_DIR))
+        FIO_CreateDirectory(SCRIPT_CACHE_DIR);
+
+    FILE * f = FIO_CreateFile(SCRIPT_SCAN_CACHE_FILE);
+    if (f)
+    {
+        FIO_WriteFile(f, &hdr, sizeof(hdr));
+        FIO_WriteFile(f, script_scan_cache, script_cnt * sizeof(struct script_scan_entry));
+        FIO_CloseFile(f);
+        script_scan_cache_dirty = 0;
+    }
+}
+
 static void script_update_menu()
 {
     int j = 0;
@@ -327,6 +478,7 @@ static void script_update_menu()
 #include "picoc.h"
 
 // call this right before running the script
+// (tcc is NULL when the script was loaded from the cache; only prints the params)
 static void script_define_param_variables(void* tcc, void* script_state)
 {
     //int j = 0;
@@ -338,6 +490,6 @@ static void script_define_param_variables(void* tcc, void* script_state)
         int _varname = 'a' + p;
         char* varname = (char*)&_varname;
         printf("   Param %s = %d; // %s\n", varname, conf_script_vars[p], script_params[p]);
-        module_exec(tcc, "tcc_add_symbol", 3, script_state, varname, &conf_script_vars[p]);
+        if (tcc) module_exec(tcc, "tcc_add_symbol", 3, script_state, varname, &conf_script_vars[p]);
     }
 }
@@ -2,12 +2,17 @@
 #include <module.h>
 #include <dryos.h>
 #include <menu.h>
+#include <config.h>
 #include <bmp.h>
 #include <string.h>
+#include <version.h>
 #include <../tcc/libtcc.h>
 
 static void script_define_param_variables(void* tcc, void* script_state);
 
+/* compile with tcc -O (ARM register cache); off by default, as it is newer than the plain code generator */
+static CONFIG_INT("script.optimize", script_optimize, 0);
+
 static int script_load_symbols(void* tcc, void* script_state, char *filename)
 {
     uint32_t size = 0;
@@ -83,13 +88,155 @@ static int script_load_symbols(void* tcc, void* script_state, char *filename)
     return 0;
 }
 
-static int tcc_compile_and_run(char* filename)
+/* compiled script cache: the code relocated by TCC is saved together with the places where it
+ * depends on its own address (recorded by the reloc_fixups helpers from module.c), so it can be
+ * loaded at another address without compiling again, as long as the script and the ML build are unchanged
+ * note: only the script file itself is hashed; edits to the headers it includes are not detected
+ */
+#define SCRIPT_CACHE_DIR "ML/SCRIPTS/CACHE"
+#define SCRIPT_CACHE_MAGIC 0x4F434354   /* "TCCO" */
+#define SCRIPT_SYM_FILE "ML/modules/5D3_123.sym"
+
+struct script_cache_hdr
+{
+    uint32_t magic;
+    uint32_t src_size;
+    uint32_t src_hash;
+    uint32_t link_hash;     /* ML build and symbols the script was linked against */
+    uint32_t image_base;    /* address of the code when it was saved */
+    uint32_t image_size;
+    uint32_t main_offset;
+    uint32_t fixup_count;   /* followed by the fixups, then by the code */
+};
+
+/* FNV-1a */
+static uint32_t script_hash(uint32_t hash, const void * data, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        hash = (hash ^ ((uint8_t *) data)[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* the ML build, the whole symbol table given to TCC (see script_load_symbols) and the compiler options */
+static uint32_t script_link_hash()
+{
+    int sym_size = 0;
+    char * sym = (char *) read_entire_file(SCRIPT_SYM_FILE, &sym_size);
+    const void * extra_symbols[] = { &strcpy, &strlen };
+
+    uint32_t hash = 2166136261u;
+    hash = script_hash(hash, build_version, strlen(build_version));
+    hash = script_hash(hash, build_id, strlen(build_id));
+    hash = script_hash(hash, build_date, strlen(build_date));
+    if (sym)
+    {
+        hash = script_hash(hash, sym, sym_size);
+        fio_free(sym);
+    }
+    hash = script_hash(hash, extra_symbols, sizeof(extra_symbols));
+    hash = script_hash(hash, &script_optimize, sizeof(script_optimize));
+    return hash;
+}
+
+/* ML/SCRIPTS/FOO.C -> ML/SCRIPTS/CACHE/FOO.TCO */
+static void script_cache_path(const char * filename, char * cache_path, int size)
+{
+    const char * name = strrchr(filename, '/');
+    name = name ? name + 1 : filename;
+    int len = strlen(name);
+    if (len > 2 && name[len-2] == '.') len -= 2;
+    snprintf(cache_path, size, SCRIPT_CACHE_DIR "/%.*s.TCO", len, name);
+}
+
+static struct reloc_fixups script_fixups;
+
+/* returns the main function of the cached code, if it matches key; the code is allocated in *script_buf */
+static void * script_cache_load(const char * cache_path, struct script_cache_hdr * key, void ** script_buf)
+{
+    int cache_size = 0;
+    char * cache = (char *) read_entire_file(cache_path, &cache_size);
+    if (!cache)
+    {
+        return 0;
+    }
+
+    struct script_cache_hdr * hdr = (struct script_cache_hdr *) cache;
+    const uint32_t * fixups = (const uint32_t *)(hdr + 1);
+    void * script_main = 0;
+
+    if (cache_size < (int) sizeof(struct script_cache_hdr) ||
+        hdr->magic != key->magic || hdr->src_size != key->src_size ||
+        hdr->src_hash != key->src_hash || hdr->link_hash != key->link_hash ||
+        hdr->main_offset >= hdr->image_size ||
+        cache_size != (int)(sizeof(struct script_cache_hdr) + hdr->fixup_count * 4 + hdr->image_size))
+    {
+        goto end;
+    }
+
+    char * buf = (char *) tcc_malloc(hdr->image_size);
+    if (!buf)
+    {
+        goto end;
+    }
+
+    memcpy(buf, fixups + hdr->fixup_count, hdr->image_size);
+
+    if (!reloc_fixups_apply(buf, hdr->image_size, hdr->image_base, fixups, hdr->fixup_count))
+    {
+        printf("Cached code can't be moved here.\n");
+        tcc_free(buf);
+        goto end;
+    }
+
+    *script_buf = buf;
+    script_main = buf + hdr->main_offset;
+
+end:
+    fio_free(cache);
+    return script_main;
+}
+
+/* save the code just relocated to script_buf, before it runs (and changes its data) */
+static void script_cache_store(const char * cache_path, struct script_cache_hdr * key,
+                               void * script_buf, int size, void * script_main)
+{
+    reloc_fixups_check_branches(&script_fixups);
+
+    if (script_fixups.unsupported)
+    {
+        return;
+    }
+
+    struct script_cache_hdr hdr = *key;
+    hdr.image_base = (uint32_t) script_buf;
+    hdr.image_size = size;
+    hdr.main_offset = (uint32_t) script_main - (uint32_t) script_buf;
+    hdr.fixup_count = script_fixups.count;
+
+    if (!is_dir(SCRIPT_CACHE_DIR))
+    {
+        FIO_CreateDirectory(SCRIPT_CACHE_DIR);
+    }
+
+    FILE * f = FIO_CreateFile(cache_path);
+    if (f)
+    {
+        FIO_WriteFile(f, &hdr, sizeof(hdr));
+        FIO_WriteFile(f, script_fixups.fixups, script_fixups.count * sizeof(uint32_t));
+        FIO_WriteFile(f, script_buf, size);
+        FIO_CloseFile(f);
+    }
+}
+
+/* returns the main function of the compiled script; the code is allocated in *script_buf */
+static void * tcc_compile(char* filename, const char * cache_path, struct script_cache_hdr * key, void ** script_buf)
 {
     printf("Compiling script %s...\n", filename);
 
     void* tcc = NULL;
     TCCState * script_state = NULL;
-    void* script_buf = NULL;
     
     tcc = module_load("ML/MODULES/tcc.mo");
     if (!tcc)
@@ -107,6 +254,10 @@ static int tcc_compile_and_run(char* filename)
 
     module_exec(tcc, "tcc_set_options", 2, script_state, "-nostdlib");
     module_exec(tcc, "tcc_set_options", 2, script_state, "-Wall");
+    if (script_optimize)
+    {
+        module_exec(tcc, "tcc_set_options", 2, script_state, "-O");
+    }
     module_exec(tcc, "tcc_set_options", 2, script_state, "-IML/scripts");
     module_exec(tcc, "tcc_set_output_type", 2, script_state, TCC_OUTPUT_MEMORY);
 
@@ -117,7 +268,7 @@ static int tcc_compile_and_run(char* filename)
         goto err;
     }
 
-    script_load_symbols(tcc, script_state, "ML/modules/5D3_123.sym");
+    script_load_symbols(tcc, script_state, SCRIPT_SYM_FILE);
 
     int size = module_exec(tcc, "tcc_relocate", 2, script_state, NULL);
     if (size <= 0)
@@ -126,14 +277,28 @@ static int tcc_compile_and_run(char* filename)
         goto err;
     }
 
-    script_buf = (void*) tcc_malloc(size);
-    if (!script_buf)
+    *script_buf = (void*) tcc_malloc(size);
+    if (!*script_buf)
     {
         printf("Malloc error.\n");
         goto err;
     }
     
-    int ret_link = module_exec(tcc, "tcc_relocate", 2, script_state, script_buf);
+    /* record the address-dependent relocations, to be able to move the code later */
+    reloc_fixups_free(&script_fixups);
+    script_fixups.base = (uint32_t) *script_buf;
+    script_fixups.size = size;
+    if (module_get_symbol(tcc, "tcc_set_reloc_func"))
+    {
+        module_exec(tcc, "tcc_set_reloc_func", 3, script_state, &script_fixups, reloc_fixups_record);
+    }
+    else
+    {
+        /* old tcc.mo */
+        script_fixups.unsupported = 1;
+    }
+
+    int ret_link = module_exec(tcc, "tcc_relocate", 2, script_state, *script_buf);
     if (ret_link < 0)
     {
         printf("Relocate error.\n");
@@ -147,11 +312,63 @@ static int tcc_compile_and_run(char* filename)
         goto err;
     }
 
+    script_cache_store(cache_path, key, *script_buf, size, script_main);
+    reloc_fixups_free(&script_fixups);
+
     script_define_param_variables(tcc, script_state);
 
     module_exec(tcc, "tcc_delete", 1, script_state); script_state = NULL;
     module_unload(tcc); tcc = NULL;
 
+    return script_main;
+
+err:
+    reloc_fixups_free(&script_fixups);
+    if (*script_buf) { tcc_free(*script_buf); *script_buf = NULL; }
+    if (script_state) module_exec(tcc, "tcc_delete", 1, script_state);
+    if (tcc) module_unload(tcc);
+    return NULL;
+}
+
+static int tcc_compile_and_run(char* filename)
+{
+    void* script_buf = NULL;
+    void (*script_main)() = NULL;
+
+    char cache_path[100];
+    script_cache_path(filename, cache_path, sizeof(cache_path));
+
+    int src_size = 0;
+    char* src = (char*) read_entire_file(filename, &src_size);
+    if (!src)
+    {
+        printf("Could not read %s.\n", filename);
+        return 1;
+    }
+
+    struct script_cache_hdr key = {
+        .magic      = SCRIPT_CACHE_MAGIC,
+        .src_size   = src_size,
+        .src_hash   = script_hash(2166136261u, src, src_size),
+        .link_hash  = script_link_hash(),
+    };
+    fio_free(src);
+
+    script_main = script_cache_load(cache_path, &key, &script_buf);
+    if (script_main)
+    {
+        printf("Loaded script %s from cache.\n", filename);
+        script_define_param_variables(NULL, NULL);
+    }
+    else
+    {
+        script_main = tcc_compile(filename, cache_path, &key, &script_buf);
+        if (!script_main)
+        {
+            return 1;
+        }
+    }
+
     printf("Running script %s...\n", filename);
 
     /* http://repo.or.cz/w/tinycc.git/commit/6ed6a36a51065060bd5e9bb516b85ff796e05f30 */
@@ -161,16 +378,14 @@ static int tcc_compile_and_run(char* filename)
 
     tcc_free(script_buf); script_buf = NULL;
     return 0;
-
-err:
-    if (script_buf) tcc_free(script_buf);
-    if (script_state) module_exec(tcc, "tcc_delete", 1, script_state);
-    if (tcc) module_unload(tcc);
-    return 1;
 }
 
 static void script_update_menu();
 static void script_scan(const char *fn, const char * script_source_str);
+static int script_scan_restore(int script_index, uint32_t size, uint32_t timestamp);
+static void script_scan_store(int script_index, uint32_t size, uint32_t timestamp);
+static void script_scan_cache_load();
+static void script_scan_cache_save();
 
 static int script_state = 0;
 #define SCRIPT_RUNNING 1
@@ -189,6 +404,8 @@ static char script_preview[1000] = "";
 
 static char script_list[MAX_SCRIPT_NUM][FILENAME_SIZE];
 static char script_titles[MAX_SCRIPT_NUM][SCRIPT_TITLE_SIZE];
+static uint32_t script_sizes[MAX_SCRIPT_NUM];       /* from the directory listing */
+static uint32_t script_timestamps[MAX_SCRIPT_NUM];
 
 static int script_selected = 0;
 static int script_cnt = 0;
@@ -229,6 +446,13 @@ static void script_parse_header(int script_index)
     // clear params submenu (hide all unused stuff)
     script_reset_params();
 
+    // parsed before, and unchanged since?
+    if (script_scan_restore(script_index, script_sizes[script_index], script_timestamps[script_index]))
+    {
+        script_update_menu();
+        return;
+    }
+
     // try to read the script 
     static char _buf[1024+128];
     char* buf = UNCACHEABLE(_buf)+64;
@@ -246,6 +470,7 @@ static void script_parse_header(int script_index)
     
     // parse CHDK script header
     script_scan(fn, buf);
+    script_scan_store(script_index, script_sizes[script_index], script_timestamps[script_index]);
     
     // update submenu
     script_update_menu();
@@ -274,6 +499,8 @@ static void find_scripts(void)
         if (file.mode & ATTR_DIRECTORY) continue; // is a directory
         if (is_valid_script_filename(file.name)) {
             
+            script_sizes[script_cnt] = file.size;
+            script_timestamps[script_cnt] = file.timestamp;
             snprintf(script_list[script_cnt++], FILENAME_SIZE, "%s", file.name);
 
             if (script_cnt >= MAX_SCRIPT_NUM)
@@ -285,8 +512,12 @@ static void find_scripts(void)
     } while( FIO_FindNextEx( dirent, &file ) == 0);
     FIO_FindClose(dirent);
     
+    script_scan_cache_load();
+
     for (int i = 0; i < script_cnt; i++)
         script_parse_header(i);
+
+    script_scan_cache_save();
 }
 
 static char* get_script_status_msg()
@@ -591,10 +822,17 @@ static struct menu_entry tccgui_submenu[] = {
         {
             .help = "Script parameter #9",
         },
+        {
+            .name = "Optimize code",
+            .priv = &script_optimize,
+            .max = 1,
+            .help = "Compile with the TCC register cache (-O). Applies to all scripts.",
+            .help2 = "Smaller and faster code. Turn off if a script misbehaves.",
+        },
         MENU_EOL
 };
 
-#define MAX_PARAMS (COUNT(tccgui_submenu) - 3)
+#define MAX_PARAMS (COUNT(tccgui_submenu) - 4)
 
 #define SCRIPT_ENTRY(i) \
         { \
@@ -722,4 +960,8 @@ MODULE_CBRS_START()
     //~ MODULE_CBR(CBR_KEYPRESS, script_keypress_cbr, 0)
 MODULE_CBRS_END()
 
+MODULE_CONFIGS_START()
+    MODULE_CONFIG(script_optimize)
+MODULE_CONFIGS_END()
+
 #include "chdk-gui_script.c"
@@ -15,6 +15,7 @@
 #include <string.h>
 #include <battery.h>
 #include <powersave.h>
+#include <edmac-memcpy.h>
 #include "../lv_rec/lv_rec.h"
 #include "../mlv_rec/mlv.h"
 
@@ -37,12 +38,15 @@ extern WEAK_FUNC(ret_0) int GetBatteryLevel();
 extern WEAK_FUNC(ret_0) int GetBatteryTimeRemaining();
 extern WEAK_FUNC(ret_0) int GetBatteryDrainRate();
 
+extern WEAK_FUNC(ret_0) uint32_t edmac_copy_rectangle_queue(void* dst, void* src, int src_width, int src_x, int src_y, int dst_width, int dst_x, int dst_y, int w, int h, edmac_copy_cbr_t cbr, void* ctx);
+
 #define FEATURE_SILENT_PIC_RAW_BURST
 //~ #define FEATURE_SILENT_PIC_RAW
 
 static CONFIG_INT( "silent.pic", silent_pic_enabled, 0 );
 static CONFIG_INT( "silent.pic.mode", silent_pic_mode, 0 );
 static CONFIG_INT( "silent.pic.slitscan.mode", silent_pic_slitscan_mode, 0 );
+static CONFIG_INT( "silent.pic.slitscan.width", silent_pic_slitscan_width, 0 );
 static CONFIG_INT( "silent.pic.fullres.trigger", silent_pic_fullres_trigger_mode, 0 );
 static CONFIG_INT( "silent.pic.file_format", silent_pic_file_format, 0 );
 #define SILENT_PIC_MODE_SIMPLE 0
@@ -78,9 +82,10 @@ static MENU_UPDATE_FUNC(silent_pic_mode_update)
 {
     /* reveal options for the current shooting mode, if any */
     silent_menu[0].children[1].shidden =
+    silent_menu[0].children[2].shidden =
         (silent_pic_mode != SILENT_PIC_MODE_SLITSCAN);
 
-    silent_menu[0].children[2].shidden =
+    silent_menu[0].children[3].shidden =
         (silent_pic_mode != SILENT_PIC_MODE_FULLRES);
 }
 
@@ -529,7 +534,8 @@ static volatile int sp_buffer_count = 0;    /* how many valid slots we have in t
 static volatile int sp_min_frames = 0;      /* how many pictures we should take without halfshutter pressed (e.g. from intervalometer) */
 static volatile int sp_max_frames = 0;      /* after how many pictures we should stop (even if we still have enough RAM) */
 static volatile int sp_num_frames = 0;      /* how many pics we actually took */
-static volatile int sp_slitscan_line = 0;   /* current line for slit-scan */
+static volatile int sp_slitscan_line = 0;   /* current line for slit-scan (bytes for horizontal scans) */
+static volatile int sp_slitscan_pending = 0; /* slit copies not yet completed by EDMAC */
 
 static unsigned int silent_pic_preview(unsigned int ctx)
 {
@@ -638,131 +644,136 @@ static int silent_pic_raw_choose_next_slot()
     return next_slot;
 }
 
+static void silent_pic_raw_slitscan_dma_cbr(uint32_t id, void* ctx)
+{
+    /* called from interrupt */
+    sp_slitscan_pending--;
+}
+
+/* copy a rectangle from the LiveView raw buffer into our frame; x and w in bytes, y and h in lines */
+static void silent_pic_raw_slitscan_copy(int src_x, int src_y, int dst_x, int dst_y, int w, int h)
+{
+    void* dst = UNCACHEABLE(sp_frames[0]);
+    void* src = UNCACHEABLE(raw_info.buffer);
+    int pitch = raw_info.pitch;
+
+    uint32_t old = cli();
+    sp_slitscan_pending++;
+    sei(old);
+
+    /* the EDMAC walks the strided rectangle by itself, without spending CPU time in vsync */
+    if (edmac_copy_rectangle_queue(dst, src, pitch, src_x, src_y, pitch, dst_x, dst_y, w, h, &silent_pic_raw_slitscan_dma_cbr, 0))
+    {
+        return;
+    }
+
+    /* no EDMAC copy engine on this camera, or its queue is full */
+    for (int y = 0; y < h; y++)
+    {
+        memcpy(dst + (dst_y + y) * pitch + dst_x, src + (src_y + y) * pitch + src_x, w);
+    }
+
+    old = cli();
+    sp_slitscan_pending--;
+    sei(old);
+}
+
+static int silent_pic_raw_slitscan_horizontal()
+{
+    return silent_pic_slitscan_mode == SILENT_PIC_MODE_SLITSCAN_SCAN_LTR ||
+           silent_pic_slitscan_mode == SILENT_PIC_MODE_SLITSCAN_SCAN_RTL;
+}
+
+static int silent_pic_raw_slitscan_progress()
+{
+    int total = silent_pic_raw_slitscan_horizontal() ? raw_info.pitch : raw_info.height;
+    return MIN(sp_slitscan_line, total) * 100 / total;
+}
+
 static void FAST silent_pic_raw_slitscan_vsync()
 {
-    void* buf = sp_frames[0];
     /*
     * SILENT_PIC_MODE_SLITSCAN_SCAN_TTB 0 // top to bottom
     * SILENT_PIC_MODE_SLITSCAN_SCAN_BTT 1 // bottom to top
     * SILENT_PIC_MODE_SLITSCAN_SCAN_LTR 2 // left to right
     * SILENT_PIC_MODE_SLITSCAN_SCAN_RTL 3 // right to left
     * SILENT_PIC_MODE_SLITSCAN_CENTER_H 4 // center horizontal
-    * SILENT_PIC_MODE_SLITSCAN_CENTER_V 5 // center vertical
      */
-    // probably a better way to do this than a switch, quite a bit of this code is redundant
+    int pitch = raw_info.pitch;
+    int height = raw_info.height;
+    int slit = 1 << silent_pic_slitscan_width;
+
+    /* progress is displayed from silent_pic_take_raw, not from here */
+    if (sp_slitscan_line >= (silent_pic_raw_slitscan_horizontal() ? pitch : height)) /* done */
+    {
+        sp_running = 0;
+        return;
+    }
+
     switch (silent_pic_slitscan_mode)
     {
         case SILENT_PIC_MODE_SLITSCAN_SCAN_TTB:
-            if (sp_slitscan_line >= raw_info.height) /* done */
-            {
-                sp_running = 0;
-            }
-            else
-            {
-                int offset = raw_info.pitch * sp_slitscan_line;
-                memcpy(CACHEABLE(buf + offset), CACHEABLE(raw_info.buffer + offset), raw_info.pitch);
-                sp_slitscan_line++;
-                sp_num_frames = 1;
-                bmp_printf(FONT_MED, 0, 60, "Slit-scan: %d%%...", sp_slitscan_line * 100 / raw_info.height);
-            }
+        {
+            int h = MIN(slit, height - sp_slitscan_line);
+            silent_pic_raw_slitscan_copy(0, sp_slitscan_line, 0, sp_slitscan_line, pitch, h);
+            sp_slitscan_line += h;
             break;
-            
+        }
+
         case SILENT_PIC_MODE_SLITSCAN_SCAN_BTT:
-            if (sp_slitscan_line >= raw_info.height) /* done */
-            {
-                sp_running = 0;
-            }
-            else
-            {
-                int offset = raw_info.pitch * (raw_info.height - sp_slitscan_line); // should start offset and bottom of frame
-                memcpy(CACHEABLE(buf + offset), CACHEABLE(raw_info.buffer + offset), raw_info.pitch);
-                sp_slitscan_line++;
-                sp_num_frames = 1;
-                bmp_printf(FONT_MED, 0, 60, "Slit-scan: %d%%...", sp_slitscan_line * 100 / raw_info.height);
-            }
+        {
+            int h = MIN(slit, height - sp_slitscan_line);
+            int y = height - sp_slitscan_line - h;
+            silent_pic_raw_slitscan_copy(0, y, 0, y, pitch, h);
+            sp_slitscan_line += h;
             break;
-            
+        }
+
         case SILENT_PIC_MODE_SLITSCAN_SCAN_LTR:
-            if (sp_slitscan_line  >= raw_info.pitch)
-            {
-                sp_running = 0;
-            }
-            else
+        case SILENT_PIC_MODE_SLITSCAN_SCAN_RTL:
+        {
+            /* columns are copied 4 pixels (7 bytes) at a time; cutting 14-bit pixels apart would be bad */
+            int w = MIN(MAX(slit, 4) * 14/8, pitch - sp_slitscan_line);
+            int x = (silent_pic_slitscan_mode == SILENT_PIC_MODE_SLITSCAN_SCAN_LTR)
+                ? sp_slitscan_line
+                : pitch - sp_slitscan_line - w;
+
+            /* the EDMAC wants w * h to be a multiple of its transfer size (up to 16 bytes);
+             * if it isn't, widen the slit towards the columns that were not scanned yet
+             * (they will be overwritten by the next frames), so the copy doesn't need the CPU */
+            int w16 = (w + 15) & ~15;
+            int xd = x;
+            int wd = w;
+            if ((w * height) % 16)
             {
-                for (int i = 0; i < raw_info.height; i++)
+                if (silent_pic_slitscan_mode == SILENT_PIC_MODE_SLITSCAN_SCAN_LTR)
                 {
-                    // going down with i * pitch, then over to whatever line we're on
-                    int offset =  (i * raw_info.pitch) + sp_slitscan_line;
-                    // have to copy 7 bytes at a time, 4 x 14 bit pixels. memcpy only deals in whole bytes,
-                    // and if you cut the pixels apart bad things happen.
-                    memcpy(CACHEABLE(buf + offset), CACHEABLE(raw_info.buffer + offset), 7);
+                    wd = MIN(w16, pitch - x);
                 }
-                // move over the 7 bytes at a time.
-                sp_slitscan_line += 7;
-                sp_num_frames = 1;
-                bmp_printf(FONT_MED, 0, 60, "Slit-scan: %d%%...", sp_slitscan_line * 100 / raw_info.pitch);
-            }
-            break;
-            
-        case SILENT_PIC_MODE_SLITSCAN_SCAN_RTL:
-            if (sp_slitscan_line  >= raw_info.pitch)
-            {
-                sp_running = 0;
-            }
-            else 
-            {
-                for (int i = 0; i < raw_info.height; i++)
+                else
                 {
-                    // going down with i * pitch, then back from the right of whatever line we're on
-                    int offset =  (i * raw_info.pitch) + (raw_info.pitch - sp_slitscan_line - 7);
-                    // have to copy 7 bytes at a time, 4 x 14 bit pixels. memcpy only deals in whole bytes.
-                    memcpy(CACHEABLE(buf + offset), CACHEABLE(raw_info.buffer + offset), 7);
+                    xd = MAX(x + w - w16, 0);
+                    wd = x + w - xd;
                 }
-                // move over the 7 bytes at a time.
-                sp_slitscan_line += 7;
-                sp_num_frames = 1;
-                bmp_printf(FONT_MED, 0, 60, "Slit-scan: %d%%...", sp_slitscan_line * 100 / raw_info.pitch);
             }
+
+            silent_pic_raw_slitscan_copy(xd, 0, xd, 0, wd, height);
+            sp_slitscan_line += w;
             break;
-        /* // not working yet! couldn't get the correct pixels out of the center of the frame.
-        case SILENT_PIC_MODE_SLITSCAN_CENTER_V:
-            if (sp_slitscan_line  >= raw_info.pitch)
-            {
-                sp_running = 0;
-            } else {
-                for (int i = 0; i < raw_info.height; i++) {
-                    // going down with i * pitch, then back from the right of whatever line we're on
-                    int offset =  (i * raw_info.pitch) + sp_slitscan_line;
-                    int middle = (i * raw_info.pitch) + (7 * 100);
-                    // have to copy 7 bytes at a time, 4 x 14 bit pixels. memcpy only deals in whole bytes.
-                    memcpy(CACHEABLE(buf + offset), CACHEABLE(raw_info.buffer + middle), 7);
-                }
-                // move over the 7 bytes at a time.
-                sp_slitscan_line += 7;
-                sp_num_frames = 1;
-                bmp_printf(FONT_MED, 0, 60, "Slit-scan Vertical: %d%%...", sp_slitscan_line * 100 / raw_info.pitch);
-            }
-            break; */
-            
+        }
+
         case SILENT_PIC_MODE_SLITSCAN_CENTER_H:
-            if (sp_slitscan_line >= raw_info.height) /* done */
-            {
-                sp_running = 0;
-            }
-            else 
-            {
-                int offset = raw_info.pitch * (sp_slitscan_line & ~1);
-                int middle = raw_info.pitch * ((raw_info.height / 2) & ~1); // find the middle of the buffer, keep the parity
-                memcpy(CACHEABLE(buf + offset), CACHEABLE(raw_info.buffer + middle), raw_info.pitch * 2);
-                sp_slitscan_line += 2; // have to copy two lines at a time, or we lose the red or blue pixels
-                sp_num_frames = 1;
-                bmp_printf(FONT_MED, 0, 60, "Slit-scan: %d%%...", sp_slitscan_line * 100 / raw_info.height);
-            }
+        {
+            /* have to copy two lines at a time, or we lose the red or blue pixels */
+            int h = MIN(MAX(slit, 2), height - sp_slitscan_line);
+            int middle = (height / 2 - h / 2) & ~1; /* find the middle of the buffer, keep the parity */
+            silent_pic_raw_slitscan_copy(0, middle, 0, sp_slitscan_line, pitch, h);
+            sp_slitscan_line += h;
             break;
-            
-        
+        }
     }
-    
+
+    sp_num_frames = 1;
 }
 
 
@@ -938,11 +949,22 @@ silent_pic_take_lv(int interactive)
         goto cleanup;
     }
     
+    if (sp_slitscan_pending)
+    {
+        /* copies from a previous slit-scan never completed; the counter is still theirs */
+        bmp_printf(FONT_MED, 0, 83, "EDMAC busy");
+        ok = 0;
+        goto cleanup;
+    }
+
     /* misc initializers */
     sp_num_frames = 0;
     sp_slitscan_line = 0;
     memset(sp_focus, 0, sizeof(sp_focus));
-    memset(sp_frames[0], 0, raw_info.frame_size);
+
+    /* slit-scan writes this frame with EDMAC, so clear it without leaving dirty cache lines behind */
+    memset(UNCACHEABLE(sp_frames[0]), 0, raw_info.frame_size);
+    sync_caches();
 
     /* how many pics we should take? */
     switch (silent_pic_mode)
@@ -977,6 +999,9 @@ silent_pic_take_lv(int interactive)
         if (silent_pic_mode == SILENT_PIC_MODE_BEST_FOCUS)
             silent_pic_raw_show_focus(-1);
         
+        if (silent_pic_mode == SILENT_PIC_MODE_SLITSCAN)
+            bmp_printf(FONT_MED, 0, 60, "Slit-scan: %d%%...", silent_pic_raw_slitscan_progress());
+        
         if (!lv)
         {
             sp_running = 0;
@@ -985,8 +1010,29 @@ silent_pic_take_lv(int interactive)
         }
     }
 
+    /* wait for the last slit-scan copies */
+    for (int i = 0; i < 100 && sp_slitscan_pending; i++)
+    {
+        msleep(10);
+    }
+
     /* disable the debug flag, no longer needed */
     raw_lv_release(); raw_flag = 0;
+
+    if (sp_slitscan_pending)
+    {
+        /* incomplete image; the EDMAC may still write into our buffer, so keep it allocated */
+        NotifyBox(5000, "Slit-scan: EDMAC timeout");
+        hSuite1 = hSuite2 = 0;
+        ok = 0;
+        goto cleanup;
+    }
+
+    if (silent_pic_mode == SILENT_PIC_MODE_SLITSCAN)
+    {
+        /* the preview may have cached parts of the frame before the EDMAC filled them */
+        sync_caches();
+    }
     
     if (silent_pic_mode == SILENT_PIC_MODE_BEST_FOCUS)
     {
@@ -1620,6 +1666,15 @@ static struct menu_entry silent_menu[] = {
                     "Keep scan line in middle of frame, horizontally.\n",
                 .shidden = 1,   /* enabled only when choosing slit-scan */
             },
+            {
+                .name = "Slit Width",
+                .priv = &silent_pic_slitscan_width,
+                .max = 6,
+                .choices = CHOICES("1 px", "2 px", "4 px", "8 px", "16 px", "32 px", "64 px"),
+                .help = "How many pixels to capture from each LiveView frame.",
+                .help2 = "Left/right scans capture at least 4 pixels; center scan, at least 2.",
+                .shidden = 1,   /* enabled only when choosing slit-scan */
+            },
             {
                 .name = "Trigger Mode",
                 .priv = &silent_pic_fullres_trigger_mode,
@@ -1693,6 +1748,7 @@ MODULE_CONFIGS_START()
     MODULE_CONFIG(silent_pic_enabled)
     MODULE_CONFIG(silent_pic_mode)
     MODULE_CONFIG(silent_pic_slitscan_mode)
+    MODULE_CONFIG(silent_pic_slitscan_width)
     MODULE_CONFIG(silent_pic_fullres_trigger_mode)
     MODULE_CONFIG(silent_pic_file_format)
 MODULE_CONFIGS_END()
@@ -195,6 +195,379 @@ static int regmask(int r) {
   return reg_classes[r]&~(RC_INT|RC_FLOAT);
 }
 
+/******************************************************/
+/* register cache (-O): what the integer registers are known to hold, so
+   that load() and store() can skip redundant loads and stores of locals and
+   reuse constants. Only load() and store() learn facts, and every
+   instruction emitted by o() forgets what it may change. At a label only
+   reached by forward jumps, the facts known at all the jumps are merged;
+   at a label that backward jumps may target, everything is forgotten. */
+
+#define RCACHE_REGS 6 /* r0-r3, r12 and lr, the registers load() uses */
+#define RCACHE_MAX_JUMPS 1024
+#define RCACHE_MAX_JOINS 4
+
+struct rcache_reg {
+  char slot; /* holds the local at [fp, #off] */
+  char cnst; /* holds the constant sym + c */
+  short size; /* of the local: 1, 2 or 4 bytes, negative if sign extended */
+  int off;
+  Sym *sym;
+  uint32_t c;
+};
+
+struct rcache {
+  int live; /* cleared by an unconditional branch */
+  struct rcache_reg r[RCACHE_REGS];
+};
+
+/* the state at a branch, to be merged at its target */
+struct rcache_jump {
+  int addr;
+  struct rcache s;
+};
+
+static const int rcache_regno[RCACHE_REGS] = { 0, 1, 2, 3, 12, 14 };
+static struct rcache rcache;
+static int rcache_off;
+static int rcache_label; /* last label, maybe targeted by backward jumps */
+static int rcache_target; /* last address jumps were resolved to */
+static struct rcache_jump *rcache_jumps;
+static int rcache_nb_jumps, rcache_max_jumps;
+/* targets of "b +0" (over a literal, or over one instruction) */
+static struct rcache_jump rcache_joins[RCACHE_MAX_JOINS];
+static int rcache_nb_joins;
+
+static int rcache_idx(int r)
+{
+  if(r < 4)
+    return r;
+  if(r == 12)
+    return 4;
+  if(r == 14)
+    return 5;
+  return -1;
+}
+
+static void rcache_flush(void)
+{
+  memset(&rcache, 0, sizeof(rcache));
+  rcache.live = 1;
+}
+
+static void rcache_forget(int r)
+{
+  int i = rcache_idx(r);
+  if(r == 15)
+    rcache_flush();
+  else if(i >= 0)
+    rcache.r[i].slot = rcache.r[i].cnst = 0;
+}
+
+/* forget the locals overlapping [off, off + size), all of them if size is 0 */
+static void rcache_forget_slots(int off, int size)
+{
+  struct rcache_reg *p;
+  int n;
+  for(p = rcache.r; p < rcache.r + RCACHE_REGS; p++) {
+    n = p->size < 0 ? -p->size : p->size;
+    if(!size || (p->off < off + size && off < p->off + n))
+      p->slot = 0;
+  }
+}
+
+/* keep in s only what is also known in t */
+static void rcache_meet(struct rcache *s, struct rcache *t)
+{
+  struct rcache_reg *p, *q;
+  if(!t->live)
+    return;
+  if(!s->live) {
+    *s = *t;
+    return;
+  }
+  for(p = s->r, q = t->r; p < s->r + RCACHE_REGS; p++, q++) {
+    if(p->slot && !(q->slot && q->off == p->off && q->size == p->size))
+      p->slot = 0;
+    if(p->cnst && !(q->cnst && q->sym == p->sym && q->c == p->c))
+      p->cnst = 0;
+  }
+}
+
+/* merge what "b +0" jumped over */
+static void rcache_sync(void)
+{
+  int k;
+  for(k = 0; k < rcache_nb_joins; k++)
+    if(rcache_joins[k].addr == ind) {
+      rcache_meet(&rcache, &rcache_joins[k].s);
+      rcache_joins[k--] = rcache_joins[--rcache_nb_joins];
+    }
+}
+
+static struct rcache_jump *rcache_find_jump(int addr)
+{
+  int lo = 0, hi = rcache_nb_jumps - 1, m;
+  while(lo <= hi) {
+    m = (lo + hi) / 2;
+    if(rcache_jumps[m].addr == addr)
+      return &rcache_jumps[m];
+    if(rcache_jumps[m].addr < addr)
+      lo = m + 1;
+    else
+      hi = m - 1;
+  }
+  return NULL;
+}
+
+static void rcache_branch(uint32_t i)
+{
+  int off = ((int)(i << 8)) >> 6;
+  if(off >= 0) {
+    if(rcache_nb_joins == RCACHE_MAX_JOINS) {
+      rcache_off = 1;
+      return;
+    }
+    rcache_joins[rcache_nb_joins].addr = ind + 8 + off;
+    rcache_joins[rcache_nb_joins++].s = rcache;
+  } else {
+    if(rcache_nb_jumps == rcache_max_jumps) {
+      if(rcache_max_jumps == RCACHE_MAX_JUMPS)
+        goto done; /* merged as unknown at the target */
+      rcache_max_jumps = rcache_max_jumps ? rcache_max_jumps * 2 : 16;
+      rcache_jumps = tcc_realloc(rcache_jumps,
+                                 rcache_max_jumps * sizeof(struct rcache_jump));
+    }
+    rcache_jumps[rcache_nb_jumps].addr = ind;
+    rcache_jumps[rcache_nb_jumps++].s = rcache;
+  }
+done:
+  if((i >> 28) == 0xE)
+    rcache.live = 0;
+}
+
+/* load or store of size bytes at rn + off (register offset if !imm) */
+static void rcache_ldst(uint32_t i, int size, int imm, int off)
+{
+  int rd = (i >> 12) & 15, rn = (i >> 16) & 15;
+  int wb = !(i & 0x1000000) || (i & 0x200000);
+
+  if(!(i & 0x800000))
+    off = -off;
+  if(i & 0x100000)
+    rcache_forget(rd);
+  else if(rn == 11 && imm && !wb)
+    rcache_forget_slots(off, size);
+  else
+    rcache_forget_slots(0, 0);
+  if(wb)
+    rcache_forget(rn);
+}
+
+/* forget what instruction i may change */
+static void rcache_update(uint32_t i)
+{
+  int rd = (i >> 12) & 15, rn = (i >> 16) & 15, r;
+
+  rcache_sync();
+  if(!rcache.live) {
+    /* dead code, or a literal after a branch */
+    if(((i >> 24) & 0xF) == 0xA && (i >> 28) != 0xF)
+      rcache_branch(i);
+    return;
+  }
+  if((i >> 28) == 0xF)
+    goto flush;
+  switch((i >> 25) & 7) {
+    case 0:
+      if((i & 0x90) == 0x90) {
+        if((i & 0x60) == 0) {
+          if((i & 0x1800000) == 0) { /* mul, mla */
+            rcache_forget(rn);
+            return;
+          }
+          if((i & 0x1800000) == 0x800000) { /* umull, smull... */
+            rcache_forget(rn);
+            rcache_forget(rd);
+            return;
+          }
+          goto flush; /* swp */
+        }
+        if(!(i & 0x100000) && (i & 0x40))
+          goto flush; /* ldrd, strd */
+        /* ldrh, ldrsh, ldrsb, strh */
+        rcache_ldst(i, (i & 0x20) ? 2 : 1, i & 0x400000,
+                    ((i >> 4) & 0xF0) | (i & 0xF));
+        return;
+      }
+      /* fall through */
+    case 1:
+      if((i & 0x1800000) == 0x1000000) {
+        if(!(i & 0x100000))
+          goto flush; /* mrs, msr, bx... */
+        return; /* tst, teq, cmp, cmn */
+      }
+      rcache_forget(rd);
+      return;
+    case 3:
+      if(i & 0x10)
+        goto flush;
+      /* fall through */
+    case 2: /* ldr, str */
+      rcache_ldst(i, (i & 0x400000) ? 1 : 4, !(i & 0x2000000), i & 0xFFF);
+      return;
+    case 4: /* ldm, stm */
+      if(i & 0x100000) {
+        if(i & 0x8000)
+          goto flush;
+        for(r = 0; r < 15; r++)
+          if(i & (1 << r))
+            rcache_forget(r);
+      } else
+        rcache_forget_slots(0, 0);
+      if(i & 0x200000)
+        rcache_forget(rn);
+      return;
+    case 5:
+      if(i & 0x1000000)
+        goto flush; /* bl */
+      rcache_branch(i);
+      return;
+    case 6:
+      if((i & 0x1E00000) == 0x400000) { /* mcrr, mrrc */
+        if(i & 0x100000) {
+          rcache_forget(rd);
+          rcache_forget(rn);
+        }
+        return;
+      }
+      /* coprocessor load, store */
+      if(!(i & 0x100000))
+        rcache_forget_slots(0, 0);
+      if(i & 0x200000)
+        rcache_forget(rn);
+      return;
+    case 7:
+      if(i & 0x1000000)
+        goto flush; /* swi */
+      if((i & 0x100010) == 0x100010 && rd != 15)
+        rcache_forget(rd); /* mrc */
+      return;
+  }
+flush:
+  rcache_flush();
+}
+
+static int rcache_has_slot(int r, int off, int size)
+{
+  struct rcache_reg *p;
+  if(rcache_idx(r) < 0)
+    return 0;
+  p = &rcache.r[rcache_idx(r)];
+  return p->slot && p->off == off && p->size == size;
+}
+
+static void rcache_set_slot(int r, int off, int size)
+{
+  struct rcache_reg *p;
+  if(rcache_idx(r) < 0)
+    return;
+  p = &rcache.r[rcache_idx(r)];
+  p->slot = 1;
+  p->off = off;
+  p->size = size;
+}
+
+static int rcache_has_const(int r, Sym *sym, uint32_t c)
+{
+  struct rcache_reg *p;
+  if(rcache_idx(r) < 0)
+    return 0;
+  p = &rcache.r[rcache_idx(r)];
+  return p->cnst && p->sym == sym && p->c == c;
+}
+
+static void rcache_set_const(int r, Sym *sym, uint32_t c)
+{
+  struct rcache_reg *p;
+  if(rcache_idx(r) < 0)
+    return;
+  p = &rcache.r[rcache_idx(r)];
+  p->cnst = 1;
+  p->sym = sym;
+  p->c = c;
+}
+
+/* load the local at off into r from a register already holding it */
+static int rcache_load_slot(int r, int off, int size)
+{
+  int i;
+  if(rcache_off)
+    return 0;
+  rcache_sync();
+  if(rcache_has_slot(r, off, size))
+    return 1;
+  for(i = 0; i < RCACHE_REGS; i++)
+    if(rcache_has_slot(rcache_regno[i], off, size)) {
+      o(0xE1A00000|(r<<12)|rcache_regno[i]); /* mov */
+      rcache_set_slot(r, off, size);
+      return 1;
+    }
+  return 0;
+}
+
+/* same for a constant; only worth a mov if it would need a literal */
+static int rcache_load_const(int r, Sym *sym, uint32_t c, int literal)
+{
+  int i;
+  if(rcache_off)
+    return 0;
+  rcache_sync();
+  if(rcache_has_const(r, sym, c))
+    return 1;
+  if(literal)
+    for(i = 0; i < RCACHE_REGS; i++)
+      if(rcache_has_const(rcache_regno[i], sym, c)) {
+        o(0xE1A00000|(r<<12)|rcache_regno[i]); /* mov */
+        rcache_set_const(r, sym, c);
+        return 1;
+      }
+  return 0;
+}
+
+/* r holds the local at off already: no need to store it */
+static int rcache_stored(int r, int off, int size)
+{
+  if(rcache_off)
+    return 0;
+  rcache_sync();
+  return rcache_has_slot(r, off, size) || rcache_has_slot(r, off, -size);
+}
+
+static void rcache_start(void)
+{
+  rcache_flush();
+  rcache_off = 0;
+  rcache_label = rcache_target = -1;
+  rcache_nb_jumps = 0;
+  rcache_nb_joins = 0;
+}
+
+static void rcache_end(void)
+{
+  tcc_free(rcache_jumps);
+  rcache_jumps = NULL;
+  rcache_nb_jumps = rcache_max_jumps = 0;
+}
+
+/* the code at ind may be reached by jumps not seen yet */
+ST_FUNC void gen_label(void)
+{
+  rcache_sync();
+  rcache_flush();
+  rcache_label = rcache_target = ind;
+}
+
 /******************************************************/
 
 void o(uint32_t i)
@@ -202,6 +575,9 @@ void o(uint32_t i)
   /* this is a good place to start adding big-endian support*/
   int ind1;
 
+  if (tcc_state->optimize && !rcache_off)
+    rcache_update(i);
+
   ind1 = ind + 4;
   if (!cur_text_section)
     tcc_error("compiler error! This happens f.ex. if the compiler\n"
@@ -349,11 +725,48 @@ int decbranch(int pos)
   return x*4+pos+8;
 }
 
+/* the state at a label reached by the jumps of chain t, or falling through */
+static void rcache_merge(int t)
+{
+  struct rcache s;
+  struct rcache_jump *j;
+
+  rcache_sync();
+  s = rcache;
+  for(; t; t = decbranch(t)) {
+    j = rcache_find_jump(t);
+    if(!j) {
+      rcache_flush();
+      return;
+    }
+    rcache_meet(&s, &j->s);
+  }
+  rcache = s;
+  /* drop the state of a jump removed by gsym_addr */
+  if(rcache_nb_jumps && rcache_jumps[rcache_nb_jumps - 1].addr >= ind)
+    rcache_nb_jumps--;
+  if(ind == rcache_label)
+    rcache_flush();
+  rcache_target = ind;
+}
+
 /* output a symbol and patch all calls to it */
 void gsym_addr(int t, int a)
 {
   uint32_t *x;
   int lt;
+  if(t && a==ind && tcc_state->optimize) {
+    /* drop a jump to the next instruction */
+    x=(uint32_t *)(cur_text_section->data + t);
+    if(t==ind-4 && (*x>>24)==0xEA && !rcache_nb_joins
+       && rcache_target!=ind) {
+      ind-=4;
+      a=ind;
+      rcache_merge(t);
+      t=decbranch(t);
+    } else
+      rcache_merge(t);
+  }
   while(t) {
     x=(uint32_t *)(cur_text_section->data + t);
     t=decbranch(lt=t);
@@ -492,13 +905,14 @@ static int negcc(int cc)
 /* load 'r' from value 'sv' */
 void load(int r, SValue *sv)
 {
-  int v, ft, fc, fr, sign;
+  int v, ft, fc, fr, sign, slot, size;
   uint32_t op;
   SValue v1;
 
   fr = sv->r;
   ft = sv->type.t;
   fc = sv->c.ul;
+  slot = tcc_state->optimize && !(fr & VT_SYM) && !(ft & VT_VOLATILE);
 
   if(fc>=0)
     sign=0;
@@ -510,6 +924,8 @@ void load(int r, SValue *sv)
   v = fr & VT_VALMASK;
   if (fr & VT_LVAL) {
     uint32_t base = 0xB; // fp
+    if(v != VT_LOCAL)
+      slot = 0;
     if(v == VT_LLOCAL) {
       v1.type.t = VT_PTR;
       v1.r = VT_LOCAL | VT_LVAL;
@@ -557,6 +973,11 @@ void load(int r, SValue *sv)
 #endif
       } else if((ft & (VT_BTYPE|VT_UNSIGNED)) == VT_BYTE
                 || (ft & VT_BTYPE) == VT_SHORT) {
+	size = (ft & VT_BTYPE) == VT_SHORT ? 2 : 1;
+	if ((ft & VT_UNSIGNED) == 0)
+	  size = -size;
+	if(slot && rcache_load_slot(intr(r), sv->c.i, size))
+	  return;
 	calcaddr(&base,&fc,&sign,255,0);
 	op=0xE1500090;
 	if ((ft & VT_BTYPE) == VT_SHORT)
@@ -566,7 +987,12 @@ void load(int r, SValue *sv)
 	if(!sign)
 	  op|=0x800000;
 	o(op|(intr(r)<<12)|(base<<16)|((fc&0xf0)<<4)|(fc&0xf));
+	if(slot)
+	  rcache_set_slot(intr(r), sv->c.i, size);
       } else {
+	size = (ft & VT_BTYPE) == VT_BYTE ? 1 : 4;
+	if(slot && rcache_load_slot(intr(r), sv->c.i, size))
+	  return;
 	calcaddr(&base,&fc,&sign,4095,0);
 	op=0xE5100000;
 	if(!sign)
@@ -574,20 +1000,32 @@ void load(int r, SValue *sv)
         if ((ft & VT_BTYPE) == VT_BYTE)
           op|=0x400000;
         o(op|(intr(r)<<12)|fc|(base<<16));
+	if(slot)
+	  rcache_set_slot(intr(r), sv->c.i, size);
       }
       return;
     }
   } else {
     if (v == VT_CONST) {
+      Sym *sym = (fr & VT_SYM) ? sv->sym : NULL;
       op=stuff_const(0xE3A00000|(intr(r)<<12),sv->c.ul);
+      if (tcc_state->optimize
+          && rcache_load_const(intr(r), sym, sv->c.ul, sym || !op))
+        return;
       if (fr & VT_SYM || !op) {
         o(0xE59F0000|(intr(r)<<12));
+        /* before the branch, whose snapshot is what survives the literal */
+        if (tcc_state->optimize)
+          rcache_set_const(intr(r), sym, sv->c.ul);
         o(0xEA000000);
         if(fr & VT_SYM)
 	  greloc(cur_text_section, sv->sym, ind, R_ARM_ABS32);
         o(sv->c.ul);
-      } else
+      } else {
         o(op);
+        if (tcc_state->optimize)
+          rcache_set_const(intr(r), sym, sv->c.ul);
+      }
       return;
     } else if (v == VT_LOCAL) {
       op=stuff_const(0xE28B0000|(intr(r)<<12),sv->c.ul);
@@ -620,7 +1058,7 @@ void load(int r, SValue *sv)
 #else
 	o(0xEE008180|(fpr(r)<<12)|fpr(v));
 #endif
-      else
+      else if(intr(r) != intr(v) || !tcc_state->optimize)
 	o(0xE1A00000|(intr(r)<<12)|intr(v));
       return;
     }
@@ -632,12 +1070,14 @@ void load(int r, SValue *sv)
 void store(int r, SValue *sv)
 {
   SValue v1;
-  int v, ft, fc, fr, sign;
+  int v, ft, fc, fr, sign, slot, size;
   uint32_t op;
 
   fr = sv->r;
   ft = sv->type.t;
   fc = sv->c.ul;
+  slot = tcc_state->optimize && (fr & VT_VALMASK) == VT_LOCAL
+         && !(fr & VT_SYM) && !(ft & VT_VOLATILE);
 
   if(fc>=0)
     sign=0;
@@ -689,12 +1129,18 @@ void store(int r, SValue *sv)
 #endif
 	return;
       } else if((ft & VT_BTYPE) == VT_SHORT) {
+	/* skip the store if r was loaded from there */
+	if(slot && rcache_stored(intr(r), sv->c.i, 2))
+	  return;
 	calcaddr(&base,&fc,&sign,255,0);
 	op=0xE14000B0;
 	if(!sign)
 	  op|=0x800000;
 	o(op|(intr(r)<<12)|(base<<16)|((fc&0xf0)<<4)|(fc&0xf));
       } else {
+	size = (ft & VT_BTYPE) == VT_BYTE ? 1 : 4;
+	if(slot && rcache_stored(intr(r), sv->c.i, size))
+	  return;
 	calcaddr(&base,&fc,&sign,4095,0);
 	op=0xE5000000;
 	if(!sign)
@@ -702,6 +1148,8 @@ void store(int r, SValue *sv)
         if ((ft & VT_BTYPE) == VT_BYTE)
           op|=0x400000;
         o(op|(intr(r)<<12)|fc|(base<<16));
+	if(slot && size == 4)
+	  rcache_set_slot(intr(r), sv->c.i, 4);
       }
       return;
     }
@@ -736,6 +1184,8 @@ static void gcall_or_jmp(int is_jmp)
       if (vtop->r & VT_SYM)
 	greloc(cur_text_section, vtop->sym, ind, R_ARM_ABS32);
       o(vtop->c.ul);
+      /* the literal is no branch, and we come back here */
+      rcache_flush();
     }
   } else {
     /* otherwise, indirect call */
@@ -1241,6 +1691,7 @@ from_stack:
   last_itod_magic=0;
   leaffunc = 1;
   loc = 0;
+  rcache_start();
 }
 
 /* generate function epilog */
@@ -1280,6 +1731,7 @@ void gfunc_epilog(void)
       *(uint32_t *)(cur_text_section->data + func_sub_sp_offset) = 0xE1000000|encbranch(func_sub_sp_offset,addr,1);
     }
   }
+  rcache_end();
 }
 
 /* generate a jump to a label */
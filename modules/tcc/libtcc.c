@@ -1263,6 +1263,13 @@ LIBTCCAPI int tcc_add_file(TCCState *s, const char *filename)
         return tcc_add_file_internal(s, filename, AFF_PRINT_ERROR);
 }
 
+LIBTCCAPI void tcc_set_reloc_func(TCCState *s, void *reloc_opaque,
+    void (*reloc_func)(void *opaque, int type, unsigned long addr, unsigned long val))
+{
+    s->reloc_opaque = reloc_opaque;
+    s->reloc_func = reloc_func;
+}
+
 LIBTCCAPI int tcc_add_library_path(TCCState *s, const char *pathname)
 {
     tcc_split_path(s, (void ***)&s->library_paths, &s->nb_library_paths, pathname);
@@ -1913,6 +1920,8 @@ PUB_FUNC int tcc_parse_args(TCCState *s, int argc, char **argv)
             printf ("%s\n", TCC_VERSION);
             exit(0);
         case TCC_OPTION_O:
+            s->optimize = isnum(*optarg) ? atoi(optarg) : 1;
+            break;
         case TCC_OPTION_pedantic:
         case TCC_OPTION_pipe:
         case TCC_OPTION_s:
@@ -93,6 +93,12 @@ LIBTCCAPI int tcc_relocate(TCCState *s1, void *ptr);
 /* return symbol value or NULL if not found */
 LIBTCCAPI void *tcc_get_symbol(TCCState *s, const char *name);
 
+/* set a callback invoked by tcc_relocate() for every relocation it applies
+   (type is the ELF relocation type, addr the patched address at the final
+   location, val the resolved symbol value) */
+LIBTCCAPI void tcc_set_reloc_func(TCCState *s, void *reloc_opaque,
+    void (*reloc_func)(void *opaque, int type, unsigned long addr, unsigned long val));
+
 #ifdef __cplusplus
 }
 #endif
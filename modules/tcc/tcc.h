@@ -538,6 +538,8 @@ struct TCCState {
 
     /* compile with debug symbol (and use them if error during execution) */
     int do_debug;
+    /* -O level; only used by the ARM code generator */
+    int optimize;
 #ifdef CONFIG_TCC_BCHECK
     /* compile with built-in memory and bounds checker */
     int do_bounds_check;
@@ -660,6 +662,10 @@ struct TCCState {
 # endif
 #endif
 
+    /* relocation callback (see tcc_set_reloc_func) */
+    void *reloc_opaque;
+    void (*reloc_func)(void *opaque, int type, unsigned long addr, unsigned long val);
+
     /* used by main and tcc_parse_args only */
     char **files; /* files seen on command line */
     int nb_files; /* number thereof */
@@ -1302,6 +1308,7 @@ ST_FUNC void gen_opl(int op);
 #ifdef TCC_TARGET_ARM
 ST_FUNC void arm_init_types(void);
 ST_FUNC uint32_t encbranch(int pos, int addr, int fail);
+ST_FUNC void gen_label(void);
 ST_FUNC void gen_cvt_itof1(int t);
 #endif
 
@@ -537,6 +537,9 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
         type = ELFW(R_TYPE)(rel->r_info);
         addr = s->sh_addr + rel->r_offset;
 
+        if (s1->reloc_func)
+            s1->reloc_func(s1->reloc_opaque, type, addr, val);
+
         /* CPU specific */
         switch(type) {
 #if defined(TCC_TARGET_I386)
@@ -4357,7 +4357,16 @@ static void label_or_decl(int l)
     decl(l);
 }
 
-static void block(int *bsym, int *csym, int *case_sym, int *def_sym, 
+/* current code address, to be used as the target of later jumps */
+static int gind(void)
+{
+#ifdef TCC_TARGET_ARM
+    gen_label();
+#endif
+    return ind;
+}
+
+static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
                   int case_reg, int is_expr)
 {
     int a, b, c, d;
@@ -4396,7 +4405,7 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
             gsym(a);
     } else if (tok == TOK_WHILE) {
         next();
-        d = ind;
+        d = gind();
         skip('(');
         gexpr();
         skip(')');
@@ -4540,8 +4549,8 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
             }
         }
         skip(';');
-        d = ind;
-        c = ind;
+        d = gind();
+        c = d;
         a = 0;
         b = 0;
         if (tok != ';') {
@@ -4551,7 +4560,7 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
         skip(';');
         if (tok != ')') {
             e = gjmp(0);
-            c = ind;
+            c = gind();
             gexpr();
             vpop();
             gjmp_addr(d);
@@ -4569,7 +4578,7 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
         next();
         a = 0;
         b = 0;
-        d = ind;
+        d = gind();
         block(&a, &b, case_sym, def_sym, case_reg, 0);
         skip(TOK_WHILE);
         skip('(');
@@ -4595,7 +4604,7 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
         block(&a, csym, &b, &c, case_reg, 0);
         /* if no default, jmp after switch */
         if (c == 0)
-            c = ind;
+            c = gind();
         /* default label */
         gsym_addr(b, c);
         /* break label */
@@ -4642,7 +4651,7 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
             expect("switch");
         if (*def_sym)
             tcc_error("too many 'default'");
-        *def_sym = ind;
+        *def_sym = gind();
         is_expr = 0;
         goto block_after_label;
     } else
@@ -4689,7 +4698,7 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
             } else {
                 s = label_push(&global_label_stack, b, LABEL_DEFINED);
             }
-            s->jnext = ind;
+            s->jnext = gind();
             /* we accept this, but it is a mistake */
         block_after_label:
             if (tok == '}') {
@@ -0,0 +1,6 @@
+/* ARM register cache (-O): the constant is loaded from the literal pool
+   once, the second use takes it from the register it was loaded into */
+int literal_reuse(int a)
+{
+    return (a + 0x12345678) ^ 0x12345678;
+}
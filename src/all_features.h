@@ -296,6 +296,7 @@
     #define FEATURE_DONT_CLICK_ME
 
     #define FEATURE_SHOW_TASKS
+    #define FEATURE_SHOW_PROP_STATS
     #define FEATURE_SHOW_CPU_USAGE
     #define FEATURE_SHOW_GUI_EVENTS
 
@@ -297,6 +297,27 @@ int bmp_strlen_clipped(int fontspec, const char* str, int maxwidth)
     return rbf_strlen_clipped((void*)font_dynamic[FONT_ID(fontspec)].bitmap, str, maxwidth);
 }
 
+struct bmp_text * bmp_text_render(uint32_t fontspec, const char* str)
+{
+    uint32_t fg_color = fontspec_fg( fontspec );
+    uint32_t bg_color = fontspec_bg( fontspec );
+    return rbf_render_string((void*)font_dynamic[FONT_ID(fontspec)].bitmap, str, FONT(fontspec, fg_color, bg_color));
+}
+
+void bmp_text_draw(struct bmp_text * text, int x, int y)
+{
+    x = COERCE(x, BMP_W_MINUS, BMP_W_PLUS);
+    y = COERCE(y, BMP_H_MINUS, BMP_H_PLUS);
+    rbf_draw_text(text, x, y);
+}
+
+void bmp_text_free(struct bmp_text * text)
+{
+    if (!text) return;
+    free(text->pix);
+    free(text);
+}
+
 #ifdef CONFIG_HEXDUMP
 
 static void bmp_puts_diff(uint32_t font_normal, uint32_t font_highlight, int x, int y, char* msg, char* old_msg)
@@ -961,6 +982,68 @@ static uint8_t* bfnt_find_char(int code)
     return 0;
 }
 
+/* expand a Canon font character into a (cached) glyph; only foreground pixels are opaque */
+/* g->ch and g->fg must be set; scratch (optional): where to render it if it can't be cached */
+int bfnt_render_glyph(struct glyph * g, uint8_t * scratch)
+{
+    g->font = 0;
+    g->bg = NO_BG_ERASE;
+    g->flags = GLYPH_BFNT;
+
+    if (glyph_cache_lookup(g))
+    {
+        return 1;
+    }
+
+    if (!bfnt_ok())
+    {
+        return 0;
+    }
+
+    uint16_t* chardata = (uint16_t*) bfnt_find_char(g->ch);
+    if (!chardata) return 0;
+    uint8_t* buff = (uint8_t*)(chardata + 5);
+
+    int cw  = chardata[0]; // the stored bitmap width
+    int ch  = chardata[1]; // the stored bitmap height
+    int crw = chardata[2]; // the displayed character width
+    int xo  = chardata[3]; // X offset for displaying the bitmap
+    int yo  = chardata[4]; // Y offset for displaying the bitmap
+    int bb  = cw / 8 + (cw % 8 == 0 ? 0 : 1); // calculate the byte number per line
+
+    if (crw+xo > 100) return 0;
+    if (ch+yo > 50) return 0;
+
+    g->w = cw;
+    g->h = ch;
+    g->xo = xo;
+    g->yo = yo;
+
+    int cached = glyph_cache_reserve(g, 1);
+    if (!cached)
+    {
+        if (!scratch) return 0;
+        g->pix = scratch;
+        g->mask = scratch + cw * ch;
+    }
+
+    for (int i = 0; i < ch; i++)
+    {
+        for (int k = 0; k < cw; k++)
+        {
+            int px = buff[i*bb + k/8] & (1 << (7 - k%8));
+            g->pix[i*cw + k] = px ? g->fg : 0;
+            g->mask[i*cw + k] = px ? 0xFF : 0;
+        }
+    }
+
+    if (cached)
+    {
+        glyph_cache_commit(g);
+    }
+    return 1;
+}
+
 // returns width
 int bfnt_draw_char(int c, int px, int py, int fg, int bg)
 {
@@ -1001,6 +1084,15 @@ int bfnt_draw_char(int c, int px, int py, int fg, int bg)
         bmp_fill(bg, px, py, crw+xo+3, 40);
     }
 
+#ifndef CONFIG_VXWORKS
+    struct glyph g = { .ch = c, .fg = fg };
+    if (bvram && bfnt_render_glyph(&g, 0))
+    {
+        glyph_blit(bvram, px, py, &g);
+        return crw;
+    }
+#endif
+
     int i,j,k;
     for (i = 0; i < ch; i++)
     {
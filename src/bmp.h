@@ -262,6 +262,22 @@ bmp_puts(
         const char *s
 );
 
+/** Pre-rendered text: render a string once, then re-blit it as often as needed
+ * (useful for labels redrawn at every frame). Transparent pixels are kept.
+ * Only left-aligned strings are supported; '\n' starts a new line.
+ */
+struct bmp_text
+{
+    int w;
+    int h;
+    uint8_t * pix;      /* w*h pixels, 8 bpp */
+    uint8_t * mask;     /* w*h bytes, 0xFF = opaque */
+};
+
+struct bmp_text * bmp_text_render(uint32_t fontspec, const char* str);
+void bmp_text_draw(struct bmp_text * text, int x, int y);
+void bmp_text_free(struct bmp_text * text);
+
 /** Fill the screen with a bitmap palette */
 extern void
 bmp_draw_palette( void );
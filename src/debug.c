@@ -1006,6 +1006,8 @@ void menu_kill_flicker()
 
 
 extern MENU_UPDATE_FUNC(tasks_print);
+extern MENU_UPDATE_FUNC(prop_stats_print);
+extern MENU_SELECT_FUNC(prop_stats_reset);
 extern MENU_UPDATE_FUNC(batt_display);
 extern MENU_SELECT_FUNC(tasks_toggle_flags);
 
@@ -1172,6 +1174,22 @@ static struct menu_entry debug_menus[] = {
         }
     },
 #endif
+#ifdef FEATURE_SHOW_PROP_STATS
+    {
+        .name = "Show property stats",
+        .select = menu_open_submenu,
+        .help = "Which properties are fired most often by Canon firmware.",
+        .children =  (struct menu_entry[]) {
+            {
+                .name = "Property stats",
+                .update = prop_stats_print,
+                .select = prop_stats_reset,
+                .help = "Hits and handler time for each property. SET: reset counters.",
+            },
+            MENU_EOL
+        }
+    },
+#endif
 #ifdef FEATURE_SHOW_CPU_USAGE
 #ifdef CONFIG_TSKMON
     {
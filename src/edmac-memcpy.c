@@ -68,11 +68,64 @@ uint32_t edmac_memcpy_flags = EDMAC_16_BYTES_PER_TRANSFER; //Enhanced
 
 static struct LockEntry * resLock = 0;
 
+/* row size for lengths without an exact width x height split */
+#define EDMAC_COPY_ROW 1024
+
+#define EDMAC_COPY_MAX_CHANS 4
+
+/* how long a request may wait for edmac_memcpy to release the first pair (ms) */
+#define EDMAC_COPY_BORROW_TIMEOUT 10
+
+/* a queued copy; ids are (sequence << 4) | index, so a stale id never matches a reused entry */
+struct edmac_copy_job
+{
+    uint32_t id;                        /* 0 = free */
+    uint32_t done;
+    uint32_t orphan;                    /* the waiter timed out, completion releases the entry */
+    void* src;                          /* first byte of the block */
+    void* dst;
+    int src_width;
+    int dst_width;
+    int w;
+    int h;
+    edmac_copy_cbr_t cbr;
+    void* cbr_ctx;
+    struct semaphore * sem;
+    struct edmac_copy_job * next;
+};
+
+struct edmac_copy_chan
+{
+    uint32_t read_chan;
+    uint32_t write_chan;
+    uint32_t connection;
+    struct edmac_copy_job * active;
+};
+
+static struct edmac_copy_job edmac_copy_jobs[EDMAC_COPY_QUEUE];
+static struct edmac_copy_job * edmac_copy_head = 0;
+static struct edmac_copy_job * edmac_copy_tail = 0;
+static uint32_t edmac_copy_seq = 0;
+
+/* the first pair is the one from edmac_memcpy; the engine borrows it by holding edmac_memcpy_sem */
+static struct edmac_copy_chan edmac_copy_chans[EDMAC_COPY_MAX_CHANS];
+static int edmac_copy_num_chans = 1;
+static int edmac_copy_owns_first = 0;
+
 static void edmac_memcpy_init()
 {
     edmac_memcpy_sem = create_named_semaphore("edmac_memcpy_sem", 1);
     edmac_read_done_sem = create_named_semaphore("edmac_read_done_sem", 0);
     
+    edmac_copy_chans[0].read_chan = edmac_read_chan;
+    edmac_copy_chans[0].write_chan = edmac_write_chan;
+    edmac_copy_chans[0].connection = dmaConnection;
+    
+    for (int i = 0; i < COUNT(edmac_copy_jobs); i++)
+    {
+        edmac_copy_jobs[i].sem = create_named_semaphore("edmac_copy_sem", 0);
+    }
+    
     /* lookup the edmac channel indices for reslock */
     int read_edmac_index = edmac_channel_to_index(edmac_read_chan);
     int write_edmac_index = edmac_channel_to_index(edmac_write_chan);
@@ -311,11 +364,26 @@ uint32_t edmac_find_divider(size_t length, size_t transfer_size)
     return 0;
 }
 
+/* split length into a width x height block for the EDMAC and return its size; the rest is left for the CPU */
+static uint32_t edmac_find_divider_or_rows(size_t length, uint32_t * width)
+{
+    *width = edmac_find_divider(length, 0);
+    if (*width)
+    {
+        return length;
+    }
+
+    /* no exact factorization: transfer whole rows */
+    *width = EDMAC_COPY_ROW;
+    return length - length % EDMAC_COPY_ROW;
+}
+
 void* edmac_memcpy_start(void* dst, void* src, size_t length)
 {
-    int blocksize = edmac_find_divider(length, 0);
+    uint32_t blocksize = 0;
+    uint32_t body = edmac_find_divider_or_rows(length, &blocksize);
 
-    if (!blocksize)
+    if (!body)
     {
         printf("[edmac] warning: using memcpy (size=%d)\n", length);
         void * ret = memcpy(dst, src, length);
@@ -325,7 +393,13 @@ void* edmac_memcpy_start(void* dst, void* src, size_t length)
         return ret;
     }
     
-    return edmac_copy_rectangle_adv_start(dst, src, blocksize, 0, 0, blocksize, 0, 0, blocksize, length / blocksize);
+    if (body < length)
+    {
+        /* the CPU copies the tail, the EDMAC does the rest */
+        memcpy(dst + body, src + body, length - body);
+    }
+
+    return edmac_copy_rectangle_adv_start(dst, src, blocksize, 0, 0, blocksize, 0, 0, blocksize, body / blocksize);
 }
 
 void edmac_memcpy_finish()
@@ -341,6 +415,337 @@ void* edmac_memcpy(void* dst, void* src, size_t length)
     return ans;
 }
 
+static void edmac_copy_nop_cbr(void * ctx)
+{
+}
+
+static void edmac_copy_complete(struct edmac_copy_job * job)
+{
+    job->done = 1;
+
+    if (job->cbr)
+    {
+        /* nobody waits for requests with a callback */
+        job->cbr(job->id, job->cbr_ctx);
+        job->id = 0;
+    }
+    else if (job->orphan)
+    {
+        job->id = 0;
+    }
+    else
+    {
+        give_semaphore(job->sem);
+    }
+}
+
+static void edmac_copy_chan_cbr(void * ctx);
+
+/* program one channel pair with the next request; called with interrupts disabled */
+static void edmac_copy_program(struct edmac_copy_chan * chan, struct edmac_copy_job * job)
+{
+    chan->active = job;
+
+    /* the write channel finishing means the data is in RAM */
+    RegisterEDmacCompleteCBR(chan->read_chan, &edmac_copy_nop_cbr, 0);
+    RegisterEDmacAbortCBR(chan->read_chan, &edmac_copy_nop_cbr, 0);
+    RegisterEDmacPopCBR(chan->read_chan, &edmac_copy_nop_cbr, 0);
+    RegisterEDmacCompleteCBR(chan->write_chan, &edmac_copy_chan_cbr, chan);
+    RegisterEDmacAbortCBR(chan->write_chan, &edmac_copy_chan_cbr, chan);
+    RegisterEDmacPopCBR(chan->write_chan, &edmac_copy_chan_cbr, chan);
+
+    ConnectWriteEDmac(chan->write_chan, chan->connection);
+    ConnectReadEDmac(chan->read_chan, chan->connection);
+
+    struct edmac_info src_edmac_info = {
+        .xb = job->w,
+        .yb = job->h - 1,
+        .off1b = job->src_width - job->w,
+    };
+
+    struct edmac_info dst_edmac_info = {
+        .xb = job->w,
+        .yb = job->h - 1,
+        .off1b = job->dst_width - job->w,
+    };
+
+    SetEDmac(chan->read_chan, (void*)((uint32_t)job->src & 0x1FFFFFFF), &src_edmac_info, edmac_memcpy_flags);
+    SetEDmac(chan->write_chan, (void*)((uint32_t)job->dst & 0x1FFFFFFF), &dst_edmac_info, edmac_memcpy_flags);
+
+    StartEDmac(chan->write_chan, 0);
+    StartEDmac(chan->read_chan, 2);
+}
+
+/* hand queued requests to idle channel pairs; called with interrupts disabled */
+static void edmac_copy_dispatch()
+{
+    for (int i = 0; i < edmac_copy_num_chans && edmac_copy_head; i++)
+    {
+        struct edmac_copy_chan * chan = &edmac_copy_chans[i];
+
+        if (chan->active || (i == 0 && !edmac_copy_owns_first))
+        {
+            continue;
+        }
+
+        struct edmac_copy_job * job = edmac_copy_head;
+        edmac_copy_head = job->next;
+        if (!edmac_copy_head)
+        {
+            edmac_copy_tail = 0;
+        }
+
+        edmac_copy_program(chan, job);
+    }
+
+    /* give the first pair back to edmac_memcpy users when we no longer need it */
+    if (edmac_copy_owns_first && !edmac_copy_chans[0].active)
+    {
+        UnregisterEDmacCompleteCBR(edmac_read_chan);
+        UnregisterEDmacAbortCBR(edmac_read_chan);
+        UnregisterEDmacPopCBR(edmac_read_chan);
+        UnregisterEDmacCompleteCBR(edmac_write_chan);
+        UnregisterEDmacAbortCBR(edmac_write_chan);
+        UnregisterEDmacPopCBR(edmac_write_chan);
+
+        edmac_copy_owns_first = 0;
+        give_semaphore(edmac_memcpy_sem);
+    }
+}
+
+static void edmac_copy_chan_cbr(void * ctx)
+{
+    struct edmac_copy_chan * chan = ctx;
+
+    uint32_t old = cli();
+    struct edmac_copy_job * job = chan->active;
+    chan->active = 0;
+
+    /* complete, abort and pop may all fire for the same transfer */
+    if (job)
+    {
+        edmac_copy_complete(job);
+    }
+
+    edmac_copy_dispatch();
+    sei(old);
+}
+
+/* remove a request that was not started yet; called with interrupts disabled */
+static int edmac_copy_unqueue(struct edmac_copy_job * job)
+{
+    struct edmac_copy_job * prev = 0;
+
+    for (struct edmac_copy_job * j = edmac_copy_head; j; prev = j, j = j->next)
+    {
+        if (j == job)
+        {
+            if (prev)
+            {
+                prev->next = job->next;
+            }
+            else
+            {
+                edmac_copy_head = job->next;
+            }
+
+            if (edmac_copy_tail == job)
+            {
+                edmac_copy_tail = prev;
+            }
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static uint32_t edmac_copy_submit(void* dst, void* src, int src_width, int dst_width, int w, int h, edmac_copy_cbr_t cbr, void* ctx)
+{
+    struct edmac_copy_job * job = 0;
+    uint32_t id = 0;
+
+    uint32_t old = cli();
+    for (int i = 0; i < COUNT(edmac_copy_jobs); i++)
+    {
+        if (!edmac_copy_jobs[i].id)
+        {
+            job = &edmac_copy_jobs[i];
+            edmac_copy_seq++;
+            id = (edmac_copy_seq << 4) | i;
+            job->id = id;
+            break;
+        }
+    }
+    sei(old);
+
+    if (!job)
+    {
+        return 0;
+    }
+
+    job->done = 0;
+    job->orphan = 0;
+    job->src = src;
+    job->dst = dst;
+    job->src_width = src_width;
+    job->dst_width = dst_width;
+    job->w = w;
+    job->h = h;
+    job->cbr = cbr;
+    job->cbr_ctx = ctx;
+    job->next = 0;
+
+    if (!w || !h)
+    {
+        /* everything was done by the CPU; cbr runs right here, from the caller's task */
+        old = cli();
+        edmac_copy_complete(job);
+        sei(old);
+        return id;
+    }
+
+    /* clean the cache before reading from regular (cacheable) memory */
+    if (src == CACHEABLE(src))
+    {
+        sync_caches();
+    }
+
+    old = cli();
+    if (edmac_copy_tail)
+    {
+        edmac_copy_tail->next = job;
+    }
+    else
+    {
+        edmac_copy_head = job;
+    }
+    edmac_copy_tail = job;
+    edmac_copy_dispatch();
+    int need_first = edmac_copy_head && !edmac_copy_owns_first;
+    sei(old);
+
+    if (need_first)
+    {
+        /* still queued: borrow the edmac_memcpy pair; if edmac_memcpy keeps it busy,
+         * don't block the caller (it may be a vsync hook), let it do the copy instead */
+        int borrowed = !take_semaphore(edmac_memcpy_sem, EDMAC_COPY_BORROW_TIMEOUT);
+        old = cli();
+        if (borrowed)
+        {
+            edmac_copy_owns_first = 1;
+            edmac_copy_dispatch();
+        }
+        else if (!edmac_copy_owns_first && edmac_copy_unqueue(job))
+        {
+            /* nobody will run it */
+            job->id = 0;
+            id = 0;
+        }
+        sei(old);
+    }
+
+    return id;
+}
+
+uint32_t edmac_copy_rectangle_queue(void* dst, void* src, int src_width, int src_x, int src_y, int dst_width, int dst_x, int dst_y, int w, int h, edmac_copy_cbr_t cbr, void* ctx)
+{
+    /* make sure we are writing to uncacheable memory */
+    ASSERT(dst == UNCACHEABLE(dst));
+
+    src += src_x + src_y * src_width;
+    dst += dst_x + dst_y * dst_width;
+
+    /* w * h must be mod bytes per transfer (see edmac_copy_rectangle_cbr_start);
+     * if not, the EDMAC copies the columns it can, and the CPU does the rest */
+    uint32_t bpt = edmac_bytes_per_transfer(edmac_memcpy_flags);
+    int w_dma = ((w * h) % bpt) ? w - w % bpt : w;
+
+    if (w_dma < w)
+    {
+        for (int y = 0; y < h; y++)
+        {
+            memcpy(dst + y * dst_width + w_dma, src + y * src_width + w_dma, w - w_dma);
+        }
+    }
+
+    return edmac_copy_submit(dst, src, src_width, dst_width, w_dma, h, cbr, ctx);
+}
+
+uint32_t edmac_copy_queue(void* dst, void* src, size_t length, edmac_copy_cbr_t cbr, void* ctx)
+{
+    uint32_t width = 0;
+    uint32_t body = 0;
+
+    /* small copies are faster on the CPU */
+    if (length >= EDMAC_COPY_ROW)
+    {
+        body = edmac_find_divider_or_rows(length, &width);
+    }
+
+    if (body < length)
+    {
+        memcpy(dst + body, src + body, length - body);
+    }
+
+    return edmac_copy_rectangle_queue(dst, src, width, 0, 0, width, 0, 0, width, width ? body / width : 0, cbr, ctx);
+}
+
+int edmac_copy_wait(uint32_t id, int timeout)
+{
+    struct edmac_copy_job * job = &edmac_copy_jobs[id & 0x0F];
+
+    if (!id || job->id != id || job->cbr)
+    {
+        return -1;
+    }
+
+    if (take_semaphore(job->sem, timeout))
+    {
+        uint32_t old = cli();
+        int done = job->done;
+        if (!done)
+        {
+            job->orphan = 1;
+        }
+        sei(old);
+
+        if (!done)
+        {
+            return -1;
+        }
+
+        /* completed right after the timeout, consume its semaphore */
+        take_semaphore(job->sem, 0);
+    }
+
+    job->id = 0;
+    return 0;
+}
+
+int edmac_copy_add_channels(uint32_t read_chan, uint32_t write_chan, uint32_t connection)
+{
+    if (edmac_copy_num_chans >= EDMAC_COPY_MAX_CHANS ||
+        edmac_get_dir(read_chan) != EDMAC_DIR_READ ||
+        edmac_get_dir(write_chan) != EDMAC_DIR_WRITE)
+    {
+        return -1;
+    }
+
+    struct edmac_copy_chan * chan = &edmac_copy_chans[edmac_copy_num_chans];
+    chan->read_chan = read_chan;
+    chan->write_chan = write_chan;
+    chan->connection = connection;
+    chan->active = 0;
+
+    uint32_t old = cli();
+    edmac_copy_num_chans++;
+    edmac_copy_dispatch();
+    sei(old);
+
+    return 0;
+}
+
 #endif
 
 /** this method bypasses Canon's lv_save_raw and slurps the raw data directly from connection #0 */
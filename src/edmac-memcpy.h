@@ -23,6 +23,25 @@ void edmac_copy_rectangle_adv_cleanup();
 void edmac_memcpy_finish();
 void edmac_copy_rectangle_finish();
 
+/* asynchronous copy engine
+ * requests are queued and run on the free EDMAC channel pairs; sizes the EDMAC can't handle
+ * are split into a DMA body and a tail copied by the CPU right away. dst must be uncacheable.
+ * on completion, cbr is called from interrupt context and the request id is released;
+ * if the CPU did the whole copy, cbr is called before returning, from the caller's task
+ * with interrupts disabled. without cbr, the caller must collect the request with edmac_copy_wait.
+ * return a request id, or 0 if the queue is full or no channel pair is available
+ * (the caller should then copy the data by itself) */
+typedef void (*edmac_copy_cbr_t)(uint32_t id, void* ctx);
+#define EDMAC_COPY_QUEUE 16
+uint32_t edmac_copy_queue(void* dst, void* src, size_t length, edmac_copy_cbr_t cbr, void* ctx);
+uint32_t edmac_copy_rectangle_queue(void* dst, void* src, int src_width, int src_x, int src_y, int dst_width, int dst_x, int dst_y, int w, int h, edmac_copy_cbr_t cbr, void* ctx);
+
+/* wait for a request queued without callback (timeout in ms, 0 = forever); 0 on success */
+int edmac_copy_wait(uint32_t id, int timeout);
+
+/* give the engine another read/write channel pair, connected through the given service; 0 on success */
+int edmac_copy_add_channels(uint32_t read_chan, uint32_t write_chan, uint32_t connection);
+
 /* Lock/unlock engine resources used by edmac_memcpy (only if ported for your camera) */
 void edmac_memcpy_res_lock();
 void edmac_memcpy_res_unlock();
@@ -226,6 +226,7 @@ static void config_menu_reload_flags();
 static int guess_submenu_enabled(struct menu_entry * entry);
 static void menu_draw_icon(int x, int y, int type, intptr_t arg, int warn); // private
 static struct menu_entry * entry_find_by_name(const char* name, const char* entry_name);
+static struct menu_entry * entry_find_by_name_internal(const char* name, const char* entry_name);
 static struct menu_entry * get_selected_menu_entry(struct menu * menu);
 static void submenu_display(struct menu * submenu);
 static void start_redraw_flood();
@@ -447,6 +448,225 @@ struct menu * menu_get_root() {
   return menus;
 }
 
+/* Name lookup index
+ * =================
+ * Menus and menu entries are looked up by name very often
+ * (Lua scripts, menu config files, module menus, duplicate check at startup),
+ * so besides the linked lists, we keep two hash tables (open addressing):
+ * - menus by name: updated when a menu is created (menus are never removed)
+ * - entries by (menu name, entry name): rebuilt lazily after menu_add / menu_remove
+ * Lookups always check the names again, so a stale slot is never trusted.
+ */
+
+struct name_index_slot
+{
+    uint32_t hash;
+    void * item;                /* struct menu * or struct menu_entry * */
+    int count;                  /* how many entries have this name (duplicates) */
+};
+
+struct name_index
+{
+    struct name_index_slot * slots;
+    int size;                   /* power of 2, or 0 if not allocated */
+    int used;
+};
+
+static struct name_index menu_index = {0};
+static struct name_index entry_index = {0};
+static int entry_index_dirty = 1;
+
+/* FNV-1a */
+static uint32_t name_hash(uint32_t h, const char * name)
+{
+    while (*name)
+    {
+        h ^= (uint8_t) *name++;
+        h *= 16777619;
+    }
+    return h;
+}
+
+#define NAME_HASH_INIT 2166136261u
+
+static uint32_t entry_name_hash(const char * menu_name, const char * entry_name)
+{
+    uint32_t h = name_hash(NAME_HASH_INIT, menu_name);
+    h = name_hash(h ^ '\\', entry_name);
+    return h;
+}
+
+/* make room for at least 'items' items (load factor <= 1/2); clears the index */
+static int name_index_alloc(struct name_index * index, int items)
+{
+    int size = 64;
+    while (size < items * 2)
+    {
+        size *= 2;
+    }
+
+    if (size > index->size)
+    {
+        struct name_index_slot * slots = malloc(size * sizeof(slots[0]));
+        if (!slots)
+        {
+            return 0;
+        }
+        if (index->slots) free(index->slots);
+        index->slots = slots;
+        index->size = size;
+    }
+
+    memset(index->slots, 0, index->size * sizeof(index->slots[0]));
+    index->used = 0;
+    return 1;
+}
+
+static struct name_index_slot * menu_index_slot(const char * name, uint32_t hash)
+{
+    int mask = menu_index.size - 1;
+    for (int i = hash & mask; ; i = (i + 1) & mask)
+    {
+        struct name_index_slot * slot = &menu_index.slots[i];
+        if (!slot->item)
+        {
+            return slot;
+        }
+        if (slot->hash == hash && streq(((struct menu *) slot->item)->name, name))
+        {
+            return slot;
+        }
+    }
+}
+
+static REQUIRES(menu_sem)
+void menu_index_add(struct menu * menu)
+{
+    if ((menu_index.used + 1) * 2 > menu_index.size)
+    {
+        /* grow and re-insert all menus (including the new one, already linked) */
+        int count = 0;
+        for (struct menu * m = menus; m; m = m->next)
+        {
+            count++;
+        }
+
+        if (!name_index_alloc(&menu_index, count * 2))
+        {
+            return;
+        }
+
+        for (struct menu * m = menus; m; m = m->next)
+        {
+            uint32_t hash = name_hash(NAME_HASH_INIT, m->name);
+            struct name_index_slot * slot = menu_index_slot(m->name, hash);
+            if (!slot->item)
+            {
+                slot->hash = hash;
+                slot->item = m;
+                slot->count = 1;
+                menu_index.used++;
+            }
+        }
+        return;
+    }
+
+    uint32_t hash = name_hash(NAME_HASH_INIT, menu->name);
+    struct name_index_slot * slot = menu_index_slot(menu->name, hash);
+    if (!slot->item)
+    {
+        slot->hash = hash;
+        slot->item = menu;
+        slot->count = 1;
+        menu_index.used++;
+    }
+}
+
+static REQUIRES(menu_sem)
+struct menu * menu_index_find(const char * name)
+{
+    if (!menu_index.size)
+    {
+        return 0;
+    }
+
+    struct name_index_slot * slot = menu_index_slot(name, name_hash(NAME_HASH_INIT, name));
+    return slot->item;
+}
+
+static int entry_matches(struct menu_entry * entry, const char * menu_name, const char * entry_name)
+{
+    return entry->parent_menu && streq(entry->name, entry_name) && streq(entry->parent_menu->name, menu_name);
+}
+
+static struct name_index_slot * entry_index_slot(const char * menu_name, const char * entry_name, uint32_t hash)
+{
+    int mask = entry_index.size - 1;
+    for (int i = hash & mask; ; i = (i + 1) & mask)
+    {
+        struct name_index_slot * slot = &entry_index.slots[i];
+        if (!slot->item)
+        {
+            return slot;
+        }
+        if (slot->hash == hash && entry_matches(slot->item, menu_name, entry_name))
+        {
+            return slot;
+        }
+    }
+}
+
+/* walks the whole menu tree */
+static REQUIRES(menu_sem)
+void entry_index_rebuild()
+{
+    int count = 0;
+    for (struct menu * menu = menus; menu; menu = menu->next)
+    {
+        for (struct menu_entry * entry = menu->children; entry; entry = entry->next)
+        {
+            count++;
+        }
+    }
+
+    if (!name_index_alloc(&entry_index, count))
+    {
+        /* lookups will fall back to the linear search */
+        entry_index.size = 0;
+        return;
+    }
+
+    for (struct menu * menu = menus; menu; menu = menu->next)
+    {
+        /* special menus are not looked up by name, and their contents change often */
+        if (menu->no_name_lookup)
+            continue;
+
+        for (struct menu_entry * entry = menu->children; entry; entry = entry->next)
+        {
+            /* skip placeholders */
+            if (MENU_IS_PLACEHOLDER(entry))
+                continue;
+
+            uint32_t hash = entry_name_hash(menu->name, entry->name);
+            struct name_index_slot * slot = entry_index_slot(menu->name, entry->name, hash);
+            if (slot->item)
+            {
+                slot->count++;
+            }
+            else
+            {
+                slot->hash = hash;
+                slot->item = entry;
+                slot->count = 1;
+                entry_index.used++;
+            }
+        }
+    }
+
+    entry_index_dirty = 0;
+}
+
 // 1-2-5 series - https://en.wikipedia.org/wiki/Preferred_number#1-2-5_series
 static int round_to_125(int val)
 {
@@ -1013,13 +1233,20 @@ struct menu * menu_find_by_name_internal(
 {
     ASSERT(name);
 
-    struct menu * menu = menus;
+    struct menu * menu = menu_index_find(name);
 
-    for( ; menu ; menu = menu->next )
+    if (menu)
+    {
+        if (icon && !menu->icon) menu->icon = icon;
+        return menu;
+    }
+
+    for( menu = menus ; menu ; menu = menu->next )
     {
         ASSERT(menu->name);
         if( streq( menu->name, name ) )
         {
+            /* not indexed? (out of memory) */
             if (icon && !menu->icon) menu->icon = icon;
             return menu;
         }
@@ -1055,6 +1282,8 @@ struct menu * menu_find_by_name_internal(
         new_menu->selected  = 1;
     }
 
+    menu_index_add(new_menu);
+
     return new_menu;
 }
 
@@ -1299,6 +1528,7 @@ void menu_add_internal(
 
     menu_flags_load_dirty = 1;
     duplicate_check_dirty = 1;
+    entry_index_dirty = 1;
     
     int count0 = count; // for submenus
 
@@ -1409,6 +1639,8 @@ void menu_add(
 
 static void menu_remove_entry(struct menu * menu, struct menu_entry * entry)
 {
+    entry_index_dirty = 1;
+
     if (entry == entry_being_updated)
     {
         entry_removed_itself = 1;
@@ -1534,7 +1766,7 @@ static void menu_update_usage_counters(struct menu_entry * entry)
     {
         /* not at home? use original entry */
         /* fixme: remove the lookup */
-        entry = entry_find_by_name(entry->parent_menu->name, entry->name);
+        entry = entry_find_by_name_internal(entry->parent_menu->name, entry->name);
         if (!entry) goto end;
     }
 
@@ -5880,13 +6112,10 @@ void select_menu_by_name(char* name, const char* entry_name)
     give_semaphore(menu_sem);
 }
 
-static struct menu_entry * entry_find_by_name(const char* menu_name, const char* entry_name)
+/* linear search; used if the name index is not available */
+static REQUIRES(menu_sem)
+struct menu_entry * entry_find_by_name_slow(const char* menu_name, const char* entry_name)
 {
-    if (!menu_name || !entry_name)
-    {
-        return 0;
-    }
-
     struct menu_entry * ans = 0;
     int count = 0;
 
@@ -5923,6 +6152,68 @@ static struct menu_entry * entry_find_by_name(const char* menu_name, const char*
     return ans;
 }
 
+static REQUIRES(menu_sem)
+struct menu_entry * entry_find_by_name_internal(const char* menu_name, const char* entry_name)
+{
+    if (!menu_name || !entry_name)
+    {
+        return 0;
+    }
+
+    struct menu_entry * ans = 0;
+    int count = 0;
+    uint32_t hash = entry_name_hash(menu_name, entry_name);
+
+    for (int retry = 0; retry < 2; retry++)
+    {
+        if (entry_index_dirty)
+        {
+            entry_index_rebuild();
+        }
+
+        if (!entry_index.size)
+        {
+            return entry_find_by_name_slow(menu_name, entry_name);
+        }
+
+        struct name_index_slot * slot = entry_index_slot(menu_name, entry_name, hash);
+        ans = slot->item;
+        count = slot->count;
+
+        if (ans && MENU_IS_PLACEHOLDER(ans))
+        {
+            /* changed since the index was built? */
+            entry_index_dirty = 1;
+            continue;
+        }
+
+        break;
+    }
+
+    if (ans && ans->parent_menu->no_name_lookup)
+    {
+        return 0;
+    }
+
+    if (count > 1)
+    {
+        console_show();
+        printf("Duplicate menu: %s -> %s (%d)\n", menu_name, entry_name, count);
+        return 0;
+    }
+
+    return ans;
+}
+
+static EXCLUDES(menu_sem)
+struct menu_entry * entry_find_by_name(const char* menu_name, const char* entry_name)
+{
+    take_semaphore(menu_sem, 0);
+    struct menu_entry * ans = entry_find_by_name_internal(menu_name, entry_name);
+    give_semaphore(menu_sem);
+    return ans;
+}
+
 static EXCLUDES(menu_sem)
 void select_menu_by_icon(int icon)
 {
@@ -6591,9 +6882,10 @@ int menu_get_value_from_script(const char* name, const char* entry_name)
 }
 
 /* not thread-safe */
-static char* menu_get_str_value_from_script_do(const char* name, const char* entry_name, struct menu_display_info * info)
+static REQUIRES(menu_sem)
+char* menu_get_str_value_from_script_do(const char* name, const char* entry_name, struct menu_display_info * info)
 {
-    struct menu_entry * entry = entry_find_by_name(name, entry_name);
+    struct menu_entry * entry = entry_find_by_name_internal(name, entry_name);
     if (!entry)
     {
         printf("Menu not found: %s -> %s\n", name, entry_name);
@@ -6893,7 +7185,7 @@ void run_in_separate_task(void* routine, int argument)
     task_create("run_test", 0x1a, 0x8000, task_without_powersave, cbr);
 }
 
-/* fixme: may be slow on large menus */
+/* note: entry_find_by_name uses the name index, so this check is linear in the number of entries */
 static void check_duplicate_entries()
 {
     duplicate_check_dirty = 0;
@@ -38,11 +38,19 @@ uint32_t ml_rpc_available_cached = 0;
 static uint32_t ret_parm1 = 0;
 static uint32_t ret_parm2 = 0;
 static uint32_t ret_parm3 = 0;
+
+/* given by the RPC handler on every message from master */
+static struct semaphore *ml_rpc_reply_sem = 0;
+
+/* master's bulk receive buffer, as reported by ML_RPC_BUFFER */
+static uint32_t ml_rpc_master_buf = 0;
+static uint32_t ml_rpc_master_buf_size = 0;
+static uint32_t ml_rpc_master_buf_queried = 0;
+#else
+/* slave writes larger payloads here with BulkOutIPCTransfer, then sends a command that uses them;
+ * it's a DMA target, so it must not share cache lines with anything else (512 bytes, line-aligned) */
+static uint32_t ml_rpc_bulk_buf[0x80] __attribute__((aligned(32)));
 #endif
-static uint32_t ml_rpc_read_addr = 0;
-static uint32_t ml_rpc_read_remain = 0;
-static uint32_t ml_rpc_read_pos = 0;
-static uint32_t *ml_rpc_read_buf = 0;
 
 ml_rpc_request_t ml_rpc_buffer;
 
@@ -57,6 +65,24 @@ uint32_t ml_rpc_call(uint32_t address, uint32_t arg0, uint32_t arg1)
     return 0;
 }
 
+#ifndef CONFIG_7D_MASTER
+/* wait up to n*50ms for the handler to receive a response */
+static void ml_rpc_wait_reply(uint32_t wait)
+{
+    int deadline = get_ms_clock() + wait * 50;
+    
+    /* replies to earlier requests that timed out may have left the semaphore given; they did not set ml_rpc_transferred for us */
+    while(wait && (ml_rpc_transferred == 0))
+    {
+        int remaining = deadline - get_ms_clock();
+        if(remaining <= 0 || take_semaphore(ml_rpc_reply_sem, remaining))
+        {
+            break;
+        }
+    }
+}
+#endif
+
 /* send a command with parameters to other digic. wait n*50ms for a response */
 uint32_t ml_rpc_send(uint32_t command, uint32_t parm1, uint32_t parm2, uint32_t parm3, uint32_t wait)
 {
@@ -77,11 +103,7 @@ uint32_t ml_rpc_send(uint32_t command, uint32_t parm1, uint32_t parm2, uint32_t
     RequestRPC(ML_RPC_ID_MASTER, &ml_rpc_buffer, sizeof(ml_rpc_request_t), 0, 0);
     
     /* now wait until we get some response */
-    while(wait && (ml_rpc_transferred == 0))
-    {
-        msleep(50);
-        wait--;
-    }
+    ml_rpc_wait_reply(wait);
 #endif
     
     return ml_rpc_transferred;
@@ -106,11 +128,7 @@ uint32_t ml_rpc_send_recv(uint32_t command, uint32_t *parm1, uint32_t *parm2, ui
     RequestRPC(ML_RPC_ID_MASTER, &ml_rpc_buffer, sizeof(ml_rpc_request_t), 0, 0);
     
     /* now wait until we get some response */
-    while(wait && (ml_rpc_transferred == 0))
-    {
-        msleep(50);
-        wait--;
-    }
+    ml_rpc_wait_reply(wait);
     *parm1 = ret_parm1;
     *parm2 = ret_parm2;
     *parm3 = ret_parm3;
@@ -119,36 +137,6 @@ uint32_t ml_rpc_send_recv(uint32_t command, uint32_t *parm1, uint32_t *parm2, ui
     return ml_rpc_transferred;
 }
 
-/* read from other digic (bad performance!!) */
-uint32_t ml_rpc_readmem(uint32_t address, uint32_t length, uint8_t *buffer)
-{
-    uint32_t wait = (length / 4) * 50;
-    
-    /* reset flag that signals transfer and contains result */
-    ml_rpc_transferred = 0;
-    
-    ml_rpc_read_remain = length;
-    ml_rpc_read_addr = address;
-    ml_rpc_read_buf = (uint32_t *)buffer;
-    ml_rpc_read_pos = 0;
-    
-    /* build buffer to send */
-    ml_rpc_buffer.message = ML_RPC_READ;
-    ml_rpc_buffer.parm1 = ml_rpc_read_addr;
-    ml_rpc_buffer.parm2 = ml_rpc_read_addr + 4;
-    
-    RequestRPC(ML_RPC_ID_MASTER, &ml_rpc_buffer, sizeof(ml_rpc_request_t), 0, 0);
-    
-    /* now wait until we get some response */
-    while(wait && ml_rpc_read_remain)
-    {
-        msleep(50);
-        wait--;
-    }
-    
-    return wait > 0;
-}
-
 uint32_t ml_rpc_available()
 {
     if(ml_rpc_available_cached)
@@ -185,9 +173,224 @@ uint32_t ml_rpc_handler_vignetting(uint8_t *buffer, uint32_t length)
 
 #else
 
+uint32_t BulkOutIPCTransfer(int type, uint8_t *buffer, int length, uint32_t master_addr, void (*cb)(uint32_t, uint32_t, uint32_t), uint32_t cb_parm);
+uint32_t BulkInIPCTransfer(int type, uint8_t *buffer, int length, uint32_t master_addr, void (*cb)(uint32_t, uint32_t, uint32_t), uint32_t cb_parm);
+
+/* one in-flight bulk transfer. ids are (sequence << 4) | slot, so a stale id never matches a reused slot */
+struct ml_rpc_bulk
+{
+    uint32_t id;                /* 0 = free */
+    uint32_t done;              /* set by the completion callback */
+    uint32_t orphan;            /* the waiter timed out, the callback releases the slot */
+    ml_rpc_bulk_cbr_t cbr;
+    void *ctx;
+    struct semaphore *sem;
+};
+
+static struct ml_rpc_bulk ml_rpc_bulk_slots[ML_RPC_BULK_SLOTS];
+static uint32_t ml_rpc_bulk_seq = 0;
+
+static void ml_rpc_bulk_cb(uint32_t parm, uint32_t address, uint32_t length)
+{
+    struct ml_rpc_bulk *slot = (struct ml_rpc_bulk *)parm;
+    
+    slot->done = 1;
+    
+    if(slot->cbr)
+    {
+        /* nobody waits for transfers with a callback */
+        slot->cbr(slot->id, ML_RPC_OK, slot->ctx);
+        slot->id = 0;
+    }
+    else if(slot->orphan)
+    {
+        slot->id = 0;
+    }
+    else
+    {
+        give_semaphore(slot->sem);
+    }
+}
+
+static uint32_t ml_rpc_bulk_start(uint32_t write, uint32_t address, uint8_t *buffer, uint32_t length, ml_rpc_bulk_cbr_t cbr, void *ctx)
+{
+    struct ml_rpc_bulk *slot = 0;
+    uint32_t id = 0;
+    
+    uint32_t old = cli();
+    for(uint32_t pos = 0; pos < ML_RPC_BULK_SLOTS; pos++)
+    {
+        if(!ml_rpc_bulk_slots[pos].id)
+        {
+            slot = &ml_rpc_bulk_slots[pos];
+            ml_rpc_bulk_seq++;
+            id = (ml_rpc_bulk_seq << 4) | pos;
+            slot->id = id;
+            break;
+        }
+    }
+    sei(old);
+    
+    if(!slot)
+    {
+        return 0;
+    }
+    
+    slot->done = 0;
+    slot->orphan = 0;
+    slot->cbr = cbr;
+    slot->ctx = ctx;
+    
+    if(buffer == CACHEABLE(buffer))
+    {
+        /* write back what we send, and drop lines that could be evicted over (or hide) what we receive */
+        uint32_t old = cli();
+        _clean_d_cache();
+        sei(old);
+    }
+    
+    /* the IPC layer refuses new transfers while busy; retry for a while, like ptp-chdk does */
+    for(uint32_t retry = 0; retry < 10; retry++)
+    {
+        uint32_t ret = write
+            ? BulkOutIPCTransfer(0, buffer, length, address, &ml_rpc_bulk_cb, (uint32_t)slot)
+            : BulkInIPCTransfer(0, buffer, length, address, &ml_rpc_bulk_cb, (uint32_t)slot);
+        
+        if(!ret)
+        {
+            /* slot->id may already be cleared if a callback transfer has completed */
+            return id;
+        }
+        msleep(10);
+    }
+    
+    slot->id = 0;
+    return 0;
+}
+
+/* read length bytes from master's address into buffer. returns a request id, 0 on error */
+uint32_t ml_rpc_bulk_read_start(uint32_t address, uint8_t *buffer, uint32_t length, ml_rpc_bulk_cbr_t cbr, void *ctx)
+{
+    return ml_rpc_bulk_start(0, address, buffer, length, cbr, ctx);
+}
+
+/* write length bytes from buffer to master's address. returns a request id, 0 on error */
+uint32_t ml_rpc_bulk_write_start(uint32_t address, uint8_t *buffer, uint32_t length, ml_rpc_bulk_cbr_t cbr, void *ctx)
+{
+    return ml_rpc_bulk_start(1, address, buffer, length, cbr, ctx);
+}
+
+/* wait up to timeout ms for a transfer started without callback. returns ML_RPC_OK or ML_RPC_ERROR */
+uint32_t ml_rpc_bulk_wait(uint32_t id, uint32_t timeout)
+{
+    struct ml_rpc_bulk *slot = &ml_rpc_bulk_slots[id & 0x0F];
+    
+    if(!id || (id & 0x0F) >= ML_RPC_BULK_SLOTS || slot->id != id || slot->cbr)
+    {
+        return ML_RPC_ERROR;
+    }
+    
+    if(take_semaphore(slot->sem, timeout))
+    {
+        uint32_t old = cli();
+        uint32_t done = slot->done;
+        if(!done)
+        {
+            slot->orphan = 1;
+        }
+        sei(old);
+        
+        if(!done)
+        {
+            return ML_RPC_ERROR;
+        }
+        
+        /* completed right after the timeout, consume its semaphore */
+        take_semaphore(slot->sem, 0);
+    }
+    
+    slot->id = 0;
+    return ML_RPC_OK;
+}
+
+/* allow about 1ms per KiB, plus some latency */
+static uint32_t ml_rpc_bulk_timeout(uint32_t length)
+{
+    return 1000 + length / 1024;
+}
+
+uint32_t ml_rpc_bulk_read(uint32_t address, uint8_t *buffer, uint32_t length)
+{
+    uint32_t id = ml_rpc_bulk_read_start(address, buffer, length, 0, 0);
+    return id ? ml_rpc_bulk_wait(id, ml_rpc_bulk_timeout(length)) : ML_RPC_ERROR;
+}
+
+uint32_t ml_rpc_bulk_write(uint32_t address, uint8_t *buffer, uint32_t length)
+{
+    uint32_t id = ml_rpc_bulk_write_start(address, buffer, length, 0, 0);
+    return id ? ml_rpc_bulk_wait(id, ml_rpc_bulk_timeout(length)) : ML_RPC_ERROR;
+}
+
+/* read length bytes from other digic, into any buffer */
+uint32_t ml_rpc_readmem(uint32_t address, uint32_t length, uint8_t *buffer)
+{
+    uint8_t *buf = fio_malloc(length);
+    
+    if(!buf)
+    {
+        return 0;
+    }
+    
+    uint32_t ok = (ml_rpc_bulk_read(address, buf, length) == ML_RPC_OK);
+    if(ok)
+    {
+        memcpy(buffer, buf, length);
+    }
+    fio_free(buf);
+    
+    return ok;
+}
+
 /* send vignetting data to master digic. set length to 0 to disable vignetting correction */
 uint32_t ml_rpc_send_vignetting(uint32_t *buffer, uint32_t length)
 {
+    if(!ml_rpc_master_buf_queried)
+    {
+        uint32_t parm1 = 0, parm2 = 0, parm3 = 0;
+        
+        if(ml_rpc_send_recv(ML_RPC_BUFFER, &parm1, &parm2, &parm3, 4) == ML_RPC_OK)
+        {
+            ml_rpc_master_buf = parm2;
+            ml_rpc_master_buf_size = parm3;
+        }
+        ml_rpc_master_buf_queried = 1;
+    }
+    
+    /* bulk write the table to master, then tell it to use it */
+    if(length && length <= ml_rpc_master_buf_size)
+    {
+        uint8_t *buf = fio_malloc(length);
+        
+        if(buf)
+        {
+            memcpy(buf, buffer, length);
+            uint32_t ret = ml_rpc_bulk_write(ml_rpc_master_buf, buf, length);
+            fio_free(buf);
+            
+            if(ret == ML_RPC_OK)
+            {
+                /* wait until master has copied the table, so the next update can't overwrite it early */
+                if(ml_rpc_send(ML_RPC_VIGNETTING, length, 0, 0, 4) == ML_RPC_OK)
+                {
+                    return 0;
+                }
+                
+                /* no reply: master may still read its buffer later, don't write it again */
+                ml_rpc_master_buf_size = 0;
+            }
+        }
+    }
+    
     RequestRPC(ML_RPC_ID_VIGNETTING, buffer, length, 0, 0);
     return 0;
 }
@@ -237,8 +440,28 @@ uint32_t ml_rpc_handler (uint8_t *buffer, uint32_t length)
                 ml_rpc_send(ML_RPC_PING_REPLY, req->parm1, req->parm2, req->parm3, 0);
                 break;
                 
-            case ML_RPC_READ:
-                ml_rpc_send(ML_RPC_READ_REPLY, MEM(req->parm1), MEM(req->parm2), 0, 0);
+            case ML_RPC_BUFFER:
+                {
+                    /* slave writes through our uncached mapping, make sure no dirty line is evicted on top of it */
+                    uint32_t old = cli();
+                    _clean_d_cache();
+                    sei(old);
+                }
+                ml_rpc_send(ML_RPC_OK, req->message, (uint32_t)UNCACHEABLE(ml_rpc_bulk_buf), sizeof(ml_rpc_bulk_buf), 0);
+                break;
+                
+            case ML_RPC_VIGNETTING:
+                vignetting_update_table(UNCACHEABLE(ml_rpc_bulk_buf), req->parm1);
+                {
+                    /* same as above, before the next transfer */
+                    uint32_t old = cli();
+                    _clean_d_cache();
+                    sei(old);
+                }
+                if(req->wait)
+                {
+                    ml_rpc_send(ML_RPC_OK, req->message, 0, 0, 0);
+                }
                 break;
                 
             case ML_RPC_CALL:
@@ -286,28 +509,6 @@ uint32_t ml_rpc_handler (uint8_t *buffer, uint32_t length)
                 ml_rpc_send(ML_RPC_PING_REPLY, req->parm1, req->parm3, req->parm3, 0);
                 break;
                 
-            case ML_RPC_READ_REPLY:
-                if(ml_rpc_read_buf)
-                {
-                    if(ml_rpc_read_remain)
-                    {
-                        ml_rpc_read_buf[ml_rpc_read_pos++] = req->parm1;
-                        ml_rpc_read_remain--;
-                        ml_rpc_read_addr += 4;
-                    }
-                    if(ml_rpc_read_remain)
-                    {
-                        ml_rpc_read_buf[ml_rpc_read_pos++] = req->parm2;
-                        ml_rpc_read_remain--;
-                        ml_rpc_read_addr += 4;
-                    }
-                }
-                if(ml_rpc_read_remain)
-                {
-                    ml_rpc_send(ML_RPC_READ, ml_rpc_read_addr, ml_rpc_read_addr + 4, 0, 0);
-                }
-                break;
-                
             case ML_RPC_PING_REPLY:
                 if(ml_rpc_verbosity)
                 {
@@ -319,6 +520,8 @@ uint32_t ml_rpc_handler (uint8_t *buffer, uint32_t length)
                 bmp_printf(FONT_MED, 0, 60, "RPC 0x%08X unknown", req->message);
                 break;
         }
+        
+        give_semaphore(ml_rpc_reply_sem);
 #endif
     }
     
@@ -336,6 +539,13 @@ void ml_rpc_init()
     RegisterRPCHandler(ML_RPC_ID_MASTER, &ml_rpc_handler);
     RegisterRPCHandler(ML_RPC_ID_VIGNETTING, &ml_rpc_handler_vignetting);
 #else
+    ml_rpc_reply_sem = create_named_semaphore("ml_rpc_reply", 0);
+    
+    for(uint32_t pos = 0; pos < ML_RPC_BULK_SLOTS; pos++)
+    {
+        ml_rpc_bulk_slots[pos].sem = create_named_semaphore("ml_rpc_bulk", 0);
+    }
+    
     RegisterRPCHandler(ML_RPC_ID_SLAVE, &ml_rpc_handler);
 #endif
 }
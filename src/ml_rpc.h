@@ -10,6 +10,8 @@
 #define ML_RPC_ENGIO_READ     (0x80000006)
 #define ML_RPC_READ           (0x80000007)
 #define ML_RPC_READ_REPLY     (0x80000008)
+#define ML_RPC_BUFFER         (0x80000009)
+#define ML_RPC_VIGNETTING     (0x8000000A)
 #define ML_RPC_OK             (0xFEEFEE00)
 #define ML_RPC_ERROR          (0xFEEFEEEE)
 
@@ -27,6 +29,12 @@ typedef struct
     uint32_t wait;
 } ml_rpc_request_t;
 
+/* bulk transfers (slave only): called from the IPC completion context with the id
+   returned by ml_rpc_bulk_*_start and ML_RPC_OK, keep it short */
+typedef void (*ml_rpc_bulk_cbr_t)(uint32_t id, uint32_t status, void *ctx);
+
+#define ML_RPC_BULK_SLOTS     4
+
 
 uint32_t ml_rpc_available();
 uint32_t ml_rpc_send(uint32_t command, uint32_t parm1, uint32_t parm2, uint32_t parm3, uint32_t wait);
@@ -34,5 +42,12 @@ uint32_t ml_rpc_send_recv(uint32_t command, uint32_t *parm1, uint32_t *parm2, ui
 uint32_t ml_rpc_call(uint32_t address, uint32_t arg0, uint32_t arg1);
 uint32_t ml_rpc_readmem(uint32_t address, uint32_t length, uint8_t *buffer);
 uint32_t ml_rpc_send_vignetting(uint32_t *buffer, uint32_t length);
+
+/* buffers passed to the bulk functions must be DMA-capable (fio_malloc) */
+uint32_t ml_rpc_bulk_read_start(uint32_t address, uint8_t *buffer, uint32_t length, ml_rpc_bulk_cbr_t cbr, void *ctx);
+uint32_t ml_rpc_bulk_write_start(uint32_t address, uint8_t *buffer, uint32_t length, ml_rpc_bulk_cbr_t cbr, void *ctx);
+uint32_t ml_rpc_bulk_wait(uint32_t id, uint32_t timeout);
+uint32_t ml_rpc_bulk_read(uint32_t address, uint8_t *buffer, uint32_t length);
+uint32_t ml_rpc_bulk_write(uint32_t address, uint8_t *buffer, uint32_t length);
 void ml_rpc_verbose(uint32_t state);
 #endif
@@ -11,6 +11,7 @@
 #include "bmp.h"
 #include "lens.h"
 #include "ml-cbr.h"
+#include "version.h"
 
 //used for custom mode folder tree upon install
 extern WEAK_FUNC(ret_0) unsigned int config_preset_scan();
@@ -20,6 +21,11 @@ extern WEAK_FUNC(ret_0) unsigned int config_preset_scan();
 #endif
 #define MAGIC_SYMBOLS                 "ML/MODULES/"CONFIG_MODULES_MODEL_SYM
 
+#ifndef CONFIG_MODULES_MODEL_HSYM
+#error Not defined file name with hashed symbols
+#endif
+#define MAGIC_SYMBOLS_HASHED          "ML/MODULES/"CONFIG_MODULES_MODEL_HSYM
+
 /* unloads TCC after linking the modules */
 /* note: this breaks module_exec and ETTR */
 #define CONFIG_TCC_UNLOAD
@@ -133,6 +139,204 @@ static int module_load_symbols(TCCState *s, char *filename)
     return 0;
 }
 
+/* FNV-1a */
+static uint32_t module_hash(uint32_t hash, const void * data, int len)
+{
+    const uint8_t * p = data;
+    for (int i = 0; i < len; i++)
+    {
+        hash = (hash ^ p[i]) * 16777619;
+    }
+    return hash;
+}
+
+static uint32_t module_hash_string(uint32_t hash, const char * str)
+{
+    return module_hash(hash, str, strlen(str) + 1);
+}
+
+/* binary core symbol table, generated from the .sym file by build_tools/symhash.c
+ * 
+ * header, then num_buckets hash buckets (symbol index + 1, 0 = empty; linear probing),
+ * then num_symbols entries, then the symbol names (null-terminated)
+ */
+#define SYMTAB_MAGIC                  0x59534C4D  /* MLSY */
+#define SYMTAB_VERSION                1
+
+struct symtab_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_symbols;
+    uint32_t num_buckets;           /* power of 2 */
+    uint32_t strings_size;
+};
+
+struct symtab_entry
+{
+    uint32_t hash;                  /* FNV-1a of the name, without the terminator */
+    uint32_t address;
+    uint32_t name;                  /* offset into the string table */
+};
+
+static struct
+{
+    struct symtab_header * hdr;
+    uint32_t * buckets;
+    struct symtab_entry * symbols;
+    char * strings;
+} core_symtab;
+
+static int core_symtab_load(char *filename)
+{
+    uint32_t size = 0;
+
+    if( FIO_GetFileSize( filename, &size ) != 0 || size < sizeof(struct symtab_header) )
+    {
+        return -1;
+    }
+
+    struct symtab_header * hdr = fio_malloc(size);
+    if (!hdr)
+    {
+        return -1;
+    }
+
+    FILE* file = FIO_OpenFile(filename, O_RDONLY | O_SYNC);
+    if (!file)
+    {
+        fio_free(hdr);
+        return -1;
+    }
+    int read = FIO_ReadFile(file, hdr, size);
+    FIO_CloseFile(file);
+
+    uint32_t expected_size = sizeof(*hdr) +
+        hdr->num_buckets * sizeof(uint32_t) +
+        hdr->num_symbols * sizeof(struct symtab_entry) +
+        hdr->strings_size;
+
+    if (read != (int) size ||
+        hdr->magic != SYMTAB_MAGIC ||
+        hdr->version != SYMTAB_VERSION ||
+        hdr->num_buckets == 0 ||
+        hdr->strings_size == 0 ||
+        (hdr->num_buckets & (hdr->num_buckets - 1)) ||
+        hdr->num_symbols >= hdr->num_buckets ||
+        expected_size > size ||
+        expected_size + 4 <= size)
+    {
+        printf("Invalid symbol table: %s\n", filename);
+        fio_free(hdr);
+        return -1;
+    }
+
+    core_symtab.hdr = hdr;
+    core_symtab.buckets = (void*) hdr + sizeof(*hdr);
+    core_symtab.symbols = (void*) (core_symtab.buckets + hdr->num_buckets);
+    core_symtab.strings = (void*) (core_symtab.symbols + hdr->num_symbols);
+
+    /* make sure the lookups can't run past the string table */
+    core_symtab.strings[hdr->strings_size - 1] = 0;
+    return 0;
+}
+
+static void core_symtab_free()
+{
+    if (core_symtab.hdr)
+    {
+        fio_free(core_symtab.hdr);
+    }
+    memset(&core_symtab, 0, sizeof(core_symtab));
+}
+
+#ifdef CONFIG_TCC_UNLOAD
+/* states returned by module_load, still looking up core symbols in module_get_symbol */
+static int core_symtab_users = 0;
+
+/* free the table after linking, unless a module_load state still needs it */
+static void core_symtab_release()
+{
+    if (!core_symtab_users)
+    {
+        core_symtab_free();
+    }
+}
+#endif
+
+/* address of a core symbol, or 0 if not found */
+static void * core_symtab_find(const char * name)
+{
+    if (!core_symtab.hdr)
+    {
+        return 0;
+    }
+
+    uint32_t hash = module_hash(2166136261u, name, strlen(name));
+    uint32_t mask = core_symtab.hdr->num_buckets - 1;
+
+    for (uint32_t b = hash & mask; core_symtab.buckets[b]; b = (b + 1) & mask)
+    {
+        uint32_t index = core_symtab.buckets[b] - 1;
+        if (index >= core_symtab.hdr->num_symbols)
+        {
+            break;
+        }
+
+        struct symtab_entry * sym = &core_symtab.symbols[index];
+        if (sym->hash == hash && sym->name < core_symtab.hdr->strings_size &&
+            streq(core_symtab.strings + sym->name, name))
+        {
+            return (void *) sym->address;
+        }
+    }
+
+    return 0;
+}
+
+/* called by TCC for undefined symbols while linking */
+static void * module_resolve_core_symbol(void * opaque, const char * name)
+{
+    return core_symtab_find(name);
+}
+
+/* TCC state ready for adding modules; NULL if core symbols are not available */
+static TCCState * module_new_linker()
+{
+    TCCState * state = tcc_new();
+    tcc_set_options(state, "-nostdlib");
+
+    /* binary symbol table: nothing to parse, and TCC only sees the symbols actually used by modules */
+    if (core_symtab.hdr || core_symtab_load(MAGIC_SYMBOLS_HASHED) == 0)
+    {
+        tcc_set_resolve_func(state, 0, module_resolve_core_symbol);
+        return state;
+    }
+
+    /* fall back to the text symbol file */
+    if(module_load_symbols(state, MAGIC_SYMBOLS) < 0)
+    {
+        tcc_delete(state);
+        return 0;
+    }
+
+    return state;
+}
+
+/* symbol from a linked TCC state, or from core */
+static void * module_lookup_symbol(TCCState * state, const char * name)
+{
+    void * addr = state ? tcc_get_symbol(state, name) : 0;
+
+    if (!addr)
+    {
+        /* core symbols are only known to TCC if some module referenced them */
+        addr = core_symtab_find(name);
+    }
+
+    return addr;
+}
+
 /* this is not perfect, as .Mo and .mO aren't detected. important? */
 static int module_valid_filename(char* filename)
 {
@@ -151,6 +355,521 @@ static int module_valid_filename(char* filename)
     return 0;
 }
 
+/* boot time spent in each stage of _module_load_all, in milliseconds */
+static struct
+{
+    int scan;                   /* directory scan, enable flags */
+    int symbols;                /* parsing the core symbol file */
+    int load;                   /* reading the .mo files into TCC */
+    int link;                   /* relocation, or restoring the prelinked image */
+    int init;                   /* registration, configs, module init */
+    int total;
+    int cached;                 /* 1 if the prelinked image was used */
+} module_load_times;
+
+static int module_lap(int * t0)
+{
+    int t = get_ms_clock();
+    int dt = t - *t0;
+    *t0 = t;
+    return dt;
+}
+
+/* prelinked module cache
+ * 
+ * Linking all the modules with TCC (parsing the symbol file, loading
+ * the objects and relocating them) takes most of the module loading time.
+ * Once linked, the image only depends on the ML build, on the .mo files
+ * and on the address it was relocated to, so we save it on the card,
+ * together with the fixups needed to move it to a different address,
+ * and reuse it at the next boot if nothing changed.
+ */
+#define MODULE_CACHE_FILE       MODULE_PATH"MODULES.CCH"
+#define MODULE_CACHE_MAGIC      0x4843434D  /* MCCH */
+#define MODULE_CACHE_VERSION    1
+
+CONFIG_INT("module.cache", module_cache_enabled, 1);
+
+/* ELF relocation types we may see from tcc_relocate (see tcc/elf.h) */
+#define R_ARM_NONE              0
+#define R_ARM_PC24              1
+#define R_ARM_ABS32             2
+#define R_ARM_REL32             3
+#define R_ARM_THM_CALL          10
+#define R_ARM_BASE_PREL         25
+#define R_ARM_GOT_BREL          26
+#define R_ARM_PLT32             27
+#define R_ARM_CALL              28
+#define R_ARM_JUMP24            29
+#define R_ARM_THM_JUMP24        30
+#define R_ARM_V4BX              40
+#define R_ARM_MOVW_ABS_NC       43
+#define R_ARM_MOVT_ABS          44
+#define R_ARM_THM_MOVW_ABS_NC   47
+#define R_ARM_THM_MOVT_ABS      48
+
+/* address-dependent fixups are stored as image offset | (kind << 30) */
+#define FIXUP_ABS32             0   /* pointer into the image: += delta */
+#define FIXUP_REL32             1   /* PC-relative word to a core address: -= delta */
+#define FIXUP_BRANCH            2   /* ARM branch to a core address: imm24 -= delta/4 */
+#define FIXUP_BRANCH_LOCAL      3   /* branch within the image; only checked for veneers, not saved */
+#define FIXUP_KIND(f)           ((f) >> 30)
+#define FIXUP_OFFSET(f)         ((f) & 0x3FFFFFFF)
+
+#define ARM_VENEER              0xE51FF004  /* ldr pc, [pc, #-4], see add_jmp_table in tccelf.c */
+
+struct module_cache_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t key;               /* hash of the ML build, symbol file and enabled modules */
+    uint32_t base;              /* address the image was linked at */
+    uint32_t image_size;
+    uint32_t num_fixups;
+    uint32_t num_symbols;
+};
+
+/* symbols looked up after linking (module info structures, core MODULE_SYMBOLs) */
+struct module_cache_symbol
+{
+    uint32_t hash;
+    uint32_t value;
+};
+
+static struct reloc_fixups module_fixups;
+
+static struct module_cache_symbol * module_cache_symbols = 0;
+static int module_cache_num_symbols = 0;
+
+static uint32_t module_cache_key(uint32_t module_cnt)
+{
+    uint32_t sym_size = 0;
+    if (FIO_GetFileSize(MAGIC_SYMBOLS, &sym_size) != 0)
+    {
+        return 0;
+    }
+
+    uint32_t key = 2166136261u;
+    key = module_hash_string(key, build_version);
+    key = module_hash_string(key, build_id);
+    key = module_hash_string(key, build_date);
+    key = module_hash(key, &sym_size, sizeof(sym_size));
+
+    for (uint32_t mod = 0; mod < module_cnt; mod++)
+    {
+        if (module_list[mod].enabled)
+        {
+            key = module_hash_string(key, module_list[mod].filename);
+            key = module_hash(key, &module_list[mod].file_size, sizeof(module_list[mod].file_size));
+            key = module_hash(key, &module_list[mod].file_timestamp, sizeof(module_list[mod].file_timestamp));
+        }
+    }
+
+    return key;
+}
+
+/* called by TCC for every relocation applied while linking; opaque is a struct reloc_fixups */
+void reloc_fixups_record(void * opaque, int type, unsigned long addr, unsigned long val)
+{
+    struct reloc_fixups * fx = opaque;
+    uint32_t offset = addr - fx->base;
+    int internal = (val - fx->base < fx->size);
+    int kind;
+
+    switch (type)
+    {
+        case R_ARM_NONE:
+        case R_ARM_V4BX:
+        case R_ARM_BASE_PREL:
+        case R_ARM_GOT_BREL:
+            /* position-independent */
+            return;
+
+        case R_ARM_ABS32:
+            if (!internal) return;
+            kind = FIXUP_ABS32;
+            break;
+
+        case R_ARM_REL32:
+            if (internal) return;
+            kind = FIXUP_REL32;
+            break;
+
+        case R_ARM_PC24:
+        case R_ARM_CALL:
+        case R_ARM_JUMP24:
+        case R_ARM_PLT32:
+            kind = internal ? FIXUP_BRANCH_LOCAL : FIXUP_BRANCH;
+            break;
+
+        case R_ARM_THM_CALL:
+        case R_ARM_THM_JUMP24:
+            /* Thumb branches are fine only within the image */
+            if (internal) return;
+            fx->unsupported = 1;
+            return;
+
+        case R_ARM_MOVW_ABS_NC:
+        case R_ARM_MOVT_ABS:
+        case R_ARM_THM_MOVW_ABS_NC:
+        case R_ARM_THM_MOVT_ABS:
+            /* absolute addresses are fine only outside the image */
+            if (!internal) return;
+            fx->unsupported = 1;
+            return;
+
+        default:
+            printf("  [i] cache: reloc type %d not handled\n", type);
+            fx->unsupported = 1;
+            return;
+    }
+
+    if (offset >= fx->size || offset > 0x3FFFFFFF)
+    {
+        fx->unsupported = 1;
+        return;
+    }
+
+    if (fx->count >= fx->max)
+    {
+        int max = fx->max ? fx->max * 2 : 256;
+        uint32_t * fixups = realloc(fx->fixups, max * sizeof(fixups[0]));
+        if (!fixups)
+        {
+            fx->unsupported = 1;
+            return;
+        }
+        fx->fixups = fixups;
+        fx->max = max;
+    }
+
+    fx->fixups[fx->count++] = offset | (kind << 30);
+}
+
+/* decode the target of an ARM B/BL/BLX at addr */
+static uint32_t arm_branch_target(uint32_t addr)
+{
+    int32_t imm = (*(uint32_t *) addr << 8);
+    return addr + 8 + (imm >> 6);
+}
+
+/* once the image is in place: veneers (long branches from add_jmp_table)
+ * hold absolute addresses, so branches going through them need no fixup,
+ * but local branches must not use them */
+void reloc_fixups_check_branches(struct reloc_fixups * fx)
+{
+    int out = 0;
+
+    for (int i = 0; i < fx->count; i++)
+    {
+        uint32_t f = fx->fixups[i];
+        int kind = FIXUP_KIND(f);
+
+        if (kind == FIXUP_BRANCH || kind == FIXUP_BRANCH_LOCAL)
+        {
+            uint32_t addr = fx->base + FIXUP_OFFSET(f);
+            uint32_t target = arm_branch_target(addr);
+            int target_internal = (target - fx->base < fx->size - 8);
+            int veneer = target_internal && (*(uint32_t *) target == ARM_VENEER);
+
+            if (kind == FIXUP_BRANCH_LOCAL)
+            {
+                if (veneer)
+                {
+                    fx->unsupported = 1;
+                }
+                continue;
+            }
+
+            if (veneer)
+            {
+                continue;
+            }
+
+            if (target_internal)
+            {
+                fx->unsupported = 1;
+                continue;
+            }
+        }
+
+        fx->fixups[out++] = f;
+    }
+
+    fx->count = out;
+}
+
+/* move a restored image from old_base to its new address; returns 0 if it can't be moved that far */
+int reloc_fixups_apply(void * image, uint32_t image_size, uint32_t old_base, const uint32_t * fixups, int count)
+{
+    int32_t delta = (uint32_t) image - old_base;
+
+    if (delta == 0)
+    {
+        return 1;
+    }
+
+    if (delta & 3)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t offset = FIXUP_OFFSET(fixups[i]);
+        if (offset + 4 > image_size)
+        {
+            return 0;
+        }
+
+        uint32_t * p = image + offset;
+        switch (FIXUP_KIND(fixups[i]))
+        {
+            case FIXUP_ABS32:
+                *p += delta;
+                break;
+
+            case FIXUP_REL32:
+                *p -= delta;
+                break;
+
+            case FIXUP_BRANCH:
+            {
+                int32_t x = (int32_t)(*p << 8) >> 8;
+                x -= delta >> 2;
+                if (x >= 0x800000 || x < -0x800000)
+                {
+                    /* out of range, would need a veneer */
+                    return 0;
+                }
+                *p = (*p & 0xFF000000) | (x & 0xFFFFFF);
+                break;
+            }
+
+            default:
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+void reloc_fixups_free(struct reloc_fixups * fx)
+{
+    free(fx->fixups);
+    memset(fx, 0, sizeof(*fx));
+}
+
+static void module_cache_add_symbol(TCCState * state, const char * name)
+{
+    struct module_cache_symbol * sym = &module_cache_symbols[module_cache_num_symbols++];
+    sym->hash = module_hash_string(2166136261u, name);
+    sym->value = (uint32_t) module_lookup_symbol(state, name);
+
+    /* lookups are done by hash only */
+    for (struct module_cache_symbol * s = module_cache_symbols; s < sym; s++)
+    {
+        if (s->hash == sym->hash)
+        {
+            printf("  [i] cache: hash collision (%s)\n", name);
+            module_fixups.unsupported = 1;
+        }
+    }
+}
+
+static const char * module_symbol_prefixes[] = {
+    STR(MODULE_INFO_PREFIX),
+    STR(MODULE_STRINGS_PREFIX),
+    STR(MODULE_PROPHANDLERS_PREFIX),
+    STR(MODULE_CBR_PREFIX),
+    STR(MODULE_CONFIG_PREFIX),
+};
+
+/* remember all the symbols we are going to look up after linking */
+static void module_cache_collect_symbols(TCCState * state, uint32_t module_cnt)
+{
+    extern struct module_symbol_entry _module_symbols_start[];
+    extern struct module_symbol_entry _module_symbols_end[];
+
+    int max = module_cnt * COUNT(module_symbol_prefixes) + (_module_symbols_end - _module_symbols_start);
+    module_cache_symbols = malloc(max * sizeof(module_cache_symbols[0]));
+    module_cache_num_symbols = 0;
+    if (!module_cache_symbols)
+    {
+        module_fixups.unsupported = 1;
+        return;
+    }
+
+    for (uint32_t mod = 0; mod < module_cnt; mod++)
+    {
+        if (module_list[mod].enabled)
+        {
+            for (int i = 0; i < COUNT(module_symbol_prefixes); i++)
+            {
+                char name[32];
+                snprintf(name, sizeof(name), "%s%s", module_symbol_prefixes[i], module_list[mod].name);
+                module_cache_add_symbol(state, name);
+            }
+        }
+    }
+
+    for (struct module_symbol_entry * e = _module_symbols_start; e < _module_symbols_end; e++)
+    {
+        module_cache_add_symbol(state, e->name);
+    }
+}
+
+/* symbol lookup after linking: from TCC, or from the prelinked cache if TCC was not used */
+static void * module_get_linked_symbol(TCCState * state, const char * name)
+{
+    if (state)
+    {
+        return module_lookup_symbol(state, name);
+    }
+
+    uint32_t hash = module_hash_string(2166136261u, name);
+    for (int i = 0; i < module_cache_num_symbols; i++)
+    {
+        if (module_cache_symbols[i].hash == hash)
+        {
+            return (void *) module_cache_symbols[i].value;
+        }
+    }
+    return 0;
+}
+
+static void module_cache_free()
+{
+    reloc_fixups_free(&module_fixups);
+    free(module_cache_symbols);
+    module_cache_symbols = 0;
+    module_cache_num_symbols = 0;
+}
+
+/* must be called right after linking, before any module code runs */
+static void module_cache_save(uint32_t key, void * image, uint32_t image_size)
+{
+    reloc_fixups_check_branches(&module_fixups);
+
+    if (module_fixups.unsupported)
+    {
+        printf("  [i] cache: image not relocatable, not saved\n");
+        FIO_RemoveFile(MODULE_CACHE_FILE);
+        return;
+    }
+
+    struct module_cache_header hdr = {
+        .magic          = MODULE_CACHE_MAGIC,
+        .version        = MODULE_CACHE_VERSION,
+        .key            = key,
+        .base           = (uint32_t) image,
+        .image_size     = image_size,
+        .num_fixups     = module_fixups.count,
+        .num_symbols    = module_cache_num_symbols,
+    };
+
+    FILE * f = FIO_CreateFile(MODULE_CACHE_FILE);
+    if (!f)
+    {
+        return;
+    }
+
+    int fixups_size = hdr.num_fixups * sizeof(module_fixups.fixups[0]);
+    int symbols_size = hdr.num_symbols * sizeof(module_cache_symbols[0]);
+    int ok =
+        FIO_WriteFile(f, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        FIO_WriteFile(f, image, image_size) == (int) image_size &&
+        FIO_WriteFile(f, module_fixups.fixups, fixups_size) == fixups_size &&
+        FIO_WriteFile(f, module_cache_symbols, symbols_size) == symbols_size;
+    FIO_CloseFile(f);
+
+    if (ok)
+    {
+        printf("  [i] cache: saved %d bytes, %d fixups\n", image_size, hdr.num_fixups);
+    }
+    else
+    {
+        FIO_RemoveFile(MODULE_CACHE_FILE);
+    }
+}
+
+/* returns the restored image, or NULL if the cache is missing, stale or can't be moved here */
+static void * module_cache_load(uint32_t key)
+{
+    uint32_t size = 0;
+    void * image = 0;
+
+    if (FIO_GetFileSize(MODULE_CACHE_FILE, &size) != 0 || size < sizeof(struct module_cache_header))
+    {
+        return 0;
+    }
+
+    /* read the whole file at once; the header tells whether it's worth it */
+    void * buf = fio_malloc(size);
+    if (!buf)
+    {
+        return 0;
+    }
+
+    FILE * f = FIO_OpenFile(MODULE_CACHE_FILE, O_RDONLY | O_SYNC);
+    if (!f)
+    {
+        goto end;
+    }
+    int read = FIO_ReadFile(f, buf, size);
+    FIO_CloseFile(f);
+
+    struct module_cache_header * hdr = buf;
+    if (read != (int) size ||
+        hdr->magic != MODULE_CACHE_MAGIC ||
+        hdr->version != MODULE_CACHE_VERSION ||
+        hdr->key != key ||
+        sizeof(*hdr) + hdr->image_size +
+            hdr->num_fixups * sizeof(uint32_t) +
+            hdr->num_symbols * sizeof(struct module_cache_symbol) != size)
+    {
+        printf("  [i] cache: stale\n");
+        goto end;
+    }
+
+    uint32_t * fixups = buf + sizeof(*hdr) + hdr->image_size;
+    struct module_cache_symbol * symbols = (void *)(fixups + hdr->num_fixups);
+
+    image = malloc(hdr->image_size);
+    module_cache_symbols = malloc(hdr->num_symbols * sizeof(symbols[0]) + 1);
+    if (!image || !module_cache_symbols)
+    {
+        goto fail;
+    }
+
+    memcpy(image, buf + sizeof(*hdr), hdr->image_size);
+    if (!reloc_fixups_apply(image, hdr->image_size, hdr->base, fixups, hdr->num_fixups))
+    {
+        printf("  [i] cache: can't move image from %x to %x\n", hdr->base, image);
+        goto fail;
+    }
+
+    int32_t delta = (uint32_t) image - hdr->base;
+    for (uint32_t i = 0; i < hdr->num_symbols; i++)
+    {
+        module_cache_symbols[i] = symbols[i];
+        if (symbols[i].value - hdr->base < hdr->image_size)
+        {
+            module_cache_symbols[i].value += delta;
+        }
+    }
+    module_cache_num_symbols = hdr->num_symbols;
+    goto end;
+
+fail:
+    free(image);
+    image = 0;
+    module_cache_free();
+end:
+    fio_free(buf);
+    return image;
+}
+
 /* must be called before unloading TCC */
 static void module_update_core_symbols(TCCState* state)
 {
@@ -163,7 +882,7 @@ static void module_update_core_symbols(TCCState* state)
     for( ; module_symbol_entry < _module_symbols_end ; module_symbol_entry++ )
     {
         void* old_address = *(module_symbol_entry->address);
-        void* new_address = (void*) tcc_get_symbol(state, (char*) module_symbol_entry->name);
+        void* new_address = module_get_linked_symbol(state, module_symbol_entry->name);
         if (new_address)
         {
             if (new_address != module_symbol_entry->address)
@@ -192,6 +911,8 @@ static void _module_load_all(uint32_t list_only)
     uint32_t module_cnt = 0;
     struct fio_file file;
     uint32_t update_properties = 0;
+    int t0 = get_ms_clock();
+    int t = t0;
 
     if(module_console_enabled)
     {
@@ -213,22 +934,14 @@ static void _module_load_all(uint32_t list_only)
         return;
     }
 
-    /* initialize linker */
-    state = tcc_new();
-    tcc_set_options(state, "-nostdlib");
-    if(module_load_symbols(state, MAGIC_SYMBOLS) < 0)
-    {
-        NotifyBox(2000, "Missing symbol file: " MAGIC_SYMBOLS );
-        tcc_delete(state); console_show();
-        return;
-    }
+    memset(&module_load_times, 0, sizeof(module_load_times));
 
     printf("Scanning modules...\n");
     struct fio_dirent * dirent = FIO_FindFirstEx( MODULE_PATH, &file );
     if( IS_ERROR(dirent) )
     {
         NotifyBox(2000, "Module dir missing" );
-        tcc_delete(state); console_show();
+        console_show();
         return;
     }
 
@@ -246,6 +959,8 @@ static void _module_load_all(uint32_t list_only)
             memset(module_name, 0x00, sizeof(module_name));
             strncpy(module_name, file.name, MODULE_NAME_LENGTH);
             strncpy(module_list[module_cnt].filename, file.name, MODULE_FILENAME_LENGTH);
+            module_list[module_cnt].file_size = file.size;
+            module_list[module_cnt].file_timestamp = file.timestamp;
             snprintf(module_list[module_cnt].long_filename, sizeof(module_list[module_cnt].long_filename), "%s%s", MODULE_PATH, module_list[module_cnt].filename);
 
             uint32_t pos = 0;
@@ -333,13 +1048,45 @@ static void _module_load_all(uint32_t list_only)
     }
     
 
+    module_load_times.scan = module_lap(&t);
+
     /* dont load anything, just return */
     if(list_only)
     {
-        tcc_delete(state);
         return;
     }
-    
+
+#ifdef CONFIG_TCC_UNLOAD
+    /* try the modules linked at previous boot */
+    uint32_t cache_key = module_cache_enabled ? module_cache_key(module_cnt) : 0;
+    if (cache_key)
+    {
+        module_code = module_cache_load(cache_key);
+    }
+
+    if (module_code)
+    {
+        printf("Using prelinked modules.\n");
+        for (uint32_t mod = 0; mod < module_cnt; mod++)
+        {
+            module_list[mod].valid = module_list[mod].enabled;
+        }
+        module_load_times.link = module_lap(&t);
+        module_load_times.cached = 1;
+        goto linked;
+    }
+#endif
+
+    /* initialize linker */
+    state = module_new_linker();
+    if(!state)
+    {
+        NotifyBox(2000, "Missing symbol file: " MAGIC_SYMBOLS );
+        console_show();
+        return;
+    }
+    module_load_times.symbols = module_lap(&t);
+
     /* load modules */
     printf("Load modules...\n");
     for (uint32_t mod = 0; mod < module_cnt; mod++)
@@ -361,6 +1108,8 @@ static void _module_load_all(uint32_t list_only)
         }
     }
 
+    module_load_times.load = module_lap(&t);
+
     printf("Linking..\n");
 #ifdef CONFIG_TCC_UNLOAD
     int32_t size = tcc_relocate(state, NULL);
@@ -370,8 +1119,30 @@ static void _module_load_all(uint32_t list_only)
     {
         void* buf = (void*) malloc(size);
         
+        if (cache_key && buf)
+        {
+            /* record the address-dependent relocations, to be able to move the image later */
+            module_fixups.base = (uint32_t) buf;
+            module_fixups.size = size;
+            tcc_set_reloc_func(state, &module_fixups, reloc_fixups_record);
+        }
+
         reloc_status = tcc_relocate(state, buf);
         module_code = buf;
+
+        if (cache_key && buf && reloc_status >= 0)
+        {
+            /* save it now, before module code gets a chance to modify it */
+            for (uint32_t mod = 0; mod < module_cnt; mod++)
+            {
+                if (module_list[mod].error)
+                {
+                    module_fixups.unsupported = 1;
+                }
+            }
+            module_cache_collect_symbols(state, module_cnt);
+            module_cache_save(cache_key, buf, size);
+        }
     }
     if(size < 0 || reloc_status < 0)
 #else
@@ -389,10 +1160,16 @@ static void _module_load_all(uint32_t list_only)
                 snprintf(module_list[mod].long_status, sizeof(module_list[mod].long_status), "Linking failed");
             }
         }
+        module_cache_free();
+        core_symtab_release();
         tcc_delete(state); console_show();
         return;
     }
-    
+    module_load_times.link = module_lap(&t);
+
+#ifdef CONFIG_TCC_UNLOAD
+linked:
+#endif
     /* load modules symbols */
     printf("Register modules...\n");
     for (uint32_t mod = 0; mod < module_cnt; mod++)
@@ -403,15 +1180,15 @@ static void _module_load_all(uint32_t list_only)
 
             /* now check for info structure */
             snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_INFO_PREFIX), module_list[mod].name);
-            module_list[mod].info = tcc_get_symbol(state, module_info_name);
+            module_list[mod].info = module_get_linked_symbol(state, module_info_name);
             snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_STRINGS_PREFIX), module_list[mod].name);
-            module_list[mod].strings = tcc_get_symbol(state, module_info_name);
+            module_list[mod].strings = module_get_linked_symbol(state, module_info_name);
             snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_PROPHANDLERS_PREFIX), module_list[mod].name);
-            module_list[mod].prop_handlers = tcc_get_symbol(state, module_info_name);
+            module_list[mod].prop_handlers = module_get_linked_symbol(state, module_info_name);
             snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_CBR_PREFIX), module_list[mod].name);
-            module_list[mod].cbr = tcc_get_symbol(state, module_info_name);
+            module_list[mod].cbr = module_get_linked_symbol(state, module_info_name);
             snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_CONFIG_PREFIX), module_list[mod].name);
-            module_list[mod].config = tcc_get_symbol(state, module_info_name);
+            module_list[mod].config = module_get_linked_symbol(state, module_info_name);
 
             /* check if the module symbol is defined. simple check for valid memory address just in case. */
             if((uint32_t)module_list[mod].info > 0x1000)
@@ -551,14 +1328,22 @@ static void _module_load_all(uint32_t list_only)
     }
 
     module_update_core_symbols(state);
+    module_cache_free();
     
     #ifdef CONFIG_TCC_UNLOAD
-    tcc_delete(state);
+    if (state) tcc_delete(state);
+    core_symtab_release();
     #else
     module_state = state;
     #endif
     
-    printf("Modules loaded\n");
+    module_load_times.init = module_lap(&t);
+    module_load_times.total = t - t0;
+    printf("Modules loaded (%d ms%s)\n", module_load_times.total, module_load_times.cached ? ", prelinked" : "");
+    printf("  scan %d, sym %d, load %d, link %d, init %d ms\n",
+        module_load_times.scan, module_load_times.symbols, module_load_times.load,
+        module_load_times.link, module_load_times.init
+    );
 }
 
 static void _module_unload_all(void)
@@ -597,13 +1382,10 @@ void* module_load(char *filename)
     int ret = -1;
     TCCState *state = NULL;
 
-    state = tcc_new();
-    tcc_set_options(state, "-nostdlib");
-
-    if(module_load_symbols(state, MAGIC_SYMBOLS) < 0)
+    state = module_new_linker();
+    if(!state)
     {
         NotifyBox(2000, "Missing symbol file: " MAGIC_SYMBOLS );
-        tcc_delete(state);
         return NULL;
     }
 
@@ -611,16 +1393,28 @@ void* module_load(char *filename)
     if(ret < 0)
     {
         tcc_delete(state);
+        #ifdef CONFIG_TCC_UNLOAD
+        core_symtab_release();
+        #endif
         return NULL;
     }
 
     ret = tcc_relocate(state, TCC_RELOCATE_AUTO);
+
     if(ret < 0)
     {
         tcc_delete(state);
+        #ifdef CONFIG_TCC_UNLOAD
+        core_symtab_release();
+        #endif
         return NULL;
     }
 
+    #ifdef CONFIG_TCC_UNLOAD
+    /* module_get_symbol falls back to core symbols; keep them until module_unload */
+    core_symtab_users++;
+    #endif
+
     return (void*)state;
 }
 
@@ -633,7 +1427,7 @@ unsigned int module_get_symbol(void *module, char *symbol)
     
     TCCState *state = (TCCState *)module;
     
-    return (int) tcc_get_symbol(state, symbol);
+    return (int) module_lookup_symbol(state, symbol);
 }
 
 int module_exec(void *module, char *symbol, int count, ...)
@@ -712,6 +1506,13 @@ int module_unload(void *module)
 {
     TCCState *state = (TCCState *)module;
     tcc_delete(state);
+
+    #ifdef CONFIG_TCC_UNLOAD
+    if (core_symtab_users && --core_symtab_users == 0)
+    {
+        core_symtab_free();
+    }
+    #endif
     return 0;
 }
 
@@ -1619,6 +2420,21 @@ static struct menu_entry module_menu[] = {
     MODULE_ENTRY(63)
 };
 
+static MENU_UPDATE_FUNC(module_load_times_update)
+{
+    if (!module_load_times.total)
+    {
+        MENU_SET_VALUE("N/A");
+        return;
+    }
+
+    MENU_SET_VALUE("%d ms%s", module_load_times.total, module_load_times.cached ? " (prelinked)" : "");
+    MENU_SET_HELP("Scan %d, symbols %d, load %d, link %d, init %d ms.",
+        module_load_times.scan, module_load_times.symbols, module_load_times.load,
+        module_load_times.link, module_load_times.init
+    );
+}
+
 static struct menu_entry module_debug_menu[] = {
     {
         .name = "Show console",
@@ -1645,6 +2461,19 @@ static struct menu_entry module_debug_menu[] = {
                 .max = 1,
                 .help = "Load modules even after camera crashed and you took battery out.",
             },
+            {
+                .name = "Prelinked modules",
+                .priv = &module_cache_enabled,
+                .max = 1,
+                .help = "Reuse the modules linked at previous boot, if nothing changed.",
+                .help2 = "Saved in " MODULE_CACHE_FILE ". Faster startup.",
+            },
+            {
+                .name = "Load times",
+                .update = module_load_times_update,
+                .icon_type = IT_ALWAYS_ON,
+                .help = "Time spent loading modules at startup.",
+            },
             MENU_EOL,
         },
     },
@@ -1753,6 +2582,8 @@ static void module_load_task(void* unused)
         if(!module_ignore_crashes && FIO_GetFileSize( module_lockfile, &size ) == 0 )
         {
             /* uh, it seems the camera didnt shut down cleanly, skip module loading this time */
+            /* also link from scratch next time, in case the prelinked image was the culprit */
+            FIO_RemoveFile(MODULE_CACHE_FILE);
             msleep(1000);
             NotifyBox(10000, "Camera was not shut down cleanly.\r\nSkipping module loading." );
         }
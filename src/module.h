@@ -185,6 +185,8 @@ typedef struct
     int enabled;
     int error;
     int is_core;
+    uint32_t file_size;         /* .mo size and timestamp, for validating the prelinked cache */
+    uint32_t file_timestamp;
 } module_entry_t;
 
 
@@ -302,6 +304,29 @@ int module_send_keypress(int module_key);
 int module_display_filter_enabled();
 int module_display_filter_update();
 
+/* relocations recorded while TCC links code into a buffer, so the linked image
+ * can be saved and moved to another address later (module cache, script cache) */
+struct reloc_fixups
+{
+    uint32_t base;              /* address of the linked image */
+    uint32_t size;
+    uint32_t * fixups;
+    int count;
+    int max;
+    int unsupported;            /* set if the image can't be moved safely; don't save it */
+};
+
+/* for tcc_set_reloc_func, with a struct reloc_fixups * as opaque */
+void reloc_fixups_record(void * opaque, int type, unsigned long addr, unsigned long val);
+
+/* call once the image is in place, before saving the fixups */
+void reloc_fixups_check_branches(struct reloc_fixups * fx);
+
+/* move a saved image from old_base to its new address; returns 0 if it can't be moved */
+int reloc_fixups_apply(void * image, uint32_t image_size, uint32_t old_base, const uint32_t * fixups, int count);
+
+void reloc_fixups_free(struct reloc_fixups * fx);
+
 struct module_symbol_entry
 {
     const char * name;
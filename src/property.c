@@ -19,6 +19,7 @@
 #include "dryos.h"
 #include "property.h"
 #include "bmp.h"
+#include "menu.h"
 
 extern struct prop_handler _prop_handlers_start[];
 extern struct prop_handler _prop_handlers_end[];
@@ -31,6 +32,44 @@ static int actual_num_properties = 0;
 static struct prop_handler property_handlers[256];
 static unsigned property_list[256];
 
+/* Per-property handler index, rebuilt when handlers are (re)registered.
+ * Canon fires hundreds of property events per second in some cases
+ * (mode changes, LiveView start, lens communication), so we look up
+ * the property with a binary search rather than scanning all handlers.
+ * Two copies: one is used by the property task while the other is rebuilt.
+ */
+struct prop_index_entry
+{
+    unsigned property;
+    uint16_t first;             /* first handler, in prop_index.handlers */
+    uint8_t  count;             /* number of handlers for this property */
+    uint8_t  list_pos;          /* position in property_list (also used for prop_stats) */
+};
+
+struct prop_index
+{
+    int num_entries;
+    struct prop_index_entry entries[COUNT(property_list)];
+    uint8_t handlers[COUNT(property_handlers)];     /* positions in property_handlers */
+};
+
+static struct prop_index prop_indexes[2];
+static struct prop_index * volatile prop_index = NULL; /* NULL = not valid, use linear search */
+static struct prop_index * prop_index_last = NULL;     /* last one published; may still be in use */
+
+/* positions in property_list + 1, hashed by property (open addressing), to skip duplicates when adding */
+static uint16_t prop_list_hash[2 * COUNT(property_list)];
+
+/* per-property statistics (same order as property_list) */
+struct prop_stats
+{
+    uint32_t hits;
+    uint32_t total_us;
+    uint32_t max_us;
+};
+
+static struct prop_stats prop_stats[COUNT(property_list)];
+
 /* the token is needed for unregistering handlers and property cleanup */
 static void global_token_handler(void * token)
 {
@@ -39,6 +78,109 @@ static void global_token_handler(void * token)
 
 //~ static int current_prop_handler = 0;
 
+static struct prop_index_entry * prop_index_find(struct prop_index * index, unsigned property)
+{
+    int lo = 0;
+    int hi = index->num_entries - 1;
+
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        unsigned p = index->entries[mid].property;
+        if (p == property)
+        {
+            return &index->entries[mid];
+        }
+        if (p < property)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    return NULL;
+}
+
+/* slot of property in prop_list_hash, or the empty slot where it would go */
+static int prop_list_hash_slot(unsigned property)
+{
+    int mask = COUNT(prop_list_hash) - 1;
+    int i = ((property * 0x9E3779B1) >> 16) & mask;
+
+    while (prop_list_hash[i] && property_list[prop_list_hash[i] - 1] != property)
+    {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+/* build the property index in the copy not published last, then switch to it */
+/* (prop_index may be NULL meanwhile, but the property task may still be walking the last copy) */
+static void prop_index_rebuild()
+{
+    struct prop_index * index = (prop_index_last == &prop_indexes[0]) ? &prop_indexes[1] : &prop_indexes[0];
+    int num_properties = MIN(actual_num_properties, COUNT(property_list));
+    int num_handlers = MIN(actual_num_handlers, COUNT(property_handlers));
+
+    /* sort the properties (insertion sort; the list is small and rebuilt rarely) */
+    for (int i = 0; i < num_properties; i++)
+    {
+        struct prop_index_entry e = { .property = property_list[i], .list_pos = i };
+        int j = i;
+        while (j > 0 && index->entries[j-1].property > e.property)
+        {
+            index->entries[j] = index->entries[j-1];
+            j--;
+        }
+        index->entries[j] = e;
+    }
+    index->num_entries = num_properties;
+
+    /* group the handlers by property, keeping their registration order */
+    int n = 0;
+    for (int i = 0; i < num_properties; i++)
+    {
+        struct prop_index_entry * e = &index->entries[i];
+        e->first = n;
+        e->count = 0;
+        for (int h = 0; h < num_handlers; h++)
+        {
+            if (property_handlers[h].property == e->property)
+            {
+                index->handlers[n++] = h;
+                e->count++;
+            }
+        }
+    }
+
+    prop_index_last = index;
+    prop_index = index;
+}
+
+static void prop_run_handler(struct prop_handler * handler, unsigned property, void * priv, void * buf, unsigned len)
+{
+    /* cache length of property if not set yet */
+    if (handler->property_length == 0)
+    {
+        handler->property_length = len;
+    }
+
+    /* signal that our property handler has fired */
+    handler->property_ack = 1;
+
+    /* execute handler, if any */
+    if (handler->handler != NULL)
+    {
+        //~ current_prop_handler = property;
+        handler->handler(property, priv, buf, len);
+        //~ current_prop_handler = 0;
+    }
+}
+
 static void *
 global_property_handler(
     unsigned        property,
@@ -54,27 +196,38 @@ global_property_handler(
     if (property == 0x80010001) return (void*)_prop_cleanup(global_token, property);
 #endif
 
-    for (int entry = 0; entry < actual_num_handlers; entry++)
-    {
-        struct prop_handler *handler = &property_handlers[entry];
+    struct prop_index * index = prop_index;
 
-        if (handler->property == property)
+    if (index)
+    {
+        struct prop_index_entry * e = prop_index_find(index, property);
+        if (e)
         {
-            /* cache length of property if not set yet */
-            if (handler->property_length == 0)
+            uint32_t t0 = get_us_clock();
+
+            for (int i = 0; i < e->count; i++)
             {
-                handler->property_length = len;
+                struct prop_handler *handler = &property_handlers[index->handlers[e->first + i]];
+                prop_run_handler(handler, property, priv, buf, len);
             }
 
-            /* signal that our property handler has fired */
-            handler->property_ack = 1;
+            uint32_t dt = (uint32_t) get_us_clock() - t0;
+            struct prop_stats * stats = &prop_stats[e->list_pos];
+            stats->hits++;
+            stats->total_us += dt;
+            stats->max_us = MAX(stats->max_us, dt);
+        }
+    }
+    else
+    {
+        /* handlers were added, but not yet re-registered */
+        for (int entry = 0; entry < actual_num_handlers; entry++)
+        {
+            struct prop_handler *handler = &property_handlers[entry];
 
-            /* execute handler, if any */
-            if (handler->handler != NULL)
+            if (handler->property == property)
             {
-                //~ current_prop_handler = property;
-                handler->handler(property, priv, buf, len);
-                //~ current_prop_handler = 0;
+                prop_run_handler(handler, property, priv, buf, len);
             }
         }
     }
@@ -87,24 +240,19 @@ void prop_add_handler (uint32_t property, void *handler)
 #if defined(POSITION_INDEPENDENT)
     handler[entry].handler = PIC_RESOLVE(handler[entry].handler);
 #endif
+    /* use the linear search until prop_update_registration */
+    prop_index = NULL;
+
     property_handlers[actual_num_handlers].handler = handler;
     property_handlers[actual_num_handlers].property = property;
     actual_num_handlers++;
 
-    int duplicate = 0;
-    for (int i = 0; i < actual_num_properties; i++)
-    {
-        if (property_list[i] == property)
-        {
-            duplicate = 1;
-            break;
-        }
-    }
-
-    if (!duplicate)
+    int slot = prop_list_hash_slot(property);
+    if (!prop_list_hash[slot] && actual_num_properties < COUNT(property_list))
     {
         property_list[actual_num_properties] = property;
         actual_num_properties++;
+        prop_list_hash[slot] = actual_num_properties;
     }
     if (actual_num_properties >= COUNT(property_list))
     {
@@ -141,6 +289,8 @@ prop_unregister_handlers()
 static void
 prop_register_handlers()
 {
+    prop_index_rebuild();
+
     if (global_token == NULL)
     {
         prop_register_slave(
@@ -158,8 +308,11 @@ void
 prop_reset_registration()
 {
     prop_unregister_handlers();
+    prop_index = NULL;
     actual_num_properties = 0;
     actual_num_handlers = 0;
+    memset(prop_list_hash, 0, sizeof(prop_list_hash));
+    memset(prop_stats, 0, sizeof(prop_stats));
     prop_add_internal_handlers();
     prop_register_handlers();
 }
@@ -235,31 +388,47 @@ int _get_prop_len(int prop)
     return len;
 }*/
 
-/* return cached length of property */
-static uint32_t prop_get_prop_len(uint32_t property)
+/* first handler for this property, if any */
+static struct prop_handler * prop_find_handler(uint32_t property)
 {
+    struct prop_index * index = prop_index;
+
+    if (index)
+    {
+        struct prop_index_entry * e = prop_index_find(index, property);
+        return (e && e->count) ? &property_handlers[index->handlers[e->first]] : NULL;
+    }
+
     for (int entry = 0; entry < actual_num_handlers; entry++)
     {
-        struct prop_handler *handler = &property_handlers[entry];
-        if (handler->property == property)
+        if (property_handlers[entry].property == property)
         {
-            return handler->property_length;
+            return &property_handlers[entry];
         }
     }
 
+    return NULL;
+}
+
+/* return cached length of property */
+static uint32_t prop_get_prop_len(uint32_t property)
+{
+    struct prop_handler * first = prop_find_handler(property);
+    if (first)
+    {
+        return first->property_length;
+    }
+
     return 0;
 }
 
 /* return the acknowledge flag (set if the handler was executed) */
 static uint32_t prop_get_ack(uint32_t property)
 {
-    for (int entry = 0; entry < actual_num_handlers; entry++)
+    struct prop_handler * first = prop_find_handler(property);
+    if (first)
     {
-        struct prop_handler *handler = &property_handlers[entry];
-        if (handler->property == property)
-        {
-            return handler->property_ack;
-        }
+        return first->property_ack;
     }
 
     return 0;
@@ -376,6 +545,71 @@ int prop_request_change_wait(unsigned property, const void* addr, size_t len, in
     return 0;
 }
 
+#ifdef FEATURE_SHOW_PROP_STATS
+/* Debug menu: properties that fired most often, and how long their handlers took */
+MENU_UPDATE_FUNC(prop_stats_print)
+{
+    if (!info->can_custom_draw) return;
+
+    info->custom_drawing = CUSTOM_DRAW_THIS_MENU;
+
+    if (entry->selected)
+    {
+        bmp_fill(38, 0, 0, 720, 480);
+    }
+
+    int x = 5;
+    int y = 5;
+    uint32_t font = SHADOW_FONT(FONT(FONT_MONO_20, COLOR_WHITE, 38));
+
+    bmp_printf(font, x, y, "Property    Handlers    Hits  Total ms  Avg us  Max us");
+    y += font_med.height;
+
+    struct prop_index * index = prop_index;
+    if (!index)
+    {
+        bmp_printf(font, x, y, "Property index not valid (handlers not registered yet).");
+        return;
+    }
+
+    /* busiest properties first (selection sort on the fly; we only show a few) */
+    static uint8_t shown[COUNT(property_list)];
+    memset(shown, 0, sizeof(shown));
+
+    for (int row = 0; row < 18; row++)
+    {
+        struct prop_index_entry * best = NULL;
+        for (int i = 0; i < index->num_entries; i++)
+        {
+            struct prop_index_entry * e = &index->entries[i];
+            if (!shown[e->list_pos] && prop_stats[e->list_pos].hits &&
+                (!best || prop_stats[e->list_pos].hits > prop_stats[best->list_pos].hits))
+            {
+                best = e;
+            }
+        }
+
+        if (!best)
+        {
+            break;
+        }
+
+        shown[best->list_pos] = 1;
+        struct prop_stats * stats = &prop_stats[best->list_pos];
+        bmp_printf(font, x, y, "%08x    %8d %7d  %8d  %6d  %6d",
+            best->property, best->count, stats->hits,
+            stats->total_us / 1000, stats->total_us / stats->hits, stats->max_us
+        );
+        y += 22;
+    }
+}
+
+MENU_SELECT_FUNC(prop_stats_reset)
+{
+    memset(prop_stats, 0, sizeof(prop_stats));
+}
+#endif
+
 /**
  * For new ports, disable this function on first boots (although it should be pretty much harmless).
  */
@@ -265,6 +265,428 @@ int rbf_strlen_clipped(font *rbf_font, const char *str, int maxlen) {
 }
 
 //-------------------------------------------------------------------
+// Glyph cache
+//
+// Expanding 1-bpp font data pixel by pixel is slow, and most strings
+// (menus, info bars) are redrawn over and over with the same colors.
+// Expanded glyphs are stored in a small atlas (bump allocator, flushed
+// when full) and indexed by a direct-mapped hash table.
+//
+// Blitting uses 32-bit stores into the BMP buffer (not available on
+// VxWorks cameras, where the BMP buffer is 4 bpp).
+
+#ifndef CONFIG_VXWORKS
+#define CONFIG_GLYPH_CACHE
+#endif
+
+#ifdef CONFIG_GLYPH_CACHE
+
+#define GLYPH_CACHE_ENTRIES 512          /* power of 2 */
+#define GLYPH_ATLAS_SIZE    (64*1024)
+
+static struct glyph glyph_cache[GLYPH_CACHE_ENTRIES];
+static uint8_t * glyph_atlas = 0;
+static int glyph_atlas_used = 0;
+static uint32_t glyph_atlas_gen = 0;    /* incremented whenever the atlas starts over */
+static int glyph_cache_enabled = 1;
+
+static inline uint32_t glyph_hash(struct glyph * g)
+{
+    uint32_t h = (uint32_t) g->font;
+    h ^= h >> 7;
+    h += g->ch * 0x9E3779B1;
+    h ^= (g->fg << 8) | (g->bg << 16) | (g->flags << 24);
+    h ^= h >> 13;
+    return h & (GLYPH_CACHE_ENTRIES - 1);
+}
+
+static inline int glyph_key_equal(struct glyph * a, struct glyph * b)
+{
+    return a->font == b->font && a->ch == b->ch &&
+           a->fg == b->fg && a->bg == b->bg && a->flags == b->flags;
+}
+
+int glyph_cache_lookup(struct glyph * g)
+{
+    if (!glyph_cache_enabled)
+    {
+        return 0;
+    }
+
+    struct glyph * e = &glyph_cache[glyph_hash(g)];
+
+    /* entries may be replaced from other tasks; copy while interrupts are off */
+    uint32_t old = cli();
+    int hit = e->pix && glyph_key_equal(e, g);
+    if (hit) *g = *e;
+    sei(old);
+
+    return hit;
+}
+
+int glyph_cache_reserve(struct glyph * g, int with_mask)
+{
+    if (!glyph_cache_enabled)
+    {
+        return 0;
+    }
+
+    if (!glyph_atlas)
+    {
+        glyph_atlas = malloc(GLYPH_ATLAS_SIZE);
+        if (!glyph_atlas)
+        {
+            glyph_cache_enabled = 0;
+            return 0;
+        }
+    }
+
+    int size = g->w * g->h;
+    int total = (with_mask ? 2 * size : size);
+    total = (total + 3) & ~3;
+    if (total == 0 || total > GLYPH_ATLAS_SIZE / 16)
+    {
+        return 0;
+    }
+
+    uint32_t old = cli();
+    if (glyph_atlas_used + total > GLYPH_ATLAS_SIZE)
+    {
+        /* atlas full: start over */
+        /* a glyph being blitted from another task may show garbage for one frame; that's all */
+        memset(glyph_cache, 0, sizeof(glyph_cache));
+        glyph_atlas_used = 0;
+        glyph_atlas_gen++;
+    }
+    g->pix = glyph_atlas + glyph_atlas_used;
+    g->mask = with_mask ? g->pix + size : 0;
+    g->gen = glyph_atlas_gen;
+    glyph_atlas_used += total;
+    sei(old);
+
+    return 1;
+}
+
+void glyph_cache_commit(struct glyph * g)
+{
+    struct glyph * e = &glyph_cache[glyph_hash(g)];
+    uint32_t old = cli();
+    /* if the atlas was reset after g was reserved, its space may be handed out again: don't index it */
+    if (g->gen == glyph_atlas_gen)
+    {
+        *e = *g;
+    }
+    sei(old);
+}
+
+void glyph_cache_flush()
+{
+    uint32_t old = cli();
+    memset(glyph_cache, 0, sizeof(glyph_cache));
+    glyph_atlas_used = 0;
+    glyph_atlas_gen++;
+    sei(old);
+}
+
+void glyph_cache_enable(int enable)
+{
+    glyph_cache_flush();
+    glyph_cache_enabled = enable;
+}
+
+/* copy a w x h block of 8-bpp pixels, using aligned 32-bit stores where possible */
+/* mask (optional): 0xFF = copy the pixel, 0 = keep the destination */
+static void FAST blit_8bpp(uint8_t * dst, int dst_pitch, const uint8_t * pix, const uint8_t * mask, int src_pitch, int w, int h)
+{
+    for (int y = 0; y < h; y++)
+    {
+        uint8_t * d = dst + y * dst_pitch;
+        const uint8_t * p = pix + y * src_pitch;
+        const uint8_t * m = mask ? mask + y * src_pitch : 0;
+        int x = 0;
+
+        /* leading pixels, until the destination is word-aligned */
+        while (x < w && ((uintptr_t)(d + x) & 3))
+        {
+            if (!m || m[x]) d[x] = p[x];
+            x++;
+        }
+
+        /* whole words (source may be unaligned, so assemble it from bytes) */
+        if (m)
+        {
+            for ( ; x + 4 <= w; x += 4)
+            {
+                uint32_t mw = m[x] | (m[x+1] << 8) | (m[x+2] << 16) | (m[x+3] << 24);
+                if (!mw) continue;
+                uint32_t pw = p[x] | (p[x+1] << 8) | (p[x+2] << 16) | (p[x+3] << 24);
+                uint32_t * dw = (uint32_t *)(d + x);
+                *dw = (*dw & ~mw) | (pw & mw);
+            }
+        }
+        else
+        {
+            for ( ; x + 4 <= w; x += 4)
+            {
+                *(uint32_t *)(d + x) = p[x] | (p[x+1] << 8) | (p[x+2] << 16) | (p[x+3] << 24);
+            }
+        }
+
+        /* trailing pixels */
+        for ( ; x < w; x++)
+        {
+            if (!m || m[x]) d[x] = p[x];
+        }
+    }
+}
+
+void FAST glyph_blit(uint8_t * bvram, int x, int y, struct glyph * g)
+{
+    x += g->xo;
+    y += g->yo;
+
+    /* same vertical clipping as the pixel-by-pixel renderer */
+    if (y <= BMP_H_MINUS) return;
+    int h = MIN(g->h, BMP_H_PLUS - y);
+    if (h <= 0) return;
+
+    /* horizontally, clip at the edges of the BMP buffer */
+    int x0 = MAX(0, BMP_W_MINUS - x);
+    int w = MIN(g->w, BMP_W_PLUS - x) - x0;
+    if (w <= 0) return;
+
+    blit_8bpp(&bvram[x + x0 + y * BMPPITCH], BMPPITCH, g->pix + x0, g->mask ? g->mask + x0 : 0, g->w, w, h);
+}
+
+/* expand a RBF character into g->pix (and g->mask, for shadow fonts) */
+static void rbf_render_glyph(font *rbf_font, char *cdata, struct glyph * g)
+{
+    int width = rbf_font->width;
+    int height = g->h;
+    int x0 = g->xo;
+    int pixel_width = g->w + x0;
+
+    for (int yy = 0; yy < height; yy++)
+    {
+        for (int xx = x0; xx < pixel_width; xx++)
+        {
+            int px = cdata[yy*width/8+xx/8] & (1<<(xx%8));
+            int i = yy * g->w + xx - x0;
+
+            if (!g->mask)
+            {
+                g->pix[i] = px ? g->fg : g->bg;
+                continue;
+            }
+
+            /* shadow: foreground pixels, plus background pixels near a foreground pixel */
+            int near = 0;
+            if (!px)
+            {
+                for (int xxx = MAX(xx-1, 0); xxx <= MIN(xx+1, pixel_width-1) && !near; xxx++)
+                {
+                    for (int yyy = MAX(yy-1, 0); yyy <= MIN(yy+1, height-1); yyy++)
+                    {
+                        if (cdata[yyy*width/8+xxx/8] & (1<<(xxx%8)))
+                        {
+                            near = 1;
+                            break;
+                        }
+                    }
+                }
+            }
+            g->pix[i] = px ? g->fg : g->bg;
+            g->mask[i] = (px || near) ? 0xFF : 0;
+        }
+    }
+}
+
+/* find or create the cached glyph for a RBF character */
+/* scratch (optional): where to render the glyph if it can't be cached */
+static int rbf_get_glyph(font *rbf_font, int ch, int fontspec, struct glyph * g, uint8_t * scratch)
+{
+    char* cdata = rbf_font_char(rbf_font, ch);
+    if (!cdata)
+    {
+        return 0;
+    }
+
+    g->font = rbf_font;
+    g->ch = ch;
+    g->fg = FG_COLOR(fontspec);
+    g->bg = BG_COLOR(fontspec);
+    g->flags = (fontspec & SHADOW_MASK) ? GLYPH_SHADOW : (fontspec & FONT_CONDENSED) ? GLYPH_CONDENSED : 0;
+
+    if (glyph_cache_lookup(g))
+    {
+        return 1;
+    }
+
+    /* condensed: the first column is not drawn (the shadow renderer ignores this flag) */
+    int x0 = (g->flags & GLYPH_CONDENSED) ? 1 : 0;
+    g->xo = x0;
+    g->yo = 0;
+    g->w = MAX(rbf_font->wTable[ch] - x0, 0);
+    g->h = rbf_font->hdr.height;
+
+    if (!glyph_cache_reserve(g, g->flags & GLYPH_SHADOW))
+    {
+        if (!scratch)
+        {
+            return 0;
+        }
+        g->pix = scratch;
+        g->mask = (g->flags & GLYPH_SHADOW) ? scratch + g->w * g->h : 0;
+        rbf_render_glyph(rbf_font, cdata, g);
+        return 1;
+    }
+
+    rbf_render_glyph(rbf_font, cdata, g);
+    glyph_cache_commit(g);
+    return 1;
+}
+
+/* get the glyph for any character (RBF or Canon font) */
+static int get_glyph(font *rbf_font, int ch, int fontspec, struct glyph * g, uint8_t * scratch)
+{
+    if (rbf_font->cTable)
+    {
+        return rbf_get_glyph(rbf_font, ch, fontspec, g, scratch);
+    }
+
+    g->font = 0;
+    g->ch = ch;
+    g->fg = FG_COLOR(fontspec);
+    g->bg = NO_BG_ERASE;
+    g->flags = GLYPH_BFNT;
+    return bfnt_render_glyph(g, scratch);
+}
+
+/* largest glyph box: Canon font is up to 100x50, RBF up to 255 x height */
+#define GLYPH_SCRATCH_SIZE(f) (2 * 256 * MAX((f)->hdr.height, 50))
+
+struct bmp_text * rbf_render_string(font *rbf_font, const char *str, int fontspec)
+{
+    int height = rbf_font->hdr.height;
+    int w = rbf_str_width(rbf_font, str);
+    int h = height;
+    for (const char * c = str; *c; c++)
+    {
+        if (*c == '\n') h += height;
+    }
+
+    if (w <= 0 || h <= 0)
+    {
+        return 0;
+    }
+
+    struct bmp_text * text = malloc(sizeof(struct bmp_text));
+    uint8_t * scratch = 0;
+    if (!text)
+    {
+        return 0;
+    }
+
+    text->w = w;
+    text->h = h;
+    text->pix = malloc(2 * w * h);
+    if (!text->pix)
+    {
+        free(text);
+        return 0;
+    }
+    text->mask = text->pix + w * h;
+    memset(text->pix, 0, 2 * w * h);
+
+    /* Canon font: each character erases its own background (see bfnt_draw_char) */
+    int bfnt_bg = (!rbf_font->cTable && BG_COLOR(fontspec) != NO_BG_ERASE);
+
+    int x = 0, y = 0;
+    for (const char * c = str; *c; c++)
+    {
+        if (*c == '\n')
+        {
+            x = 0;
+            y += height;
+            continue;
+        }
+
+        int cw = rbf_char_width(rbf_font, *c);
+
+        if (bfnt_bg)
+        {
+            for (int yy = y; yy < y + height; yy++)
+            {
+                memset(&text->pix[yy * w + x], BG_COLOR(fontspec), MIN(cw, w - x));
+                memset(&text->mask[yy * w + x], 0xFF, MIN(cw, w - x));
+            }
+        }
+
+        struct glyph g;
+        int ok = get_glyph(rbf_font, *c, fontspec, &g, 0);
+        if (!ok)
+        {
+            /* cache disabled or glyph too large; render it outside the cache */
+            if (!scratch) scratch = malloc(GLYPH_SCRATCH_SIZE(rbf_font));
+            if (scratch) ok = get_glyph(rbf_font, *c, fontspec, &g, scratch);
+        }
+
+        if (ok)
+        {
+            /* copy the glyph into the text buffer, clipped */
+            for (int yy = MAX(0, -(y + g.yo)); yy < g.h && y + g.yo + yy < h; yy++)
+            {
+                for (int xx = MAX(0, -(x + g.xo)); xx < g.w && x + g.xo + xx < w; xx++)
+                {
+                    int i = yy * g.w + xx;
+                    if (!g.mask || g.mask[i])
+                    {
+                        int j = (y + g.yo + yy) * w + (x + g.xo + xx);
+                        text->pix[j] = g.pix[i];
+                        text->mask[j] = 0xFF;
+                    }
+                }
+            }
+        }
+
+        x += cw;
+    }
+
+    if (scratch) free(scratch);
+    return text;
+}
+
+void rbf_draw_text(struct bmp_text * text, int x, int y)
+{
+    uint8_t * bvram = bmp_vram();
+    if (!bvram || !text) return;
+
+    if (y <= BMP_H_MINUS) return;
+    int h = MIN(text->h, BMP_H_PLUS - y);
+    if (h <= 0) return;
+
+    int x0 = MAX(0, BMP_W_MINUS - x);
+    int w = MIN(text->w, BMP_W_PLUS - x) - x0;
+    if (w <= 0) return;
+
+    blit_8bpp(&bvram[x + x0 + y * BMPPITCH], BMPPITCH, text->pix + x0, text->mask + x0, text->w, w, h);
+}
+
+#else /* CONFIG_GLYPH_CACHE */
+
+int glyph_cache_lookup(struct glyph * g) { return 0; }
+int glyph_cache_reserve(struct glyph * g, int with_mask) { return 0; }
+void glyph_cache_commit(struct glyph * g) { }
+void glyph_blit(uint8_t * bvram, int x, int y, struct glyph * g) { }
+void glyph_cache_enable(int enable) { }
+void glyph_cache_flush() { }
+struct bmp_text * rbf_render_string(font *rbf_font, const char *str, int fontspec) { return 0; }
+void rbf_draw_text(struct bmp_text * text, int x, int y) { }
+
+#endif /* CONFIG_GLYPH_CACHE */
+
+//-------------------------------------------------------------------
+// Pixel-by-pixel renderers (used when the glyph cache is not available)
 static void FAST font_draw_char(font *rbf_font, int x, int y, char *cdata, int width, int height, int pixel_width, int fontspec) {
     int xx, yy;
     uint8_t * bmp = bmp_vram();
@@ -335,8 +757,16 @@ static int FAST rbf_draw_char(font *rbf_font, int x, int y, int ch, int fontspec
     // Get char data pointer
     char* cdata = rbf_font_char(rbf_font, ch);
     
+#ifdef CONFIG_GLYPH_CACHE
+    struct glyph g;
+#endif
+
     if (!rbf_font->cTable)
         bfnt_draw_char(ch, x, y, FG_COLOR(fontspec), BG_COLOR(fontspec));
+#ifdef CONFIG_GLYPH_CACHE
+    else if (rbf_get_glyph(rbf_font, ch, fontspec, &g, 0))
+        glyph_blit(bmp_vram(), x, y, &g);
+#endif
     else if (fontspec & SHADOW_MASK)
         font_draw_char_shadow(rbf_font, x, y, cdata, rbf_font->width, rbf_font->hdr.height, rbf_font->wTable[ch], fontspec);
     else
@@ -66,6 +66,44 @@ extern int rbf_strlen_clipped(font *rbf_font, const char *str, int maxlen);
 extern int rbf_draw_string(font *rbf_font, int x, int y, const char *str, int cl);
 //-------------------------------------------------------------------
 
+// Glyph cache: characters pre-expanded to 8-bpp pixels, ready to be blitted
+// Key: (font, char, fg, bg, flags); the Canon font (bfnt) uses font = 0.
+#define GLYPH_SHADOW        1
+#define GLYPH_CONDENSED     2
+#define GLYPH_BFNT          4
+
+struct glyph {
+    const void * font;          // RBF font, or 0 for Canon font
+    int ch;
+    uint8_t fg, bg;
+    uint8_t flags;              // GLYPH_*
+    uint8_t w, h;               // size of the pixel box
+    int8_t xo, yo;              // position of the pixel box, relative to the drawing point
+    uint8_t * pix;              // w*h pixels, 8 bpp
+    uint8_t * mask;             // w*h bytes, 0xFF = opaque, 0 = transparent; null if fully opaque
+    uint32_t gen;               // atlas generation of pix/mask (set by glyph_cache_reserve)
+};
+
+// private functions for bmp.c
+// glyph_cache_lookup: fill the key fields of g, then call; returns 1 on hit (g filled in)
+// glyph_cache_reserve: on miss, fill w/h/xo/yo and call it; render into g->pix / g->mask, then commit
+// (the commit is dropped if the atlas was reset in the meantime)
+extern int glyph_cache_lookup(struct glyph * g);
+extern int glyph_cache_reserve(struct glyph * g, int with_mask);
+extern void glyph_cache_commit(struct glyph * g);
+extern void glyph_blit(uint8_t * bvram, int x, int y, struct glyph * g);
+extern int bfnt_render_glyph(struct glyph * g, uint8_t * scratch);   // bmp.c
+
+// pre-rendered strings (see bmp_text_render)
+struct bmp_text;
+extern struct bmp_text * rbf_render_string(font *rbf_font, const char *str, int fontspec);
+extern void rbf_draw_text(struct bmp_text * text, int x, int y);
+
+// for benchmarking
+extern void glyph_cache_enable(int enable);
+extern void glyph_cache_flush();
+//-------------------------------------------------------------------
+
 /* to be called at startup, before init funcs */
 void _load_fonts();
 
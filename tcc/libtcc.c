@@ -958,6 +958,20 @@ LIBTCCAPI void *tcc_get_section_ptr(TCCState *s, const char *name, int* size)
     return NULL;
 }
 
+LIBTCCAPI void tcc_set_reloc_func(TCCState *s, void *reloc_opaque,
+    void (*reloc_func)(void *opaque, int type, unsigned long addr, unsigned long val))
+{
+    s->reloc_opaque = reloc_opaque;
+    s->reloc_func = reloc_func;
+}
+
+LIBTCCAPI void tcc_set_resolve_func(TCCState *s, void *resolve_opaque,
+    void *(*resolve_func)(void *opaque, const char *name))
+{
+    s->resolve_opaque = resolve_opaque;
+    s->resolve_func = resolve_func;
+}
+
 static int tcc_add_library_internal(TCCState *s, const char *fmt,
     const char *filename, int flags, char **paths, int nb_paths)
 {
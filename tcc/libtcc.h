@@ -96,6 +96,19 @@ LIBTCCAPI void *tcc_get_symbol(TCCState *s, const char *name);
 /* return a reference to section data area */
 LIBTCCAPI void *tcc_get_section_ptr(TCCState *s, const char *name, int* size);
 
+/* set a callback invoked by tcc_relocate() for every relocation it applies
+   (type is the ELF relocation type, addr the patched address at the final
+   location, val the resolved symbol value) */
+LIBTCCAPI void tcc_set_reloc_func(TCCState *s, void *reloc_opaque,
+    void (*reloc_func)(void *opaque, int type, unsigned long addr, unsigned long val));
+
+/* set a callback used by tcc_relocate() to resolve undefined symbols
+   (tried before the built-in table; return NULL if not found). A global
+   definition of a symbol it knows is an error ("defined twice"), a weak
+   or hidden one is replaced by the callback's address. */
+LIBTCCAPI void tcc_set_resolve_func(TCCState *s, void *resolve_opaque,
+    void *(*resolve_func)(void *opaque, const char *name));
+
 #ifdef __cplusplus
 }
 #endif
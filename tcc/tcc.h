@@ -660,6 +660,14 @@ struct TCCState {
 # endif
 #endif
 
+    /* relocation callback (see tcc_set_reloc_func) */
+    void *reloc_opaque;
+    void (*reloc_func)(void *opaque, int type, unsigned long addr, unsigned long val);
+
+    /* undefined symbol resolver (see tcc_set_resolve_func) */
+    void *resolve_opaque;
+    void *(*resolve_func)(void *opaque, const char *name);
+
     /* used by main and tcc_parse_args only */
     char **files; /* files seen on command line */
     int nb_files; /* number thereof */
@@ -436,7 +436,9 @@ ST_FUNC void relocate_syms(TCCState *s1, int do_resolve)
 #if defined TCC_IS_NATIVE && !defined _WIN32
                 void *addr;
                 name = symtab_section->link->data + sym->st_name;
-                addr = resolve_sym(s1, name);
+                addr = s1->resolve_func ? s1->resolve_func(s1->resolve_opaque, name) : NULL;
+                if (!addr)
+                    addr = resolve_sym(s1, name);
                 if (addr) {
                     sym->st_value = (addr_t)addr;
                     goto found;
@@ -464,6 +466,28 @@ ST_FUNC void relocate_syms(TCCState *s1, int do_resolve)
                 tcc_error_noabort("undefined symbol '%s'", name);
             }
         } else if (sh_num < SHN_LORESERVE) {
+#if defined TCC_IS_NATIVE && !defined _WIN32
+            /* the resolver's symbols were never added to the symbol
+               table: check the definitions against them as add_elf_sym()
+               would have done */
+            sym_bind = ELFW(ST_BIND)(sym->st_info);
+            if (do_resolve && s1->resolve_func && sym_bind != STB_LOCAL) {
+                void *addr;
+                int sym_vis = ELFW(ST_VISIBILITY)(sym->st_other);
+                name = symtab_section->link->data + sym->st_name;
+                addr = s1->resolve_func(s1->resolve_opaque, name);
+                if (addr) {
+                    if (sym_bind == STB_WEAK || sym_vis == STV_HIDDEN
+                        || sym_vis == STV_INTERNAL) {
+                        /* the resolver's definition wins */
+                        sym->st_value = (addr_t)addr;
+                        sym->st_shndx = SHN_ABS;
+                        goto found;
+                    }
+                    tcc_error_noabort("'%s' defined twice", name);
+                }
+            }
+#endif
             /* add section base */
             sym->st_value += s1->sections[sym->st_shndx]->sh_addr;
         }
@@ -537,6 +561,9 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
         type = ELFW(R_TYPE)(rel->r_info);
         addr = s->sh_addr + rel->r_offset;
 
+        if (s1->reloc_func)
+            s1->reloc_func(s1->reloc_opaque, type, addr, val);
+
         /* CPU specific */
         switch(type) {
 #if defined(TCC_TARGET_I386)